@@ -0,0 +1,346 @@
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include "bayer.h"
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "cpu_features.h"
+
+
+uint32_t BayerBytesPerSample(EBayerFormat format)
+{
+	switch (format)
+	{
+	case BayerFormat_RGGB8:
+	case BayerFormat_BGGR8:
+		return 1;
+	case BayerFormat_RGGB16:
+	case BayerFormat_BGGR16:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+bool ParseBayerFormat(const std::string& name, EBayerFormat& outFormat)
+{
+	if (name == "off") { outFormat = BayerFormat_None; }
+	else if (name == "rggb8") { outFormat = BayerFormat_RGGB8; }
+	else if (name == "bggr8") { outFormat = BayerFormat_BGGR8; }
+	else if (name == "rggb16") { outFormat = BayerFormat_RGGB16; }
+	else if (name == "bggr16") { outFormat = BayerFormat_BGGR16; }
+	else { return false; }
+	return true;
+}
+
+const char* BayerFormatName(EBayerFormat format)
+{
+	switch (format)
+	{
+	case BayerFormat_RGGB8: return "rggb8";
+	case BayerFormat_BGGR8: return "bggr8";
+	case BayerFormat_RGGB16: return "rggb16";
+	case BayerFormat_BGGR16: return "bggr16";
+	default: return "off";
+	}
+}
+
+
+// Every row alternates green with one other colour. Returns the RGBX channel of that colour on row y, 0 for red and 2 for blue.
+// The colour is at even x on even rows, and at odd x on odd rows.
+static inline uint32_t RowColour(EBayerFormat format, uint32_t y)
+{
+	bool bBGGR = (format == BayerFormat_BGGR8 || format == BayerFormat_BGGR16);
+	bool bEvenRow = (y & 1) == 0;
+	return (bEvenRow != bBGGR) ? 0 : 2;
+}
+
+static inline uint8_t Average(uint8_t a, uint8_t b)
+{
+	return (uint8_t)((a + b + 1) >> 1);
+}
+
+
+static void MosaicRowScalar(const uint8_t* pRGBX, uint8_t* pRaw, uint32_t firstX, uint32_t endX, uint32_t evenChannel, uint32_t oddChannel, bool b16Bit)
+{
+	for (uint32_t x = firstX; x < endX; x++)
+	{
+		uint8_t value = pRGBX[x * 4 + ((x & 1) ? oddChannel : evenChannel)];
+
+		if (b16Bit)
+		{
+			// Scales 255 to 65535.
+			((uint16_t*)pRaw)[x] = (uint16_t)(value * 257);
+		}
+		else
+		{
+			pRaw[x] = value;
+		}
+	}
+}
+
+// Upper 8 bits of 16 bit samples.
+static void NarrowRowScalar(const uint16_t* pSource, uint8_t* pDest, uint32_t firstX, uint32_t endX)
+{
+	for (uint32_t x = firstX; x < endX; x++)
+	{
+		pDest[x] = (uint8_t)(pSource[x] >> 8);
+	}
+}
+
+// Interpolates output pixels [firstX, endX) of a row from the row and its neighbours above and below.
+// The missing colours are averaged from the horizontal, vertical, cross or diagonal neighbours, with pairs averaged first.
+static void DemosaicRowScalar(const uint8_t* pUp, const uint8_t* pRow, const uint8_t* pDown, uint8_t* pRGBX, uint32_t firstX, uint32_t endX, uint32_t width, uint32_t colour, bool bColourAtEven)
+{
+	for (uint32_t x = firstX; x < endX; x++)
+	{
+		uint32_t left = (x > 0) ? x - 1 : 1;
+		uint32_t right = (x + 1 < width) ? x + 1 : x - 1;
+
+		uint8_t centre = pRow[x];
+		uint8_t horizontal = Average(pRow[left], pRow[right]);
+		uint8_t vertical = Average(pUp[x], pDown[x]);
+
+		uint8_t* pPixel = pRGBX + (size_t)x * 4;
+
+		if (((x & 1) == 0) == bColourAtEven)
+		{
+			pPixel[colour] = centre;
+			pPixel[1] = Average(horizontal, vertical);
+			pPixel[2 - colour] = Average(Average(pUp[left], pUp[right]), Average(pDown[left], pDown[right]));
+		}
+		else
+		{
+			pPixel[colour] = horizontal;
+			pPixel[1] = centre;
+			pPixel[2 - colour] = vertical;
+		}
+		pPixel[3] = 255;
+	}
+}
+
+
+#ifdef CPU_X86
+
+// 32 pixels at a time from x = 0. Returns where the scalar kernel has to continue.
+CPU_TARGET_AVX2 static uint32_t MosaicRowAVX2(const uint8_t* pRGBX, uint8_t* pRaw, uint32_t width, uint32_t evenChannel, uint32_t oddChannel, bool b16Bit)
+{
+	// Each of the four source registers picks its pixels into its own dword of both lanes, so they can be or'ed together.
+	__m256i shuffles[4];
+	for (int reg = 0; reg < 4; reg++)
+	{
+		alignas(32) int8_t indices[32];
+		memset(indices, -128, sizeof(indices));
+
+		for (int lane = 0; lane < 2; lane++)
+		{
+			for (int pixel = 0; pixel < 4; pixel++)
+			{
+				indices[lane * 16 + reg * 4 + pixel] = (int8_t)(pixel * 4 + ((pixel & 1) ? oddChannel : evenChannel));
+			}
+		}
+		shuffles[reg] = _mm256_load_si256((const __m256i*)indices);
+	}
+
+	// The low lanes hold pixels 0-3, 8-11, 16-19 and 24-27, the high lanes the rest.
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	uint32_t x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		const __m256i* pSource = (const __m256i*)(pRGBX + (size_t)x * 4);
+
+		__m256i packed = _mm256_or_si256(
+			_mm256_or_si256(_mm256_shuffle_epi8(_mm256_loadu_si256(pSource), shuffles[0]), _mm256_shuffle_epi8(_mm256_loadu_si256(pSource + 1), shuffles[1])),
+			_mm256_or_si256(_mm256_shuffle_epi8(_mm256_loadu_si256(pSource + 2), shuffles[2]), _mm256_shuffle_epi8(_mm256_loadu_si256(pSource + 3), shuffles[3])));
+
+		packed = _mm256_permutevar8x32_epi32(packed, order);
+
+		if (b16Bit)
+		{
+			// Unpacking a byte with itself scales it to 16 bits.
+			packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256((__m256i*)(pRaw + (size_t)x * 2), _mm256_unpacklo_epi8(packed, packed));
+			_mm256_storeu_si256((__m256i*)(pRaw + (size_t)x * 2 + 32), _mm256_unpackhi_epi8(packed, packed));
+		}
+		else
+		{
+			_mm256_storeu_si256((__m256i*)(pRaw + x), packed);
+		}
+	}
+
+	return x;
+}
+
+CPU_TARGET_AVX2 static uint32_t NarrowRowAVX2(const uint16_t* pSource, uint8_t* pDest, uint32_t width)
+{
+	uint32_t x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		__m256i low = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)(pSource + x)), 8);
+		__m256i high = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)(pSource + x + 16)), 8);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(pDest + x), packed);
+	}
+	return x;
+}
+
+// 32 pixels at a time from x = 2, as long as the right neighbours are inside the row. Returns where the scalar kernel has to continue.
+CPU_TARGET_AVX2 static uint32_t DemosaicRowAVX2(const uint8_t* pUp, const uint8_t* pRow, const uint8_t* pDown, uint8_t* pRGBX, uint32_t width, uint32_t colour, bool bColourAtEven)
+{
+	// Blends take the second value on odd pixels.
+	const __m256i oddMask = _mm256_set1_epi16((short)0xFF00);
+	const __m256i alpha = _mm256_set1_epi8((char)0xFF);
+
+	uint32_t x = 2;
+	for (; x + 33 <= width; x += 32)
+	{
+		__m256i centre = _mm256_loadu_si256((const __m256i*)(pRow + x));
+		__m256i horizontal = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(pRow + x - 1)), _mm256_loadu_si256((const __m256i*)(pRow + x + 1)));
+		__m256i vertical = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(pUp + x)), _mm256_loadu_si256((const __m256i*)(pDown + x)));
+		__m256i cross = _mm256_avg_epu8(horizontal, vertical);
+		__m256i diagonal = _mm256_avg_epu8(
+			_mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(pUp + x - 1)), _mm256_loadu_si256((const __m256i*)(pUp + x + 1))),
+			_mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(pDown + x - 1)), _mm256_loadu_si256((const __m256i*)(pDown + x + 1))));
+
+		// The row colour, green, and the colour of the rows above and below.
+		__m256i rowColour, green, otherColour;
+		if (bColourAtEven)
+		{
+			rowColour = _mm256_blendv_epi8(centre, horizontal, oddMask);
+			green = _mm256_blendv_epi8(cross, centre, oddMask);
+			otherColour = _mm256_blendv_epi8(diagonal, vertical, oddMask);
+		}
+		else
+		{
+			rowColour = _mm256_blendv_epi8(horizontal, centre, oddMask);
+			green = _mm256_blendv_epi8(centre, cross, oddMask);
+			otherColour = _mm256_blendv_epi8(vertical, diagonal, oddMask);
+		}
+
+		__m256i red = (colour == 0) ? rowColour : otherColour;
+		__m256i blue = (colour == 0) ? otherColour : rowColour;
+
+		// Interleaving works within lanes, so the low lanes end up with pixels 0-7 and 16-23.
+		__m256i redGreenLow = _mm256_unpacklo_epi8(red, green);
+		__m256i redGreenHigh = _mm256_unpackhi_epi8(red, green);
+		__m256i blueAlphaLow = _mm256_unpacklo_epi8(blue, alpha);
+		__m256i blueAlphaHigh = _mm256_unpackhi_epi8(blue, alpha);
+
+		__m256i pixels0 = _mm256_unpacklo_epi16(redGreenLow, blueAlphaLow);
+		__m256i pixels1 = _mm256_unpackhi_epi16(redGreenLow, blueAlphaLow);
+		__m256i pixels2 = _mm256_unpacklo_epi16(redGreenHigh, blueAlphaHigh);
+		__m256i pixels3 = _mm256_unpackhi_epi16(redGreenHigh, blueAlphaHigh);
+
+		__m256i* pDest = (__m256i*)(pRGBX + (size_t)x * 4);
+		_mm256_storeu_si256(pDest, _mm256_permute2x128_si256(pixels0, pixels1, 0x20));
+		_mm256_storeu_si256(pDest + 1, _mm256_permute2x128_si256(pixels2, pixels3, 0x20));
+		_mm256_storeu_si256(pDest + 2, _mm256_permute2x128_si256(pixels0, pixels1, 0x31));
+		_mm256_storeu_si256(pDest + 3, _mm256_permute2x128_si256(pixels2, pixels3, 0x31));
+	}
+
+	return x;
+}
+
+#endif
+
+
+BayerConverter::BayerConverter()
+{
+	m_bUseAVX2 = CpuSupportsAVX2();
+}
+
+void BayerConverter::MosaicRows(EBayerFormat format, const uint8_t* pRGBX, uint8_t* pRaw, uint32_t width, uint32_t firstRow, uint32_t endRow) const
+{
+	uint32_t bytesPerSample = BayerBytesPerSample(format);
+	if (bytesPerSample == 0)
+	{
+		return;
+	}
+
+	bool b16Bit = (bytesPerSample == 2);
+
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		const uint8_t* pSourceRow = pRGBX + (size_t)y * width * 4;
+		uint8_t* pRawRow = pRaw + (size_t)y * width * bytesPerSample;
+
+		uint32_t colour = RowColour(format, y);
+		bool bColourAtEven = (y & 1) == 0;
+		uint32_t evenChannel = bColourAtEven ? colour : 1;
+		uint32_t oddChannel = bColourAtEven ? 1 : colour;
+
+		uint32_t x = 0;
+#ifdef CPU_X86
+		if (m_bUseAVX2)
+		{
+			x = MosaicRowAVX2(pSourceRow, pRawRow, width, evenChannel, oddChannel, b16Bit);
+		}
+#endif
+		MosaicRowScalar(pSourceRow, pRawRow, x, width, evenChannel, oddChannel, b16Bit);
+	}
+}
+
+void BayerConverter::DemosaicRows(EBayerFormat format, const uint8_t* pRaw, uint8_t* pRGBX, uint32_t width, uint32_t height, uint32_t firstRow, uint32_t endRow) const
+{
+	uint32_t bytesPerSample = BayerBytesPerSample(format);
+	if (bytesPerSample == 0 || width < 2 || height < 2)
+	{
+		return;
+	}
+
+	// The rows and their neighbours, narrowed to 8 bits first if needed.
+	uint32_t firstSourceRow = (firstRow > 0) ? firstRow - 1 : 0;
+	uint32_t endSourceRow = (std::min)(endRow + 1, height);
+	const uint8_t* pSource = pRaw + (size_t)firstSourceRow * width;
+
+	static thread_local std::vector<uint8_t> narrowRows;
+
+	if (bytesPerSample == 2)
+	{
+		narrowRows.resize((size_t)(endSourceRow - firstSourceRow) * width);
+
+		for (uint32_t y = firstSourceRow; y < endSourceRow; y++)
+		{
+			const uint16_t* pSourceRow = (const uint16_t*)pRaw + (size_t)y * width;
+			uint8_t* pNarrowRow = narrowRows.data() + (size_t)(y - firstSourceRow) * width;
+
+			uint32_t x = 0;
+#ifdef CPU_X86
+			if (m_bUseAVX2)
+			{
+				x = NarrowRowAVX2(pSourceRow, pNarrowRow, width);
+			}
+#endif
+			NarrowRowScalar(pSourceRow, pNarrowRow, x, width);
+		}
+
+		pSource = narrowRows.data();
+	}
+
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		// Mirrored at the top and bottom, which keeps the colour of the neighbouring rows.
+		uint32_t up = (y > 0) ? y - 1 : 1;
+		uint32_t down = (y + 1 < height) ? y + 1 : y - 1;
+
+		const uint8_t* pUp = pSource + (size_t)(up - firstSourceRow) * width;
+		const uint8_t* pRow = pSource + (size_t)(y - firstSourceRow) * width;
+		const uint8_t* pDown = pSource + (size_t)(down - firstSourceRow) * width;
+		uint8_t* pDestRow = pRGBX + (size_t)y * width * 4;
+
+		uint32_t colour = RowColour(format, y);
+		bool bColourAtEven = (y & 1) == 0;
+
+		uint32_t x = 2;
+#ifdef CPU_X86
+		if (m_bUseAVX2)
+		{
+			x = DemosaicRowAVX2(pUp, pRow, pDown, pDestRow, width, colour, bColourAtEven);
+		}
+#endif
+		DemosaicRowScalar(pUp, pRow, pDown, pDestRow, 0, 2, width, colour, bColourAtEven);
+		DemosaicRowScalar(pUp, pRow, pDown, pDestRow, x, width, width, colour, bColourAtEven);
+	}
+}
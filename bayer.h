@@ -0,0 +1,49 @@
+#pragma once
+
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include <cstdint>
+#include <string>
+
+
+// Frame rows per parallel task when converting whole frames.
+#define BAYER_BAND_ROWS 32
+
+
+// Raw frame formats served in place of RGBX32. The values are written to the /bayer_format queue path.
+// 16 bit samples use the full range, little endian.
+enum EBayerFormat
+{
+	BayerFormat_None = 0,
+	BayerFormat_RGGB8,
+	BayerFormat_BGGR8,
+	BayerFormat_RGGB16,
+	BayerFormat_BGGR16,
+};
+
+uint32_t BayerBytesPerSample(EBayerFormat format);
+
+// Names are the pattern followed by the bits per sample, like "rggb8". "off" parses as BayerFormat_None.
+bool ParseBayerFormat(const std::string& name, EBayerFormat& outFormat);
+const char* BayerFormatName(EBayerFormat format);
+
+
+// Converts between RGBX32 frames and tightly packed Bayer mosaics of the same size.
+// The demosaic is bilinear, with neighbours mirrored at the frame edges. Both directions use AVX2 kernels when the CPU supports them,
+// which give the same results as the scalar ones.
+class BayerConverter
+{
+public:
+	BayerConverter();
+
+	// Samples rows [firstRow, endRow) of the RGBX32 frame into the raw frame.
+	void MosaicRows(EBayerFormat format, const uint8_t* pRGBX, uint8_t* pRaw, uint32_t width, uint32_t firstRow, uint32_t endRow) const;
+
+	// Interpolates rows [firstRow, endRow) of the RGBX32 frame from the raw frame. The frame must be at least 2x2.
+	// 16 bit samples are interpolated at their upper 8 bits.
+	void DemosaicRows(EBayerFormat format, const uint8_t* pRaw, uint8_t* pRGBX, uint32_t width, uint32_t height, uint32_t firstRow, uint32_t endRow) const;
+
+	bool IsUsingAVX2() const { return m_bUseAVX2; }
+
+protected:
+	bool m_bUseAVX2 = false;
+};
@@ -0,0 +1,26 @@
+# Run by the bench_check target: runs the checks and compares a full run against the baseline. If no baseline has been
+# recorded yet, the comparison is skipped, and the run only fails on the checks. Baselines are specific to the machine,
+# so none is committed. Expects BENCH_EXE, BENCH_BASELINE, BENCH_THRESHOLD and BENCH_OUT.
+
+if(NOT EXISTS "${BENCH_BASELINE}")
+	message(STATUS "No benchmark baseline at ${BENCH_BASELINE}, skipping the comparison. Build the bench_baseline target to record one on this machine.")
+
+	execute_process(
+		COMMAND "${BENCH_EXE}" --out "${BENCH_OUT}"
+		RESULT_VARIABLE BENCH_RESULT
+	)
+
+	if(NOT BENCH_RESULT EQUAL 0)
+		message(FATAL_ERROR "driver_bench failed (${BENCH_RESULT})")
+	endif()
+	return()
+endif()
+
+execute_process(
+	COMMAND "${BENCH_EXE}" --out "${BENCH_OUT}" --baseline "${BENCH_BASELINE}" --threshold "${BENCH_THRESHOLD}"
+	RESULT_VARIABLE BENCH_RESULT
+)
+
+if(NOT BENCH_RESULT EQUAL 0)
+	message(FATAL_ERROR "driver_bench failed against ${BENCH_BASELINE} (${BENCH_RESULT})")
+endif()
@@ -0,0 +1,100 @@
+#include "frame_arena.h"
+
+// Stands in for frame_arena.cpp, which needs the Windows virtual memory API. The slots come from one aligned heap
+// allocation without large pages or pre-faulting, and the free list is guarded by the reserve mutex. Nothing on the
+// measured paths acquires slots, so the difference to the driver does not show up in the results.
+
+
+FrameArena::~FrameArena()
+{
+	Free();
+}
+
+void FrameArena::SetOptions(bool bUseLargePages, int32_t numaNode)
+{
+	std::lock_guard<std::mutex> lock(m_reserveMutex);
+	m_bUseLargePages = bUseLargePages;
+	m_numaNode = numaNode;
+}
+
+bool FrameArena::Reserve(size_t slotSize, uint32_t numSlots)
+{
+	std::lock_guard<std::mutex> lock(m_reserveMutex);
+
+	if (m_pMemory != nullptr && slotSize <= m_slotSize && numSlots <= m_numSlots)
+	{
+		return true;
+	}
+
+	if (m_slotsInUse > 0)
+	{
+		return false;
+	}
+
+	Free();
+	return Allocate(slotSize, numSlots);
+}
+
+bool FrameArena::Allocate(size_t slotSize, uint32_t numSlots)
+{
+	m_slotSize = (slotSize + FRAME_ARENA_SMALL_ALIGNMENT - 1) / FRAME_ARENA_SMALL_ALIGNMENT * FRAME_ARENA_SMALL_ALIGNMENT;
+	m_pMemory = (uint8_t*)::operator new[](m_slotSize * numSlots, std::align_val_t(FRAME_ARENA_SMALL_ALIGNMENT));
+
+	m_numSlots = numSlots;
+	m_nextFree = std::make_unique<std::atomic<uint32_t>[]>(numSlots);
+	m_freeHead = FRAME_ARENA_INVALID_SLOT;
+
+	for (uint32_t i = numSlots; i-- > 0;)
+	{
+		PushSlot(i);
+	}
+	return true;
+}
+
+void FrameArena::Free()
+{
+	if (m_pMemory != nullptr)
+	{
+		::operator delete[](m_pMemory, std::align_val_t(FRAME_ARENA_SMALL_ALIGNMENT));
+		m_pMemory = nullptr;
+	}
+
+	m_slotSize = 0;
+	m_numSlots = 0;
+	m_nextFree.reset();
+	m_freeHead = FRAME_ARENA_INVALID_SLOT;
+}
+
+// Called with the reserve mutex held.
+void FrameArena::PushSlot(uint32_t index)
+{
+	m_nextFree[index] = (uint32_t)m_freeHead;
+	m_freeHead = index;
+}
+
+uint8_t* FrameArena::AcquireSlot()
+{
+	std::lock_guard<std::mutex> lock(m_reserveMutex);
+
+	uint32_t index = (uint32_t)m_freeHead;
+	if (index == FRAME_ARENA_INVALID_SLOT)
+	{
+		return nullptr;
+	}
+
+	m_freeHead = m_nextFree[index].load();
+	m_slotsInUse++;
+	return m_pMemory + (size_t)index * m_slotSize;
+}
+
+void FrameArena::ReleaseSlot(uint8_t* pSlot)
+{
+	if (pSlot == nullptr)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_reserveMutex);
+	PushSlot((uint32_t)((pSlot - m_pMemory) / m_slotSize));
+	m_slotsInUse--;
+}
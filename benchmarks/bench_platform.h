@@ -0,0 +1,46 @@
+#pragma once
+
+// Force included into every benchmark translation unit in place of the driver precompiled header,
+// so the portable driver sources build outside Windows. Their own include of pch.h becomes a no-op.
+
+#define PCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "openvr_driver.h"
+#include "vr_blockqueue.h"
+
+
+// The driver times everything with the performance counter. Nanosecond steady clock ticks stand in for it.
+union LARGE_INTEGER
+{
+	int64_t QuadPart;
+};
+
+inline int QueryPerformanceCounter(LARGE_INTEGER* pCount)
+{
+	pCount->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	return 1;
+}
+
+inline int QueryPerformanceFrequency(LARGE_INTEGER* pFrequency)
+{
+	pFrequency->QuadPart = 1000000000;
+	return 1;
+}
@@ -0,0 +1,1211 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "camera_rig.h"
+#include "frame_source.h"
+#include "frame_metadata.h"
+#include "head_motion.h"
+#include "thread_pool.h"
+#include "stereo_rectify.h"
+#include "stereo_matcher.h"
+#include "frame_codec.h"
+#include "frame_capture.h"
+#include "pattern_source.h"
+#include "frame_pack.h"
+#include "bayer.h"
+
+
+// Headless microbenchmarks of the driver hot paths, built from the driver sources that don't depend on Windows or the runtime.
+// Each case reports the time per call of its kernel. Results are written as JSON, and compared against a baseline
+// written by an earlier run, failing the run if any case got slower than its threshold allows.
+// Some kernels also have correctness checks, run on the same inputs before they are timed. Any failed check fails the run.
+
+#define BENCH_RESULTS_VERSION 1
+
+#define BENCH_DEFAULT_SAMPLES 15
+#define BENCH_DEFAULT_THRESHOLD_PERCENT 10.0
+
+// Each sample repeats the kernel until it has run at least this long, to keep timer resolution out of the cheap kernels.
+#define BENCH_MIN_SAMPLE_NS 2000000
+
+// Points cycled through by the per-call kernels, so they don't run on a single cached input.
+#define BENCH_INPUT_POINTS 4096
+
+
+struct BenchResolution
+{
+	uint32_t width;
+	uint32_t height;
+};
+
+struct BenchResult
+{
+	std::string name;
+	uint64_t callsPerSample;
+	double medianNs;
+	double minNs;
+	double p90Ns;
+};
+
+struct BenchThreshold
+{
+	std::string prefix;
+	double percent;
+};
+
+struct BenchOptions
+{
+	std::vector<BenchResolution> resolutions = { { 640, 480 }, { 1024, 1024 }, { 1920, 1080 }, { 2048, 2048 } };
+	std::vector<uint32_t> threadCounts;
+	uint32_t numCameras = 2;
+	ERigFrameLayout layout = RigFrameLayout_Horizontal;
+	uint32_t samples = BENCH_DEFAULT_SAMPLES;
+	std::string filter;
+	std::string outPath = "bench_results.json";
+	std::string baselinePath;
+	bool bUpdateBaseline = false;
+	double defaultThreshold = BENCH_DEFAULT_THRESHOLD_PERCENT;
+	std::vector<BenchThreshold> thresholds;
+};
+
+
+// Results of the per-call kernels are accumulated here, so the compiler can't drop the calls.
+static volatile double g_sink = 0.0;
+
+static int64_t GetTimeNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+class BenchRunner
+{
+public:
+	BenchRunner(const BenchOptions& options)
+		: m_options(options)
+	{}
+
+	bool IsSelected(const std::string& name) const
+	{
+		return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+	}
+
+	// Times run(calls), which makes the given number of kernel calls. The call count per sample is doubled until a sample
+	// takes long enough, then the samples are taken with that count.
+	void Measure(const std::string& name, const std::function<void(uint64_t)>& run)
+	{
+		if (!IsSelected(name))
+		{
+			return;
+		}
+
+		uint64_t calls = 1;
+		run(calls);
+
+		while (true)
+		{
+			int64_t start = GetTimeNs();
+			run(calls);
+			int64_t elapsed = GetTimeNs() - start;
+
+			if (elapsed >= BENCH_MIN_SAMPLE_NS || calls >= (1ull << 30))
+			{
+				break;
+			}
+			calls *= 2;
+		}
+
+		std::vector<double> sampleNs(m_options.samples);
+		for (double& sample : sampleNs)
+		{
+			int64_t start = GetTimeNs();
+			run(calls);
+			sample = (GetTimeNs() - start) / (double)calls;
+		}
+
+		std::sort(sampleNs.begin(), sampleNs.end());
+
+		BenchResult result;
+		result.name = name;
+		result.callsPerSample = calls;
+		result.medianNs = sampleNs[sampleNs.size() / 2];
+		result.minNs = sampleNs.front();
+		result.p90Ns = sampleNs[(sampleNs.size() - 1) * 9 / 10];
+
+		std::cout << std::left << std::setw(56) << name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(16) << result.medianNs << " ns" << std::setw(16) << result.minNs << " ns min\n";
+
+		m_results.push_back(result);
+	}
+
+	// Reports the result of a correctness check. The caller skips the check if its name is not selected.
+	void Check(const std::string& name, bool bPassed, const std::string& detail)
+	{
+		std::cout << std::left << std::setw(56) << name << (bPassed ? "    ok" : "    FAILED") << (detail.empty() ? "" : ", ") << detail << "\n";
+
+		if (!bPassed)
+		{
+			m_numFailedChecks++;
+		}
+	}
+
+	const std::vector<BenchResult>& GetResults() const { return m_results; }
+	uint32_t GetNumFailedChecks() const { return m_numFailedChecks; }
+
+private:
+	const BenchOptions& m_options;
+	std::vector<BenchResult> m_results;
+	uint32_t m_numFailedChecks = 0;
+};
+
+
+static std::string GetRigName(const CameraRig& rig)
+{
+	return std::format("{}x{}x{}", rig.numCameras, rig.frameWidth, rig.frameHeight);
+}
+
+// Mirrors the render thread in CameraComponent::RenderFrames, splitting the frame into row bands over the pool.
+static void BenchServeFill(BenchRunner& runner, const BenchOptions& options, const char* sourceName, const CameraRig& rig)
+{
+	std::unique_ptr<FrameSource> source;
+	if (strcmp(sourceName, "gradient") == 0) { source = std::make_unique<GradientFrameSource>(); }
+	else if (strcmp(sourceName, "solid") == 0) { source = std::make_unique<SolidFrameSource>(); }
+	else if (strcmp(sourceName, "pattern") == 0) { source = std::make_unique<PatternFrameSource>(PatternSettings()); }
+	else { source = std::make_unique<WorldFrameSource>(); }
+
+	source->SetFrameLayout(rig, 4);
+
+	std::vector<uint8_t> buffer((size_t)rig.textureWidth * rig.textureHeight * 4);
+	uint32_t textureHeight = rig.textureHeight;
+	uint32_t numBands = (textureHeight + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+
+	for (uint32_t threads : options.threadCounts)
+	{
+		std::string name = std::format("serve_fill/{}/{}/t{}", sourceName, GetRigName(rig), threads);
+		if (!runner.IsSelected(name))
+		{
+			continue;
+		}
+
+		// The calling thread works too.
+		ThreadPool pool;
+		pool.Start(threads - 1);
+
+		FrameRenderInfo renderInfo = {};
+		uint8_t* pBuffer = buffer.data();
+		FrameSource* pFrameSource = source.get();
+
+		runner.Measure(name, [&](uint64_t calls)
+		{
+			for (uint64_t i = 0; i < calls; i++)
+			{
+				LARGE_INTEGER currTime;
+				QueryPerformanceCounter(&currTime);
+
+				renderInfo.frameCount++;
+				renderInfo.exposureStartTicks = currTime.QuadPart;
+				renderInfo.readoutTicks = 10000000;
+
+				pFrameSource->BeginFrame(renderInfo);
+
+				pool.ParallelFor(numBands, [&](uint32_t band)
+				{
+					uint32_t firstRow = band * RENDER_BAND_ROWS;
+					pFrameSource->RenderRows(pBuffer, renderInfo, firstRow, (std::min)(firstRow + RENDER_BAND_ROWS, textureHeight));
+				});
+			}
+		});
+	}
+}
+
+static void BenchDistortion(BenchRunner& runner, const BenchOptions& options, const CameraRig& rig)
+{
+	// Single lookups as made by the runtime, spread over the frame.
+	std::vector<float> inputU(BENCH_INPUT_POINTS);
+	std::vector<float> inputV(BENCH_INPUT_POINTS);
+	for (uint32_t i = 0; i < BENCH_INPUT_POINTS; i++)
+	{
+		inputU[i] = ((i * 37) % 64 + 0.5f) / 64.0f;
+		inputV[i] = ((i * 11) % 64 + 0.5f) / 64.0f;
+	}
+
+	runner.Measure(std::format("distortion/single/{}", GetRigName(rig)), [&](uint64_t calls)
+	{
+		double sum = 0.0;
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			uint32_t point = i % BENCH_INPUT_POINTS;
+			float outU, outV;
+			rig.ComputeDistortion(point % rig.numCameras, inputU[point], inputV[point], outU, outV);
+			sum += outU + outV;
+		}
+		g_sink = g_sink + sum;
+	});
+
+	// Full distortion mesh with one vertex per pixel for every camera, split into row bands like the frame rendering.
+	std::vector<float> mesh((size_t)rig.numCameras * rig.frameWidth * rig.frameHeight * 2);
+	uint32_t meshRows = rig.numCameras * rig.frameHeight;
+	uint32_t numBands = (meshRows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+
+	for (uint32_t threads : options.threadCounts)
+	{
+		std::string name = std::format("distortion/mesh/{}/t{}", GetRigName(rig), threads);
+		if (!runner.IsSelected(name))
+		{
+			continue;
+		}
+
+		ThreadPool pool;
+		pool.Start(threads - 1);
+
+		runner.Measure(name, [&](uint64_t calls)
+		{
+			for (uint64_t i = 0; i < calls; i++)
+			{
+				pool.ParallelFor(numBands, [&](uint32_t band)
+				{
+					uint32_t endRow = (std::min)((band + 1) * RENDER_BAND_ROWS, meshRows);
+
+					for (uint32_t row = band * RENDER_BAND_ROWS; row < endRow; row++)
+					{
+						uint32_t camera = row / rig.frameHeight;
+						float v = ((row % rig.frameHeight) + 0.5f) / rig.frameHeight;
+						float* pVertex = &mesh[(size_t)row * rig.frameWidth * 2];
+
+						for (uint32_t x = 0; x < rig.frameWidth; x++, pVertex += 2)
+						{
+							rig.ComputeDistortion(camera, (x + 0.5f) / rig.frameWidth, v, pVertex[0], pVertex[1]);
+						}
+					}
+				});
+			}
+		});
+	}
+
+	g_sink = g_sink + mesh[mesh.size() / 2];
+}
+
+// Rectification of the first two cameras, with the second one yawed a little so the maps are not the identity.
+static void BenchRectify(BenchRunner& runner, const BenchOptions& options, const CameraRig& rig)
+{
+	if (rig.numCameras < 2)
+	{
+		return;
+	}
+
+	StereoRectifyCamera cameras[2];
+	rig.GetRectifyCamera(0, cameras[0]);
+	rig.GetRectifyCamera(1, cameras[1]);
+
+	float yaw = 0.05f;
+	cameras[1].cameraToHead[0][0] = cosf(yaw);
+	cameras[1].cameraToHead[0][2] = sinf(yaw);
+	cameras[1].cameraToHead[2][0] = -sinf(yaw);
+	cameras[1].cameraToHead[2][2] = cosf(yaw);
+
+	// Configured up front too, in case the filter skips the map case.
+	StereoRectifier rectifier;
+	rectifier.Configure(cameras[0], cameras[1], rig.frameWidth, rig.frameHeight);
+
+	runner.Measure(std::format("rectify/maps/{}", GetRigName(rig)), [&](uint64_t calls)
+	{
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			rectifier.Configure(cameras[0], cameras[1], rig.frameWidth, rig.frameHeight);
+		}
+	});
+
+	uint32_t rowStride = rig.textureWidth * 4;
+	std::vector<uint8_t> frame((size_t)rowStride * rig.textureHeight, 0x80);
+	std::vector<uint8_t> output((size_t)rig.frameWidth * rig.frameHeight * 4 * 2);
+
+	const uint8_t* pFirstView = frame.data() + (size_t)rig.regions[0].y * rowStride + (size_t)rig.regions[0].x * 4;
+	const uint8_t* pSecondView = frame.data() + (size_t)rig.regions[1].y * rowStride + (size_t)rig.regions[1].x * 4;
+	uint8_t* pFirstOutput = output.data();
+	uint8_t* pSecondOutput = output.data() + output.size() / 2;
+
+	for (uint32_t threads : options.threadCounts)
+	{
+		std::string name = std::format("rectify/remap/{}/t{}", GetRigName(rig), threads);
+		if (!runner.IsSelected(name))
+		{
+			continue;
+		}
+
+		ThreadPool pool;
+		pool.Start(threads - 1);
+
+		StereoParallelFor parallelFor = [&](uint32_t numTasks, const std::function<void(uint32_t)>& task)
+		{
+			pool.ParallelFor(numTasks, task);
+		};
+
+		runner.Measure(name, [&](uint64_t calls)
+		{
+			for (uint64_t i = 0; i < calls; i++)
+			{
+				rectifier.Rectify(pFirstView, pSecondView, rowStride, pFirstOutput, pSecondOutput, rig.frameWidth * 4, parallelFor);
+			}
+		});
+	}
+
+	g_sink = g_sink + output[output.size() / 2];
+}
+
+// Mirrors CameraComponent::ComputeStereo without rectification, matching the views of the first two world source cameras
+// at half resolution. To keep up with the camera, a call has to take less than the frame interval.
+static void BenchStereoMatch(BenchRunner& runner, const BenchOptions& options, const CameraRig& rig)
+{
+	if (rig.numCameras < 2)
+	{
+		return;
+	}
+
+	WorldFrameSource source;
+	source.SetFrameLayout(rig, 4);
+
+	uint32_t rowStride = rig.textureWidth * 4;
+	std::vector<uint8_t> frame((size_t)rowStride * rig.textureHeight);
+	FrameRenderInfo renderInfo = {};
+	source.RenderFrame(frame.data(), renderInfo);
+
+	const uint8_t* pLeftView = frame.data() + (size_t)rig.regions[0].y * rowStride + (size_t)rig.regions[0].x * 4;
+	const uint8_t* pRightView = frame.data() + (size_t)rig.regions[1].y * rowStride + (size_t)rig.regions[1].x * 4;
+
+	StereoMatcher matcher;
+	matcher.Configure(rig.frameWidth, rig.frameHeight);
+
+	for (uint32_t threads : options.threadCounts)
+	{
+		std::string name = std::format("stereo/match/{}/t{}", GetRigName(rig), threads);
+		if (!runner.IsSelected(name))
+		{
+			continue;
+		}
+
+		ThreadPool pool;
+		pool.Start(threads - 1);
+
+		StereoParallelFor parallelFor = [&](uint32_t numTasks, const std::function<void(uint32_t)>& task)
+		{
+			pool.ParallelFor(numTasks, task);
+		};
+
+		runner.Measure(name, [&](uint64_t calls)
+		{
+			for (uint64_t i = 0; i < calls; i++)
+			{
+				matcher.Compute(pLeftView, pRightView, rowStride, parallelFor);
+			}
+		});
+	}
+
+	g_sink = g_sink + matcher.GetStats().validPixels;
+}
+
+// Mirrors CameraComponent::PackFrame. The copy case is the same traffic as a plain memcpy of the source frame, for reference.
+static void BenchPack(BenchRunner& runner, const BenchOptions& options, const CameraRig& rig)
+{
+	std::vector<uint8_t> frame((size_t)rig.textureWidth * rig.textureHeight * 4);
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		frame[i] = (uint8_t)(i * 7);
+	}
+	std::vector<uint8_t> packed(frame.size());
+
+	uint32_t textureHeight = rig.textureHeight;
+	uint32_t numBands = (textureHeight + PACK_BAND_ROWS - 1) / PACK_BAND_ROWS;
+
+	for (int format = PackFormat_RGBX32; format < PackFormat_Count; format++)
+	{
+		FramePacker packer;
+		bool bCopy = !packer.Configure((EPackFormat)format, rig);
+		size_t bandBytes = (size_t)rig.textureWidth * PACK_BAND_ROWS * 4;
+
+		for (uint32_t threads : options.threadCounts)
+		{
+			std::string name = std::format("pack/{}/{}/t{}", bCopy ? "copy" : PackFormatName((EPackFormat)format), GetRigName(rig), threads);
+			if (!runner.IsSelected(name))
+			{
+				continue;
+			}
+
+			ThreadPool pool;
+			pool.Start(threads - 1);
+
+			runner.Measure(name, [&](uint64_t calls)
+			{
+				for (uint64_t i = 0; i < calls; i++)
+				{
+					pool.ParallelFor(numBands, [&](uint32_t band)
+					{
+						uint32_t firstRow = band * PACK_BAND_ROWS;
+						if (bCopy)
+						{
+							size_t offset = band * bandBytes;
+							memcpy(packed.data() + offset, frame.data() + offset, (std::min)(bandBytes, frame.size() - offset));
+						}
+						else
+						{
+							packer.PackRows(frame.data(), packed.data(), firstRow, (std::min)(firstRow + PACK_BAND_ROWS, textureHeight));
+						}
+					});
+				}
+			});
+		}
+	}
+
+	g_sink = g_sink + packed[packed.size() / 3];
+}
+
+// Runs the scalar kernels even when the CPU supports AVX2, to compare against.
+class ScalarBayerConverter : public BayerConverter
+{
+public:
+	ScalarBayerConverter() { m_bUseAVX2 = false; }
+};
+
+// Counts the channel values of the demosaiced frame outside the bilinear bound of the source frame. The sampled channel
+// of each pixel must come through unchanged, and the interpolated ones are averages of the same channel of the 3x3
+// neighbourhood, mirrored at the edges, so they can't leave its range.
+static uint64_t CountBayerErrors(EBayerFormat format, const uint8_t* pSource, const uint8_t* pDemosaiced, uint32_t width, uint32_t height, int& outMaxError)
+{
+	bool bBGGR = (format == BayerFormat_BGGR8 || format == BayerFormat_BGGR16);
+	uint64_t numErrors = 0;
+	outMaxError = 0;
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		uint32_t rows[3] = { (y > 0) ? y - 1 : 1, y, (y + 1 < height) ? y + 1 : y - 1 };
+
+		// Every row alternates green with red or blue, the colour being at even x on even rows.
+		uint32_t rowColour = (((y & 1) == 0) != bBGGR) ? 0 : 2;
+
+		for (uint32_t x = 0; x < width; x++)
+		{
+			uint32_t columns[3] = { (x > 0) ? x - 1 : 1, x, (x + 1 < width) ? x + 1 : x - 1 };
+			uint32_t sampled = ((x & 1) == (y & 1)) ? rowColour : 1;
+
+			const uint8_t* pPixel = pDemosaiced + ((size_t)y * width + x) * 4;
+
+			for (uint32_t channel = 0; channel < 3; channel++)
+			{
+				int low = 255;
+				int high = 0;
+
+				if (channel == sampled)
+				{
+					low = high = pSource[((size_t)y * width + x) * 4 + channel];
+				}
+				else
+				{
+					for (uint32_t row : rows)
+					{
+						for (uint32_t column : columns)
+						{
+							int value = pSource[((size_t)row * width + column) * 4 + channel];
+							low = (std::min)(low, value);
+							high = (std::max)(high, value);
+						}
+					}
+				}
+
+				int error = (std::max)(low - (int)pPixel[channel], (int)pPixel[channel] - high);
+				if (error > 0)
+				{
+					numErrors++;
+					outMaxError = (std::max)(outMaxError, error);
+				}
+			}
+
+			if (pPixel[3] != 255)
+			{
+				numErrors++;
+			}
+		}
+	}
+
+	return numErrors;
+}
+
+// Mosaics a world source frame in each raw format like CameraComponent::MosaicFrame, and demosaics it back like the snooper.
+// The round trip is checked against the bilinear bound, and the AVX2 kernels against the scalar ones byte for byte, also at
+// an odd width that leaves a scalar tail on every row.
+static void BenchBayer(BenchRunner& runner, const BenchOptions& options, const CameraRig& rig)
+{
+	uint32_t width = rig.textureWidth;
+	uint32_t height = rig.textureHeight;
+
+	WorldFrameSource source;
+	source.SetFrameLayout(rig, 4);
+
+	std::vector<uint8_t> frame((size_t)width * height * 4);
+	FrameRenderInfo renderInfo = {};
+	source.RenderFrame(frame.data(), renderInfo);
+
+	BayerConverter converter;
+	ScalarBayerConverter scalarConverter;
+
+	std::vector<uint8_t> raw((size_t)width * height * 2);
+	std::vector<uint8_t> scalarRaw(raw.size());
+	std::vector<uint8_t> demosaiced(frame.size());
+	std::vector<uint8_t> scalarDemosaiced(frame.size());
+
+	uint32_t numBands = (height + BAYER_BAND_ROWS - 1) / BAYER_BAND_ROWS;
+
+	for (int format = BayerFormat_RGGB8; format <= BayerFormat_BGGR16; format++)
+	{
+		EBayerFormat bayerFormat = (EBayerFormat)format;
+		const char* pFormatName = BayerFormatName(bayerFormat);
+
+		std::string roundTripName = std::format("bayer/round_trip/{}/{}", pFormatName, GetRigName(rig));
+		if (runner.IsSelected(roundTripName))
+		{
+			converter.MosaicRows(bayerFormat, frame.data(), raw.data(), width, 0, height);
+			converter.DemosaicRows(bayerFormat, raw.data(), demosaiced.data(), width, height, 0, height);
+
+			int maxError;
+			uint64_t numErrors = CountBayerErrors(bayerFormat, frame.data(), demosaiced.data(), width, height, maxError);
+			runner.Check(roundTripName, numErrors == 0, (numErrors == 0) ? "" : std::format("{} values outside the bilinear bound, by up to {}", numErrors, maxError));
+		}
+
+		std::string parityName = std::format("bayer/avx2_parity/{}/{}", pFormatName, GetRigName(rig));
+		if (runner.IsSelected(parityName))
+		{
+			if (!converter.IsUsingAVX2())
+			{
+				runner.Check(parityName, true, "skipped, no AVX2");
+			}
+			else
+			{
+				std::string mismatch;
+
+				for (uint32_t checkWidth : { width, (width > 32) ? width - 13 : width })
+				{
+					size_t rawSize = (size_t)checkWidth * height * BayerBytesPerSample(bayerFormat);
+					size_t frameSize = (size_t)checkWidth * height * 4;
+
+					converter.MosaicRows(bayerFormat, frame.data(), raw.data(), checkWidth, 0, height);
+					scalarConverter.MosaicRows(bayerFormat, frame.data(), scalarRaw.data(), checkWidth, 0, height);
+					if (memcmp(raw.data(), scalarRaw.data(), rawSize) != 0)
+					{
+						mismatch += std::format("{}mosaic differs at width {}", mismatch.empty() ? "" : ", ", checkWidth);
+					}
+
+					converter.DemosaicRows(bayerFormat, raw.data(), demosaiced.data(), checkWidth, height, 0, height);
+					scalarConverter.DemosaicRows(bayerFormat, raw.data(), scalarDemosaiced.data(), checkWidth, height, 0, height);
+					if (memcmp(demosaiced.data(), scalarDemosaiced.data(), frameSize) != 0)
+					{
+						mismatch += std::format("{}demosaic differs at width {}", mismatch.empty() ? "" : ", ", checkWidth);
+					}
+				}
+
+				runner.Check(parityName, mismatch.empty(), mismatch);
+			}
+		}
+
+		// The timed cases start from a full width mosaic.
+		converter.MosaicRows(bayerFormat, frame.data(), raw.data(), width, 0, height);
+
+		for (uint32_t threads : options.threadCounts)
+		{
+			std::string mosaicName = std::format("bayer/mosaic/{}/{}/t{}", pFormatName, GetRigName(rig), threads);
+			std::string demosaicName = std::format("bayer/demosaic/{}/{}/t{}", pFormatName, GetRigName(rig), threads);
+			if (!runner.IsSelected(mosaicName) && !runner.IsSelected(demosaicName))
+			{
+				continue;
+			}
+
+			ThreadPool pool;
+			pool.Start(threads - 1);
+
+			// Into a separate buffer, so the demosaic keeps reading the full width mosaic.
+			runner.Measure(mosaicName, [&](uint64_t calls)
+			{
+				for (uint64_t i = 0; i < calls; i++)
+				{
+					pool.ParallelFor(numBands, [&](uint32_t band)
+					{
+						uint32_t firstRow = band * BAYER_BAND_ROWS;
+						converter.MosaicRows(bayerFormat, frame.data(), scalarRaw.data(), width, firstRow, (std::min)(firstRow + BAYER_BAND_ROWS, height));
+					});
+				}
+			});
+
+			runner.Measure(demosaicName, [&](uint64_t calls)
+			{
+				for (uint64_t i = 0; i < calls; i++)
+				{
+					pool.ParallelFor(numBands, [&](uint32_t band)
+					{
+						uint32_t firstRow = band * BAYER_BAND_ROWS;
+						converter.DemosaicRows(bayerFormat, raw.data(), demosaiced.data(), width, height, firstRow, (std::min)(firstRow + BAYER_BAND_ROWS, height));
+					});
+				}
+			});
+		}
+	}
+
+	g_sink = g_sink + demosaiced[demosaiced.size() / 2] + scalarRaw[scalarRaw.size() / 3];
+}
+
+// Encodes and decodes a delta frame between two world source frames a 60 Hz interval apart, like a capture of a moving head.
+static void BenchCapture(BenchRunner& runner, const BenchOptions& options, const CameraRig& rig)
+{
+	WorldFrameSource source;
+	source.SetFrameLayout(rig, 4);
+
+	uint32_t rowSize = rig.textureWidth * 4;
+	size_t frameSize = (size_t)rowSize * rig.textureHeight;
+	std::vector<uint8_t> prevFrame(frameSize);
+	std::vector<uint8_t> frame(frameSize);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	// The world source follows the shared head motion, which is off unless configured.
+	g_headMotion.SetMotion(30.0, 0.2);
+
+	FrameRenderInfo renderInfo = {};
+	source.RenderFrame(prevFrame.data(), renderInfo);
+	renderInfo.frameCount++;
+	renderInfo.exposureStartTicks = frequency.QuadPart / 60;
+	source.RenderFrame(frame.data(), renderInfo);
+
+	g_headMotion.SetMotion(0.0, 0.0);
+
+	uint32_t numBands = (rig.textureHeight + FRAME_CAPTURE_BAND_ROWS - 1) / FRAME_CAPTURE_BAND_ROWS;
+	size_t bandCapacity = FrameBandBound((size_t)rowSize * FRAME_CAPTURE_BAND_ROWS);
+	std::vector<uint8_t> scratch((size_t)rowSize * FRAME_CAPTURE_BAND_ROWS * numBands);
+	std::vector<uint8_t> encoded(bandCapacity * numBands);
+	std::vector<uint32_t> bandSizes(numBands);
+
+	auto encodeBand = [&](uint32_t band)
+	{
+		uint32_t firstRow = band * FRAME_CAPTURE_BAND_ROWS;
+		uint32_t numRows = (std::min)((uint32_t)FRAME_CAPTURE_BAND_ROWS, rig.textureHeight - firstRow);
+		size_t offset = (size_t)firstRow * rowSize;
+
+		bandSizes[band] = (uint32_t)EncodeFrameBand(frame.data() + offset, prevFrame.data() + offset, rowSize, numRows, 4,
+			scratch.data() + offset, encoded.data() + band * bandCapacity, bandCapacity);
+	};
+
+	// Decoding applies the delta in place, so repeated calls drift from the real frame, at the same cost.
+	std::vector<uint8_t> decoded = prevFrame;
+	auto decodeBand = [&](uint32_t band)
+	{
+		uint32_t firstRow = band * FRAME_CAPTURE_BAND_ROWS;
+		uint32_t numRows = (std::min)((uint32_t)FRAME_CAPTURE_BAND_ROWS, rig.textureHeight - firstRow);
+		size_t offset = (size_t)firstRow * rowSize;
+
+		DecodeFrameBand(encoded.data() + band * bandCapacity, bandSizes[band], false, rowSize, numRows, 4, scratch.data() + offset, decoded.data() + offset);
+	};
+
+	for (uint32_t band = 0; band < numBands; band++)
+	{
+		encodeBand(band);
+	}
+
+	// A single decode onto the previous frame has to give back the encoded frame exactly.
+	std::string roundTripName = std::format("capture/round_trip/{}", GetRigName(rig));
+	if (runner.IsSelected(roundTripName))
+	{
+		for (uint32_t band = 0; band < numBands; band++)
+		{
+			decodeBand(band);
+		}
+
+		if (memcmp(decoded.data(), frame.data(), frameSize) == 0)
+		{
+			runner.Check(roundTripName, true, "");
+		}
+		else
+		{
+			size_t offset = std::mismatch(decoded.begin(), decoded.end(), frame.begin()).first - decoded.begin();
+			runner.Check(roundTripName, false, std::format("decoded frame differs from row {}", offset / rowSize));
+		}
+	}
+
+	for (uint32_t threads : options.threadCounts)
+	{
+		std::string encodeName = std::format("capture/encode/{}/t{}", GetRigName(rig), threads);
+		std::string decodeName = std::format("capture/decode/{}/t{}", GetRigName(rig), threads);
+		if (!runner.IsSelected(encodeName) && !runner.IsSelected(decodeName))
+		{
+			continue;
+		}
+
+		ThreadPool pool;
+		pool.Start(threads - 1);
+
+		if (runner.IsSelected(encodeName))
+		{
+			runner.Measure(encodeName, [&](uint64_t calls)
+			{
+				for (uint64_t i = 0; i < calls; i++)
+				{
+					pool.ParallelFor(numBands, encodeBand);
+				}
+			});
+		}
+
+		if (runner.IsSelected(decodeName))
+		{
+			runner.Measure(decodeName, [&](uint64_t calls)
+			{
+				for (uint64_t i = 0; i < calls; i++)
+				{
+					pool.ParallelFor(numBands, decodeBand);
+				}
+			});
+		}
+	}
+
+	g_sink = g_sink + decoded[decoded.size() / 2] + bandSizes[0];
+}
+
+static void BenchIntrinsics(BenchRunner& runner, const CameraRig& rig)
+{
+	runner.Measure(std::format("projection/{}", GetRigName(rig)), [&](uint64_t calls)
+	{
+		double sum = 0.0;
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			vr::HmdMatrix44_t projection;
+			rig.ComputeProjection(i % rig.numCameras, 0.01f + (i % 16) * 0.001f, 100.0f, projection);
+			sum += projection.m[0][0] + projection.m[2][3];
+		}
+		g_sink = g_sink + sum;
+	});
+
+	runner.Measure(std::format("intrinsics/{}", GetRigName(rig)), [&](uint64_t calls)
+	{
+		double sum = 0.0;
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			vr::HmdVector2_t focalLength, center;
+			vr::EVRDistortionFunctionType distortionType;
+			double coefficients[vr::k_unMaxDistortionFunctionParameters];
+			rig.GetIntrinsics(i % rig.numCameras, focalLength, center, distortionType, coefficients);
+			sum += focalLength.v[0] + center.v[1] + coefficients[0];
+		}
+		g_sink = g_sink + sum;
+	});
+}
+
+// Mirrors CameraComponent::ServeFrames, which builds a new batch for every frame.
+static void BenchMetadataBatch(BenchRunner& runner)
+{
+	FrameMetadataPaths paths;
+	paths.frameSize = 1;
+	paths.frameSequence = 2;
+	paths.frameTimeMonotonic = 3;
+	paths.serverTimeTicks = 4;
+	paths.deliveryRate = 5;
+	paths.elapsedTime = 6;
+	paths.readoutTime = 7;
+
+	runner.Measure("metadata_batch", [&](uint64_t calls)
+	{
+		uint64_t sum = 0;
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			FrameMetadata metadata;
+			metadata.frameSize = 1024 * 1024 * 8;
+			metadata.frameSequence = i % 16;
+			metadata.frameTimeMonotonic = i / 60.0;
+			metadata.serverTimeTicks = i * 166666;
+			metadata.deliveryRate = 1.0 / 60.0;
+			metadata.elapsedTime = i / 60.0;
+			metadata.readoutTime = 0.01;
+
+			vr::PathWrite_t write[FRAME_METADATA_WRITES];
+			BuildFrameMetadataBatch(paths, metadata, write);
+			sum += write[i % FRAME_METADATA_WRITES].unBufferSize;
+		}
+		g_sink = g_sink + (double)sum;
+	});
+}
+
+static void BenchPose(BenchRunner& runner)
+{
+	// Camera to head style transforms, rotating about the vertical axis.
+	std::vector<vr::HmdMatrix34_t> matrices34(BENCH_INPUT_POINTS);
+	std::vector<vr::HmdMatrix33_t> matrices33(BENCH_INPUT_POINTS);
+	for (uint32_t i = 0; i < BENCH_INPUT_POINTS; i++)
+	{
+		float yaw = i * 6.2831853f / BENCH_INPUT_POINTS;
+
+		vr::HmdMatrix34_t& transform = matrices34[i];
+		memset(&transform, 0, sizeof(transform));
+		transform.m[0][0] = cosf(yaw);
+		transform.m[0][2] = sinf(yaw);
+		transform.m[1][1] = 1;
+		transform.m[2][0] = -sinf(yaw);
+		transform.m[2][2] = cosf(yaw);
+
+		for (int row = 0; row < 3; row++)
+		{
+			for (int column = 0; column < 3; column++)
+			{
+				matrices33[i].m[row][column] = transform.m[row][column];
+			}
+		}
+	}
+
+	runner.Measure("quaternion_from_matrix/34", [&](uint64_t calls)
+	{
+		double sum = 0.0;
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			vr::HmdQuaternion_t q = HmdQuaternion_FromMatrix(matrices34[i % BENCH_INPUT_POINTS]);
+			sum += q.w + q.y;
+		}
+		g_sink = g_sink + sum;
+	});
+
+	runner.Measure("quaternion_from_matrix/33", [&](uint64_t calls)
+	{
+		double sum = 0.0;
+		for (uint64_t i = 0; i < calls; i++)
+		{
+			vr::HmdQuaternion_t q = HmdQuaternion_FromMatrix(matrices33[i % BENCH_INPUT_POINTS]);
+			sum += q.w + q.y;
+		}
+		g_sink = g_sink + sum;
+	});
+
+	// Same as CameraDevice::GetPose, which only reads the clock with the head motion enabled.
+	HeadMotion motion;
+
+	for (int bMotion = 0; bMotion < 2; bMotion++)
+	{
+		motion.SetMotion(bMotion ? 30.0 : 0.0, 0.2);
+
+		runner.Measure(bMotion ? "get_pose/motion" : "get_pose/static", [&](uint64_t calls)
+		{
+			double sum = 0.0;
+			for (uint64_t i = 0; i < calls; i++)
+			{
+				LARGE_INTEGER currTime = {};
+				if (motion.IsEnabled())
+				{
+					QueryPerformanceCounter(&currTime);
+				}
+
+				vr::DriverPose_t pose = motion.GetDriverPose(currTime.QuadPart, i);
+				sum += pose.qRotation.w + pose.vecAngularVelocity[1];
+			}
+			g_sink = g_sink + sum;
+		});
+	}
+}
+
+
+static bool WriteResults(const std::string& path, const BenchOptions& options, const std::vector<BenchResult>& results)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to write " << path << "\n";
+		return false;
+	}
+
+	file << std::format("{{\n\"version\":{},\n\"config\":{{\"cameras\":{},\"layout\":\"{}\",\"samples\":{},\"hardware_threads\":{}}},\n\"results\":[\n",
+		BENCH_RESULTS_VERSION, options.numCameras, CameraRig::GetLayoutName(options.layout), options.samples, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& result = results[i];
+		file << std::format("{{\"name\":\"{}\",\"calls_per_sample\":{},\"median_ns\":{:.2f},\"min_ns\":{:.2f},\"p90_ns\":{:.2f}}}{}\n",
+			result.name, result.callsPerSample, result.medianNs, result.minNs, result.p90Ns, (i + 1 < results.size()) ? "," : "");
+	}
+
+	file << "]\n}\n";
+	return true;
+}
+
+// Reads the median of each case from a file written by WriteResults. Names never contain quotes, so a plain scan is enough.
+static bool ReadBaseline(const std::string& path, std::map<std::string, double>& outMedians)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to read baseline " << path << "\n";
+		return false;
+	}
+
+	std::stringstream stream;
+	stream << file.rdbuf();
+	std::string text = stream.str();
+
+	const std::string nameKey = "\"name\":\"";
+	const std::string medianKey = "\"median_ns\":";
+
+	size_t position = 0;
+	while ((position = text.find(nameKey, position)) != std::string::npos)
+	{
+		size_t nameStart = position + nameKey.size();
+		size_t nameEnd = text.find('"', nameStart);
+		size_t median = text.find(medianKey, nameStart);
+		size_t recordEnd = text.find('}', nameStart);
+
+		if (nameEnd == std::string::npos || median == std::string::npos || median > recordEnd)
+		{
+			std::cout << "Malformed baseline " << path << "\n";
+			return false;
+		}
+
+		outMedians[text.substr(nameStart, nameEnd - nameStart)] = atof(text.c_str() + median + medianKey.size());
+		position = recordEnd;
+	}
+
+	return true;
+}
+
+// The longest matching prefix wins.
+static double GetThreshold(const BenchOptions& options, const std::string& name)
+{
+	double threshold = options.defaultThreshold;
+	size_t matchLength = 0;
+
+	for (const BenchThreshold& entry : options.thresholds)
+	{
+		if (name.compare(0, entry.prefix.size(), entry.prefix) == 0 && entry.prefix.size() >= matchLength)
+		{
+			threshold = entry.percent;
+			matchLength = entry.prefix.size();
+		}
+	}
+
+	return threshold;
+}
+
+// Returns the number of regressed cases.
+static uint32_t CompareBaseline(const BenchOptions& options, const std::vector<BenchResult>& results, const std::map<std::string, double>& baseline)
+{
+	uint32_t numRegressed = 0;
+
+	std::cout << "\nComparison against " << options.baselinePath << ":\n";
+
+	for (const BenchResult& result : results)
+	{
+		auto iter = baseline.find(result.name);
+		if (iter == baseline.end() || iter->second <= 0.0)
+		{
+			std::cout << std::left << std::setw(56) << result.name << "    (not in baseline)\n";
+			continue;
+		}
+
+		double change = (result.medianNs / iter->second - 1.0) * 100.0;
+		double threshold = GetThreshold(options, result.name);
+		bool bRegressed = change > threshold;
+
+		if (bRegressed)
+		{
+			numRegressed++;
+		}
+
+		std::cout << std::left << std::setw(56) << result.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(14) << iter->second << " ->" << std::setw(14) << result.medianNs << " ns "
+			<< std::showpos << std::setw(9) << change << std::noshowpos << " % (limit " << threshold << " %)"
+			<< (bRegressed ? "  REGRESSED" : "") << "\n";
+	}
+
+	return numRegressed;
+}
+
+
+static bool ParseResolutions(const char* text, std::vector<BenchResolution>& outResolutions)
+{
+	outResolutions.clear();
+
+	std::stringstream stream(text);
+	std::string entry;
+	while (std::getline(stream, entry, ','))
+	{
+		BenchResolution resolution = {};
+		if (sscanf(entry.c_str(), "%ux%u", &resolution.width, &resolution.height) != 2 || resolution.width == 0 || resolution.height == 0)
+		{
+			return false;
+		}
+		outResolutions.push_back(resolution);
+	}
+
+	return !outResolutions.empty();
+}
+
+static bool ParseThreadCounts(const char* text, std::vector<uint32_t>& outThreadCounts)
+{
+	outThreadCounts.clear();
+
+	std::stringstream stream(text);
+	std::string entry;
+	while (std::getline(stream, entry, ','))
+	{
+		int threads = atoi(entry.c_str());
+		if (threads < 1)
+		{
+			return false;
+		}
+		outThreadCounts.push_back((uint32_t)threads);
+	}
+
+	return !outThreadCounts.empty();
+}
+
+// Either a percentage applying to all cases, or <name prefix>=<percent>.
+static bool ParseThreshold(const char* text, BenchOptions& options)
+{
+	const char* pSeparator = strchr(text, '=');
+	if (pSeparator == nullptr)
+	{
+		options.defaultThreshold = atof(text);
+		return options.defaultThreshold > 0.0;
+	}
+
+	BenchThreshold entry;
+	entry.prefix = std::string(text, pSeparator - text);
+	entry.percent = atof(pSeparator + 1);
+	options.thresholds.push_back(entry);
+
+	return entry.percent > 0.0;
+}
+
+static void PrintUsage()
+{
+	std::cout << "Usage: driver_bench [options]\n\n"
+		<< "  --out <file>              Results file (default bench_results.json)\n"
+		<< "  --baseline <file>         Compares against the results of an earlier run, returns 2 if any case regressed\n"
+		<< "  --update-baseline         Writes the results to the baseline file instead of comparing\n"
+		<< "  --threshold [prefix=]<%>  Allowed slowdown of the median, for all cases or those starting with the prefix (default 10)\n"
+		<< "  --filter <text>           Only runs the cases with the text in their name\n"
+		<< "  --resolutions <WxH,...>   Per-camera frame sizes (default 640x480,1024x1024,1920x1080,2048x2048)\n"
+		<< "  --threads <n,...>         Thread counts for the parallel kernels (default 1,2,4 and the hardware thread count)\n"
+		<< "  --cameras <1-4>           Cameras in the rig (default 2)\n"
+		<< "  --layout <name>           horizontal, vertical or grid (default horizontal)\n"
+		<< "  --samples <n>             Samples per case (default 15)\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::cout << "OpenVR camera sim driver benchmarks\n\n";
+
+	BenchOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool bHasValue = i + 1 < argc;
+		bool bValid = true;
+
+		if (strcmp(argv[i], "--out") == 0 && bHasValue) { options.outPath = argv[++i]; }
+		else if (strcmp(argv[i], "--baseline") == 0 && bHasValue) { options.baselinePath = argv[++i]; }
+		else if (strcmp(argv[i], "--update-baseline") == 0) { options.bUpdateBaseline = true; }
+		else if (strcmp(argv[i], "--threshold") == 0 && bHasValue) { bValid = ParseThreshold(argv[++i], options); }
+		else if (strcmp(argv[i], "--filter") == 0 && bHasValue) { options.filter = argv[++i]; }
+		else if (strcmp(argv[i], "--resolutions") == 0 && bHasValue) { bValid = ParseResolutions(argv[++i], options.resolutions); }
+		else if (strcmp(argv[i], "--threads") == 0 && bHasValue) { bValid = ParseThreadCounts(argv[++i], options.threadCounts); }
+		else if (strcmp(argv[i], "--cameras") == 0 && bHasValue) { options.numCameras = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--layout") == 0 && bHasValue) { bValid = CameraRig::ParseLayout(argv[++i], options.layout); }
+		else if (strcmp(argv[i], "--samples") == 0 && bHasValue) { options.samples = atoi(argv[++i]); }
+		else { bValid = false; }
+
+		if (!bValid)
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (options.numCameras < 1 || options.numCameras > MAX_RIG_CAMERAS || options.samples < 1 || (options.bUpdateBaseline && options.baselinePath.empty()))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (options.threadCounts.empty())
+	{
+		uint32_t hardwareThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+		for (uint32_t threads : { 1u, 2u, 4u, hardwareThreads })
+		{
+			if (threads <= hardwareThreads && std::find(options.threadCounts.begin(), options.threadCounts.end(), threads) == options.threadCounts.end())
+			{
+				options.threadCounts.push_back(threads);
+			}
+		}
+	}
+
+	std::map<std::string, double> baseline;
+	bool bCompare = !options.baselinePath.empty() && !options.bUpdateBaseline;
+
+	// Read first, so a bad baseline path doesn't waste a full run.
+	if (bCompare && !ReadBaseline(options.baselinePath, baseline))
+	{
+		return 1;
+	}
+
+	BenchRunner runner(options);
+
+	for (const BenchResolution& resolution : options.resolutions)
+	{
+		CameraRig rig;
+		rig.Configure(options.numCameras, options.layout, resolution.width, resolution.height);
+
+		BenchServeFill(runner, options, "gradient", rig);
+		BenchServeFill(runner, options, "world", rig);
+		BenchServeFill(runner, options, "pattern", rig);
+		BenchDistortion(runner, options, rig);
+		BenchRectify(runner, options, rig);
+		BenchStereoMatch(runner, options, rig);
+		BenchPack(runner, options, rig);
+		BenchBayer(runner, options, rig);
+		BenchCapture(runner, options, rig);
+		BenchIntrinsics(runner, rig);
+	}
+
+	BenchMetadataBatch(runner);
+	BenchPose(runner);
+
+	if (!WriteResults(options.outPath, options, runner.GetResults()))
+	{
+		return 1;
+	}
+
+	std::cout << "\nWrote " << runner.GetResults().size() << " results to " << options.outPath << "\n";
+
+	if (runner.GetNumFailedChecks() > 0)
+	{
+		std::cout << "\n" << runner.GetNumFailedChecks() << " check(s) failed\n";
+		return 3;
+	}
+
+	if (options.bUpdateBaseline)
+	{
+		if (!WriteResults(options.baselinePath, options, runner.GetResults()))
+		{
+			return 1;
+		}
+		std::cout << "Updated baseline " << options.baselinePath << "\n";
+	}
+
+	if (bCompare)
+	{
+		uint32_t numRegressed = CompareBaseline(options, runner.GetResults(), baseline);
+		if (numRegressed > 0)
+		{
+			std::cout << "\n" << numRegressed << " case(s) regressed\n";
+			return 2;
+		}
+		std::cout << "\nNo regressions\n";
+	}
+
+	return 0;
+}
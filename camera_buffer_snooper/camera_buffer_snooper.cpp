@@ -3,14 +3,101 @@
 #include <windows.h>
 
 #include <iostream>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 
 #include "vr_blockqueue_client.h"
+#include "camera_reader.h"
+#include "queue_stress.h"
+#include "../stereo_matcher.h"
+#include "../stereo_rectify.h"
+#include "../bayer.h"
+#include "../frame_capture.h"
+
+// vr::CVS_FORMAT_RGBX32, only declared in the driver header.
+#define FRAME_FORMAT_RGBX32 8
+
+// Runs the tasks on short lived threads, the snooper has no pool to share.
+static void ParallelFor(uint32_t numTasks, const std::function<void(uint32_t)>& task)
+{
+	std::atomic<uint32_t> nextTask(0);
+	auto worker = [&]()
+	{
+		for (uint32_t i = nextTask++; i < numTasks; i = nextTask++)
+		{
+			task(i);
+		}
+	};
+
+	uint32_t numThreads = std::thread::hardware_concurrency();
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < numThreads && i < numTasks; i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (argc > 1 && strcmp(argv[1], "stress-reader") == 0)
+	{
+		return RunQueueStressReader(argc - 2, argv + 2);
+	}
+
 	std::cout << "OpenVR camera block queue snooper\n\n";
 
+	if (argc > 1 && strcmp(argv[1], "stress") == 0)
+	{
+		return RunQueueStress(argc - 2, argv + 2);
+	}
+
+	// With the stereo argument the first two camera views of each frame are run through the stereo matcher.
+	// With rectify they are undistorted and rectified first, or only rectified with undistorted for frames without lens distortion.
+	bool bStereo = false;
+	bool bRectify = false;
+	bool bUndistorted = false;
+
+	// With record <file> the frames are written to a capture file, which the driver's capture frame source plays back.
+	std::string capturePath;
+
+	// With queue <path> another queue is read than the HMD camera's, such as "/openvr_camera_sim/load_camera_1/raw_frames" of a load test camera.
+	std::string queuePath = CAMERA_READER_QUEUE_PATH;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "stereo") == 0)
+		{
+			bStereo = true;
+		}
+		else if (strcmp(argv[i], "rectify") == 0)
+		{
+			bRectify = true;
+		}
+		else if (strcmp(argv[i], "undistorted") == 0)
+		{
+			bUndistorted = true;
+		}
+		else if (strcmp(argv[i], "record") == 0 && i + 1 < argc)
+		{
+			capturePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "queue") == 0 && i + 1 < argc)
+		{
+			queuePath = argv[++i];
+		}
+	}
+
 	vr::EVRInitError initError;
 	vr::IVRSystem* vrSystem = vr::VR_Init(&initError, vr::VRApplication_Background);
 
@@ -24,104 +111,168 @@ int main()
 	bool bRun = true;
 
 
-	vr::PropertyContainerHandle_t rawFrameQueue = 0;
+	CameraReader reader;
 
-	vr::EBlockQueueError queueError = vr::VRBlockQueue()->Connect(&rawFrameQueue, "/lighthouse/camera/raw_frames");
+	vr::EBlockQueueError queueError = reader.Open(queuePath.c_str());
 	if (queueError != vr::EBlockQueueError_BlockQueueError_None)
 	{
 		std::cerr << "Error connecting to block queue:  " << (int)queueError << std::endl;
 		bRun = false;
-		rawFrameQueue = 0;
+	}
+	else
+	{
+		std::cout << "Connected to block queue " << queuePath << std::endl;
 	}
 
-	std::cout << "Connected to block queue /lighthouse/camera/raw_frames " << (uint64_t)rawFrameQueue << std::endl;
+	const CameraStreamFormat& streamFormat = reader.GetFormat();
+	int32_t format = streamFormat.format;
+	int32_t height = streamFormat.height;
+	int32_t width = streamFormat.width;
+	int32_t bayerFormat = streamFormat.bayerFormat;
 
+	std::cout << std::endl << "Static paths:" << std::endl;
+	std::cout << "/format " << format << std::endl;
+	std::cout << "/height " << height << std::endl;
+	std::cout << "/width " << width << std::endl;
+	std::cout << "/bayer_format " << BayerFormatName((EBayerFormat)bayerFormat) << std::endl;
 
-	vr::PathHandle_t formatHandle;
-	vr::VRPaths()->StringToHandle(&formatHandle, "/format");
+	std::cout << std::endl;
 
-	vr::PathHandle_t widthHandle;
-	vr::VRPaths()->StringToHandle(&widthHandle, "/width");
+	// Raw frames are demosaiced to RGBX32 before anything else looks at them.
+	BayerConverter bayerConverter;
+	std::vector<uint8_t> demosaicedFrame;
+	bool bRaw = (BayerBytesPerSample((EBayerFormat)bayerFormat) > 0);
 
-	vr::PathHandle_t heightHandle;
-	vr::VRPaths()->StringToHandle(&heightHandle, "/height");
+	if (bRaw)
+	{
+		demosaicedFrame.resize((size_t)width * height * 4);
+		std::cout << "Demosaicing " << BayerFormatName((EBayerFormat)bayerFormat) << " frames" << (bayerConverter.IsUsingAVX2() ? ", AVX2" : "") << std::endl << std::endl;
+	}
 
-	vr::PathHandle_t frameSizeHandle;
-	vr::VRPaths()->StringToHandle(&frameSizeHandle, "/frame_size");
+	StereoMatcher stereoMatcher;
+	StereoRectifier rectifier;
+	std::vector<uint8_t> rectifiedFrame;
+	uint32_t viewWidth = 0;
+	uint32_t viewHeight = 0;
+	uint32_t rightViewOffset = 0;
 
-	vr::PathHandle_t frameSequenceHandle;
-	vr::VRPaths()->StringToHandle(&frameSequenceHandle, "/frame_sequence");
+	if ((bStereo || bRectify) && format != FRAME_FORMAT_RGBX32 && !bRaw)
+	{
+		std::cerr << "Stereo matching and rectification need RGBX32 frames, format is " << format << std::endl;
+		bStereo = false;
+		bRectify = false;
+	}
 
-	vr::PathHandle_t frameTimeMonotonicHandle;
-	vr::VRPaths()->StringToHandle(&frameTimeMonotonicHandle, "/frame_time_monotonic");
+	if (bStereo || bRectify)
+	{
+		vr::ETrackedPropertyError propError;
+		int32_t layout = vrSystem->GetInt32TrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_CameraFrameLayout_Int32, &propError);
+		bool bVertical = (propError == vr::TrackedProp_Success) && (layout & vr::EVRTrackedCameraFrameLayout_VerticalLayout);
 
-	vr::PathHandle_t serverTimeTicksHandle;
-	vr::VRPaths()->StringToHandle(&serverTimeTicksHandle, "/server_time_ticks");
+		viewWidth = bVertical ? width : width / 2;
+		viewHeight = bVertical ? height / 2 : height;
+		rightViewOffset = bVertical ? viewHeight * width * 4 : viewWidth * 4;
+	}
 
-	vr::PathHandle_t deliveryRateHandle;
-	vr::VRPaths()->StringToHandle(&deliveryRateHandle, "/delivery_rate");
+	// The camera to head transforms, intrinsics and distortion of the first two cameras, as the runtime has them.
+	vr::HmdMatrix34_t cameraToHead[2] = {};
+	vr::HmdVector2_t focalLength[2] = {}, center[2] = {};
 
-	vr::PathHandle_t elapsedTimeHandle;
-	vr::VRPaths()->StringToHandle(&elapsedTimeHandle, "/elapsed_time");
+	if (bStereo || bRectify)
+	{
+		vr::ETrackedPropertyError propError;
+		uint32_t propSize = vrSystem->GetArrayTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_CameraToHeadTransforms_Matrix34_Array,
+			vr::k_unHmdMatrix34PropertyTag, cameraToHead, sizeof(cameraToHead), &propError);
+		if (propSize < sizeof(cameraToHead))
+		{
+			std::cerr << "Error reading Prop_CameraToHeadTransforms_Matrix34_Array: " << (int)propError << std::endl;
+		}
 
-	std::cout << std::endl << "Static paths:" << std::endl;
+		for (uint32_t camera = 0; camera < 2; camera++)
+		{
+			vr::EVRTrackedCameraError cameraError = vr::VRTrackedCamera()->GetCameraIntrinsics(vr::k_unTrackedDeviceIndex_Hmd, camera, vr::VRTrackedCameraFrameType_Distorted, &focalLength[camera], &center[camera]);
+			if (cameraError != vr::VRTrackedCameraError_None)
+			{
+				std::cerr << "GetCameraIntrinsics error: " << (int)cameraError << std::endl;
+			}
+		}
+	}
 
+	if (bRectify)
 	{
-		int32_t format = 0;
-		int32_t height = 0;
-		int32_t width = 0;
-
 		vr::ETrackedPropertyError propError;
 
-		vr::PathRead_t read = {};
-		read.unRequiredBufferSize = 0;
-		read.pszPath = nullptr;
-
+		int32_t distortionFunction[2] = {};
+		vrSystem->GetArrayTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_CameraDistortionFunction_Int32_Array,
+			vr::k_unInt32PropertyTag, distortionFunction, sizeof(distortionFunction), &propError);
 
-		read.ulPath = formatHandle;
-		read.pvBuffer = &format;
-		read.unBufferSize = sizeof(format);
-		read.unTag = vr::k_unInt32PropertyTag;
+		// Doubles despite the property name and tag, k_unMaxDistortionFunctionParameters per camera.
+		double distortionCoeff[2 * vr::k_unMaxDistortionFunctionParameters] = {};
+		uint32_t propSize = vrSystem->GetArrayTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_CameraDistortionCoefficients_Float_Array,
+			vr::k_unFloatPropertyTag, distortionCoeff, sizeof(distortionCoeff), &propError);
+		if (propSize < sizeof(distortionCoeff) && !bUndistorted)
+		{
+			std::cerr << "Error reading Prop_CameraDistortionCoefficients_Float_Array: " << (int)propError << std::endl;
+		}
 
-		propError = vr::VRPaths()->ReadPathBatch(rawFrameQueue, &read, 1);
-		if (propError != vr::TrackedProp_Success)
+		StereoRectifyCamera cameras[2] = {};
+		for (uint32_t camera = 0; camera < 2; camera++)
 		{
-			std::cerr << "Error reading /format: " << (int)propError << std::endl;
+			cameras[camera].focalX = focalLength[camera].v[0];
+			cameras[camera].focalY = focalLength[camera].v[1];
+			cameras[camera].centerX = center[camera].v[0];
+			cameras[camera].centerY = center[camera].v[1];
+			cameras[camera].bFisheye = !bUndistorted && (distortionFunction[camera] == vr::VRDistortionFunctionType_FTheta || distortionFunction[camera] == vr::VRDistortionFunctionType_Extended_FTheta);
+			memcpy(cameras[camera].coefficients, &distortionCoeff[camera * vr::k_unMaxDistortionFunctionParameters], sizeof(cameras[camera].coefficients));
+			memcpy(cameras[camera].cameraToHead, cameraToHead[camera].m, sizeof(cameras[camera].cameraToHead));
 		}
-		std::cout << "/format " << *(int32_t*)read.pvBuffer << std::endl;
 
-		read.ulPath = heightHandle;
-		read.pvBuffer = &height;
-		read.unBufferSize = sizeof(height);
-		read.unTag = vr::k_unInt32PropertyTag;
+		LARGE_INTEGER mapStart, mapEnd, perfFrequency;
+		QueryPerformanceCounter(&mapStart);
 
-		propError = vr::VRPaths()->ReadPathBatch(rawFrameQueue, &read, 1);
-		if (propError != vr::TrackedProp_Success)
+		if (rectifier.Configure(cameras[0], cameras[1], viewWidth, viewHeight, ParallelFor))
 		{
-			std::cerr << "Error reading /height: " << (int)propError << std::endl;
-		}
-		std::cout << "/height " << *(int32_t*)read.pvBuffer << std::endl;
+			QueryPerformanceCounter(&mapEnd);
+			QueryPerformanceFrequency(&perfFrequency);
 
-		read.ulPath = widthHandle;
-		read.pvBuffer = &width;
-		read.unBufferSize = sizeof(width);
-		read.unTag = vr::k_unInt32PropertyTag;
+			rectifiedFrame.resize((size_t)viewWidth * viewHeight * 4 * 2);
 
-		propError = vr::VRPaths()->ReadPathBatch(rawFrameQueue, &read, 1);
-		if (propError != vr::TrackedProp_Success)
+			std::cout << "Rectifying " << viewWidth << "x" << viewHeight << (cameras[0].bFisheye || cameras[1].bFisheye ? " with undistortion" : "") << ", focal " << rectifier.GetFocalLength()
+				<< ", baseline " << rectifier.GetBaseline() << " m, " << (rectifier.IsFirstViewLeft() ? "first" : "second") << " camera left"
+				<< (rectifier.IsUsingAVX2() ? ", AVX2" : "") << ", maps built in " << (mapEnd.QuadPart - mapStart.QuadPart) * 1000.0 / perfFrequency.QuadPart << " ms" << std::endl << std::endl;
+		}
+		else
 		{
-			std::cerr << "Error reading /width: " << (int)propError << std::endl;
+			std::cerr << "Cannot rectify, the first two cameras share their position" << std::endl;
+			bRectify = false;
 		}
-		std::cout << "/width " << *(int32_t*)read.pvBuffer << std::endl;
 	}
 
-	std::cout << std::endl;
+	if (bStereo)
+	{
+		// The baseline is the distance between the first two camera to head transforms.
+		float dx = cameraToHead[1].m[0][3] - cameraToHead[0].m[0][3];
+		float dy = cameraToHead[1].m[1][3] - cameraToHead[0].m[1][3];
+		float dz = cameraToHead[1].m[2][3] - cameraToHead[0].m[2][3];
+		float baseline = bRectify ? rectifier.GetBaseline() : sqrtf(dx * dx + dy * dy + dz * dz);
+		float focal = bRectify ? rectifier.GetFocalLength() : focalLength[0].v[0];
+
+		stereoMatcher.Configure(viewWidth, viewHeight);
+		stereoMatcher.SetCameraGeometry(baseline, focal);
+
+		std::cout << "Stereo matching " << stereoMatcher.GetWidth() << "x" << stereoMatcher.GetHeight() << ", " << stereoMatcher.GetNumDisparities()
+			<< " disparities, baseline " << baseline << " m, focal " << focal << (stereoMatcher.IsUsingAVX2() ? ", AVX2" : "") << std::endl << std::endl;
+	}
 
 	HANDLE stdinHandle = GetStdHandle(STD_INPUT_HANDLE);
 	DWORD numInputEvents;
 	DWORD charactersRead;
 	INPUT_RECORD inputRecord;
 
+	// Opened on the first frame, which gives the frame size.
+	FrameCaptureWriter captureWriter;
+	bool bCaptureFailed = false;
+
 	LARGE_INTEGER startTime;
 
 	QueryPerformanceCounter(&startTime);
@@ -141,10 +292,9 @@ int main()
 		}
 		if (!bRun) { break; }
 		
-		vr::PropertyContainerHandle_t readHandle;
-		uint8_t* pBuffer;
+		CameraFrame frame;
 
-		queueError = vr::VRBlockQueue()->WaitAndAcquireReadOnlyBlock(rawFrameQueue, &readHandle, (void**)&pBuffer, vr::EBlockQueueReadType_BlockQueueRead_Next, 10);
+		queueError = reader.WaitForFrame(frame, CameraReadMode_Next, 10);
 		if (queueError == vr::EBlockQueueError_BlockQueueError_BlockNotAvailable)
 		{
 			//std::cout << "No block available" << std::endl;
@@ -157,6 +307,7 @@ int main()
 			continue;
 		}
 
+		const uint8_t* pBuffer = frame.GetData();
 		std::cout << "Read-only block acquired: 0x" << std::hex <<(uint64_t)pBuffer << std::dec << std::endl;
 
 
@@ -168,104 +319,132 @@ int main()
 		double appTimeS = (currTime.QuadPart - startTime.QuadPart) / (double)perfFrequency.QuadPart;
 		double appTimeMonotonicS = currTime.QuadPart / (double)perfFrequency.QuadPart;
 		std::cout << "Time: " << appTimeS << " " << appTimeMonotonicS << std::endl;
-		
-		int32_t frameSize = 0;
-		uint64_t frameSequence = 0;
-		double elapsedTime = 0;
-		double frameTimeMonotonic = 0;
-		uint64_t serverTimeTicks = 0;
-		double deliveryRate = 0;
-
-		
-		vr::ETrackedPropertyError propError;
 
-		vr::PathRead_t read = {};
-		read.unRequiredBufferSize = 0;
-		read.pszPath = nullptr;
+		const CameraFrameMetadata& metadata = frame.GetMetadata();
+		double deliveryRate = metadata.deliveryRate;
 
-		read.ulPath = frameSizeHandle;
-		read.pvBuffer = &frameSize;
-		read.unBufferSize = sizeof(frameSize);
-		read.unTag = vr::k_unInt32PropertyTag;
+		std::cout << "/frame_size " << metadata.frameSize << std::endl;
+		std::cout << "/frame_sequence " << metadata.frameSequence << std::endl;
+		std::cout << "/frame_time_monotonic " << metadata.frameTimeMonotonic << std::endl;
+		std::cout << "/server_time_ticks " << metadata.serverTimeTicks << std::endl;
+		std::cout << "/delivery_rate " << metadata.deliveryRate << std::endl;
+		std::cout << "/elapsed_time " << metadata.elapsedTime << std::endl;
+		std::cout << "/readout_time " << metadata.readoutTime << std::endl;
 
-		propError = vr::VRPaths()->ReadPathBatch(readHandle, &read, 1);
-		if (propError != vr::TrackedProp_Success)
+		if (!capturePath.empty() && !bCaptureFailed)
 		{
-			std::cerr << "Error reading /frame_size: " << (int)propError << std::endl;
+			if (!captureWriter.IsOpen() && metadata.frameSize > 0)
+			{
+				FrameCaptureFileHeader captureHeader = {};
+				captureHeader.format = format;
+				captureHeader.width = width;
+				captureHeader.height = height;
+				captureHeader.bayerFormat = bayerFormat;
+				captureHeader.frameSize = (uint32_t)metadata.frameSize;
+				captureHeader.ticksPerSecond = perfFrequency.QuadPart;
+
+				bCaptureFailed = !captureWriter.Open(capturePath, captureHeader);
+				std::cout << (bCaptureFailed ? "Failed to open capture " : "Recording to ") << capturePath << std::endl;
+			}
+
+			if (captureWriter.IsOpen())
+			{
+				FrameCaptureMetadata captureMetadata = {};
+				captureMetadata.frameSequence = metadata.frameSequence;
+				captureMetadata.serverTimeTicks = metadata.serverTimeTicks;
+				captureMetadata.frameTimeMonotonic = metadata.frameTimeMonotonic;
+				captureMetadata.deliveryRate = metadata.deliveryRate;
+				captureMetadata.elapsedTime = metadata.elapsedTime;
+				captureMetadata.readoutTime = metadata.readoutTime;
+				captureMetadata.frameSize = metadata.frameSize;
+
+				// Recorded as served, before any demosaicing.
+				if (captureWriter.WriteFrame(pBuffer, captureMetadata, ParallelFor))
+				{
+					FrameCaptureStats captureStats = captureWriter.GetStats();
+					std::cout << "Capture: " << captureStats.lastEncodeMs << " ms, " << (100.0 * captureStats.encodedBytes / captureStats.rawBytes) << "% of raw" << std::endl;
+				}
+				else
+				{
+					std::cout << "Capture: frame dropped, writer behind" << std::endl;
+				}
+			}
 		}
-		std::cout << "/frame_size " << *(int32_t*)read.pvBuffer << std::endl;
 
-		read.ulPath = frameSequenceHandle;
-		read.pvBuffer = &frameSequence;
-		read.unBufferSize = sizeof(frameSequence);
-		read.unTag = vr::k_unUint64PropertyTag;
+		const uint8_t* pFrame = pBuffer;
 
-		propError = vr::VRPaths()->ReadPathBatch(readHandle, &read, 1);
-		if (propError != vr::TrackedProp_Success)
+		if (bRaw)
 		{
-			std::cerr << "Error reading /frame_sequence: " << (int)propError << std::endl;
-		}
-		std::cout << "/frame_sequence " << *(uint64_t*)read.pvBuffer << std::endl;
+			LARGE_INTEGER demosaicStart, demosaicEnd;
+			QueryPerformanceCounter(&demosaicStart);
 
+			uint32_t numBands = (height + BAYER_BAND_ROWS - 1) / BAYER_BAND_ROWS;
+			ParallelFor(numBands, [&](uint32_t band)
+			{
+				uint32_t firstRow = band * BAYER_BAND_ROWS;
+				bayerConverter.DemosaicRows((EBayerFormat)bayerFormat, pBuffer, demosaicedFrame.data(), width, height, firstRow, (std::min)(firstRow + BAYER_BAND_ROWS, (uint32_t)height));
+			});
 
-		read.ulPath = frameTimeMonotonicHandle;
-		read.pvBuffer = &frameTimeMonotonic;
-		read.unBufferSize = sizeof(frameTimeMonotonic);
-		read.unTag = vr::k_unDoublePropertyTag;
+			QueryPerformanceCounter(&demosaicEnd);
+			pFrame = demosaicedFrame.data();
 
-		propError = vr::VRPaths()->ReadPathBatch(readHandle, &read, 1);
-		if (propError != vr::TrackedProp_Success)
-		{
-			std::cerr << "Error reading /frame_time_monotonic: " << (int)propError << std::endl;
+			// Whether demosaicing alone could keep up with the delivery rate.
+			double demosaicMs = (demosaicEnd.QuadPart - demosaicStart.QuadPart) * 1000.0 / perfFrequency.QuadPart;
+			std::cout << "Demosaic: " << demosaicMs << " ms, " << (demosaicMs > 0.0 ? 1000.0 / demosaicMs : 0.0) << " fps max"
+				<< ((deliveryRate > 0.0 && demosaicMs > deliveryRate * 1000.0) ? ", slower than delivery" : "") << std::endl;
 		}
-		std::cout << "/frame_time_monotonic " << *(double*)read.pvBuffer << std::endl;
 
-		read.ulPath = serverTimeTicksHandle;
-		read.pvBuffer = &serverTimeTicks;
-		read.unBufferSize = sizeof(serverTimeTicks);
-		read.unTag = vr::k_unUint64PropertyTag;
+		const uint8_t* pLeftView = pFrame;
+		const uint8_t* pRightView = pFrame + rightViewOffset;
+		uint32_t viewRowStride = width * 4;
 
-		propError = vr::VRPaths()->ReadPathBatch(readHandle, &read, 1);
-		if (propError != vr::TrackedProp_Success)
+		if (bRectify)
 		{
-			std::cerr << "Error reading /server_time_ticks: " << (int)propError << std::endl;
-		}
-		std::cout << "/server_time_ticks " << *(uint64_t*)read.pvBuffer << std::endl;
+			LARGE_INTEGER rectifyStart, rectifyEnd;
+			QueryPerformanceCounter(&rectifyStart);
 
-		read.ulPath = deliveryRateHandle;
-		read.pvBuffer = &deliveryRate;
-		read.unBufferSize = sizeof(deliveryRate);
-		read.unTag = vr::k_unDoublePropertyTag;
+			uint8_t* pFirstRectified = rectifiedFrame.data();
+			uint8_t* pSecondRectified = pFirstRectified + rectifiedFrame.size() / 2;
+			rectifier.Rectify(pLeftView, pRightView, width * 4, pFirstRectified, pSecondRectified, viewWidth * 4, ParallelFor);
 
-		propError = vr::VRPaths()->ReadPathBatch(readHandle, &read, 1);
-		if (propError != vr::TrackedProp_Success)
-		{
-			std::cerr << "Error reading /delivery_rate: " << (int)propError << std::endl;
-		}
-		std::cout << "/delivery_rate " << *(double*)read.pvBuffer << std::endl;
+			QueryPerformanceCounter(&rectifyEnd);
 
-		read.ulPath = elapsedTimeHandle;
-		read.pvBuffer = &elapsedTime;
-		read.unBufferSize = sizeof(elapsedTime);
-		read.unTag = vr::k_unDoublePropertyTag;
+			// The matcher takes the views in their rectified left to right order.
+			pLeftView = rectifier.IsFirstViewLeft() ? pFirstRectified : pSecondRectified;
+			pRightView = rectifier.IsFirstViewLeft() ? pSecondRectified : pFirstRectified;
+			viewRowStride = viewWidth * 4;
 
-		propError = vr::VRPaths()->ReadPathBatch(readHandle, &read, 1);
-		if (propError != vr::TrackedProp_Success)
-		{
-			std::cerr << "Error reading /elapsed_time: " << (int)propError << std::endl;
+			std::cout << "Rectify: " << (rectifyEnd.QuadPart - rectifyStart.QuadPart) * 1000.0 / perfFrequency.QuadPart << " ms" << std::endl;
 		}
-		std::cout << "/elapsed_time " << *(double*)read.pvBuffer << std::endl;
-
 
-		queueError = vr::VRBlockQueue()->ReleaseReadOnlyBlock(rawFrameQueue, readHandle);
-		if (queueError != vr::EBlockQueueError_BlockQueueError_None)
+		if (bStereo)
 		{
-			std::cerr << "ReleaseReadOnlyBlock error: " << (int)queueError << std::endl;
+			stereoMatcher.Compute(pLeftView, pRightView, viewRowStride, ParallelFor);
+
+			const StereoStats& stats = stereoMatcher.GetStats();
+			std::cout << "Stereo: valid " << (100.0 * stats.validPixels / stats.totalPixels) << "%, mean disparity " << stats.meanDisparity
+				<< ", median depth " << stats.medianDepth << " m, " << stats.computeMs << " ms" << std::endl;
 		}
 
+
+		frame.Release();
+
 		std::cout << std::endl;
 	}
 
+	const CameraReaderStats& readerStats = reader.GetStats();
+	std::cout << "Frames read " << readerStats.framesRead << ", skipped " << readerStats.framesSkipped << ", metadata errors " << readerStats.metadataErrors << std::endl;
+
+	if (captureWriter.IsOpen())
+	{
+		captureWriter.Close();
+
+		FrameCaptureStats captureStats = captureWriter.GetStats();
+		std::cout << "Captured " << captureStats.framesWritten << " frames, " << captureStats.keyframes << " keyframes, dropped " << captureStats.framesDropped
+			<< ", " << captureStats.encodedBytes / (1024 * 1024) << " MB, " << (captureStats.rawBytes > 0 ? 100.0 * captureStats.encodedBytes / captureStats.rawBytes : 0.0) << "% of raw" << std::endl;
+	}
+
+	reader.Close();
 	vr::VR_Shutdown();
 
 	std::cout << "Shutdown complete"  << std::endl;
@@ -0,0 +1,323 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <chrono>
+#include <cmath>
+
+#include "camera_reader.h"
+
+
+static const char* g_formatPathNames[] = { "/format", "/width", "/height", "/bayer_format" };
+
+// In the order of CameraFrameMetadata.
+static const char* g_metadataPathNames[] = { "/frame_size", "/frame_sequence", "/frame_time_monotonic", "/server_time_ticks", "/delivery_rate", "/elapsed_time", "/readout_time" };
+
+
+static int64_t GetTicks()
+{
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+	return currTime.QuadPart;
+}
+
+static void SetRead(vr::PathRead_t& read, vr::PathHandle_t path, void* pBuffer, uint32_t size, vr::PropertyTypeTag_t tag)
+{
+	read = {};
+	read.ulPath = path;
+	read.pvBuffer = pBuffer;
+	read.unBufferSize = size;
+	read.unTag = tag;
+}
+
+
+CameraFrame::CameraFrame(CameraFrame&& other)
+{
+	*this = std::move(other);
+}
+
+CameraFrame& CameraFrame::operator=(CameraFrame&& other)
+{
+	if (this != &other)
+	{
+		Release();
+
+		m_pQueue = other.m_pQueue;
+		m_queueHandle = other.m_queueHandle;
+		m_blockHandle = other.m_blockHandle;
+		m_pData = other.m_pData;
+		m_acquireTicks = other.m_acquireTicks;
+		m_metadata = other.m_metadata;
+
+		other.m_pData = nullptr;
+		other.m_blockHandle = 0;
+	}
+	return *this;
+}
+
+void CameraFrame::Release()
+{
+	if (m_pData == nullptr)
+	{
+		return;
+	}
+
+	m_pQueue->ReleaseReadOnlyBlock(m_queueHandle, m_blockHandle);
+	m_pData = nullptr;
+	m_blockHandle = 0;
+}
+
+
+CameraReader::CameraReader(vr::IVRBlockQueue* pQueue, vr::IVRPaths* pPaths)
+	: m_pQueue(pQueue)
+	, m_pPaths(pPaths)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksToSeconds = 1.0 / (double)frequency.QuadPart;
+}
+
+vr::EBlockQueueError CameraReader::Open(const char* pchQueuePath)
+{
+	Close();
+
+	if (m_pQueue == nullptr) { m_pQueue = vr::VRBlockQueue(); }
+	if (m_pPaths == nullptr) { m_pPaths = vr::VRPaths(); }
+
+	if (m_pQueue == nullptr || m_pPaths == nullptr)
+	{
+		return vr::EBlockQueueError_BlockQueueError_InternalError;
+	}
+
+	m_queuePath = pchQueuePath;
+
+	vr::EBlockQueueError error = m_pQueue->Connect(&m_queueHandle, pchQueuePath);
+	if (error != vr::EBlockQueueError_BlockQueueError_None)
+	{
+		m_queueHandle = 0;
+		return error;
+	}
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		m_pPaths->StringToHandle(&m_formatPaths[i], g_formatPathNames[i]);
+	}
+	for (uint32_t i = 0; i < 7; i++)
+	{
+		m_pPaths->StringToHandle(&m_metadataPaths[i], g_metadataPathNames[i]);
+	}
+
+	if (!ReadFormat())
+	{
+		Close();
+		return vr::EBlockQueueError_BlockQueueError_InternalError;
+	}
+
+	m_lastServerTimeTicks = 0;
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+void CameraReader::Close()
+{
+	if (m_queueHandle != 0)
+	{
+		m_pQueue->Destroy(m_queueHandle);
+		m_queueHandle = 0;
+	}
+}
+
+vr::EBlockQueueError CameraReader::Reopen()
+{
+	std::string queuePath = m_queuePath;
+	return Open(queuePath.c_str());
+}
+
+bool CameraReader::ReadFormat()
+{
+	m_format = {};
+
+	vr::PathRead_t read[3];
+	SetRead(read[0], m_formatPaths[0], &m_format.format, sizeof(int32_t), vr::k_unInt32PropertyTag);
+	SetRead(read[1], m_formatPaths[1], &m_format.width, sizeof(int32_t), vr::k_unInt32PropertyTag);
+	SetRead(read[2], m_formatPaths[2], &m_format.height, sizeof(int32_t), vr::k_unInt32PropertyTag);
+
+	if (m_pPaths->ReadPathBatch(m_queueHandle, read, 3) != vr::TrackedProp_Success)
+	{
+		return false;
+	}
+
+	// Only written by the simulator driver, so read on its own to not fail the batch.
+	vr::PathRead_t bayerRead;
+	SetRead(bayerRead, m_formatPaths[3], &m_format.bayerFormat, sizeof(int32_t), vr::k_unInt32PropertyTag);
+	if (m_pPaths->ReadPathBatch(m_queueHandle, &bayerRead, 1) != vr::TrackedProp_Success)
+	{
+		m_format.bayerFormat = 0;
+	}
+
+	return true;
+}
+
+bool CameraReader::ReadMetadata(vr::PropertyContainerHandle_t blockHandle, CameraFrameMetadata& outMetadata)
+{
+	outMetadata = {};
+
+	vr::PathRead_t read[7];
+	SetRead(read[0], m_metadataPaths[0], &outMetadata.frameSize, sizeof(outMetadata.frameSize), vr::k_unInt32PropertyTag);
+	SetRead(read[1], m_metadataPaths[1], &outMetadata.frameSequence, sizeof(outMetadata.frameSequence), vr::k_unUint64PropertyTag);
+	SetRead(read[2], m_metadataPaths[2], &outMetadata.frameTimeMonotonic, sizeof(outMetadata.frameTimeMonotonic), vr::k_unDoublePropertyTag);
+	SetRead(read[3], m_metadataPaths[3], &outMetadata.serverTimeTicks, sizeof(outMetadata.serverTimeTicks), vr::k_unUint64PropertyTag);
+	SetRead(read[4], m_metadataPaths[4], &outMetadata.deliveryRate, sizeof(outMetadata.deliveryRate), vr::k_unDoublePropertyTag);
+	SetRead(read[5], m_metadataPaths[5], &outMetadata.elapsedTime, sizeof(outMetadata.elapsedTime), vr::k_unDoublePropertyTag);
+	SetRead(read[6], m_metadataPaths[6], &outMetadata.readoutTime, sizeof(outMetadata.readoutTime), vr::k_unDoublePropertyTag);
+
+	return m_pPaths->ReadPathBatch(blockHandle, read, 7) == vr::TrackedProp_Success;
+}
+
+void CameraReader::UpdateFrameStats(const CameraFrameMetadata& metadata)
+{
+	// The delivery rate is the interval to the previous frame, so the gap in intervals gives the frames in between.
+	if (m_lastServerTimeTicks != 0 && metadata.deliveryRate > 0.0 && metadata.serverTimeTicks > m_lastServerTimeTicks)
+	{
+		double gap = (metadata.serverTimeTicks - m_lastServerTimeTicks) * m_ticksToSeconds;
+		int64_t intervals = llround(gap / metadata.deliveryRate);
+		m_stats.framesSkipped += (intervals > 1) ? intervals - 1 : 0;
+	}
+
+	m_lastServerTimeTicks = metadata.serverTimeTicks;
+	m_stats.framesRead++;
+}
+
+vr::EBlockQueueError CameraReader::WaitForFrame(CameraFrame& outFrame, ECameraReadMode mode, uint32_t timeoutMs)
+{
+	return ReadFrame(outFrame, mode, true, timeoutMs);
+}
+
+vr::EBlockQueueError CameraReader::TryReadFrame(CameraFrame& outFrame, ECameraReadMode mode)
+{
+	return ReadFrame(outFrame, mode, false, 0);
+}
+
+vr::EBlockQueueError CameraReader::ReadFrame(CameraFrame& outFrame, ECameraReadMode mode, bool bWait, uint32_t timeoutMs)
+{
+	outFrame.Release();
+
+	if (!IsOpen())
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+	}
+
+	// New waits for a block newer than the last one read, Next for the one after it in sequence.
+	vr::EBlockQueueReadType readType = (mode == CameraReadMode_Latest) ? vr::EBlockQueueReadType_BlockQueueRead_New : vr::EBlockQueueReadType_BlockQueueRead_Next;
+
+	int64_t deadlineTicks = GetTicks() + (int64_t)(timeoutMs / 1000.0 / m_ticksToSeconds);
+	uint32_t remainingMs = timeoutMs;
+
+	while (true)
+	{
+		vr::PropertyContainerHandle_t blockHandle;
+		uint8_t* pBuffer;
+
+		vr::EBlockQueueError error = bWait ?
+			m_pQueue->WaitAndAcquireReadOnlyBlock(m_queueHandle, &blockHandle, (void**)&pBuffer, readType, remainingMs) :
+			m_pQueue->AcquireReadOnlyBlock(m_queueHandle, &blockHandle, (void**)&pBuffer, readType);
+
+		if (error == vr::EBlockQueueError_BlockQueueError_BlockNotAvailable)
+		{
+			m_stats.timeouts += bWait ? 1 : 0;
+			return error;
+		}
+		else if (error != vr::EBlockQueueError_BlockQueueError_None)
+		{
+			return error;
+		}
+
+		int64_t acquireTicks = GetTicks();
+
+		CameraFrameMetadata metadata;
+		if (!ReadMetadata(blockHandle, metadata))
+		{
+			m_stats.metadataErrors++;
+		}
+
+		// In case the runtime hands out the same block again, it is released right away and the wait continues with what is left of the timeout.
+		if (mode == CameraReadMode_Latest && metadata.serverTimeTicks != 0 && metadata.serverTimeTicks == m_lastServerTimeTicks)
+		{
+			m_pQueue->ReleaseReadOnlyBlock(m_queueHandle, blockHandle);
+			m_stats.repeatsDropped++;
+
+			if (!bWait || acquireTicks >= deadlineTicks)
+			{
+				m_stats.timeouts += bWait ? 1 : 0;
+				return vr::EBlockQueueError_BlockQueueError_BlockNotAvailable;
+			}
+
+			remainingMs = (uint32_t)ceil((deadlineTicks - acquireTicks) * m_ticksToSeconds * 1000.0);
+			std::this_thread::yield();
+			continue;
+		}
+
+		UpdateFrameStats(metadata);
+
+		outFrame.m_pQueue = m_pQueue;
+		outFrame.m_queueHandle = m_queueHandle;
+		outFrame.m_blockHandle = blockHandle;
+		outFrame.m_pData = pBuffer;
+		outFrame.m_acquireTicks = acquireTicks;
+		outFrame.m_metadata = metadata;
+
+		return vr::EBlockQueueError_BlockQueueError_None;
+	}
+}
+
+
+bool CameraFrameDispatcher::Start(CameraReader& reader, ECameraReadMode mode, const FrameCallback& frameCallback, const ErrorCallback& errorCallback)
+{
+	Stop();
+
+	if (!reader.IsOpen() || !frameCallback)
+	{
+		return false;
+	}
+
+	m_pReader = &reader;
+	m_frameCallback = frameCallback;
+	m_errorCallback = errorCallback;
+	m_bRun = true;
+	m_thread = std::thread(&CameraFrameDispatcher::Run, this, mode);
+
+	return true;
+}
+
+void CameraFrameDispatcher::Stop()
+{
+	m_bRun = false;
+
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void CameraFrameDispatcher::Run(ECameraReadMode mode)
+{
+	while (m_bRun)
+	{
+		CameraFrame frame;
+		vr::EBlockQueueError error = m_pReader->WaitForFrame(frame, mode, CAMERA_READER_DISPATCH_TIMEOUT_MS);
+
+		if (error == vr::EBlockQueueError_BlockQueueError_None)
+		{
+			m_frameCallback(frame);
+		}
+		else if (error != vr::EBlockQueueError_BlockQueueError_BlockNotAvailable)
+		{
+			if (!m_errorCallback || !m_errorCallback(error))
+			{
+				m_bRun = false;
+				break;
+			}
+
+			// Keeps a persistent error from spinning.
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+}
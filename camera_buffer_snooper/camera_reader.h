@@ -0,0 +1,210 @@
+// Reader side of the raw frame block queue, for applications consuming the camera frames directly.
+// Builds on vr_blockqueue_client.h, and needs only it and the OpenVR client headers. Add camera_reader.cpp to the application.
+//
+// A CameraReader connects to the queue and resolves the path handles once. Each read acquires a block and reads all of
+// its metadata in one batch, and hands the block out as a CameraFrame pointing straight into the shared block.
+// The block is released when the CameraFrame is destroyed or released, so holding it is scoped to its use.
+// Blocks held by readers can't be written by the driver, so frames should be released as soon as they are no longer needed.
+//
+// A CameraFrameDispatcher runs the reads on its own thread and calls back with each frame, releasing it when the callback returns.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "vr_blockqueue_client.h"
+
+
+#define CAMERA_READER_QUEUE_PATH "/lighthouse/camera/raw_frames"
+
+// Timeout of each wait in the dispatcher, so it notices when it is stopped.
+#define CAMERA_READER_DISPATCH_TIMEOUT_MS 100
+
+
+enum ECameraReadMode
+{
+	// Every frame in order, as long as the reader keeps up with the queue.
+	CameraReadMode_Next = 0,
+
+	// Only the newest frame, skipping any that arrived while the reader was busy. Never returns the same frame twice.
+	CameraReadMode_Latest,
+};
+
+// Static paths written by the driver when the queue is created.
+struct CameraStreamFormat
+{
+	// vr::ECameraVideoStreamFormat value, CVS_FORMAT_UNKNOWN for raw Bayer frames.
+	int32_t format;
+	int32_t width;
+	int32_t height;
+
+	// EBayerFormat value of raw frames, only written by the simulator driver. Zero otherwise.
+	int32_t bayerFormat;
+};
+
+// Paths written with each frame.
+struct CameraFrameMetadata
+{
+	int32_t frameSize;
+
+	// Wraps around at 16.
+	uint64_t frameSequence;
+
+	double frameTimeMonotonic;
+	uint64_t serverTimeTicks;
+
+	// Interval to the previous frame in seconds.
+	double deliveryRate;
+
+	double elapsedTime;
+
+	// Exposure time difference between the first and last row, server_time_ticks is the first row.
+	double readoutTime;
+};
+
+struct CameraReaderStats
+{
+	uint64_t framesRead;
+
+	// Frames the reader never saw, judged from the frame times and the delivery interval.
+	uint64_t framesSkipped;
+
+	// Blocks acquired again without a new frame in Latest mode, which are released without being returned.
+	uint64_t repeatsDropped;
+
+	uint64_t timeouts;
+
+	// Reads whose metadata batch failed. The frames are still returned.
+	uint64_t metadataErrors;
+};
+
+
+class CameraReader;
+
+// A read-only block holding a frame. Releases the block when destroyed. Moving hands over the block.
+// Must not outlive the reader it came from.
+class CameraFrame
+{
+public:
+	CameraFrame() {}
+	CameraFrame(CameraFrame&& other);
+	CameraFrame& operator=(CameraFrame&& other);
+	~CameraFrame() { Release(); }
+
+	CameraFrame(const CameraFrame&) = delete;
+	CameraFrame& operator=(const CameraFrame&) = delete;
+
+	bool IsValid() const { return m_pData != nullptr; }
+
+	// Frame texture in the shared block, valid until the frame is released.
+	const uint8_t* GetData() const { return m_pData; }
+	uint32_t GetSize() const { return (m_metadata.frameSize > 0) ? (uint32_t)m_metadata.frameSize : 0; }
+
+	const CameraFrameMetadata& GetMetadata() const { return m_metadata; }
+
+	// Performance counter ticks of when the block was acquired, to see how long it has been held.
+	int64_t GetAcquireTicks() const { return m_acquireTicks; }
+
+	void Release();
+
+protected:
+	friend class CameraReader;
+
+	vr::IVRBlockQueue* m_pQueue = nullptr;
+	vr::PropertyContainerHandle_t m_queueHandle = 0;
+	vr::PropertyContainerHandle_t m_blockHandle = 0;
+	const uint8_t* m_pData = nullptr;
+	int64_t m_acquireTicks = 0;
+	CameraFrameMetadata m_metadata = {};
+};
+
+
+// Connection to the raw frame queue. Reads are meant to be made from one thread at a time.
+class CameraReader
+{
+public:
+	// The interfaces default to the ones of the OpenVR client, after VR_Init.
+	CameraReader(vr::IVRBlockQueue* pQueue = nullptr, vr::IVRPaths* pPaths = nullptr);
+	~CameraReader() { Close(); }
+
+	CameraReader(const CameraReader&) = delete;
+	CameraReader& operator=(const CameraReader&) = delete;
+
+	// Connects to the queue and reads the stream format.
+	vr::EBlockQueueError Open(const char* pchQueuePath = CAMERA_READER_QUEUE_PATH);
+
+	// Any frames still held must be released first.
+	void Close();
+
+	bool IsOpen() const { return m_queueHandle != 0; }
+
+	// The driver recreates the queue when the frame format changes, which shows up as read errors.
+	// Reopening connects to the new queue.
+	vr::EBlockQueueError Reopen();
+
+	const CameraStreamFormat& GetFormat() const { return m_format; }
+
+	// Waits up to the timeout for a frame. Returns BlockNotAvailable on timeout.
+	vr::EBlockQueueError WaitForFrame(CameraFrame& outFrame, ECameraReadMode mode, uint32_t timeoutMs);
+
+	// Returns a frame if one is available right away.
+	vr::EBlockQueueError TryReadFrame(CameraFrame& outFrame, ECameraReadMode mode);
+
+	const CameraReaderStats& GetStats() const { return m_stats; }
+	void ResetStats() { m_stats = {}; }
+
+protected:
+	vr::EBlockQueueError ReadFrame(CameraFrame& outFrame, ECameraReadMode mode, bool bWait, uint32_t timeoutMs);
+	bool ReadFormat();
+	bool ReadMetadata(vr::PropertyContainerHandle_t blockHandle, CameraFrameMetadata& outMetadata);
+	void UpdateFrameStats(const CameraFrameMetadata& metadata);
+
+	vr::IVRBlockQueue* m_pQueue;
+	vr::IVRPaths* m_pPaths;
+	std::string m_queuePath;
+	vr::PropertyContainerHandle_t m_queueHandle = 0;
+
+	CameraStreamFormat m_format = {};
+
+	vr::PathHandle_t m_formatPaths[4] = {};
+	vr::PathHandle_t m_metadataPaths[7] = {};
+
+	uint64_t m_lastServerTimeTicks = 0;
+	double m_ticksToSeconds = 0.0;
+
+	CameraReaderStats m_stats = {};
+};
+
+
+// Reads frames on its own thread and calls back with each one. The frame is released when the callback returns,
+// unless the callback moves it out to keep it.
+class CameraFrameDispatcher
+{
+public:
+	typedef std::function<void(CameraFrame& frame)> FrameCallback;
+
+	// Called when a read fails with anything but a timeout. Return true to keep reading, for example after reopening the reader.
+	typedef std::function<bool(vr::EBlockQueueError error)> ErrorCallback;
+
+	~CameraFrameDispatcher() { Stop(); }
+
+	// The reader must be open, and is only used by the dispatcher thread until Stop returns.
+	bool Start(CameraReader& reader, ECameraReadMode mode, const FrameCallback& frameCallback, const ErrorCallback& errorCallback = nullptr);
+
+	void Stop();
+
+	bool IsRunning() const { return m_bRun; }
+
+protected:
+	void Run(ECameraReadMode mode);
+
+	CameraReader* m_pReader = nullptr;
+	FrameCallback m_frameCallback;
+	ErrorCallback m_errorCallback;
+	std::thread m_thread;
+	std::atomic<bool> m_bRun{ false };
+};
@@ -0,0 +1,486 @@
+#include "local_block_queue.h"
+
+#include <chrono>
+#include <cstring>
+
+
+// Layout of a path value in a block header, followed by the value padded to 8 bytes.
+struct LocalHeaderEntry
+{
+	vr::PathHandle_t path;
+	vr::PropertyTypeTag_t tag;
+	uint32_t size;
+};
+
+static uint32_t GetEntrySize(uint32_t valueSize)
+{
+	return (uint32_t)sizeof(LocalHeaderEntry) + ((valueSize + 7) & ~7u);
+}
+
+
+LocalBlockQueue::LocalBlockQueue(uint32_t maxConnections)
+	: m_maxConnections(maxConnections)
+{
+}
+
+vr::EBlockQueueError LocalBlockQueue::Create(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath, uint32_t unBlockDataSize, uint32_t unBlockHeaderSize, uint32_t unBlockCount, uint32_t unFlags)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (pulQueueHandle == nullptr || pchPath == nullptr || unBlockCount < 1 || unBlockDataSize == 0)
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidParam;
+	}
+
+	for (auto& entry : m_queues)
+	{
+		if (entry.second.path == pchPath)
+		{
+			return vr::EBlockQueueError_BlockQueueError_QueueAlreadyExists;
+		}
+	}
+
+	uint32_t queueId = m_nextQueueId++;
+	Queue& queue = m_queues[queueId];
+	queue.path = pchPath;
+	queue.blocks.resize(unBlockCount);
+	queue.header.resize(unBlockHeaderSize);
+
+	for (Block& block : queue.blocks)
+	{
+		block.data.resize(unBlockDataSize);
+		block.header.resize(unBlockHeaderSize);
+	}
+
+	Connection owner;
+	owner.queueId = queueId;
+	owner.bOwner = true;
+
+	*pulQueueHandle = m_nextConnectionHandle++;
+	m_connections[*pulQueueHandle] = owner;
+
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+vr::EBlockQueueError LocalBlockQueue::Connect(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& entry : m_queues)
+	{
+		if (entry.second.path != pchPath)
+		{
+			continue;
+		}
+
+		if (entry.second.numConnections >= m_maxConnections)
+		{
+			return vr::EBlockQueueError_BlockQueueError_TooManyConnections;
+		}
+
+		Connection connection;
+		connection.queueId = entry.first;
+
+		// Next starts from the newest block rather than replaying the whole queue.
+		connection.lastReadSequence = (entry.second.lastSequence > 0) ? entry.second.lastSequence - 1 : 0;
+
+		entry.second.numConnections++;
+
+		*pulQueueHandle = m_nextConnectionHandle++;
+		m_connections[*pulQueueHandle] = connection;
+
+		return vr::EBlockQueueError_BlockQueueError_None;
+	}
+
+	return vr::EBlockQueueError_BlockQueueError_QueueNotFound;
+}
+
+// Destroying the owner handle removes the queue, other handles only disconnect.
+vr::EBlockQueueError LocalBlockQueue::Destroy(vr::PropertyContainerHandle_t ulQueueHandle)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto iter = m_connections.find(ulQueueHandle);
+	if (iter == m_connections.end())
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+	}
+
+	uint32_t queueId = iter->second.queueId;
+
+	if (iter->second.bOwner)
+	{
+		for (auto connection = m_connections.begin(); connection != m_connections.end();)
+		{
+			connection = (connection->second.queueId == queueId) ? m_connections.erase(connection) : std::next(connection);
+		}
+		m_queues.erase(queueId);
+	}
+	else
+	{
+		m_queues[queueId].numConnections--;
+		m_connections.erase(iter);
+	}
+
+	m_releaseCondition.notify_all();
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+LocalBlockQueue::Queue* LocalBlockQueue::GetQueue(vr::PropertyContainerHandle_t handle, Connection** ppConnection)
+{
+	auto iter = m_connections.find(handle);
+	if (iter == m_connections.end())
+	{
+		return nullptr;
+	}
+
+	if (ppConnection != nullptr)
+	{
+		*ppConnection = &iter->second;
+	}
+	return &m_queues[iter->second.queueId];
+}
+
+vr::EBlockQueueError LocalBlockQueue::AcquireWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Connection* pConnection;
+	Queue* pQueue = GetQueue(ulQueueHandle, &pConnection);
+	if (pQueue == nullptr || !pConnection->bOwner)
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+	}
+
+	// The oldest block no one is reading.
+	int32_t blockIndex = -1;
+	for (uint32_t i = 0; i < pQueue->blocks.size(); i++)
+	{
+		const Block& block = pQueue->blocks[i];
+		if (block.bWriting || block.numReaders > 0)
+		{
+			continue;
+		}
+		if (blockIndex < 0 || block.sequence < pQueue->blocks[blockIndex].sequence)
+		{
+			blockIndex = (int32_t)i;
+		}
+	}
+
+	if (blockIndex < 0)
+	{
+		return vr::EBlockQueueError_BlockQueueError_BlockNotAvailable;
+	}
+
+	Block& block = pQueue->blocks[blockIndex];
+	block.bWriting = true;
+	block.headerUsed = 0;
+
+	*pulBlockHandle = MakeBlockHandle(pConnection->queueId, blockIndex);
+	*ppvBuffer = block.data.data();
+
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+vr::EBlockQueueError LocalBlockQueue::ReleaseWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		Queue* pQueue = GetQueue(ulQueueHandle, nullptr);
+		uint32_t blockIndex = (uint32_t)(ulBlockHandle & 0xFFFFFFFF) - 1;
+
+		if (pQueue == nullptr || blockIndex >= pQueue->blocks.size() || !pQueue->blocks[blockIndex].bWriting)
+		{
+			return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+		}
+
+		Block& block = pQueue->blocks[blockIndex];
+		block.bWriting = false;
+		block.sequence = ++pQueue->lastSequence;
+	}
+
+	m_releaseCondition.notify_all();
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+int32_t LocalBlockQueue::FindReadBlock(const Queue& queue, const Connection& connection, vr::EBlockQueueReadType readType) const
+{
+	int32_t blockIndex = -1;
+
+	for (uint32_t i = 0; i < queue.blocks.size(); i++)
+	{
+		const Block& block = queue.blocks[i];
+		if (block.bWriting || block.sequence == 0)
+		{
+			continue;
+		}
+
+		if (readType == vr::EBlockQueueReadType_BlockQueueRead_Next)
+		{
+			// Blocks overwritten before the reader got to them are skipped.
+			if (block.sequence > connection.lastReadSequence && (blockIndex < 0 || block.sequence < queue.blocks[blockIndex].sequence))
+			{
+				blockIndex = (int32_t)i;
+			}
+		}
+		else if (blockIndex < 0 || block.sequence > queue.blocks[blockIndex].sequence)
+		{
+			blockIndex = (int32_t)i;
+		}
+	}
+
+	if (blockIndex >= 0 && readType == vr::EBlockQueueReadType_BlockQueueRead_New && queue.blocks[blockIndex].sequence <= connection.lastReadSequence)
+	{
+		return -1;
+	}
+
+	return blockIndex;
+}
+
+vr::EBlockQueueError LocalBlockQueue::WaitAndAcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType, uint32_t unTimeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(unTimeoutMs);
+
+	while (true)
+	{
+		Connection* pConnection;
+		Queue* pQueue = GetQueue(ulQueueHandle, &pConnection);
+		if (pQueue == nullptr)
+		{
+			return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+		}
+
+		int32_t blockIndex = FindReadBlock(*pQueue, *pConnection, eReadType);
+		if (blockIndex >= 0)
+		{
+			Block& block = pQueue->blocks[blockIndex];
+			block.numReaders++;
+			pConnection->lastReadSequence = block.sequence;
+
+			*pulBlockHandle = MakeBlockHandle(pConnection->queueId, blockIndex);
+			*ppvBuffer = block.data.data();
+
+			return vr::EBlockQueueError_BlockQueueError_None;
+		}
+
+		if (m_releaseCondition.wait_until(lock, deadline) == std::cv_status::timeout)
+		{
+			return vr::EBlockQueueError_BlockQueueError_BlockNotAvailable;
+		}
+	}
+}
+
+vr::EBlockQueueError LocalBlockQueue::AcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType)
+{
+	return WaitAndAcquireReadOnlyBlock(ulQueueHandle, pulBlockHandle, ppvBuffer, eReadType, 0);
+}
+
+vr::EBlockQueueError LocalBlockQueue::ReleaseReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Queue* pQueue = GetQueue(ulQueueHandle, nullptr);
+	uint32_t blockIndex = (uint32_t)(ulBlockHandle & 0xFFFFFFFF) - 1;
+
+	if (pQueue == nullptr || blockIndex >= pQueue->blocks.size() || pQueue->blocks[blockIndex].numReaders == 0)
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+	}
+
+	pQueue->blocks[blockIndex].numReaders--;
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+vr::EBlockQueueError LocalBlockQueue::QueueHasReader(vr::PropertyContainerHandle_t ulQueueHandle, bool* pbHasReaders)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Queue* pQueue = GetQueue(ulQueueHandle, nullptr);
+	if (pQueue == nullptr)
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+	}
+
+	*pbHasReaders = pQueue->numConnections > 0;
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+uint32_t LocalBlockQueue::GetNumConnections()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	uint32_t numConnections = 0;
+	for (auto& entry : m_queues)
+	{
+		numConnections += entry.second.numConnections;
+	}
+	return numConnections;
+}
+
+
+bool LocalBlockQueue::GetHeader(vr::PropertyContainerHandle_t rootHandle, std::vector<uint8_t>** ppHeader, uint32_t** ppHeaderUsed)
+{
+	uint32_t queueId = (uint32_t)(rootHandle >> 32);
+
+	if (queueId == 0)
+	{
+		Queue* pQueue = GetQueue(rootHandle, nullptr);
+		if (pQueue == nullptr)
+		{
+			return false;
+		}
+		*ppHeader = &pQueue->header;
+		*ppHeaderUsed = &pQueue->headerUsed;
+		return true;
+	}
+
+	auto iter = m_queues.find(queueId);
+	uint32_t blockIndex = (uint32_t)(rootHandle & 0xFFFFFFFF) - 1;
+
+	if (iter == m_queues.end() || blockIndex >= iter->second.blocks.size())
+	{
+		return false;
+	}
+
+	Block& block = iter->second.blocks[blockIndex];
+	*ppHeader = &block.header;
+	*ppHeaderUsed = &block.headerUsed;
+	return true;
+}
+
+vr::ETrackedPropertyError LocalBlockQueue::ReadPathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathRead_t* pBatch, uint32_t unBatchEntryCount)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<uint8_t>* pHeader;
+	uint32_t* pHeaderUsed;
+	if (!GetHeader(ulRootHandle, &pHeader, &pHeaderUsed))
+	{
+		return vr::TrackedProp_InvalidContainer;
+	}
+
+	vr::ETrackedPropertyError result = vr::TrackedProp_Success;
+
+	for (uint32_t i = 0; i < unBatchEntryCount; i++)
+	{
+		vr::PathRead_t& read = pBatch[i];
+		read.eError = vr::TrackedProp_UnknownProperty;
+
+		for (uint32_t offset = 0; offset < *pHeaderUsed;)
+		{
+			LocalHeaderEntry entry;
+			memcpy(&entry, pHeader->data() + offset, sizeof(entry));
+
+			if (entry.path == read.ulPath)
+			{
+				read.unRequiredBufferSize = entry.size;
+
+				if (entry.tag != read.unTag)
+				{
+					read.eError = vr::TrackedProp_WrongDataType;
+				}
+				else if (entry.size > read.unBufferSize)
+				{
+					read.eError = vr::TrackedProp_BufferTooSmall;
+				}
+				else
+				{
+					memcpy(read.pvBuffer, pHeader->data() + offset + sizeof(entry), entry.size);
+					read.eError = vr::TrackedProp_Success;
+				}
+				break;
+			}
+
+			offset += GetEntrySize(entry.size);
+		}
+
+		if (read.eError != vr::TrackedProp_Success)
+		{
+			result = read.eError;
+		}
+	}
+
+	return result;
+}
+
+vr::ETrackedPropertyError LocalBlockQueue::WritePathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathWrite_t* pBatch, uint32_t unBatchEntryCount)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<uint8_t>* pHeader;
+	uint32_t* pHeaderUsed;
+	if (!GetHeader(ulRootHandle, &pHeader, &pHeaderUsed))
+	{
+		return vr::TrackedProp_InvalidContainer;
+	}
+
+	vr::ETrackedPropertyError result = vr::TrackedProp_Success;
+
+	for (uint32_t i = 0; i < unBatchEntryCount; i++)
+	{
+		vr::PathWrite_t& write = pBatch[i];
+		uint32_t entrySize = GetEntrySize(write.unBufferSize);
+
+		// Values are only appended, the header is reset when the block is next acquired for writing.
+		if (*pHeaderUsed + entrySize > pHeader->size())
+		{
+			write.eError = vr::TrackedProp_BufferTooSmall;
+			result = write.eError;
+			continue;
+		}
+
+		LocalHeaderEntry entry = { write.ulPath, write.unTag, write.unBufferSize };
+		memcpy(pHeader->data() + *pHeaderUsed, &entry, sizeof(entry));
+		memcpy(pHeader->data() + *pHeaderUsed + sizeof(entry), write.pvBuffer, write.unBufferSize);
+
+		*pHeaderUsed += entrySize;
+		write.eError = vr::TrackedProp_Success;
+	}
+
+	return result;
+}
+
+vr::ETrackedPropertyError LocalBlockQueue::StringToHandle(vr::PathHandle_t* pHandle, const char* pchPath)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto iter = m_pathHandles.find(pchPath);
+	if (iter == m_pathHandles.end())
+	{
+		iter = m_pathHandles.emplace(pchPath, (vr::PathHandle_t)m_pathHandles.size() + 1).first;
+	}
+
+	*pHandle = iter->second;
+	return vr::TrackedProp_Success;
+}
+
+vr::ETrackedPropertyError LocalBlockQueue::HandleToString(vr::PathHandle_t pHandle, const char* pchBuffer, uint32_t unBufferSize, uint32_t* punBufferSizeUsed)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& entry : m_pathHandles)
+	{
+		if (entry.second != pHandle)
+		{
+			continue;
+		}
+
+		uint32_t size = (uint32_t)entry.first.size() + 1;
+		if (punBufferSizeUsed != nullptr)
+		{
+			*punBufferSizeUsed = size;
+		}
+		if (size > unBufferSize)
+		{
+			return vr::TrackedProp_BufferTooSmall;
+		}
+
+		memcpy((char*)pchBuffer, entry.first.c_str(), size);
+		return vr::TrackedProp_Success;
+	}
+
+	return vr::TrackedProp_UnknownProperty;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "vr_blockqueue_client.h"
+
+
+// In-process stand-in for the runtime block queue and path interfaces, for stress testing the queue parameters without SteamVR.
+// Follows the observable behavior of the runtime queue: the writer gets the oldest block no reader holds, Latest and New read
+// the newest released block, and Next reads the oldest block newer than the last one the connection read.
+// Per-block path writes are packed into the block header, so a too small header fails the write like on the runtime,
+// though the entry layout is the stand-in's own.
+class LocalBlockQueue : public vr::IVRBlockQueue, public vr::IVRPaths
+{
+public:
+	// Connections past the limit fail with TooManyConnections. The runtime limit is not documented.
+	LocalBlockQueue(uint32_t maxConnections);
+
+	vr::EBlockQueueError Create(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath, uint32_t unBlockDataSize, uint32_t unBlockHeaderSize, uint32_t unBlockCount, uint32_t unFlags) override;
+	vr::EBlockQueueError Connect(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath) override;
+	vr::EBlockQueueError Destroy(vr::PropertyContainerHandle_t ulQueueHandle) override;
+	vr::EBlockQueueError AcquireWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer) override;
+	vr::EBlockQueueError ReleaseWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle) override;
+	vr::EBlockQueueError WaitAndAcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType, uint32_t unTimeoutMs) override;
+	vr::EBlockQueueError AcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType) override;
+	vr::EBlockQueueError ReleaseReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle) override;
+	vr::EBlockQueueError QueueHasReader(vr::PropertyContainerHandle_t ulQueueHandle, bool* pbHasReaders) override;
+
+	// Paths can be written to the queue handle for static values, or to a write block handle for per-block values.
+	vr::ETrackedPropertyError ReadPathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathRead_t* pBatch, uint32_t unBatchEntryCount) override;
+	vr::ETrackedPropertyError WritePathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathWrite_t* pBatch, uint32_t unBatchEntryCount) override;
+	vr::ETrackedPropertyError StringToHandle(vr::PathHandle_t* pHandle, const char* pchPath) override;
+	vr::ETrackedPropertyError HandleToString(vr::PathHandle_t pHandle, const char* pchBuffer, uint32_t unBufferSize, uint32_t* punBufferSizeUsed) override;
+
+	uint32_t GetNumConnections();
+
+protected:
+	struct Block
+	{
+		std::vector<uint8_t> data;
+		std::vector<uint8_t> header;
+		uint32_t headerUsed = 0;
+
+		// Zero until first released by the writer.
+		uint64_t sequence = 0;
+		uint32_t numReaders = 0;
+		bool bWriting = false;
+	};
+
+	struct Queue
+	{
+		std::string path;
+		std::vector<Block> blocks;
+		uint64_t lastSequence = 0;
+		uint32_t numConnections = 0;
+
+		// Static paths written on the queue handle.
+		std::vector<uint8_t> header;
+		uint32_t headerUsed = 0;
+	};
+
+	struct Connection
+	{
+		uint32_t queueId;
+		uint64_t lastReadSequence = 0;
+		bool bOwner = false;
+	};
+
+	Queue* GetQueue(vr::PropertyContainerHandle_t handle, Connection** ppConnection);
+	int32_t FindReadBlock(const Queue& queue, const Connection& connection, vr::EBlockQueueReadType readType) const;
+
+	// Block handles carry the queue and block index, so the path functions can find the header.
+	static vr::PropertyContainerHandle_t MakeBlockHandle(uint32_t queueId, uint32_t blockIndex) { return ((uint64_t)queueId << 32) | (blockIndex + 1); }
+	bool GetHeader(vr::PropertyContainerHandle_t rootHandle, std::vector<uint8_t>** ppHeader, uint32_t** ppHeaderUsed);
+
+	std::mutex m_mutex;
+	std::condition_variable m_releaseCondition;
+
+	uint32_t m_maxConnections;
+	std::map<uint32_t, Queue> m_queues;
+	std::map<vr::PropertyContainerHandle_t, Connection> m_connections;
+	uint32_t m_nextQueueId = 1;
+	vr::PropertyContainerHandle_t m_nextConnectionHandle = 1;
+
+	std::map<std::string, vr::PathHandle_t> m_pathHandles;
+};
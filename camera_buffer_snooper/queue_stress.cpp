@@ -0,0 +1,862 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <memory>
+
+#include "vr_blockqueue_client.h"
+#include "local_block_queue.h"
+#include "queue_stress.h"
+
+
+#define STRESS_QUEUE_PATH "/lighthouse/camera/raw_frames"
+
+// Timeout of each reader wait, so the readers notice the end of the round.
+#define STRESS_READ_TIMEOUT_MS 100
+
+#define STRESS_METRICS_BUFFER_SIZE 65536
+
+
+struct StressReaderConfig
+{
+	vr::EBlockQueueReadType readType = vr::EBlockQueueReadType_BlockQueueRead_Next;
+
+	// Time the block is held after it is acquired, as by a reader copying or processing in place.
+	uint32_t holdMs = 0;
+
+	// Busy time after the block is released, as by a reader processing its own copy.
+	uint32_t workMs = 0;
+};
+
+struct StressReaderStats
+{
+	vr::EBlockQueueError connectError = vr::EBlockQueueError_BlockQueueError_None;
+	uint64_t frames = 0;
+
+	// Frames delivered while the reader was busy, judged from the frame times and the delivery interval.
+	uint64_t missed = 0;
+
+	// The same block read again, possible with Latest.
+	uint64_t repeats = 0;
+
+	uint64_t timeouts = 0;
+	uint64_t errors = 0;
+	double waitTotalMs = 0.0;
+	double waitMaxMs = 0.0;
+	double ageTotalMs = 0.0;
+	double ageMaxMs = 0.0;
+};
+
+struct StressProducerStats
+{
+	bool bValid = false;
+	uint64_t frames = 0;
+
+	// Frames not served because no block was free within a frame interval. Only measured by the local producer.
+	uint64_t dropped = 0;
+	uint64_t headerErrors = 0;
+
+	double acquireMeanMs = 0.0;
+	double acquireP99Ms = 0.0;
+	double acquireMaxMs = 0.0;
+	double holdMeanMs = 0.0;
+	double holdMaxMs = 0.0;
+};
+
+struct StressOptions
+{
+	uint32_t numReaders = 4;
+	std::vector<StressReaderConfig> readers;
+	double durationS = 10.0;
+	bool bSweep = false;
+	bool bProcesses = false;
+	bool bLocal = false;
+
+	// Local queue creation parameters, the driver defaults to 4 blocks with 512 byte headers.
+	uint32_t blockCount = 4;
+	uint32_t headerSize = 512;
+	uint32_t frameWidth = 2048;
+	uint32_t frameHeight = 1024;
+	double frameRate = 60.0;
+	uint32_t maxConnections = 16;
+};
+
+
+static double GetTicksToMs()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return 1000.0 / (double)frequency.QuadPart;
+}
+
+static int64_t GetTicks()
+{
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+	return currTime.QuadPart;
+}
+
+static void BusyWait(uint32_t ms)
+{
+	if (ms == 0) { return; }
+
+	int64_t endTicks = GetTicks() + (int64_t)(ms / GetTicksToMs());
+	while (GetTicks() < endTicks)
+	{
+		YieldProcessor();
+	}
+}
+
+static const char* GetReadTypeName(vr::EBlockQueueReadType readType)
+{
+	switch (readType)
+	{
+	case vr::EBlockQueueReadType_BlockQueueRead_Latest: return "latest";
+	case vr::EBlockQueueReadType_BlockQueueRead_New: return "new";
+	default: return "next";
+	}
+}
+
+static bool ParseReadType(const std::string& name, vr::EBlockQueueReadType& outReadType)
+{
+	if (name == "latest") { outReadType = vr::EBlockQueueReadType_BlockQueueRead_Latest; }
+	else if (name == "new") { outReadType = vr::EBlockQueueReadType_BlockQueueRead_New; }
+	else if (name == "next") { outReadType = vr::EBlockQueueReadType_BlockQueueRead_Next; }
+	else { return false; }
+
+	return true;
+}
+
+static std::vector<std::string> SplitList(const char* text)
+{
+	std::vector<std::string> entries;
+	std::stringstream stream(text);
+	std::string entry;
+	while (std::getline(stream, entry, ','))
+	{
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+
+// The snooper's reader loop without the printing, timing how long each block takes to arrive and how old it is.
+static void RunReader(vr::IVRBlockQueue* pQueue, vr::IVRPaths* pPaths, vr::PropertyContainerHandle_t queueHandle, const StressReaderConfig& config, const std::atomic<bool>& bRun, StressReaderStats& stats)
+{
+	const double ticksToMs = GetTicksToMs();
+
+	vr::PathHandle_t serverTimeTicksHandle;
+	pPaths->StringToHandle(&serverTimeTicksHandle, "/server_time_ticks");
+
+	vr::PathHandle_t deliveryRateHandle;
+	pPaths->StringToHandle(&deliveryRateHandle, "/delivery_rate");
+
+	uint64_t lastServerTimeTicks = 0;
+
+	while (bRun)
+	{
+		vr::PropertyContainerHandle_t readHandle;
+		uint8_t* pBuffer;
+
+		int64_t waitStart = GetTicks();
+		vr::EBlockQueueError queueError = pQueue->WaitAndAcquireReadOnlyBlock(queueHandle, &readHandle, (void**)&pBuffer, config.readType, STRESS_READ_TIMEOUT_MS);
+		int64_t acquireTime = GetTicks();
+
+		if (queueError == vr::EBlockQueueError_BlockQueueError_BlockNotAvailable)
+		{
+			stats.timeouts++;
+			continue;
+		}
+		else if (queueError != vr::EBlockQueueError_BlockQueueError_None)
+		{
+			stats.errors++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+
+		uint64_t serverTimeTicks = 0;
+		double deliveryRate = 0.0;
+
+		vr::PathRead_t read[2] = {};
+		read[0].ulPath = serverTimeTicksHandle;
+		read[0].pvBuffer = &serverTimeTicks;
+		read[0].unBufferSize = sizeof(serverTimeTicks);
+		read[0].unTag = vr::k_unUint64PropertyTag;
+
+		read[1].ulPath = deliveryRateHandle;
+		read[1].pvBuffer = &deliveryRate;
+		read[1].unBufferSize = sizeof(deliveryRate);
+		read[1].unTag = vr::k_unDoublePropertyTag;
+
+		if (pPaths->ReadPathBatch(readHandle, read, 2) != vr::TrackedProp_Success)
+		{
+			stats.errors++;
+		}
+
+		if (serverTimeTicks == lastServerTimeTicks)
+		{
+			stats.repeats++;
+		}
+		else
+		{
+			// The delivery rate is the interval to the previous frame, so the gap in intervals gives the frames in between.
+			if (lastServerTimeTicks != 0 && deliveryRate > 0.0)
+			{
+				double gapMs = (int64_t)(serverTimeTicks - lastServerTimeTicks) * ticksToMs;
+				int64_t intervals = llround(gapMs / (deliveryRate * 1000.0));
+				stats.missed += (intervals > 1) ? intervals - 1 : 0;
+			}
+
+			double waitMs = (acquireTime - waitStart) * ticksToMs;
+			double ageMs = (acquireTime - (int64_t)serverTimeTicks) * ticksToMs;
+
+			stats.frames++;
+			stats.waitTotalMs += waitMs;
+			stats.waitMaxMs = (std::max)(stats.waitMaxMs, waitMs);
+			stats.ageTotalMs += ageMs;
+			stats.ageMaxMs = (std::max)(stats.ageMaxMs, ageMs);
+
+			lastServerTimeTicks = serverTimeTicks;
+		}
+
+		if (config.holdMs > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(config.holdMs));
+		}
+
+		if (pQueue->ReleaseReadOnlyBlock(queueHandle, readHandle) != vr::EBlockQueueError_BlockQueueError_None)
+		{
+			stats.errors++;
+		}
+
+		BusyWait(config.workMs);
+	}
+}
+
+
+// Stands in for the driver's ServeFrames, writing the same per-frame paths at a fixed rate.
+// Waits up to a frame interval for a free block, where the driver would drop the frame right away, to measure how long the readers keep it waiting.
+static void RunLocalProducer(LocalBlockQueue& queue, vr::PropertyContainerHandle_t queueHandle, const StressOptions& options, const std::atomic<bool>& bRun, StressProducerStats& stats)
+{
+	const double ticksToMs = GetTicksToMs();
+	const int64_t frameIntervalTicks = (int64_t)(1000.0 / options.frameRate / ticksToMs);
+	const size_t frameSize = (size_t)options.frameWidth * options.frameHeight * 4;
+
+	std::vector<uint8_t> frame(frameSize, 0x80);
+	std::vector<double> acquireMs;
+
+	vr::PathHandle_t handles[7];
+	const char* paths[7] = { "/frame_size", "/frame_sequence", "/frame_time_monotonic", "/server_time_ticks", "/delivery_rate", "/elapsed_time", "/readout_time" };
+	for (uint32_t i = 0; i < 7; i++)
+	{
+		queue.StringToHandle(&handles[i], paths[i]);
+	}
+
+	int64_t startTicks = GetTicks();
+	int64_t nextDeadline = startTicks + frameIntervalTicks;
+	int64_t lastFrameTicks = 0;
+	uint64_t frameSequence = 0;
+	double holdTotalMs = 0.0;
+
+	while (bRun)
+	{
+		int64_t currTicks = GetTicks();
+		if (currTicks < nextDeadline)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds((int64_t)((nextDeadline - currTicks) * ticksToMs * 1000.0)));
+			continue;
+		}
+		nextDeadline += frameIntervalTicks;
+
+		vr::PropertyContainerHandle_t writeHandle;
+		uint8_t* pBuffer = nullptr;
+		vr::EBlockQueueError error;
+
+		int64_t acquireStart = GetTicks();
+		while ((error = queue.AcquireWriteOnlyBlock(queueHandle, &writeHandle, (void**)&pBuffer)) == vr::EBlockQueueError_BlockQueueError_BlockNotAvailable)
+		{
+			if (GetTicks() - acquireStart > frameIntervalTicks || !bRun) { break; }
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		int64_t acquireTime = GetTicks();
+
+		if (error != vr::EBlockQueueError_BlockQueueError_None)
+		{
+			stats.dropped++;
+			continue;
+		}
+
+		acquireMs.push_back((acquireTime - acquireStart) * ticksToMs);
+
+		memcpy(pBuffer, frame.data(), frameSize);
+
+		int32_t frameSizeValue = (int32_t)frameSize;
+		frameSequence = (frameSequence + 1) % 16;
+		double frameTimeMonotonic = acquireTime * ticksToMs / 1000.0;
+		uint64_t serverTimeTicks = (uint64_t)acquireTime;
+		double deliveryRate = (lastFrameTicks != 0) ? (acquireTime - lastFrameTicks) * ticksToMs / 1000.0 : 1.0 / options.frameRate;
+		double elapsedTime = (acquireTime - startTicks) * ticksToMs / 1000.0;
+		double readoutTime = 0.0;
+		lastFrameTicks = acquireTime;
+
+		void* values[7] = { &frameSizeValue, &frameSequence, &frameTimeMonotonic, &serverTimeTicks, &deliveryRate, &elapsedTime, &readoutTime };
+		uint32_t sizes[7] = { sizeof(int32_t), sizeof(uint64_t), sizeof(double), sizeof(uint64_t), sizeof(double), sizeof(double), sizeof(double) };
+		vr::PropertyTypeTag_t tags[7] = { vr::k_unInt32PropertyTag, vr::k_unUint64PropertyTag, vr::k_unDoublePropertyTag, vr::k_unUint64PropertyTag, vr::k_unDoublePropertyTag, vr::k_unDoublePropertyTag, vr::k_unDoublePropertyTag };
+
+		vr::PathWrite_t write[7] = {};
+		for (uint32_t i = 0; i < 7; i++)
+		{
+			write[i].writeType = vr::PropertyWrite_Set;
+			write[i].ulPath = handles[i];
+			write[i].pvBuffer = values[i];
+			write[i].unBufferSize = sizes[i];
+			write[i].unTag = tags[i];
+		}
+
+		if (queue.WritePathBatch(writeHandle, write, 7) != vr::TrackedProp_Success)
+		{
+			stats.headerErrors++;
+		}
+
+		queue.ReleaseWriteOnlyBlock(queueHandle, writeHandle);
+
+		double holdMs = (GetTicks() - acquireTime) * ticksToMs;
+		holdTotalMs += holdMs;
+		stats.holdMaxMs = (std::max)(stats.holdMaxMs, holdMs);
+		stats.frames++;
+	}
+
+	if (!acquireMs.empty())
+	{
+		std::sort(acquireMs.begin(), acquireMs.end());
+
+		double total = 0.0;
+		for (double ms : acquireMs) { total += ms; }
+
+		stats.acquireMeanMs = total / acquireMs.size();
+		stats.acquireP99Ms = acquireMs[(acquireMs.size() - 1) * 99 / 100];
+		stats.acquireMaxMs = acquireMs.back();
+		stats.holdMeanMs = holdTotalMs / acquireMs.size();
+	}
+	stats.bValid = true;
+}
+
+
+// Finds a number field of a metric in the driver's metrics debug response.
+static double GetMetricValue(const std::string& json, const char* metric, const char* field)
+{
+	size_t metricStart = json.find(std::string("\"") + metric + "\":{");
+	if (metricStart == std::string::npos) { return 0.0; }
+
+	size_t metricEnd = json.find('}', metricStart);
+	size_t fieldStart = json.find(std::string("\"") + field + "\":", metricStart);
+	if (fieldStart == std::string::npos || fieldStart > metricEnd) { return 0.0; }
+
+	return atof(json.c_str() + fieldStart + strlen(field) + 3);
+}
+
+// The driver is the producer with SteamVR, its serving metrics give the block acquire and hold times.
+static bool RequestDriverMetrics(const char* request, std::string& outResponse)
+{
+	std::vector<char> response(STRESS_METRICS_BUFFER_SIZE);
+	uint32_t size = vr::VRSystem()->DriverDebugRequest(vr::k_unTrackedDeviceIndex_Hmd, request, response.data(), (uint32_t)response.size());
+	if (size == 0)
+	{
+		return false;
+	}
+
+	outResponse = response.data();
+	return outResponse.find("\"error\"") == std::string::npos;
+}
+
+static void GetDriverProducerStats(StressProducerStats& stats)
+{
+	std::string json;
+	if (!RequestDriverMetrics("metrics", json))
+	{
+		return;
+	}
+
+	stats.frames = (uint64_t)GetMetricValue(json, "ServeFrames::Acquire", "count");
+	stats.acquireMeanMs = GetMetricValue(json, "ServeFrames::Acquire", "mean_us") / 1000.0;
+	stats.acquireP99Ms = GetMetricValue(json, "ServeFrames::Acquire", "p99_us") / 1000.0;
+	stats.acquireMaxMs = GetMetricValue(json, "ServeFrames::Acquire", "max_us") / 1000.0;
+	stats.holdMeanMs = GetMetricValue(json, "ServeFrames::BlockHold", "mean_us") / 1000.0;
+	stats.holdMaxMs = GetMetricValue(json, "ServeFrames::BlockHold", "max_us") / 1000.0;
+	stats.bValid = true;
+}
+
+
+static std::string GetReaderArguments(const StressReaderConfig& config, double durationS)
+{
+	std::stringstream arguments;
+	arguments << "stress-reader --read " << GetReadTypeName(config.readType) << " --hold " << config.holdMs << " --work " << config.workMs << " --duration " << durationS;
+	return arguments.str();
+}
+
+// Starts the snooper again as a reader process, with its stdout going to a pipe.
+static bool StartReaderProcess(const StressReaderConfig& config, double durationS, PROCESS_INFORMATION& outProcess, HANDLE& outOutput)
+{
+	char exePath[MAX_PATH] = {};
+	GetModuleFileNameA(nullptr, exePath, MAX_PATH);
+
+	std::string commandLine = std::string("\"") + exePath + "\" " + GetReaderArguments(config, durationS);
+
+	SECURITY_ATTRIBUTES security = {};
+	security.nLength = sizeof(security);
+	security.bInheritHandle = TRUE;
+
+	HANDLE readPipe, writePipe;
+	if (!CreatePipe(&readPipe, &writePipe, &security, 0))
+	{
+		return false;
+	}
+	SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOA startupInfo = {};
+	startupInfo.cb = sizeof(startupInfo);
+	startupInfo.dwFlags = STARTF_USESTDHANDLES;
+	startupInfo.hStdOutput = writePipe;
+	startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+	startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+
+	BOOL bStarted = CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startupInfo, &outProcess);
+	CloseHandle(writePipe);
+
+	if (!bStarted)
+	{
+		CloseHandle(readPipe);
+		return false;
+	}
+
+	outOutput = readPipe;
+	return true;
+}
+
+static bool ParseReaderResult(const std::string& output, StressReaderStats& outStats)
+{
+	size_t start = output.find("stress_result ");
+	if (start == std::string::npos)
+	{
+		return false;
+	}
+
+	int connectError = 0;
+	unsigned long long frames = 0, missed = 0, repeats = 0, timeouts = 0, errors = 0;
+
+	int numFields = sscanf(output.c_str() + start, "stress_result connect=%d frames=%llu missed=%llu repeats=%llu timeouts=%llu errors=%llu wait_total=%lf wait_max=%lf age_total=%lf age_max=%lf",
+		&connectError, &frames, &missed, &repeats, &timeouts, &errors, &outStats.waitTotalMs, &outStats.waitMaxMs, &outStats.ageTotalMs, &outStats.ageMaxMs);
+
+	outStats.connectError = (vr::EBlockQueueError)connectError;
+	outStats.frames = frames;
+	outStats.missed = missed;
+	outStats.repeats = repeats;
+	outStats.timeouts = timeouts;
+	outStats.errors = errors;
+
+	return numFields == 10;
+}
+
+static void PrintReaderResult(const StressReaderStats& stats)
+{
+	std::cout << "stress_result connect=" << (int)stats.connectError << " frames=" << stats.frames << " missed=" << stats.missed << " repeats=" << stats.repeats
+		<< " timeouts=" << stats.timeouts << " errors=" << stats.errors << " wait_total=" << stats.waitTotalMs << " wait_max=" << stats.waitMaxMs
+		<< " age_total=" << stats.ageTotalMs << " age_max=" << stats.ageMaxMs << std::endl;
+}
+
+
+struct StressRoundResult
+{
+	uint32_t numReaders = 0;
+	uint32_t numConnected = 0;
+
+	// One-based index of the first reader refused with TooManyConnections, zero if none were.
+	uint32_t firstRefused = 0;
+
+	std::vector<StressReaderStats> readers;
+	StressProducerStats producer;
+};
+
+static void RunRound(const StressOptions& options, uint32_t numReaders, LocalBlockQueue* pLocalQueue, StressRoundResult& result)
+{
+	vr::IVRBlockQueue* pQueue = pLocalQueue ? (vr::IVRBlockQueue*)pLocalQueue : vr::VRBlockQueue();
+	vr::IVRPaths* pPaths = pLocalQueue ? (vr::IVRPaths*)pLocalQueue : vr::VRPaths();
+
+	result.numReaders = numReaders;
+	result.readers.resize(numReaders);
+
+	std::atomic<bool> bRun(true);
+	std::thread producerThread;
+	vr::PropertyContainerHandle_t ownerHandle = 0;
+
+	if (pLocalQueue)
+	{
+		vr::EBlockQueueError error = pLocalQueue->Create(&ownerHandle, STRESS_QUEUE_PATH, options.frameWidth * options.frameHeight * 4, options.headerSize, options.blockCount, 0);
+		if (error != vr::EBlockQueueError_BlockQueueError_None)
+		{
+			std::cerr << "Error creating local block queue: " << (int)error << std::endl;
+			return;
+		}
+		producerThread = std::thread(RunLocalProducer, std::ref(*pLocalQueue), ownerHandle, std::cref(options), std::cref(bRun), std::ref(result.producer));
+	}
+	else
+	{
+		std::string response;
+		if (!RequestDriverMetrics("metrics_reset", response))
+		{
+			std::cerr << "The driver did not respond to the metrics debug requests, producer times are not available" << std::endl;
+		}
+	}
+
+	if (options.bProcesses)
+	{
+		std::vector<PROCESS_INFORMATION> processes(numReaders);
+		std::vector<HANDLE> outputs(numReaders, nullptr);
+
+		for (uint32_t i = 0; i < numReaders; i++)
+		{
+			if (!StartReaderProcess(options.readers[i % options.readers.size()], options.durationS, processes[i], outputs[i]))
+			{
+				std::cerr << "Failed to start reader process " << i << ": " << GetLastError() << std::endl;
+				result.readers[i].connectError = vr::EBlockQueueError_BlockQueueError_InternalError;
+			}
+		}
+
+		for (uint32_t i = 0; i < numReaders; i++)
+		{
+			if (outputs[i] == nullptr) { continue; }
+
+			// Reading until the pipe closes also waits for the process to exit.
+			std::string output;
+			char buffer[256];
+			DWORD bytesRead;
+			while (ReadFile(outputs[i], buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0)
+			{
+				output.append(buffer, bytesRead);
+			}
+
+			WaitForSingleObject(processes[i].hProcess, INFINITE);
+			CloseHandle(processes[i].hProcess);
+			CloseHandle(processes[i].hThread);
+			CloseHandle(outputs[i]);
+
+			if (!ParseReaderResult(output, result.readers[i]))
+			{
+				std::cerr << "Reader process " << i << " did not report results" << std::endl;
+				result.readers[i].connectError = vr::EBlockQueueError_BlockQueueError_InternalError;
+			}
+		}
+	}
+	else
+	{
+		// Connected one by one up front, so the connection limit shows up at a fixed reader count.
+		std::vector<vr::PropertyContainerHandle_t> handles(numReaders, 0);
+		for (uint32_t i = 0; i < numReaders; i++)
+		{
+			result.readers[i].connectError = pQueue->Connect(&handles[i], STRESS_QUEUE_PATH);
+		}
+
+		std::vector<std::thread> threads;
+		for (uint32_t i = 0; i < numReaders; i++)
+		{
+			if (result.readers[i].connectError != vr::EBlockQueueError_BlockQueueError_None) { continue; }
+
+			threads.emplace_back(RunReader, pQueue, pPaths, handles[i], std::cref(options.readers[i % options.readers.size()]), std::cref(bRun), std::ref(result.readers[i]));
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(options.durationS * 1000.0)));
+		bRun = false;
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		for (uint32_t i = 0; i < numReaders; i++)
+		{
+			if (handles[i] != 0)
+			{
+				pQueue->Destroy(handles[i]);
+			}
+		}
+	}
+
+	bRun = false;
+
+	if (pLocalQueue)
+	{
+		producerThread.join();
+		pLocalQueue->Destroy(ownerHandle);
+	}
+	else
+	{
+		GetDriverProducerStats(result.producer);
+	}
+
+	for (uint32_t i = 0; i < numReaders; i++)
+	{
+		vr::EBlockQueueError error = result.readers[i].connectError;
+		if (error == vr::EBlockQueueError_BlockQueueError_None)
+		{
+			result.numConnected++;
+		}
+		else if (error == vr::EBlockQueueError_BlockQueueError_TooManyConnections && result.firstRefused == 0)
+		{
+			result.firstRefused = i + 1;
+		}
+	}
+}
+
+static void PrintRound(const StressOptions& options, const StressRoundResult& result)
+{
+	std::cout << "\n" << result.numReaders << " readers, " << result.numConnected << " connected";
+	if (result.firstRefused > 0)
+	{
+		std::cout << ", TooManyConnections from reader " << result.firstRefused;
+	}
+	std::cout << "\n\n";
+
+	std::cout << std::left << std::setw(8) << "Reader" << std::setw(8) << "Read" << std::right << std::setw(8) << "Hold ms" << std::setw(8) << "Work ms"
+		<< std::setw(9) << "Frames" << std::setw(9) << "Missed" << std::setw(8) << "Miss %" << std::setw(9) << "Repeats" << std::setw(10) << "Timeouts"
+		<< std::setw(12) << "Wait ms" << std::setw(12) << "Wait max" << std::setw(12) << "Age ms" << std::setw(12) << "Age max" << "\n";
+
+	std::cout << std::fixed << std::setprecision(2);
+
+	for (uint32_t i = 0; i < result.numReaders; i++)
+	{
+		const StressReaderConfig& config = options.readers[i % options.readers.size()];
+		const StressReaderStats& stats = result.readers[i];
+
+		std::cout << std::left << std::setw(8) << i << std::setw(8) << GetReadTypeName(config.readType) << std::right << std::setw(8) << config.holdMs << std::setw(8) << config.workMs;
+
+		if (stats.connectError != vr::EBlockQueueError_BlockQueueError_None)
+		{
+			std::cout << "    connect error " << (int)stats.connectError << "\n";
+			continue;
+		}
+
+		uint64_t expected = stats.frames + stats.missed;
+		std::cout << std::setw(9) << stats.frames << std::setw(9) << stats.missed << std::setw(8) << (expected > 0 ? 100.0 * stats.missed / expected : 0.0)
+			<< std::setw(9) << stats.repeats << std::setw(10) << stats.timeouts
+			<< std::setw(12) << (stats.frames > 0 ? stats.waitTotalMs / stats.frames : 0.0) << std::setw(12) << stats.waitMaxMs
+			<< std::setw(12) << (stats.frames > 0 ? stats.ageTotalMs / stats.frames : 0.0) << std::setw(12) << stats.ageMaxMs
+			<< (stats.errors > 0 ? "  errors " + std::to_string(stats.errors) : "") << "\n";
+	}
+
+	const StressProducerStats& producer = result.producer;
+	if (producer.bValid)
+	{
+		std::cout << "\nProducer: " << producer.frames << " frames, acquire mean " << producer.acquireMeanMs << " ms, p99 " << producer.acquireP99Ms
+			<< " ms, max " << producer.acquireMaxMs << " ms, block hold mean " << producer.holdMeanMs << " ms, max " << producer.holdMaxMs << " ms";
+		if (options.bLocal)
+		{
+			std::cout << ", " << producer.dropped << " dropped, " << producer.headerErrors << " header write errors";
+		}
+		std::cout << "\n";
+	}
+}
+
+// One line per round, to compare how the producer and readers hold up as readers are added.
+static void PrintSweep(const std::vector<StressRoundResult>& results)
+{
+	std::cout << "\nSweep summary\n\n" << std::right << std::setw(8) << "Readers" << std::setw(11) << "Connected" << std::setw(10) << "Miss %"
+		<< std::setw(14) << "Acquire ms" << std::setw(12) << "p99 ms" << std::setw(12) << "Max ms" << std::setw(10) << "Dropped" << "\n";
+
+	for (const StressRoundResult& result : results)
+	{
+		uint64_t frames = 0, missed = 0;
+		for (const StressReaderStats& stats : result.readers)
+		{
+			frames += stats.frames;
+			missed += stats.missed;
+		}
+
+		std::cout << std::setw(8) << result.numReaders << std::setw(11) << result.numConnected << std::setw(10) << (frames + missed > 0 ? 100.0 * missed / (frames + missed) : 0.0)
+			<< std::setw(14) << result.producer.acquireMeanMs << std::setw(12) << result.producer.acquireP99Ms << std::setw(12) << result.producer.acquireMaxMs
+			<< std::setw(10) << result.producer.dropped << "\n";
+	}
+}
+
+
+static bool ParseReaderConfigs(const std::vector<std::string>& readTypes, const std::vector<std::string>& holdMs, const std::vector<std::string>& workMs, std::vector<StressReaderConfig>& outConfigs)
+{
+	size_t numConfigs = (std::max)({ readTypes.size(), holdMs.size(), workMs.size(), (size_t)1 });
+	outConfigs.resize(numConfigs);
+
+	// Shorter lists repeat, so a single value applies to every reader.
+	for (size_t i = 0; i < numConfigs; i++)
+	{
+		if (!readTypes.empty() && !ParseReadType(readTypes[i % readTypes.size()], outConfigs[i].readType)) { return false; }
+		if (!holdMs.empty()) { outConfigs[i].holdMs = atoi(holdMs[i % holdMs.size()].c_str()); }
+		if (!workMs.empty()) { outConfigs[i].workMs = atoi(workMs[i % workMs.size()].c_str()); }
+	}
+
+	return true;
+}
+
+static void PrintStressUsage()
+{
+	std::cout << "Usage: camera_buffer_snooper stress [options]\n\n"
+		<< "  --readers <n>             Number of readers (default 4)\n"
+		<< "  --read <type,...>         latest, new or next, assigned to the readers in turn (default next)\n"
+		<< "  --hold <ms,...>           Time each reader holds a block before releasing it (default 0)\n"
+		<< "  --work <ms,...>           Busy time per frame after releasing the block (default 0)\n"
+		<< "  --duration <s>            Length of each round (default 10)\n"
+		<< "  --sweep                   Runs a round for each reader count from 1 to n\n"
+		<< "  --processes               Runs each reader in its own process instead of a thread, SteamVR only\n"
+		<< "  --local                   Uses an in-process queue and producer instead of SteamVR\n"
+		<< "  --blocks <n>              Local queue block count (default 4)\n"
+		<< "  --header-size <bytes>     Local queue block header size (default 512)\n"
+		<< "  --frame <WxH>             Local frame size in RGBX pixels (default 2048x1024)\n"
+		<< "  --fps <rate>              Local producer frame rate (default 60)\n"
+		<< "  --max-connections <n>     Local queue connection limit (default 16)\n";
+}
+
+int RunQueueStress(int argc, char* argv[])
+{
+	StressOptions options;
+	std::vector<std::string> readTypes, holdMs, workMs;
+
+	for (int i = 0; i < argc; i++)
+	{
+		bool bHasValue = i + 1 < argc;
+		bool bValid = true;
+
+		if (strcmp(argv[i], "--readers") == 0 && bHasValue) { options.numReaders = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--read") == 0 && bHasValue) { readTypes = SplitList(argv[++i]); }
+		else if (strcmp(argv[i], "--hold") == 0 && bHasValue) { holdMs = SplitList(argv[++i]); }
+		else if (strcmp(argv[i], "--work") == 0 && bHasValue) { workMs = SplitList(argv[++i]); }
+		else if (strcmp(argv[i], "--duration") == 0 && bHasValue) { options.durationS = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--sweep") == 0) { options.bSweep = true; }
+		else if (strcmp(argv[i], "--processes") == 0) { options.bProcesses = true; }
+		else if (strcmp(argv[i], "--local") == 0) { options.bLocal = true; }
+		else if (strcmp(argv[i], "--blocks") == 0 && bHasValue) { options.blockCount = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--header-size") == 0 && bHasValue) { options.headerSize = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--frame") == 0 && bHasValue) { bValid = sscanf(argv[++i], "%ux%u", &options.frameWidth, &options.frameHeight) == 2; }
+		else if (strcmp(argv[i], "--fps") == 0 && bHasValue) { options.frameRate = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--max-connections") == 0 && bHasValue) { options.maxConnections = atoi(argv[++i]); }
+		else { bValid = false; }
+
+		if (!bValid)
+		{
+			PrintStressUsage();
+			return 1;
+		}
+	}
+
+	if (!ParseReaderConfigs(readTypes, holdMs, workMs, options.readers) || options.numReaders < 1 || options.durationS <= 0.0
+		|| options.blockCount < 1 || options.frameWidth == 0 || options.frameHeight == 0 || options.frameRate <= 0.0 || (options.bLocal && options.bProcesses))
+	{
+		PrintStressUsage();
+		return 1;
+	}
+
+	vr::IVRSystem* vrSystem = nullptr;
+	std::unique_ptr<LocalBlockQueue> localQueue;
+
+	if (options.bLocal)
+	{
+		localQueue.reset(new LocalBlockQueue(options.maxConnections));
+
+		std::cout << "Local queue: " << options.blockCount << " blocks, " << options.headerSize << " byte headers, " << options.frameWidth << "x" << options.frameHeight
+			<< " frames at " << options.frameRate << " fps, " << options.maxConnections << " connections max\n";
+	}
+	else
+	{
+		vr::EVRInitError initError;
+		vrSystem = vr::VR_Init(&initError, vr::VRApplication_Background);
+
+		if (initError != vr::VRInitError_None)
+		{
+			std::cerr << "VR_Init failed " << vr::VR_GetVRInitErrorAsSymbol(initError) << std::endl;
+			return 1;
+		}
+		std::cout << "Connected to SteamVR, readers use " << (options.bProcesses ? "processes" : "threads") << "\n";
+	}
+
+	std::vector<StressRoundResult> results;
+
+	for (uint32_t numReaders = options.bSweep ? 1 : options.numReaders; numReaders <= options.numReaders; numReaders++)
+	{
+		results.emplace_back();
+		RunRound(options, numReaders, localQueue.get(), results.back());
+		PrintRound(options, results.back());
+	}
+
+	if (options.bSweep)
+	{
+		PrintSweep(results);
+	}
+
+	if (vrSystem != nullptr)
+	{
+		vr::VR_Shutdown();
+	}
+
+	return 0;
+}
+
+int RunQueueStressReader(int argc, char* argv[])
+{
+	std::vector<std::string> readTypes, holdMs, workMs;
+	double durationS = 10.0;
+
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--read") == 0) { readTypes = SplitList(argv[i + 1]); }
+		else if (strcmp(argv[i], "--hold") == 0) { holdMs = SplitList(argv[i + 1]); }
+		else if (strcmp(argv[i], "--work") == 0) { workMs = SplitList(argv[i + 1]); }
+		else if (strcmp(argv[i], "--duration") == 0) { durationS = atof(argv[i + 1]); }
+	}
+
+	std::vector<StressReaderConfig> configs;
+	StressReaderStats stats;
+
+	if (!ParseReaderConfigs(readTypes, holdMs, workMs, configs))
+	{
+		stats.connectError = vr::EBlockQueueError_BlockQueueError_InvalidParam;
+		PrintReaderResult(stats);
+		return 1;
+	}
+
+	vr::EVRInitError initError;
+	vr::VR_Init(&initError, vr::VRApplication_Background);
+
+	if (initError != vr::VRInitError_None)
+	{
+		std::cerr << "VR_Init failed " << vr::VR_GetVRInitErrorAsSymbol(initError) << std::endl;
+		stats.connectError = vr::EBlockQueueError_BlockQueueError_InternalError;
+		PrintReaderResult(stats);
+		return 1;
+	}
+
+	vr::PropertyContainerHandle_t queueHandle = 0;
+	stats.connectError = vr::VRBlockQueue()->Connect(&queueHandle, STRESS_QUEUE_PATH);
+
+	if (stats.connectError == vr::EBlockQueueError_BlockQueueError_None)
+	{
+		std::atomic<bool> bRun(true);
+		std::thread readerThread(RunReader, vr::VRBlockQueue(), vr::VRPaths(), queueHandle, std::cref(configs[0]), std::cref(bRun), std::ref(stats));
+
+		std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(durationS * 1000.0)));
+		bRun = false;
+		readerThread.join();
+
+		vr::VRBlockQueue()->Destroy(queueHandle);
+	}
+
+	PrintReaderResult(stats);
+
+	vr::VR_Shutdown();
+	return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Multi-reader stress mode of the snooper. Runs several readers of the raw frame block queue at once, with their own
+// read types, block hold times and per-frame work, and reports reader misses, connection limits and the producer's
+// block acquire times. Runs against SteamVR and the driver, or an in-process queue stand-in with its own producer.
+
+
+// camera_buffer_snooper stress [options], with the mode argument removed.
+int RunQueueStress(int argc, char* argv[]);
+
+// A single reader started by the --processes option, reporting its results on stdout.
+int RunQueueStressReader(int argc, char* argv[]);
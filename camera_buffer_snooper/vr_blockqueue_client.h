@@ -98,7 +98,7 @@ PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, EBlockQueueReadType
 	static const char* IVRBlockQueue_Version = "IVRBlockQueue_005";
 	
 
-	IVRPaths* VRPaths()
+	inline IVRPaths* VRPaths()
 	{
 		static IVRPaths* pPaths = nullptr;
 		static uint32_t initToken = 0;
@@ -116,7 +116,7 @@ PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, EBlockQueueReadType
 		return pPaths;
 	}
 
-	IVRBlockQueue* VRBlockQueue()
+	inline IVRBlockQueue* VRBlockQueue()
 	{
 		static IVRBlockQueue* pBlockQueue = nullptr;
 		static uint32_t initToken = 0;
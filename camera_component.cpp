@@ -1,58 +1,227 @@
 
 #include "pch.h"
 #include "camera_component.h"
+#include "driver_metrics.h"
+#include "driver_trace.h"
+#include "driver_scheduler.h"
+#include "driver_threads.h"
+#include "head_motion.h"
 
 
-CameraComponent::CameraComponent()
+#define CAMERA_CONFIG "openvr_camera_sim_camera"
+
+#define MAX_RENDER_THREADS 8
+
+// Time before a frame deadline the publisher stops sleeping and spins instead.
+#define SLEEP_SPIN_MARGIN_US 2000
+
+// Requests taken by HandleDebugCommand. Only the listed ones are dispatched, and unknown requests are answered with the list.
+static const char* g_debugRequests[] =
+{
+	"get config",
+	"get source",
+	"get sinks",
+	"get stereo",
+	"get isp",
+	"set fps",
+	"set source",
+	"set latency",
+	"set intrinsics",
+	"set resolution",
+	"set readout",
+	"set motion",
+	"set rig",
+	"set stereo",
+	"set isp",
+	"set raw",
+	"set pack",
+};
+
+static bool ParseStereoMode(const std::string& name, EStereoMode& outMode)
 {
-	m_frameWidth = 1024;
-	m_frameHeight = 1024;
+	if (name == "off") { outMode = StereoMode_Off; }
+	else if (name == "measure") { outMode = StereoMode_Measure; }
+	else if (name == "view") { outMode = StereoMode_View; }
+	else { return false; }
+	return true;
+}
 
-	m_textureWidth = m_frameWidth * 2;
-	m_textureHeight = m_frameHeight;
+static const char* StereoModeName(EStereoMode mode)
+{
+	switch (mode)
+	{
+	case StereoMode_Measure: return "measure";
+	case StereoMode_View: return "view";
+	default: return "off";
+	}
+}
+
+// The serving thread renders a share as well, so one less worker than cores is enough.
+void CameraComponent::StartRenderPool(ThreadPool& pool)
+{
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	int32_t renderThreads = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "render_threads", &settingsError);
+	if (settingsError != vr::VRSettingsError_None || renderThreads < 0)
+	{
+		renderThreads = 0;
+	}
+	if (renderThreads == 0)
+	{
+		uint32_t numCores = std::thread::hardware_concurrency();
+		renderThreads = (numCores > 1) ? (std::min)(numCores - 1, (uint32_t)MAX_RENDER_THREADS) : 0;
+	}
+	pool.Start(renderThreads, [] { g_driverThreads.Register(DriverThread_RenderWorker); });
+}
+
+CameraComponent::CameraComponent(const CameraInstanceSettings& instance, ThreadPool& renderPool)
+	: m_instance(instance)
+	, m_renderPool(renderPool)
+	, m_frameArena(g_frameArena.GetPartition(instance.index))
+{
 	m_textureBPP = 4;
 	m_streamFormat = vr::CVS_FORMAT_RGBX32;
 	m_cameraName = "Simulated stereo camera";
 
-	// Intrinsic values in terms of pixels relative to the frame size.
-	m_focalLeftX = 450.0f;
-	m_focalLeftY = 450.0f;
-	m_centerLeftX = 512.0f;
-	m_centerLeftY = 512.0f;
-
-	m_focalRightX = 450.0f;
-	m_focalRightY = 450.0f;
-	m_centerRightX = 512.0f;
-	m_centerRightY = 512.0f;
-
-	// Extended_FTheta used by Valve Index with 4 radial parameters. Unknown what the diffence between the two variants are.
-	m_distortionFunction.resize(2);
-	m_distortionFunction[0] = (int32_t)vr::VRDistortionFunctionType_Extended_FTheta;
-	m_distortionFunction[1] = (int32_t)vr::VRDistortionFunctionType_Extended_FTheta;
-
-	// Using the Valve Index coeffcients to test with.
-	// Note the coefficients being doubles per the comment in the docs
-	m_distortionCoeff.resize(16);
-	m_distortionCoeff[0] = 0.19;
-	m_distortionCoeff[1] = 0.023;
-	m_distortionCoeff[2] = -0.19;
-	m_distortionCoeff[3] = 0.07;
-	m_distortionCoeff[4] = 0.0;
-	m_distortionCoeff[5] = 0.0;
-	m_distortionCoeff[6] = 0.0;
-	m_distortionCoeff[7] = 0.0;
-
-	// Second eye coefficients start at 8
-	m_distortionCoeff[8] = 0.19;
-	m_distortionCoeff[9] = 0.023;
-	m_distortionCoeff[10] = -0.19;
-	m_distortionCoeff[11] = 0.07;
-	m_distortionCoeff[12] = 0.0;
-	m_distortionCoeff[13] = 0.0;
-	m_distortionCoeff[14] = 0.0;
-	m_distortionCoeff[15] = 0.0;
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	int32_t numCameras = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "num_cameras", &settingsError);
+	if (settingsError != vr::VRSettingsError_None) { numCameras = 2; }
+
+	int32_t frameWidth = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "frame_width", &settingsError);
+	if (settingsError != vr::VRSettingsError_None || frameWidth < 16) { frameWidth = 1024; }
+
+	int32_t frameHeight = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "frame_height", &settingsError);
+	if (settingsError != vr::VRSettingsError_None || frameHeight < 16) { frameHeight = 1024; }
+
+	ERigFrameLayout frameLayout = RigFrameLayout_Horizontal;
+	char layoutName[32] = {};
+	vr::VRSettings()->GetString(CAMERA_CONFIG, "frame_layout", layoutName, sizeof(layoutName), &settingsError);
+	if (settingsError == vr::VRSettingsError_None && !CameraRig::ParseLayout(layoutName, frameLayout))
+	{
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Unknown frame layout \"{}\", using horizontal", layoutName);
+	}
+
+	m_rig.Configure(numCameras, frameLayout, frameWidth, frameHeight);
+
+	if (m_rig.numCameras != 2)
+	{
+		m_cameraName = std::format("Simulated {}-camera rig", m_rig.numCameras);
+	}
+	if (m_instance.index > 0)
+	{
+		m_cameraName = std::format("Simulated load test camera {}", m_instance.index);
+	}
+
+	float readoutTime = vr::VRSettings()->GetFloat(CAMERA_CONFIG, "readout_time", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && readoutTime >= 0.0f && readoutTime < 1.0f) { m_readoutTime = readoutTime; }
+
+	// The camera_buffer_snooper stress mode can be used to find values for many readers.
+	int32_t queueBlockCount = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "block_queue_blocks", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && queueBlockCount >= 2 && queueBlockCount <= 16) { m_queueBlockCount = queueBlockCount; }
+
+	int32_t queueHeaderSize = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "block_queue_header_size", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && queueHeaderSize >= 256 && queueHeaderSize <= 65536) { m_queueHeaderSize = queueHeaderSize; }
+
+	float motionAmplitude = vr::VRSettings()->GetFloat(CAMERA_CONFIG, "motion_yaw_amplitude", &settingsError);
+	if (settingsError != vr::VRSettingsError_None) { motionAmplitude = 0.0f; }
+
+	float motionFrequency = vr::VRSettings()->GetFloat(CAMERA_CONFIG, "motion_frequency", &settingsError);
+	if (settingsError != vr::VRSettingsError_None) { motionFrequency = 0.5f; }
+
+	g_headMotion.SetMotion(motionAmplitude, motionFrequency);
+
+	float framePhaseMs = vr::VRSettings()->GetFloat(CAMERA_CONFIG, "frame_phase_ms", &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { m_framePhase = framePhaseMs / 1000.0; }
+
+	if (m_instance.frameRate) { m_frameRate = *m_instance.frameRate; }
+	if (m_instance.framePhase) { m_framePhase = *m_instance.framePhase; }
+
+	// The depth mesh and IOBuffer paths belong to the HMD, so the load test cameras leave them out.
+	bool bDepthMeshEnabled = vr::VRSettings()->GetBool(CAMERA_CONFIG, "depth_mesh_enable", &settingsError);
+	m_bDepthMeshEnabled = (settingsError == vr::VRSettingsError_None) && bDepthMeshEnabled && m_instance.index == 0;
+
+	float depthMeshRate = vr::VRSettings()->GetFloat(CAMERA_CONFIG, "depth_mesh_rate", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && depthMeshRate > 0.0f) { m_depthMeshRate = depthMeshRate; }
+
+	bool bUseLargePages = vr::VRSettings()->GetBool(CAMERA_CONFIG, "frame_arena_large_pages", &settingsError);
+	if (settingsError != vr::VRSettingsError_None) { bUseLargePages = true; }
+
+	int32_t numaNode = vr::VRSettings()->GetInt32(CAMERA_CONFIG, "frame_arena_numa_node", &settingsError);
+	if (settingsError != vr::VRSettingsError_None) { numaNode = -1; }
+
+	g_frameArena.SetOptions(bUseLargePages, numaNode);
+
+	// The lighthouse driver has an equivalent enableIOBuffers setting.
+	bool bIOBuffersEnabled = vr::VRSettings()->GetBool(CAMERA_CONFIG, "iobuffer_enable", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && bIOBuffersEnabled && m_instance.index == 0)
+	{
+		float ioBufferMaxRate = vr::VRSettings()->GetFloat(CAMERA_CONFIG, "iobuffer_max_rate", &settingsError);
+		if (settingsError != vr::VRSettingsError_None) { ioBufferMaxRate = 0.0f; }
+
+		bool bDropWithoutReaders = vr::VRSettings()->GetBool(CAMERA_CONFIG, "iobuffer_drop_without_readers", &settingsError);
+		if (settingsError != vr::VRSettingsError_None) { bDropWithoutReaders = true; }
+
+		// The simulated frames have no lens distortion applied, so both paths get the same frame.
+		// Each path can override the pacing with the iobuffer_<name>_max_rate and iobuffer_<name>_drop_without_readers settings.
+		for (const char* name : { "distorted", "undistorted" })
+		{
+			float maxRate = vr::VRSettings()->GetFloat(CAMERA_CONFIG, std::format("iobuffer_{}_max_rate", name).c_str(), &settingsError);
+			if (settingsError != vr::VRSettingsError_None) { maxRate = ioBufferMaxRate; }
+
+			bool bDrop = vr::VRSettings()->GetBool(CAMERA_CONFIG, std::format("iobuffer_{}_drop_without_readers", name).c_str(), &settingsError);
+			if (settingsError != vr::VRSettingsError_None) { bDrop = bDropWithoutReaders; }
+
+			std::unique_ptr<FrameSink> sink = std::make_unique<IOBufferFrameSink>(std::format("/user/head/camera/{}", name).c_str());
+			sink->SetPacing(maxRate, bDrop ? FrameSinkDrop_WithoutReaders : FrameSinkDrop_Never);
+			m_frameFanout.AddSink(std::move(sink));
+		}
+	}
+
+	char stereoModeName[32] = {};
+	vr::VRSettings()->GetString(CAMERA_CONFIG, "stereo_mode", stereoModeName, sizeof(stereoModeName), &settingsError);
+	if (settingsError == vr::VRSettingsError_None && !ParseStereoMode(stereoModeName, m_stereoMode))
+	{
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Unknown stereo mode \"{}\", disabling", stereoModeName);
+	}
+
+	bool bStereoRectify = vr::VRSettings()->GetBool(CAMERA_CONFIG, "stereo_rectify", &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { m_bStereoRectify = bStereoRectify; }
 
+	m_sensorIsp.SetSettings(SensorIspSettings::Load());
 
+	char rawFormatName[32] = {};
+	vr::VRSettings()->GetString(CAMERA_CONFIG, "raw_format", rawFormatName, sizeof(rawFormatName), &settingsError);
+	if (settingsError == vr::VRSettingsError_None && !ParseBayerFormat(rawFormatName, m_rawFormat))
+	{
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Unknown raw format \"{}\", serving RGBX frames", rawFormatName);
+	}
+
+	char packFormatName[32] = {};
+	vr::VRSettings()->GetString(CAMERA_CONFIG, "pack_format", packFormatName, sizeof(packFormatName), &settingsError);
+	if (settingsError == vr::VRSettingsError_None && !ParsePackFormat(packFormatName, m_packFormat))
+	{
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Unknown pack format \"{}\", serving RGBX frames", packFormatName);
+	}
+
+	char frameSourceSetting[32] = {};
+	vr::VRSettings()->GetString(CAMERA_CONFIG, "frame_source", frameSourceSetting, sizeof(frameSourceSetting), &settingsError);
+
+	std::string frameSourceName = m_instance.frameSource ? *m_instance.frameSource : frameSourceSetting;
+	if (m_instance.frameSource || settingsError == vr::VRSettingsError_None)
+	{
+		m_frameSource = CreateFrameSource(frameSourceName);
+		if (!m_frameSource)
+		{
+			VR_DRIVER_LOG_FORMAT("CameraComponent: Failed to create frame source \"{}\", using gradient", frameSourceName);
+		}
+	}
+
+	if (!m_frameSource)
+	{
+		m_frameSource = std::make_unique<GradientFrameSource>();
+	}
+	m_frameSource->SetFrameLayout(m_rig, m_textureBPP);
 
 	QueryPerformanceFrequency(&m_perfCounterFrequency);
 
@@ -66,6 +235,8 @@ CameraComponent::~CameraComponent()
 	{
 		m_frameServeThread.join();
 	}
+
+	ReleaseRenderBuffers();
 }
 
 bool CameraComponent::Init(vr::TrackedDeviceIndex_t HMDDeviceId)
@@ -79,271 +250,1116 @@ bool CameraComponent::Init(vr::TrackedDeviceIndex_t HMDDeviceId)
 	vr::VRProperties()->SetUint64Property(container, vr::Prop_CameraFirmwareVersion_Uint64, 0x200040049); 
 	vr::VRProperties()->SetStringProperty(container, vr::Prop_CameraFirmwareDescription_String, GetCameraDisplayName().c_str());
 
-	vr::VRProperties()->SetBoolProperty(container, vr::Prop_HasCamera_Bool, true);
-	//vr::VRProperties()->SetBoolProperty(container, vr::Prop_HasCameraComponent_Bool, true); // Should be set by SteamVR.
+	vr::VRProperties()->SetBoolProperty(container, vr::Prop_HasCamera_Bool, true);
+	//vr::VRProperties()->SetBoolProperty(container, vr::Prop_HasCameraComponent_Bool, true); // Should be set by SteamVR.
+
+	// Number of cameras. Header claims up to 4 supported.
+	vr::VRProperties()->SetInt32Property(container, vr::Prop_NumCameras_Int32, m_rig.numCameras);
+
+	vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraFrameLayout_Int32, m_rig.GetFrameLayoutProperty());
+
+	// This does not seem to affect anything.
+	vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraStreamFormat_Int32, m_streamFormat);
+
+	// Adds the appropriate controls to the camera settings menu.
+	vr::VRProperties()->SetBoolProperty(container, vr::Prop_AllowCameraToggle_Bool, true);
+	vr::VRProperties()->SetBoolProperty(container, vr::Prop_SupportsRoomViewDepthProjection_Bool, m_bDepthMeshEnabled);
+	vr::VRProperties()->SetBoolProperty(container, vr::Prop_AllowLightSourceFrequency_Bool, false);
+
+	// Unknown functionality
+	vr::VRProperties()->SetBoolProperty(container, vr::Prop_Hmd_SupportsRoomViewDirect_Bool, false);
+	vr::VRProperties()->SetBoolProperty(container, vr::Prop_CameraSupportsCompatibilityModes_Bool, false);
+	vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraCompatibilityMode_Int32, 0);
+	//vr::VRProperties()->SetFloatProperty(container, vr::Prop_CameraExposureTime_Float, 1.0f);
+	//vr::VRProperties()->SetFloatProperty(container, vr::Prop_CameraGlobalGain_Float, 1.0f);
+
+
+	PublishCameraProperties();
+
+	if (!CreateFrameQueue())
+	{
+		return false;
+	}
+
+	m_frameFanout.Open(m_rig, GetServedBytesPerPixel(), GetServedFormat());
+
+	// Allocated and pre-faulted here rather than on the first frames of the stream.
+	m_frameArena.Reserve(m_rig.textureWidth * m_rig.textureHeight * m_textureBPP, FRAME_ARENA_SLOTS);
+
+	// The mesh is generated on its own thread to keep it out of the frame serving budget.
+	if (m_bDepthMeshEnabled)
+	{
+		m_depthMesh.Start(m_HMDDeviceId, m_rig, m_depthMeshRate);
+	}
+
+	m_bIsInitialized = true;
+	return true;
+}
+
+// Publishes the properties describing the camera intrinsics and extrinsics. Called again when the intrinsics change at runtime.
+void CameraComponent::PublishCameraProperties()
+{
+	const vr::PropertyContainerHandle_t container = vr::VRProperties()->TrackedDeviceToPropertyContainer(m_HMDDeviceId);
+
+	const uint32_t numCameras = m_rig.numCameras;
+
+	std::vector<int32_t> distortionFunction(m_rig.distortionFunction, m_rig.distortionFunction + numCameras);
+	std::vector<double> distortionCoeff(m_rig.distortionCoeff, m_rig.distortionCoeff + numCameras * vr::k_unMaxDistortionFunctionParameters);
+
+	// These two properties are the only way applications can access distortion parameters.
+	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraDistortionFunction_Int32_Array, vr::k_unInt32PropertyTag, &distortionFunction);
+
+	// Needs to be set and retrived with the float property tag despite being doubles.
+	// vr::k_unMaxDistortionFunctionParameters per camera.
+	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraDistortionCoefficients_Float_Array, vr::k_unFloatPropertyTag, &distortionCoeff);
+
+	// Does not seem to have any effect. Reports the white balance applied by the ISP stage.
+	const SensorIspSettings& ispSettings = m_sensorIsp.GetSettings();
+	std::vector<vr::HmdVector4_t> CameraWhiteBalance(numCameras);
+	for (vr::HmdVector4_t& whiteBalance : CameraWhiteBalance)
+	{
+		if (ispSettings.bEnabled)
+		{
+			whiteBalance = { { ispSettings.whiteBalance[0], ispSettings.whiteBalance[1], ispSettings.whiteBalance[2], 0.0f } };
+		}
+		else
+		{
+			whiteBalance = { { 1.0f, 1.0f, 1.0f, 0.0f } };
+		}
+	}
+
+	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraWhiteBalance_Vector4_Array, vr::k_unHmdVector4PropertyTag, &CameraWhiteBalance);
+
+
+	// Inverse poses of cameras relative to the HMD origin.
+	std::vector<vr::HmdMatrix34_t> CameraToHeadTransforms(m_rig.cameraToHead, m_rig.cameraToHead + numCameras);
+
+	vr::VRProperties()->SetProperty(container, vr::Prop_CameraToHeadTransform_Matrix34, &CameraToHeadTransforms[0], sizeof(vr::HmdMatrix34_t), vr::k_unHmdMatrix34PropertyTag);
+	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraToHeadTransforms_Matrix34_Array, vr::k_unHmdMatrix34PropertyTag, &CameraToHeadTransforms);
+}
+
+// Bytes per pixel of the published frames, one or two in raw mode.
+uint32_t CameraComponent::GetServedBytesPerPixel() const
+{
+	if (m_rawFormat != BayerFormat_None)
+	{
+		return BayerBytesPerSample(m_rawFormat);
+	}
+	return (m_packFormat != PackFormat_RGBX32) ? PackBytesPerPixel(m_packFormat) : m_textureBPP;
+}
+
+// Format written to the /format paths. Only 16 bit BGGR has an equivalent in ECameraVideoStreamFormat,
+// the other raw formats are unknown there and described by /bayer_format.
+int32_t CameraComponent::GetServedFormat() const
+{
+	switch (m_rawFormat)
+	{
+	case BayerFormat_None:
+		if (m_packFormat == PackFormat_RGB24) { return vr::CVS_FORMAT_RGB24; }
+		if (m_packFormat == PackFormat_YUYV16) { return vr::CVS_FORMAT_YUYV16; }
+		return m_streamFormat;
+	case BayerFormat_BGGR16: return vr::CVS_FORMAT_BAYER16BG;
+	default: return vr::CVS_FORMAT_UNKNOWN;
+	}
+}
+
+// Creates the raw frame block queue and writes the static frame format paths.
+bool CameraComponent::CreateFrameQueue()
+{
+	// Create the block queue to serve frames to. Unknown if values for header and block count other than 512 and 4 work with the runtime.
+	vr::EBlockQueueError error = vr::VRBlockQueue()->Create(&m_rawFrameQueue, m_instance.queuePath.c_str(), m_rig.textureWidth * m_rig.textureHeight * GetServedBytesPerPixel(), m_queueHeaderSize, m_queueBlockCount, 0);
+	if (error != vr::EBlockQueueError_BlockQueueError_None)
+	{
+		VR_DRIVER_LOG_FORMAT("Error creating block queue: {}", (int)error);
+		return false;
+	}
+
+	int32_t frameFormat = GetServedFormat();
+	int32_t frameWidth = m_rig.textureWidth;
+	int32_t frameHeight = m_rig.textureHeight;
+	int32_t bayerFormat = m_rawFormat;
+
+	// Texture format of framebuffer
+	vr::PathHandle_t formatHandle;
+	vr::VRPaths()->StringToHandle(&formatHandle, "/format");
+
+	vr::PathHandle_t widthHandle;
+	vr::VRPaths()->StringToHandle(&widthHandle, "/width");
+
+	vr::PathHandle_t heightHandle;
+	vr::VRPaths()->StringToHandle(&heightHandle, "/height");
+
+	m_metadataPaths.Resolve();
+
+
+	vr::PathWrite_t write = {};
+	write.ulPath = formatHandle;
+	write.writeType = vr::PropertyWrite_Set;
+	write.unTag = vr::k_unInt32PropertyTag;
+	write.unBufferSize = sizeof(frameFormat);
+	write.pvBuffer = &frameFormat;
+	write.pszPath = nullptr;
+
+	// The format and frame dimensions are written directly using the raw_frames block queue handle.
+	// These don't like being written all in a single batch for some reason.
+	vr::ETrackedPropertyError propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
+	if (propError != vr::TrackedProp_Success)
+	{
+		VR_DRIVER_LOG_FORMAT("Error writing frame format to block queue path: {}", (int)propError);
+		return false;
+	}
+
+	write.ulPath = widthHandle;
+	write.pvBuffer = &frameWidth;
+
+	propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
+	if (propError != vr::TrackedProp_Success)
+	{
+		VR_DRIVER_LOG_FORMAT("Error writing frame width to block queue path: {}", (int)propError);
+		return false;
+	}
+
+	write.ulPath = heightHandle;
+	write.pvBuffer = &frameHeight;
+
+	propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
+	if (propError != vr::TrackedProp_Success)
+	{
+		VR_DRIVER_LOG_FORMAT("Error writing frame height to block queue path: {}", (int)propError);
+		return false;
+	}
+
+	// Not a runtime path. Lets consumers tell the raw formats apart, since /format can't describe all of them.
+	vr::PathHandle_t bayerFormatHandle;
+	vr::VRPaths()->StringToHandle(&bayerFormatHandle, "/bayer_format");
+
+	write.ulPath = bayerFormatHandle;
+	write.pvBuffer = &bayerFormat;
+
+	propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
+	if (propError != vr::TrackedProp_Success)
+	{
+		VR_DRIVER_LOG_FORMAT("Error writing Bayer format to block queue path: {}", (int)propError);
+		return false;
+	}
+
+	return true;
+}
+
+void CameraComponent::Deinit()
+{
+	m_depthMesh.Stop();
+
+	m_bRunThread = false;
+	if (m_frameServeThread.joinable())
+	{
+		m_frameServeThread.join();
+	}
+
+	m_frameFanout.Close();
+}
+
+// Sleeps the serving thread until the given performance counter time.
+void CameraComponent::SleepUntil(int64_t targetTicks)
+{
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+
+	// Sleeps can overshoot by the scheduler granularity, so the last stretch before the deadline is spun.
+	int64_t spinTicks = m_perfCounterFrequency.QuadPart * SLEEP_SPIN_MARGIN_US / 1000000;
+	int64_t remainingTicks = targetTicks - currTime.QuadPart - spinTicks;
+	if (remainingTicks > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(remainingTicks * 1000000 / m_perfCounterFrequency.QuadPart));
+	}
+
+	do
+	{
+		YieldProcessor();
+		QueryPerformanceCounter(&currTime);
+	}
+	while (currTime.QuadPart < targetTicks);
+
+	// Nonzero only if the sleep overshot the spin margin, or the thread wasn't scheduled for the spin.
+	g_driverThreads.RecordWake(currTime.QuadPart - targetTicks);
+}
+
+// Random delivery delay on top of the frame schedule, according to the configured jitter profile.
+int64_t CameraComponent::SampleDeliveryJitterTicks()
+{
+	double jitter = 0.0;
+
+	switch (m_jitterProfile)
+	{
+	case JitterProfile_Uniform:
+	{
+		std::uniform_real_distribution<double> distribution(0.0, m_jitter);
+		jitter = distribution(m_jitterRng);
+		break;
+	}
+	case JitterProfile_Gaussian:
+	{
+		std::normal_distribution<double> distribution(0.0, m_jitter);
+		jitter = fabs(distribution(m_jitterRng));
+		break;
+	}
+	default:
+		break;
+	}
+
+	return (int64_t)(jitter * m_perfCounterFrequency.QuadPart);
+}
+
+static const char* JitterProfileName(EJitterProfile profile)
+{
+	switch (profile)
+	{
+	case JitterProfile_Uniform: return "uniform";
+	case JitterProfile_Gaussian: return "gaussian";
+	default: return "none";
+	}
+}
+
+std::string CameraComponent::GetDebugRequestListJson()
+{
+	std::string list;
+	for (const char* pRequest : g_debugRequests)
+	{
+		list += std::format("{}\"{}\"", list.empty() ? "" : ",", pRequest);
+	}
+	return list;
+}
+
+// Parses stream reconfiguration commands received through DebugRequest. Returns false if the request is not a stream command.
+bool CameraComponent::HandleDebugCommand(const std::string& request, std::string& response)
+{
+	std::istringstream stream(request);
+	std::string verb, target;
+	stream >> verb >> target;
+
+	std::string name = verb + " " + target;
+	if (std::find_if(std::begin(g_debugRequests), std::end(g_debugRequests), [&](const char* pRequest) { return name == pRequest; }) == std::end(g_debugRequests))
+	{
+		// Other get requests may be for the device.
+		if (verb != "set")
+		{
+			return false;
+		}
+
+		response = std::format("{{\"error\":\"unknown setting\",\"requests\":[{}]}}", GetDebugRequestListJson());
+		return true;
+	}
+
+	if (verb == "get" && target == "config")
+	{
+		std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+		std::shared_lock lock(m_intrinsicsMutex);
+
+		response = std::format("{{\"instance\":{},\"queue\":\"{}\",\"fps\":{},\"phase_ms\":{},\"source\":\"{}\",\"latency\":{},\"jitter\":{},\"jitter_profile\":\"{}\",\"readout_time\":{},\"motion_amplitude\":{},\"motion_frequency\":{},\"render_threads\":{},\"render_ahead\":{},\"frames_dropped\":{},\"block_queue_blocks\":{},\"block_queue_header_size\":{},\"large_pages\":{},\"depth_mesh_id\":{},\"cameras\":{},\"layout\":\"{}\",\"width\":{},\"height\":{},\"raw_format\":\"{}\",\"pack_format\":\"{}\",\"intrinsics\":[",
+			m_instance.index, m_instance.queuePath, m_frameRate, m_framePhase * 1000.0, m_frameSource->GetName(), m_latency, m_jitter, JitterProfileName(m_jitterProfile),
+			m_readoutTime, g_headMotion.GetYawAmplitudeDegrees(), g_headMotion.GetFrequency(), m_renderPool.GetNumThreads(), RENDER_AHEAD_FRAMES, m_frameRing.GetDroppedFrames(), m_queueBlockCount, m_queueHeaderSize, m_frameArena.IsUsingLargePages(), m_depthMesh.GetMeshId(),
+			m_rig.numCameras, CameraRig::GetLayoutName(m_rig.layout), m_rig.frameWidth, m_rig.frameHeight, BayerFormatName(m_rawFormat), PackFormatName(m_packFormat));
+
+		for (uint32_t i = 0; i < m_rig.numCameras; i++)
+		{
+			response += std::format("{}{{\"fx\":{},\"fy\":{},\"cx\":{},\"cy\":{}}}", (i > 0) ? "," : "",
+				m_rig.focalX[i], m_rig.focalY[i], m_rig.centerX[i], m_rig.centerY[i]);
+		}
+		response += "]}";
+		return true;
+	}
+
+	if (verb == "get" && target == "source")
+	{
+		std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+		response = std::format("{{\"source\":\"{}\",\"status\":{}}}", m_frameSource->GetName(), m_frameSource->GetStatusJson());
+		return true;
+	}
+
+	if (verb == "get" && target == "sinks")
+	{
+		response = m_frameFanout.GetStatsJson();
+		return true;
+	}
+
+	if (verb == "get" && target == "stereo")
+	{
+		std::lock_guard<std::mutex> lock(m_stereoStatsMutex);
+
+		response = std::format("{{\"mode\":\"{}\",\"avx2\":{},\"width\":{},\"height\":{},\"disparities\":{},\"valid_pixels\":{},\"total_pixels\":{},\"mean_disparity\":{:.3f},\"median_depth\":{:.3f},\"compute_ms\":{:.3f},"
+			"\"rectify\":{},\"rectified_focal\":{:.3f},\"rectified_baseline\":{:.4f},\"rectify_ms\":{:.3f}}}",
+			StereoModeName(m_stereoMode), m_stereoMatcher.IsUsingAVX2(), m_stereoMatcher.GetWidth(), m_stereoMatcher.GetHeight(), m_stereoMatcher.GetNumDisparities(),
+			m_stereoStats.validPixels, m_stereoStats.totalPixels, m_stereoStats.meanDisparity, m_stereoStats.medianDepth, m_stereoStats.computeMs,
+			m_bStereoRectify, m_stereoRectifier.GetFocalLength(), m_stereoRectifier.GetBaseline(), m_stereoRectifyMs);
+		return true;
+	}
+
+	if (verb == "get" && target == "isp")
+	{
+		std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+		const SensorIspSettings& settings = m_sensorIsp.GetSettings();
+		SensorIspStats stats = m_sensorIsp.GetStats();
+
+		response = std::format("{{\"enabled\":{},\"avx2\":{},\"exposure_ms\":{},\"gain\":{},\"white_balance\":[{},{},{}],\"vignetting\":{},\"shot_noise\":{},\"read_noise\":{},\"budget_ms\":{},\"frames\":{},\"tiles_over_budget\":{},\"last_ms\":{:.3f},\"max_ms\":{:.3f}}}",
+			settings.bEnabled, m_sensorIsp.IsUsingAVX2(), settings.exposureMs, settings.gain, settings.whiteBalance[0], settings.whiteBalance[1], settings.whiteBalance[2],
+			settings.vignetting, settings.shotNoise, settings.readNoise, settings.budgetMs, stats.frames, stats.tilesOverBudget, stats.lastMs, stats.maxMs);
+		return true;
+	}
+
+	if (verb != "set")
+	{
+		return false;
+	}
+
+	StreamReconfiguration change;
+
+	if (target == "fps")
+	{
+		double frameRate = 0.0;
+		if (!(stream >> frameRate) || frameRate < 1.0 || frameRate > 1000.0)
+		{
+			response = "{\"error\":\"usage: set fps <1-1000>\"}";
+			return true;
+		}
+		change.frameRate = frameRate;
+	}
+	else if (target == "source")
+	{
+		// set source <name> [argument]. The argument is the rest of the line, e.g. a sequence directory with spaces.
+		std::string name, argument;
+		stream >> name >> std::ws;
+		std::getline(stream, argument);
+		change.frameSource = CreateFrameSource(name, argument);
+		if (!change.frameSource)
+		{
+			response = std::format("{{\"error\":\"unknown frame source\",\"sources\":\"{}\"}}", GetFrameSourceNames());
+			return true;
+		}
+	}
+	else if (target == "latency")
+	{
+		// set latency <seconds> [jitter <seconds>] [profile none|uniform|gaussian]
+		double latency = 0.0;
+		if (!(stream >> latency) || latency < 0.0 || latency > 1.0)
+		{
+			response = "{\"error\":\"usage: set latency <seconds> [jitter <seconds>] [profile none|uniform|gaussian]\"}";
+			return true;
+		}
+		change.latency = latency;
+
+		std::string key;
+		while (stream >> key)
+		{
+			if (key == "jitter")
+			{
+				double jitter = 0.0;
+				if (!(stream >> jitter) || jitter < 0.0 || jitter > 1.0)
+				{
+					response = "{\"error\":\"invalid jitter\"}";
+					return true;
+				}
+				change.jitter = jitter;
+			}
+			else if (key == "profile")
+			{
+				std::string profile;
+				stream >> profile;
+				if (profile == "none") { change.jitterProfile = JitterProfile_None; }
+				else if (profile == "uniform") { change.jitterProfile = JitterProfile_Uniform; }
+				else if (profile == "gaussian") { change.jitterProfile = JitterProfile_Gaussian; }
+				else
+				{
+					response = "{\"error\":\"unknown jitter profile\"}";
+					return true;
+				}
+			}
+			else
+			{
+				response = std::format("{{\"error\":\"unknown latency parameter: {}\"}}", key);
+				return true;
+			}
+		}
+	}
+	else if (target == "intrinsics")
+	{
+		// set intrinsics <camera> <fx> <fy> <cx> <cy> [k1 k2 k3 k4]
+		CameraIntrinsicsUpdate update = {};
+		if (!(stream >> update.cameraIndex >> update.focalX >> update.focalY >> update.centerX >> update.centerY) || update.cameraIndex >= MAX_RIG_CAMERAS)
+		{
+			response = "{\"error\":\"usage: set intrinsics <camera> <fx> <fy> <cx> <cy> [k1 k2 k3 k4]\"}";
+			return true;
+		}
+
+		update.bHasDistortion = (bool)(stream >> update.distortion[0]);
+		if (update.bHasDistortion && !(stream >> update.distortion[1] >> update.distortion[2] >> update.distortion[3]))
+		{
+			response = "{\"error\":\"expected 4 distortion coefficients\"}";
+			return true;
+		}
+		change.intrinsics.push_back(update);
+	}
+	else if (target == "resolution")
+	{
+		// Per-camera frame size. Requires recreating the block queue.
+		uint32_t width = 0, height = 0;
+		if (!(stream >> width >> height) || width < 16 || height < 16 || width > 4096 || height > 4096)
+		{
+			response = "{\"error\":\"usage: set resolution <width> <height>\"}";
+			return true;
+		}
+		change.frameSize = std::make_pair(width, height);
+	}
+	else if (target == "readout")
+	{
+		// Rolling shutter readout time from the first to the last row of each camera.
+		double readoutTime = 0.0;
+		if (!(stream >> readoutTime) || readoutTime < 0.0 || readoutTime > 0.5)
+		{
+			response = "{\"error\":\"usage: set readout <seconds>\"}";
+			return true;
+		}
+		change.readoutTime = readoutTime;
+	}
+	else if (target == "motion")
+	{
+		// Takes effect immediately, since the HMD pose follows the same motion.
+		double amplitude = 0.0, frequency = 0.0;
+		if (!(stream >> amplitude >> frequency) || amplitude < 0.0 || amplitude > 180.0 || frequency < 0.0 || frequency > 10.0)
+		{
+			response = "{\"error\":\"usage: set motion <yaw amplitude degrees> <frequency hz>\"}";
+			return true;
+		}
+		g_headMotion.SetMotion(amplitude, frequency);
+		response = "{\"result\":\"applied\"}";
+		return true;
+	}
+	else if (target == "rig")
+	{
+		// set rig <cameras> [horizontal|vertical|grid]. Also requires recreating the block queue.
+		uint32_t numCameras = 0;
+		if (!(stream >> numCameras) || numCameras < 1 || numCameras > MAX_RIG_CAMERAS)
+		{
+			response = "{\"error\":\"usage: set rig <1-4> [horizontal|vertical|grid]\"}";
+			return true;
+		}
+		change.numCameras = numCameras;
+
+		std::string layoutName;
+		if (stream >> layoutName)
+		{
+			ERigFrameLayout layout;
+			if (!CameraRig::ParseLayout(layoutName, layout))
+			{
+				response = "{\"error\":\"unknown frame layout\"}";
+				return true;
+			}
+			change.frameLayout = layout;
+		}
+	}
+	else if (target == "stereo")
+	{
+		std::string modeName;
+		stream >> modeName;
+		EStereoMode mode;
+		std::string rectifyName;
+		bool bHasRectify = (bool)(stream >> rectifyName);
+		if (!ParseStereoMode(modeName, mode) || (bHasRectify && rectifyName != "rectify" && rectifyName != "norectify"))
+		{
+			response = "{\"error\":\"usage: set stereo off|measure|view [rectify|norectify]\"}";
+			return true;
+		}
+		change.stereoMode = mode;
+		if (bHasRectify) { change.stereoRectify = (rectifyName == "rectify"); }
+	}
+	else if (target == "isp")
+	{
+		// Changes one parameter on top of the current or already queued ISP settings.
+		SensorIspSettings settings;
+		{
+			std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+			std::lock_guard<std::mutex> lock(m_pendingReconfigurationMutex);
+			settings = m_pendingReconfiguration.ispSettings.value_or(m_sensorIsp.GetSettings());
+		}
+
+		std::string parameter;
+		stream >> parameter;
+		bool bValid = true;
+
+		if (parameter == "on" || parameter == "off")
+		{
+			settings.bEnabled = (parameter == "on");
+		}
+		else if (parameter == "exposure")
+		{
+			bValid = (stream >> settings.exposureMs) && settings.exposureMs > 0.0f;
+		}
+		else if (parameter == "gain")
+		{
+			bValid = (stream >> settings.gain) && settings.gain > 0.0f;
+		}
+		else if (parameter == "wb")
+		{
+			bValid = (stream >> settings.whiteBalance[0] >> settings.whiteBalance[1] >> settings.whiteBalance[2]) &&
+				settings.whiteBalance[0] > 0.0f && settings.whiteBalance[1] > 0.0f && settings.whiteBalance[2] > 0.0f;
+		}
+		else if (parameter == "vignetting")
+		{
+			bValid = (stream >> settings.vignetting) && settings.vignetting >= 0.0f && settings.vignetting <= 1.0f;
+		}
+		else if (parameter == "noise")
+		{
+			bValid = (stream >> settings.shotNoise >> settings.readNoise) && settings.shotNoise >= 0.0f && settings.readNoise >= 0.0f;
+		}
+		else if (parameter == "budget")
+		{
+			bValid = (stream >> settings.budgetMs) && settings.budgetMs > 0.0f;
+		}
+		else
+		{
+			bValid = false;
+		}
+
+		if (!bValid)
+		{
+			response = "{\"error\":\"usage: set isp on|off|exposure <ms>|gain <gain>|wb <r> <g> <b>|vignetting <0-1>|noise <shot> <read>|budget <ms>\"}";
+			return true;
+		}
+		change.ispSettings = settings;
+	}
+	else if (target == "raw")
+	{
+		std::string formatName;
+		stream >> formatName;
+		EBayerFormat format;
+		if (!ParseBayerFormat(formatName, format))
+		{
+			response = "{\"error\":\"usage: set raw off|rggb8|bggr8|rggb16|bggr16\"}";
+			return true;
+		}
+		change.rawFormat = format;
+	}
+	else if (target == "pack")
+	{
+		std::string formatName;
+		stream >> formatName;
+		EPackFormat format;
+		if (!ParsePackFormat(formatName, format))
+		{
+			response = "{\"error\":\"usage: set pack rgbx32|rgb24|yuyv16\"}";
+			return true;
+		}
+		change.packFormat = format;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_pendingReconfigurationMutex);
+
+		if (change.frameRate) { m_pendingReconfiguration.frameRate = change.frameRate; }
+		if (change.frameSource) { m_pendingReconfiguration.frameSource = std::move(change.frameSource); }
+		if (change.latency) { m_pendingReconfiguration.latency = change.latency; }
+		if (change.jitter) { m_pendingReconfiguration.jitter = change.jitter; }
+		if (change.jitterProfile) { m_pendingReconfiguration.jitterProfile = change.jitterProfile; }
+		if (change.frameSize) { m_pendingReconfiguration.frameSize = change.frameSize; }
+		if (change.readoutTime) { m_pendingReconfiguration.readoutTime = change.readoutTime; }
+		if (change.numCameras) { m_pendingReconfiguration.numCameras = change.numCameras; }
+		if (change.frameLayout) { m_pendingReconfiguration.frameLayout = change.frameLayout; }
+		if (change.stereoMode) { m_pendingReconfiguration.stereoMode = change.stereoMode; }
+		if (change.stereoRectify) { m_pendingReconfiguration.stereoRectify = change.stereoRectify; }
+		if (change.ispSettings) { m_pendingReconfiguration.ispSettings = change.ispSettings; }
+		if (change.rawFormat) { m_pendingReconfiguration.rawFormat = change.rawFormat; }
+		if (change.packFormat) { m_pendingReconfiguration.packFormat = change.packFormat; }
+		m_pendingReconfiguration.intrinsics.insert(m_pendingReconfiguration.intrinsics.end(), change.intrinsics.begin(), change.intrinsics.end());
+
+		m_bHasPendingReconfiguration = true;
+	}
+
+	// Without a serving thread there is no frame boundary to wait for. The lock keeps the stream from starting in between.
+	{
+		std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+
+		if (!m_bIsStreamActive)
+		{
+			ApplyPendingReconfigurationLocked();
+			response = "{\"result\":\"applied\"}";
+			return true;
+		}
+	}
+
+	response = "{\"result\":\"queued for next frame\"}";
+	return true;
+}
+
+// Applies any queued stream changes. Only called between frames, or when the stream is not running.
+void CameraComponent::ApplyPendingReconfiguration()
+{
+	if (!m_bHasPendingReconfiguration)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+	ApplyPendingReconfigurationLocked();
+}
+
+// Called with m_applyReconfigurationMutex held.
+void CameraComponent::ApplyPendingReconfigurationLocked()
+{
+	if (!m_bHasPendingReconfiguration)
+	{
+		return;
+	}
+
+	// The render thread reads most of the configuration, so it is stopped while applying. Frames rendered ahead are discarded.
+	bool bRestartRenderThread = StopRenderThread();
+
+	StreamReconfiguration change;
+	{
+		std::lock_guard<std::mutex> lock(m_pendingReconfigurationMutex);
+		change = std::move(m_pendingReconfiguration);
+		m_pendingReconfiguration = StreamReconfiguration();
+		m_bHasPendingReconfiguration = false;
+	}
+
+	if (change.frameRate)
+	{
+		m_frameRate = *change.frameRate;
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Frame rate set to {}", m_frameRate);
+	}
+
+	if (change.latency) { m_latency = *change.latency; }
+	if (change.jitter) { m_jitter = *change.jitter; }
+	if (change.jitterProfile) { m_jitterProfile = *change.jitterProfile; }
+	if (change.readoutTime) { m_readoutTime = *change.readoutTime; }
+
+	if (change.stereoMode)
+	{
+		m_stereoMode = *change.stereoMode;
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Stereo mode set to {}", StereoModeName(m_stereoMode));
+	}
+
+	if (change.stereoRectify)
+	{
+		m_bStereoRectify = *change.stereoRectify;
+		m_bRectifyMapsDirty = true;
+	}
+
+	if (change.ispSettings)
+	{
+		m_sensorIsp.SetSettings(*change.ispSettings);
+
+		// Republishes the white balance.
+		if (m_bIsInitialized)
+		{
+			PublishCameraProperties();
+		}
+	}
+
+	bool bResizeFrameSize = change.frameSize && (change.frameSize->first != m_rig.frameWidth || change.frameSize->second != m_rig.frameHeight);
+	bool bResizeRig = (change.numCameras && *change.numCameras != m_rig.numCameras) || (change.frameLayout && *change.frameLayout != m_rig.layout);
+	bool bChangeRawFormat = change.rawFormat && *change.rawFormat != m_rawFormat;
+	bool bChangePackFormat = change.packFormat && *change.packFormat != m_packFormat;
+
+	if (bChangeRawFormat)
+	{
+		m_rawFormat = *change.rawFormat;
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Raw format set to {}", BayerFormatName(m_rawFormat));
+	}
+
+	if (bChangePackFormat)
+	{
+		m_packFormat = *change.packFormat;
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Pack format set to {}", PackFormatName(m_packFormat));
+	}
+
+	if (bResizeFrameSize || bResizeRig || bChangeRawFormat || bChangePackFormat)
+	{
+		m_bRectifyMapsDirty = true;
+
+		{
+			std::unique_lock lock(m_intrinsicsMutex);
+
+			// Keep the intrinsics relative to the frame size.
+			if (bResizeFrameSize)
+			{
+				m_rig.SetFrameSize(change.frameSize->first, change.frameSize->second);
+			}
+
+			// Changing the camera count resets the rig to the default parameters.
+			if (bResizeRig)
+			{
+				m_rig.Configure(change.numCameras.value_or(m_rig.numCameras), change.frameLayout.value_or(m_rig.layout), m_rig.frameWidth, m_rig.frameHeight);
+			}
+		}
+
+		// Only a frame size, layout or format change requires tearing down the queue.
+		vr::VRBlockQueue()->Destroy(m_rawFrameQueue);
+		m_rawFrameQueue = 0;
+
+		if (!CreateFrameQueue())
+		{
+			VR_DRIVER_LOG_FORMAT("CameraComponent: Failed to recreate block queue after frame format change!");
+		}
+
+		m_frameFanout.Open(m_rig, GetServedBytesPerPixel(), GetServedFormat());
+
+		m_frameSource->SetFrameLayout(m_rig, m_textureBPP);
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Rig set to {} cameras, {} layout, {}x{} per camera", m_rig.numCameras, CameraRig::GetLayoutName(m_rig.layout), m_rig.frameWidth, m_rig.frameHeight);
+	}
+
+	if (change.frameSource)
+	{
+		change.frameSource->SetFrameLayout(m_rig, m_textureBPP);
+		m_frameSource = std::move(change.frameSource);
+		VR_DRIVER_LOG_FORMAT("CameraComponent: Frame source set to {}", m_frameSource->GetName());
+	}
+
+	if (!change.intrinsics.empty() || bResizeRig)
+	{
+		m_bRectifyMapsDirty = true;
+
+		{
+			std::unique_lock lock(m_intrinsicsMutex);
 
-	// Number of cameras. Header claims up to 4 supported.
-	vr::VRProperties()->SetInt32Property(container, vr::Prop_NumCameras_Int32, 2);
+			for (const CameraIntrinsicsUpdate& update : change.intrinsics)
+			{
+				if (update.cameraIndex >= m_rig.numCameras)
+				{
+					VR_DRIVER_LOG_FORMAT("CameraComponent: Ignoring intrinsics for camera {}, rig has {} cameras", update.cameraIndex, m_rig.numCameras);
+					continue;
+				}
 
+				m_rig.focalX[update.cameraIndex] = update.focalX;
+				m_rig.focalY[update.cameraIndex] = update.focalY;
+				m_rig.centerX[update.cameraIndex] = update.centerX;
+				m_rig.centerY[update.cameraIndex] = update.centerY;
 
-	vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraFrameLayout_Int32, vr::EVRTrackedCameraFrameLayout_Stereo | vr::EVRTrackedCameraFrameLayout_HorizontalLayout);
+				if (update.bHasDistortion)
+				{
+					double* pCoeffs = &m_rig.distortionCoeff[update.cameraIndex * vr::k_unMaxDistortionFunctionParameters];
+					for (int i = 0; i < 4; i++)
+					{
+						pCoeffs[i] = update.distortion[i];
+					}
+				}
+			}
+		}
 
-	// This does not seem to affect anything.
-	vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraStreamFormat_Int32, m_streamFormat);
+		if (m_bIsInitialized)
+		{
+			const vr::PropertyContainerHandle_t container = vr::VRProperties()->TrackedDeviceToPropertyContainer(m_HMDDeviceId);
+			vr::VRProperties()->SetInt32Property(container, vr::Prop_NumCameras_Int32, m_rig.numCameras);
+			vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraFrameLayout_Int32, m_rig.GetFrameLayoutProperty());
 
-	// Adds the appropriate controls to the camera settings menu.
-	vr::VRProperties()->SetBoolProperty(container, vr::Prop_AllowCameraToggle_Bool, true);
-	vr::VRProperties()->SetBoolProperty(container, vr::Prop_SupportsRoomViewDepthProjection_Bool, false);
-	vr::VRProperties()->SetBoolProperty(container, vr::Prop_AllowLightSourceFrequency_Bool, false);
+			PublishCameraProperties();
 
-	// Unknown functionality
-	vr::VRProperties()->SetBoolProperty(container, vr::Prop_Hmd_SupportsRoomViewDirect_Bool, false);
-	vr::VRProperties()->SetBoolProperty(container, vr::Prop_CameraSupportsCompatibilityModes_Bool, false);
-	vr::VRProperties()->SetInt32Property(container, vr::Prop_CameraCompatibilityMode_Int32, 0);
-	//vr::VRProperties()->SetFloatProperty(container, vr::Prop_CameraExposureTime_Float, 1.0f);
-	//vr::VRProperties()->SetFloatProperty(container, vr::Prop_CameraGlobalGain_Float, 1.0f);
+			if (m_bDepthMeshEnabled)
+			{
+				std::shared_lock lock(m_intrinsicsMutex);
+				m_depthMesh.SetRig(m_rig);
+			}
 
+			// Let the runtime know it should query the camera parameters again.
+			// The camera count is only read on startup, so a rig change may need a SteamVR restart to show up.
+			vr::VREvent_Data_t eventData = {};
+			vr::VRServerDriverHost()->VendorSpecificEvent(m_HMDDeviceId, vr::VREvent_CameraSettingsHaveChanged, eventData, 0.0);
+		}
+	}
 
-	// These two properties are the only way applications can access distortion parameters.
-	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraDistortionFunction_Int32_Array, vr::k_unInt32PropertyTag, &m_distortionFunction);
+	// ServeFrames retries if the frame buffers for the new configuration can't be allocated.
+	if (bRestartRenderThread)
+	{
+		StartRenderThread();
+	}
+}
 
-	// Needs to be set and retrived with the float property tag despite being doubles.
-	// 2x vr::k_unMaxDistortionFunctionParameters since it's for both eyes.
-	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraDistortionCoefficients_Float_Array, vr::k_unFloatPropertyTag, &m_distortionCoeff);
+// Thread rendering frames ahead into the frame ring, one frame interval apart. The publisher decides when they are delivered.
+void CameraComponent::RenderFrames()
+{
+	g_driverThreads.Register(DriverThread_FrameRender);
 
-	// Does not seem to have any effect.
-	std::vector<float> CameraWhiteBalance;
-	CameraWhiteBalance.resize(8);
-	CameraWhiteBalance[0] = 1.0f;
-	CameraWhiteBalance[1] = 1.0f;
-	CameraWhiteBalance[2] = 1.0f;
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
 
-	CameraWhiteBalance[4] = 1.0f;
-	CameraWhiteBalance[5] = 1.0f;
-	CameraWhiteBalance[6] = 1.0f;
+	// Deadlines are on the scheduler timeline, so the frames keep a fixed phase to the simulated vsync and pose updates.
+	int64_t nextDeadline = g_driverScheduler.GetNextDeadline(m_frameRate, m_framePhase, currTime.QuadPart + 1);
 
-	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraWhiteBalance_Vector4_Array, vr::k_unHmdVector4PropertyTag, &CameraWhiteBalance);
+	while (m_bRunRenderThread)
+	{
+		RenderedFrame* pFrame = m_frameRing.AcquireFree(m_bRunRenderThread);
+		if (pFrame == nullptr)
+		{
+			if (m_bRunRenderThread)
+			{
+				VR_DRIVER_LOG_FORMAT("CameraComponent: Frame ring has no slots, stopping the render thread");
+			}
+			break;
+		}
 
+		int64_t frameIntervalTicks = (int64_t)(m_perfCounterFrequency.QuadPart / m_frameRate);
 
+		// Don't try to catch up after long stalls, the missed deadlines are simply skipped.
+		QueryPerformanceCounter(&currTime);
+		if (currTime.QuadPart - nextDeadline > frameIntervalTicks)
+		{
+			nextDeadline = g_driverScheduler.GetNextDeadline(m_frameRate, m_framePhase, currTime.QuadPart);
+		}
 
-	
-	// Inverse poses of cameras relative to the HMD origin.
-	std::vector<vr::HmdMatrix34_t> CameraToHeadTransforms;
-	CameraToHeadTransforms.resize(2);
+		// The exposure is timed from the frame deadline, so neither render time nor delivery jitter show up in the timestamps.
+		pFrame->deadlineTicks = nextDeadline;
+		pFrame->exposureTicks = nextDeadline - (int64_t)(m_latency * (double)m_perfCounterFrequency.QuadPart);
+		pFrame->readoutTime = m_readoutTime;
+		pFrame->frameCount = ++m_frameCount;
+		nextDeadline = g_driverScheduler.GetNextDeadline(m_frameRate, m_framePhase, nextDeadline + frameIntervalTicks / 2);
 
-	CameraToHeadTransforms[0].m[0][0] = 1;
-	CameraToHeadTransforms[0].m[1][1] = 1;
-	CameraToHeadTransforms[0].m[2][2] = 1;
-	CameraToHeadTransforms[0].m[0][3] = 0.05f;
+		{
+			DRIVER_METRIC_SCOPE(Metric_RenderFill);
 
-	CameraToHeadTransforms[1].m[0][0] = 1;
-	CameraToHeadTransforms[1].m[1][1] = 1;
-	CameraToHeadTransforms[1].m[2][2] = 1;
-	CameraToHeadTransforms[1].m[0][3] = -0.05f;
+			FrameRenderInfo renderInfo = {};
+			renderInfo.frameCount = pFrame->frameCount;
+			renderInfo.exposureStartTicks = pFrame->exposureTicks;
+			renderInfo.readoutTicks = (int64_t)(pFrame->readoutTime * (double)m_perfCounterFrequency.QuadPart);
 
-	vr::VRProperties()->SetProperty(container, vr::Prop_CameraToHeadTransform_Matrix34, &CameraToHeadTransforms[0], sizeof(vr::HmdMatrix34_t), vr::k_unHmdMatrix34PropertyTag);
-	vr::VRProperties()->SetPropertyVector(container, vr::Prop_CameraToHeadTransforms_Matrix34_Array, vr::k_unHmdMatrix34PropertyTag, &CameraToHeadTransforms);
-	
+			uint32_t textureHeight = m_rig.textureHeight;
+			uint32_t numBands = (textureHeight + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+			FrameSource* pFrameSource = m_frameSource.get();
+			uint8_t* pBuffer = pFrame->pData;
 
-	// Create the block queue to serve frames to. Unknown if other values for header and block count works.
-	vr::EBlockQueueError error = vr::VRBlockQueue()->Create(&m_rawFrameQueue, "/lighthouse/camera/raw_frames", m_textureWidth * m_textureHeight * m_textureBPP, 512, 4, 0);
-	if (error != vr::EBlockQueueError_BlockQueueError_None)
-	{
-		VR_DRIVER_LOG_FORMAT("Error creating block queue: {}", (int)error);
-		return false;
-	}
+			pFrameSource->BeginFrame(renderInfo);
+			pFrame->exposureTicks = renderInfo.exposureStartTicks;
 
-	int32_t frameFormat = m_streamFormat;
-	int32_t frameWidth = m_textureWidth;
-	int32_t frameHeight = m_textureHeight;
+			m_renderPool.ParallelFor(numBands, [&](uint32_t band)
+			{
+				uint32_t firstRow = band * RENDER_BAND_ROWS;
+				pFrameSource->RenderRows(pBuffer, renderInfo, firstRow, (std::min)(firstRow + RENDER_BAND_ROWS, textureHeight));
+			});
+		}
 
-	// Texture format of framebuffer
-	vr::PathHandle_t formatHandle;
-	vr::VRPaths()->StringToHandle(&formatHandle, "/format");
+		// Before stereo matching, so the matcher sees the same noise as consumers.
+		if (m_sensorIsp.GetSettings().bEnabled)
+		{
+			DRIVER_METRIC_SCOPE(Metric_RenderIsp);
+			m_sensorIsp.Process(pFrame->pData, pFrame->frameCount, m_renderPool);
+		}
 
-	vr::PathHandle_t widthHandle;
-	vr::VRPaths()->StringToHandle(&widthHandle, "/width");
+		if (m_stereoMode != StereoMode_Off)
+		{
+			DRIVER_METRIC_SCOPE(Metric_RenderStereo);
+			ComputeStereo(pFrame->pData);
+		}
 
-	vr::PathHandle_t heightHandle;
-	vr::VRPaths()->StringToHandle(&heightHandle, "/height");
+		// Last, as the frame is no longer RGBX after either.
+		if (m_rawFormat != BayerFormat_None)
+		{
+			DRIVER_METRIC_SCOPE(Metric_RenderMosaic);
+			MosaicFrame(pFrame);
+		}
+		else if (m_framePacker.IsConfigured())
+		{
+			DRIVER_METRIC_SCOPE(Metric_RenderPack);
+			PackFrame(pFrame);
+		}
 
-	vr::VRPaths()->StringToHandle(&m_frameSequenceHandle, "/frame_sequence");
-	vr::VRPaths()->StringToHandle(&m_frameSizeHandle, "/frame_size");
-	vr::VRPaths()->StringToHandle(&m_frameTimeMonotonicHandle, "/frame_time_monotonic");
-	vr::VRPaths()->StringToHandle(&m_serverTimeTicksHandle, "/server_time_ticks");
-	vr::VRPaths()->StringToHandle(&m_deliveryRateHandle, "/delivery_rate");
-	vr::VRPaths()->StringToHandle(&m_elapsedTimeHandle, "/elapsed_time");
+		m_frameRing.MarkReady(pFrame);
+	}
 
+	m_bRenderThreadExited = true;
+}
 
-	vr::PathWrite_t write = {};
-	write.ulPath = formatHandle;
-	write.writeType = vr::PropertyWrite_Set;
-	write.unTag = vr::k_unInt32PropertyTag;
-	write.unBufferSize = sizeof(frameFormat);
-	write.pvBuffer = &frameFormat;
-	write.pszPath = nullptr;
+// Starts rendering ahead with the current configuration. Frames rendered with an older one are discarded.
+// Returns false if the frame buffers could not be allocated, in which case no thread is started.
+bool CameraComponent::StartRenderThread()
+{
+	// All slots are returned before the ring is reset, so the arena can grow for a larger frame size.
+	ReleaseRenderBuffers();
 
-	// The format and frame dimensions are written directly using the raw_frames block queue handle.
-	// These don't like being written all in a single batch for some reason.
-	vr::ETrackedPropertyError propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
-	if (propError != vr::TrackedProp_Success)
+	if (!m_frameRing.Reset(m_frameArena, m_rig.textureWidth * m_rig.textureHeight * m_textureBPP))
 	{
-		VR_DRIVER_LOG_FORMAT("Error writing frame format to block queue path: {}", (int)propError);
 		return false;
 	}
 
-	write.ulPath = widthHandle;
-	write.pvBuffer = &frameWidth;
+	m_sensorIsp.Configure(m_rig);
 
-	propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
-	if (propError != vr::TrackedProp_Success)
+	// Raw Bayer frames take precedence over packing.
+	m_framePacker.Configure((m_rawFormat == BayerFormat_None) ? m_packFormat : PackFormat_RGBX32, m_rig);
+
+	if (m_rawFormat != BayerFormat_None || m_framePacker.IsConfigured())
 	{
-		VR_DRIVER_LOG_FORMAT("Error writing frame width to block queue path: {}", (int)propError);
-		return false;
+		m_pStagingFrame = m_frameArena.AcquireSlot();
+		if (m_pStagingFrame == nullptr)
+		{
+			VR_DRIVER_LOG_FORMAT("CameraComponent: Frame arena is out of slots for the staging frame");
+			return false;
+		}
 	}
 
-	write.ulPath = heightHandle;
-	write.pvBuffer = &frameHeight;
-
-	propError = vr::VRPaths()->WritePathBatch(m_rawFrameQueue, &write, 1);
-	if (propError != vr::TrackedProp_Success)
+	// Two views fit in a slot, as stereo matching needs at least two cameras in the frame.
+	if (m_stereoMode != StereoMode_Off && m_bStereoRectify && m_rig.numCameras >= 2)
 	{
-		VR_DRIVER_LOG_FORMAT("Error writing frame height to block queue path: {}", (int)propError);
-		return false;
+		m_pRectifiedViews = m_frameArena.AcquireSlot();
+		if (m_pRectifiedViews == nullptr)
+		{
+			VR_DRIVER_LOG_FORMAT("CameraComponent: Frame arena is out of slots for the rectified views");
+			return false;
+		}
 	}
 
-	m_bIsInitialized = true;
+	m_bRunRenderThread = true;
+	m_bRenderThreadExited = false;
+	m_frameRenderThread = std::thread(&CameraComponent::RenderFrames, this);
 	return true;
 }
 
-void CameraComponent::Deinit()
+// Returns the arena slots held outside the frame ring. The render thread must not be running.
+void CameraComponent::ReleaseRenderBuffers()
 {
-	m_bRunThread = false;
-	if (m_frameServeThread.joinable())
+	m_frameArena.ReleaseSlot(m_pStagingFrame);
+	m_pStagingFrame = nullptr;
+
+	m_frameArena.ReleaseSlot(m_pRectifiedViews);
+	m_pRectifiedViews = nullptr;
+}
+
+// Returns whether the thread was started, including one that has already exited on its own.
+bool CameraComponent::StopRenderThread()
+{
+	if (!m_frameRenderThread.joinable())
 	{
-		m_frameServeThread.join();
+		return false;
 	}
+
+	m_bRunRenderThread = false;
+	m_frameRing.Wake();
+	m_frameRenderThread.join();
+	return true;
 }
 
-// Thread that runs loop serving frames while the video stream is enabled by the runtime.
+// Thread that publishes the rendered frames to the block queue at their deadlines while the video stream is enabled by the runtime.
+// The block is only held for the copy and the metadata write.
 void CameraComponent::ServeFrames()
 {
+	g_driverThreads.Register(DriverThread_FrameServe);
+
 	while (m_bRunThread)
 	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(16));
+		// Frame boundary, no block is held here.
+		ApplyPendingReconfiguration();
+
+		// Nothing is rendered while paused.
+		if (m_bIsStreamPaused)
+		{
+			StopRenderThread();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+
+		// A render thread that exited on its own is joined, and starting it again retries taking the ring slots.
+		if (m_bRenderThreadExited)
+		{
+			StopRenderThread();
+		}
+
+		if (!m_frameRenderThread.joinable() && !StartRenderThread())
+		{
+			DRIVER_LOG_RATE_LIMITED(1, "CameraComponent: No frame buffers for {}x{} frames, retrying", m_rig.textureWidth, m_rig.textureHeight);
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+
+		uint64_t deadlineTicks = 0;
+		if (!m_frameRing.WaitForReady(100, deadlineTicks))
+		{
+			continue;
+		}
+
+		SleepUntil(deadlineTicks + SampleDeliveryJitterTicks());
 
 		if (!m_bRunThread) { break; }
 
-		if (m_bIsStreamPaused) { continue; }
+		LARGE_INTEGER currTime;
+		QueryPerformanceCounter(&currTime);
+
+		RenderedFrame* pFrame = m_frameRing.TakeDue(currTime.QuadPart);
+		if (pFrame == nullptr) { continue; }
 
+		DRIVER_METRIC_SCOPE(Metric_ServeFrame);
 
-		m_frameCount++;
 		m_frameSequence = (m_frameSequence + 1) % 16;
 
+		// Raw frames only use the start of the ring slot.
+		int32_t frameSize = m_rig.textureWidth * m_rig.textureHeight * GetServedBytesPerPixel();
+		DRIVER_TRACE_SCOPE(TraceEvent_ServeFrame, pFrame->frameCount, frameSize);
+		uint64_t exposureTicks = pFrame->exposureTicks;
+
+		FrameMetadata& metadata = m_frameMetadata;
+		metadata.frameSize = frameSize;
+		metadata.frameSequence = m_frameSequence;
+		metadata.elapsedTime = (currTime.QuadPart - m_startTime.QuadPart) / (double)m_perfCounterFrequency.QuadPart;
+		metadata.frameTimeMonotonic = exposureTicks / (double)m_perfCounterFrequency.QuadPart;
+		metadata.serverTimeTicks = exposureTicks;
+		metadata.deliveryRate = (double)(exposureTicks - m_lastFrameTime.QuadPart) / (double)m_perfCounterFrequency.QuadPart;
+		metadata.readoutTime = pFrame->readoutTime;
+
+		m_lastFrameTime.QuadPart = exposureTicks;
+
+		// The per-frame metadata is prepared before acquiring the block, to keep the hold time short.
+		BuildFrameMetadataBatch(m_metadataPaths, metadata, m_metadataWrite);
+
 
 		vr::PropertyContainerHandle_t writeHandle;
 		uint8_t* pBuffer;
 
-		vr::EBlockQueueError error = vr::VRBlockQueue()->AcquireWriteOnlyBlock(m_rawFrameQueue, &writeHandle, (void**)&pBuffer);
+		vr::EBlockQueueError error;
+		{
+			DRIVER_METRIC_SCOPE(Metric_ServeAcquire);
+			error = vr::VRBlockQueue()->AcquireWriteOnlyBlock(m_rawFrameQueue, &writeHandle, (void**)&pBuffer);
+		}
 		if (error != vr::EBlockQueueError_BlockQueueError_None)
 		{
-			std::string info = std::format("AcquireWriteOnlyBlock error: {}", (int)error);
-			vr::VRDriverLog()->Log(info.c_str());
+			DRIVER_LOG_RATE_LIMITED(1, "AcquireWriteOnlyBlock error: {}", (int)error);
+			m_frameRing.Release(pFrame);
 			continue;
 		}
 
-		// Draw image to framebuffer
-		for (uint32_t y = 0; y < m_textureHeight; y++)
+		LARGE_INTEGER acquireTime;
+		QueryPerformanceCounter(&acquireTime);
+
 		{
-			for (uint32_t x = 0; x < m_textureWidth; x++)
-			{
-				int pixel = (x + y * m_textureWidth) * 4;
+			DRIVER_METRIC_SCOPE(Metric_ServeCopy);
+			StreamFrameCopy(pBuffer, pFrame->pData, frameSize);
+		}
 
+		vr::ETrackedPropertyError propError;
+		{
+			DRIVER_METRIC_SCOPE(Metric_ServeMetadata);
+			propError = vr::VRPaths()->WritePathBatch(writeHandle, m_metadataWrite, FRAME_METADATA_WRITES);
+		}
 
-				// Draw grid lines
-				if (y % 64 == (m_textureHeight / 2) % 64 || x % 64 == (m_textureWidth / 4) % 64)
-				{
-					pBuffer[pixel] = 160;
-					pBuffer[pixel + 1] = 160;
-					pBuffer[pixel + 2] = 160;
-					pBuffer[pixel + 3] = 255;
-				}
-				else
-				{
-					pBuffer[pixel] = ((x * 256) / m_textureWidth * 2) % 256;
-					pBuffer[pixel + 1] = ((y * 256) / m_textureHeight) % 256;
-					pBuffer[pixel + 2] = (x < m_textureWidth / 2) ? 127 : 0; // Tint left view blue
-					pBuffer[pixel + 3] = 255;
-				}
-			}
+		{
+			DRIVER_METRIC_SCOPE(Metric_ServeRelease);
+			error = vr::VRBlockQueue()->ReleaseWriteOnlyBlock(m_rawFrameQueue, writeHandle);
 		}
-		
-		LARGE_INTEGER currTime;
 
-		QueryPerformanceCounter(&currTime);
+		LARGE_INTEGER releaseTime;
+		QueryPerformanceCounter(&releaseTime);
+		g_driverMetrics.Record(Metric_ServeBlockHold, releaseTime.QuadPart - acquireTime.QuadPart);
 
-		int32_t frameSize = m_textureWidth * m_textureHeight * m_textureBPP;
-
-		double latency = 0.040;
-		uint64_t latencyTicks = (uint64_t)(latency * (double)m_perfCounterFrequency.QuadPart);
-
-		uint64_t frameSequence = m_frameSequence;
-		double elapsedTime = (currTime.QuadPart - m_startTime.QuadPart) / (double)m_perfCounterFrequency.QuadPart;
-		double frameTimeMonotonic = currTime.QuadPart / (double)m_perfCounterFrequency.QuadPart - latency;
-		uint64_t serverTimeTicks = currTime.QuadPart - latencyTicks;
-		double deliveryRate = (double)(currTime.QuadPart - latency - m_lastFrameTime.QuadPart) / (double)m_perfCounterFrequency.QuadPart;
-
-		m_lastFrameTime.QuadPart = currTime.QuadPart - latencyTicks;
-
-		// Write the per-frame metadata to the handle recived by AcquireWriteOnlyBlock.
-		std::vector<vr::PathWrite_t> write(6, {0});
-
-		write[0].writeType = vr::PropertyWrite_Set;
-		write[0].ulPath = m_frameSizeHandle;
-		write[0].pvBuffer = &frameSize;
-		write[0].unBufferSize = sizeof(frameSize);
-		write[0].unTag = vr::k_unInt32PropertyTag;
-
-		write[1].writeType = vr::PropertyWrite_Set;
-		write[1].ulPath = m_frameSequenceHandle;
-		write[1].pvBuffer = &frameSequence;
-		write[1].unBufferSize = sizeof(frameSequence);
-		write[1].unTag = vr::k_unUint64PropertyTag;
-
-		write[2].writeType = vr::PropertyWrite_Set;
-		write[2].ulPath = m_frameTimeMonotonicHandle;
-		write[2].pvBuffer = &frameTimeMonotonic;
-		write[2].unBufferSize = sizeof(frameTimeMonotonic);
-		write[2].unTag = vr::k_unDoublePropertyTag;
-
-		write[3].writeType = vr::PropertyWrite_Set;
-		write[3].ulPath = m_serverTimeTicksHandle;
-		write[3].pvBuffer = &serverTimeTicks;
-		write[3].unBufferSize = sizeof(serverTimeTicks);
-		write[3].unTag = vr::k_unUint64PropertyTag;
-
-		write[4].writeType = vr::PropertyWrite_Set;
-		write[4].ulPath = m_deliveryRateHandle;
-		write[4].pvBuffer = &deliveryRate;
-		write[4].unBufferSize = sizeof(deliveryRate);
-		write[4].unTag = vr::k_unDoublePropertyTag;
-
-		write[5].writeType = vr::PropertyWrite_Set;
-		write[5].ulPath = m_elapsedTimeHandle;
-		write[5].pvBuffer = &elapsedTime;
-		write[5].unBufferSize = sizeof(elapsedTime);
-		write[5].unTag = vr::k_unDoublePropertyTag;
-
-		vr::ETrackedPropertyError propError = vr::VRPaths()->WritePathBatch(writeHandle, write.data(), 6);
 		if (propError != vr::TrackedProp_Success)
 		{
-			VR_DRIVER_LOG_FORMAT("Error writing frame data to block queue path: {}", (int)propError);
+			DRIVER_LOG_RATE_LIMITED(1, "Error writing frame data to block queue path: {}", (int)propError);
+		}
+
+		// The sinks copy from the private ring slot, after the block has been released.
+		if (m_frameFanout.HasSinks())
+		{
+			DRIVER_METRIC_SCOPE(Metric_ServeFanout);
+			m_frameFanout.Submit(pFrame->pData, frameSize, exposureTicks, m_metadataWrite, FRAME_METADATA_WRITES);
 		}
 
-		error = vr::VRBlockQueue()->ReleaseWriteOnlyBlock(m_rawFrameQueue, writeHandle);
+		m_frameRing.Release(pFrame);
+
 		if (error != vr::EBlockQueueError_BlockQueueError_None)
 		{
-			VR_DRIVER_LOG_FORMAT("ReleaseWriteOnlyBlock error: {}", (int)error);
+			DRIVER_LOG_RATE_LIMITED(1, "ReleaseWriteOnlyBlock error: {}", (int)error);
 			continue;
 		}
 
@@ -355,16 +1371,161 @@ void CameraComponent::ServeFrames()
 			m_pCameraVideoSinkCallback->OnCameraVideoSinkCallback();
 		}
 	}
+
+	StopRenderThread();
+}
+
+// Replaces the rendered frame with its Bayer mosaic, packed at the start of the slot. Runs on the render pool.
+void CameraComponent::MosaicFrame(RenderedFrame* pFrame)
+{
+	uint32_t textureWidth = m_rig.textureWidth;
+	uint32_t textureHeight = m_rig.textureHeight;
+	uint32_t numBands = (textureHeight + BAYER_BAND_ROWS - 1) / BAYER_BAND_ROWS;
+	const uint8_t* pBuffer = pFrame->pData;
+	uint8_t* pRawFrame = m_pStagingFrame;
+
+	// The mosaic rows would overwrite RGBX rows other bands are still reading, so it goes into the staging slot,
+	// which then takes the place of the rendered one in the ring.
+	m_renderPool.ParallelFor(numBands, [&](uint32_t band)
+	{
+		uint32_t firstRow = band * BAYER_BAND_ROWS;
+		m_bayerConverter.MosaicRows(m_rawFormat, pBuffer, pRawFrame, textureWidth, firstRow, (std::min)(firstRow + BAYER_BAND_ROWS, textureHeight));
+	});
+
+	std::swap(pFrame->pData, m_pStagingFrame);
+}
+
+// Replaces the rendered frame with its packed form, at the start of the slot. Runs on the render pool.
+void CameraComponent::PackFrame(RenderedFrame* pFrame)
+{
+	uint32_t textureHeight = m_rig.textureHeight;
+	uint32_t numBands = (textureHeight + PACK_BAND_ROWS - 1) / PACK_BAND_ROWS;
+	const uint8_t* pBuffer = pFrame->pData;
+	uint8_t* pPackedFrame = m_pStagingFrame;
+
+	// As with the mosaic, packed rows would overwrite rows other bands are still reading.
+	m_renderPool.ParallelFor(numBands, [&](uint32_t band)
+	{
+		uint32_t firstRow = band * PACK_BAND_ROWS;
+		m_framePacker.PackRows(pBuffer, pPackedFrame, firstRow, (std::min)(firstRow + PACK_BAND_ROWS, textureHeight));
+	});
+
+	std::swap(pFrame->pData, m_pStagingFrame);
+}
+
+// Matches the views of the first two cameras in the rendered frame. Runs on the render pool.
+void CameraComponent::ComputeStereo(uint8_t* pBuffer)
+{
+	if (m_rig.numCameras < 2)
+	{
+		DRIVER_LOG_RATE_LIMITED(1, "CameraComponent: Stereo matching needs at least two cameras");
+		return;
+	}
+
+	StereoParallelFor parallelFor = [this](uint32_t numTasks, const std::function<void(uint32_t)>& task)
+	{
+		m_renderPool.ParallelFor(numTasks, task);
+	};
+
+	if (m_stereoMatcher.GetWidth() != m_rig.frameWidth / 2 || m_stereoMatcher.GetHeight() != m_rig.frameHeight / 2)
+	{
+		std::lock_guard<std::mutex> lock(m_stereoStatsMutex);
+		m_stereoMatcher.Configure(m_rig.frameWidth, m_rig.frameHeight);
+	}
+
+	if (m_bStereoRectify && m_bRectifyMapsDirty)
+	{
+		StereoRectifyCamera cameras[2];
+		{
+			std::shared_lock lock(m_intrinsicsMutex);
+			m_rig.GetRectifyCamera(0, cameras[0]);
+			m_rig.GetRectifyCamera(1, cameras[1]);
+		}
+
+		// The frames are rendered without lens distortion, so the maps only rotate the views onto a common image plane.
+		cameras[0].bFisheye = false;
+		cameras[1].bFisheye = false;
+
+		std::lock_guard<std::mutex> lock(m_stereoStatsMutex);
+		if (!m_stereoRectifier.Configure(cameras[0], cameras[1], m_rig.frameWidth, m_rig.frameHeight, parallelFor))
+		{
+			VR_DRIVER_LOG_FORMAT("CameraComponent: Cannot rectify cameras 0 and 1, matching unrectified views");
+		}
+
+		m_bRectifyMapsDirty = false;
+	}
+
+	bool bRectify = m_bStereoRectify && m_stereoRectifier.IsConfigured() && m_pRectifiedViews != nullptr;
+
+	if (bRectify)
+	{
+		m_stereoMatcher.SetCameraGeometry(m_stereoRectifier.GetBaseline(), m_stereoRectifier.GetFocalLength());
+	}
+	else
+	{
+		// Same baseline as published in Prop_CameraToHeadTransforms_Matrix34_Array.
+		std::shared_lock lock(m_intrinsicsMutex);
+		const vr::HmdMatrix34_t& left = m_rig.cameraToHead[0];
+		const vr::HmdMatrix34_t& right = m_rig.cameraToHead[1];
+		float dx = right.m[0][3] - left.m[0][3];
+		float dy = right.m[1][3] - left.m[1][3];
+		float dz = right.m[2][3] - left.m[2][3];
+		m_stereoMatcher.SetCameraGeometry(sqrtf(dx * dx + dy * dy + dz * dz), m_rig.focalX[0]);
+	}
+
+	uint32_t rowStride = m_rig.textureWidth * m_textureBPP;
+	const CameraRegion& leftRegion = m_rig.regions[0];
+	const CameraRegion& rightRegion = m_rig.regions[1];
+	uint8_t* pLeftView = pBuffer + (size_t)leftRegion.y * rowStride + (size_t)leftRegion.x * m_textureBPP;
+	uint8_t* pRightView = pBuffer + (size_t)rightRegion.y * rowStride + (size_t)rightRegion.x * m_textureBPP;
+
+	const uint8_t* pMatchLeft = pLeftView;
+	const uint8_t* pMatchRight = pRightView;
+	uint32_t matchRowStride = rowStride;
+	double rectifyMs = 0.0;
+
+	if (bRectify)
+	{
+		LARGE_INTEGER rectifyStart, rectifyEnd, frequency;
+		QueryPerformanceCounter(&rectifyStart);
+
+		uint32_t viewRowStride = m_rig.frameWidth * m_textureBPP;
+		uint8_t* pFirstRectified = m_pRectifiedViews;
+		uint8_t* pSecondRectified = pFirstRectified + (size_t)viewRowStride * m_rig.frameHeight;
+		m_stereoRectifier.Rectify(pLeftView, pRightView, rowStride, pFirstRectified, pSecondRectified, viewRowStride, parallelFor);
+
+		QueryPerformanceCounter(&rectifyEnd);
+		QueryPerformanceFrequency(&frequency);
+		rectifyMs = (rectifyEnd.QuadPart - rectifyStart.QuadPart) * 1000.0 / frequency.QuadPart;
+
+		// The matcher takes the views in their rectified left to right order.
+		bool bFirstLeft = m_stereoRectifier.IsFirstViewLeft();
+		pMatchLeft = bFirstLeft ? pFirstRectified : pSecondRectified;
+		pMatchRight = bFirstLeft ? pSecondRectified : pFirstRectified;
+		matchRowStride = viewRowStride;
+	}
+
+	m_stereoMatcher.Compute(pMatchLeft, pMatchRight, matchRowStride, parallelFor);
+
+	if (m_stereoMode == StereoMode_View)
+	{
+		m_stereoMatcher.RenderDisparity(pRightView, rowStride);
+	}
+
+	std::lock_guard<std::mutex> lock(m_stereoStatsMutex);
+	m_stereoStats = m_stereoMatcher.GetStats();
+	m_stereoRectifyMs = rectifyMs;
 }
 
 // Never seems to be called. 
 bool CameraComponent::GetCameraFrameDimensions(vr::ECameraVideoStreamFormat nVideoStreamFormat, uint32_t* pWidth, uint32_t* pHeight)
 {
-	std::string message = std::format("CameraComponent: GetCameraFrameDimensions: {}", (int)nVideoStreamFormat);
-	vr::VRDriverLog()->Log(message.c_str());
+	DRIVER_METRIC_SCOPE(Metric_GetCameraFrameDimensions);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraFrameDimensions, (int)nVideoStreamFormat);
+	VR_DRIVER_LOG_FORMAT("CameraComponent: GetCameraFrameDimensions: {}", (int)nVideoStreamFormat);
 
-	*pWidth = m_textureWidth;
-	*pHeight = m_textureHeight;
+	*pWidth = m_rig.textureWidth;
+	*pHeight = m_rig.textureHeight;
 
 	return true;
 }
@@ -372,9 +1533,11 @@ bool CameraComponent::GetCameraFrameDimensions(vr::ECameraVideoStreamFormat nVid
 // Called before video stream started.
 bool CameraComponent::GetCameraFrameBufferingRequirements(int* pDefaultFrameQueueSize, uint32_t* pFrameBufferDataSize)
 {
-	vr::VRDriverLog()->Log("GetCameraFrameBufferingRequirements");
+	DRIVER_METRIC_SCOPE(Metric_GetCameraFrameBufferingRequirements);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraFrameBufferingRequirements);
+	VR_DRIVER_LOG_FORMAT("GetCameraFrameBufferingRequirements");
 	*pDefaultFrameQueueSize = 4;
-	*pFrameBufferDataSize = m_textureWidth * m_textureHeight * m_textureBPP;
+	*pFrameBufferDataSize = m_rig.textureWidth * m_rig.textureHeight * GetServedBytesPerPixel();
 	return true;
 }
 
@@ -382,8 +1545,9 @@ bool CameraComponent::GetCameraFrameBufferingRequirements(int* pDefaultFrameQueu
 // Called before video stream started. Provides values from GetCameraFrameBufferingRequirements. The Framebuffer pointers point to allocated data, but are not read from in favor for the BlockQueue.
 bool CameraComponent::SetCameraFrameBuffering(int nFrameBufferCount, void** ppFrameBuffers, uint32_t nFrameBufferDataSize)
 {
-	std::string message = std::format("CameraComponent: SetCameraFrameBuffering: count={} dataSize={}", nFrameBufferCount, nFrameBufferDataSize);
-	vr::VRDriverLog()->Log(message.c_str());
+	DRIVER_METRIC_SCOPE(Metric_SetCameraFrameBuffering);
+	DRIVER_TRACE_SCOPE(TraceEvent_SetCameraFrameBuffering, nFrameBufferCount, nFrameBufferDataSize);
+	VR_DRIVER_LOG_FORMAT("CameraComponent: SetCameraFrameBuffering: count={} dataSize={}", nFrameBufferCount, nFrameBufferDataSize);
 
 	if (nFrameBufferCount < 1)
 	{
@@ -396,8 +1560,9 @@ bool CameraComponent::SetCameraFrameBuffering(int nFrameBufferCount, void** ppFr
 // Never seems to be called. 
 bool CameraComponent::SetCameraVideoStreamFormat(vr::ECameraVideoStreamFormat nVideoStreamFormat)
 {
-	std::string message = std::format("CameraComponent: SetCameraVideoStreamFormat: {}", (int)nVideoStreamFormat);
-	vr::VRDriverLog()->Log(message.c_str());
+	DRIVER_METRIC_SCOPE(Metric_SetCameraVideoStreamFormat);
+	DRIVER_TRACE_SCOPE(TraceEvent_SetCameraVideoStreamFormat, (int)nVideoStreamFormat);
+	VR_DRIVER_LOG_FORMAT("CameraComponent: SetCameraVideoStreamFormat: {}", (int)nVideoStreamFormat);
 
 	return true;
 }
@@ -405,7 +1570,9 @@ bool CameraComponent::SetCameraVideoStreamFormat(vr::ECameraVideoStreamFormat nV
 // Called before video stream started. Does not seem to use the value.
 vr::ECameraVideoStreamFormat CameraComponent::GetCameraVideoStreamFormat()
 {
-	vr::VRDriverLog()->Log("GetCameraVideoStreamFormat");
+	DRIVER_METRIC_SCOPE(Metric_GetCameraVideoStreamFormat);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraVideoStreamFormat);
+	VR_DRIVER_LOG_FORMAT("GetCameraVideoStreamFormat");
 	return m_streamFormat;
 }
 
@@ -413,7 +1580,9 @@ vr::ECameraVideoStreamFormat CameraComponent::GetCameraVideoStreamFormat()
 // Called to start the video stream. 
 bool CameraComponent::StartVideoStream()
 {
-	vr::VRDriverLog()->Log("StartVideoStream");
+	DRIVER_METRIC_SCOPE(Metric_StartVideoStream);
+	DRIVER_TRACE_SCOPE(TraceEvent_StartVideoStream);
+	VR_DRIVER_LOG_FORMAT("StartVideoStream");
 
 	if (m_bIsStreamActive)
 	{
@@ -426,8 +1595,16 @@ bool CameraComponent::StartVideoStream()
 		m_frameServeThread.join();
 	}
 
-	m_bRunThread = true;
-	m_frameServeThread = std::thread(&CameraComponent::ServeFrames, this);
+	{
+		// Waits for a change being applied by a debug request, and makes later ones go through the serving thread.
+		std::lock_guard<std::mutex> applyLock(m_applyReconfigurationMutex);
+
+		m_bIsStreamActive = true;
+		m_bIsStreamPaused = false;
+
+		m_bRunThread = true;
+		m_frameServeThread = std::thread(&CameraComponent::ServeFrames, this);
+	}
 
 	QueryPerformanceCounter(&m_startTime);
 
@@ -437,27 +1614,31 @@ bool CameraComponent::StartVideoStream()
 		m_firstStartTime = m_startTime;
 	}
 
-	m_bIsStreamActive = true;
-	m_bIsStreamPaused = false;
 	return true;
 }
 
 // Never seems to be called. The stream is paused rather than stopped when the camera is not used.
 void CameraComponent::StopVideoStream()
 {
-	vr::VRDriverLog()->Log("StopVideoStream");
-	m_bIsStreamActive = false;
+	DRIVER_METRIC_SCOPE(Metric_StopVideoStream);
+	DRIVER_TRACE_SCOPE(TraceEvent_StopVideoStream);
+	VR_DRIVER_LOG_FORMAT("StopVideoStream");
 
 	m_bRunThread = false;
 	if (m_frameServeThread.joinable())
 	{
 		m_frameServeThread.join();
 	}
+
+	// Only after the serving thread has exited, so debug requests don't apply changes while it still runs.
+	m_bIsStreamActive = false;
 }
 
 // Called before a running stream is paused.
 bool CameraComponent::IsVideoStreamActive(bool* pbPaused, float* pflElapsedTime)
 {
+	DRIVER_METRIC_SCOPE(Metric_IsVideoStreamActive);
+	DRIVER_TRACE_SCOPE(TraceEvent_IsVideoStreamActive);
 	*pbPaused = m_bIsStreamPaused;
 
 	if (!m_bIsStreamActive)
@@ -471,13 +1652,15 @@ bool CameraComponent::IsVideoStreamActive(bool* pbPaused, float* pflElapsedTime)
 
 	*pflElapsedTime = (currTime.QuadPart - m_startTime.QuadPart) / (float)m_perfCounterFrequency.QuadPart;
 	
-	vr::VRDriverLog()->Log("IsVideoStreamActive");
+	DRIVER_LOG_RATE_LIMITED(1, "IsVideoStreamActive");
 	return true;
 }
 
 // Called on OnCameraVideoSinkCallback(). Returning a frame struct seems to reject any frame data passed, and keeps calling the function non-stop. Frame data not used. Seems to be safe to return nullptr.
 const vr::CameraVideoStreamFrame_t* CameraComponent::GetVideoStreamFrame()
 {
+	DRIVER_METRIC_SCOPE(Metric_GetVideoStreamFrame);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetVideoStreamFrame);
 	//VR_DRIVER_LOG_FORMAT("GetVideoStreamFrame: num {}", m_frameCount);
 	return nullptr;
 }
@@ -485,20 +1668,26 @@ const vr::CameraVideoStreamFrame_t* CameraComponent::GetVideoStreamFrame()
 // Does not seem to be called due to frame data being rejected in the above function.
 void CameraComponent::ReleaseVideoStreamFrame(const vr::CameraVideoStreamFrame_t* pFrameImage)
 {
-	vr::VRDriverLog()->Log("ReleaseVideoStreamFrame");
+	DRIVER_METRIC_SCOPE(Metric_ReleaseVideoStreamFrame);
+	DRIVER_TRACE_SCOPE(TraceEvent_ReleaseVideoStreamFrame);
+	VR_DRIVER_LOG_FORMAT("ReleaseVideoStreamFrame");
 }
 
 // Never seems to be called. 
 bool CameraComponent::SetAutoExposure(bool bEnable)
 {
-	vr::VRDriverLog()->Log("SetAutoExposure");
+	DRIVER_METRIC_SCOPE(Metric_SetAutoExposure);
+	DRIVER_TRACE_SCOPE(TraceEvent_SetAutoExposure, bEnable);
+	VR_DRIVER_LOG_FORMAT("SetAutoExposure");
 	return true;
 }
 
 // Called rather than StopVideoStream when no one is using the camera.
 bool CameraComponent::PauseVideoStream()
 {
-	vr::VRDriverLog()->Log("PauseVideoStream");
+	DRIVER_METRIC_SCOPE(Metric_PauseVideoStream);
+	DRIVER_TRACE_SCOPE(TraceEvent_PauseVideoStream);
+	VR_DRIVER_LOG_FORMAT("PauseVideoStream");
 	m_bIsStreamPaused = true;
 	return true;
 }
@@ -506,116 +1695,53 @@ bool CameraComponent::PauseVideoStream()
 // Called to resume a paused stream.
 bool CameraComponent::ResumeVideoStream()
 {
-	vr::VRDriverLog()->Log("ResumeVideoStream");
+	DRIVER_METRIC_SCOPE(Metric_ResumeVideoStream);
+	DRIVER_TRACE_SCOPE(TraceEvent_ResumeVideoStream);
+	VR_DRIVER_LOG_FORMAT("ResumeVideoStream");
 
 	m_bIsStreamPaused = false;
 	return true;
 }
 
-//static int GetCameraDistortionTimesCalled = 0;
-
 // Called on startup to build distortion mesh. Only used by internal undistortion to generate Room View (directly) and EVRTrackedCameraFrameType 1 and 2.
 bool CameraComponent::GetCameraDistortion(uint32_t nCameraIndex, float flInputU, float flInputV, float* pflOutputU, float* pflOutputV)
 {
-	/*GetCameraDistortionTimesCalled++;
-
-	if (GetCameraDistortionTimesCalled % 10000 == 0)
-	{
-		VR_DRIVER_LOG_FORMAT("CameraComponent: GetCameraDistortion called {} times, cam {}, [{}, {}]", GetCameraDistortionTimesCalled, nCameraIndex, flInputU, flInputV);
-	}*/
+	DRIVER_METRIC_SCOPE(Metric_GetCameraDistortion);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraDistortion, nCameraIndex, flInputU, flInputV);
+	std::shared_lock lock(m_intrinsicsMutex);
 
 	//VR_DRIVER_LOG_FORMAT("CameraComponent: GetCameraDistortion: cam {}, [{}, {}]", nCameraIndex, flInputU, flInputV);
 
-
-	// Radial fisheye lens distortion correction as described here: https://docs.opencv.org/4.x/db/d58/group__calib3d__fisheye.html
-
-	double focalX;
-	double focalY;
-
-	double centerX;
-	double centerY;
-
-	int distIndex = (nCameraIndex == 0) ? 0 : 8;
-
-	if (nCameraIndex == 0)
-	{
-		focalX = m_focalLeftX / (double)m_frameWidth;
-		focalY = m_focalLeftY / (double)m_frameHeight;
-
-		centerX = m_centerLeftX / (double)m_frameWidth - 0.5;
-		centerY = m_centerLeftY / (double)m_frameHeight - 0.5;
-	}
-	else
-	{
-		focalX = m_focalRightX / (double)m_frameWidth;
-		focalY = m_focalRightY / (double)m_frameHeight;
-
-		centerX = m_centerRightX / (double)m_frameWidth - 0.5;
-		centerY = m_centerRightY / (double)m_frameHeight - 0.5;
-	}
-
-	double UScaled = (flInputU - 0.5) * 2.0 / focalX;
-	double VScaled = (flInputV - 0.5) * 2.0 / focalY;
-
-	double radius = sqrt(UScaled * UScaled + VScaled * VScaled);
-
-	double theta = atan(radius);
-
-	double thetaD = theta +
-		m_distortionCoeff[distIndex + 0] * pow(theta, 3) +
-		m_distortionCoeff[distIndex + 1] * pow(theta, 5) +
-		m_distortionCoeff[distIndex + 2] * pow(theta, 7) +
-		m_distortionCoeff[distIndex + 3] * pow(theta, 9);
-
-	double radialFactor = thetaD / radius;
-
-	*pflOutputU = (float)(UScaled * radialFactor * focalX + centerX + 0.5);
-	*pflOutputV = (float)(VScaled * radialFactor * focalY + centerY + 0.5);
-
-	return true;
+	return m_rig.ComputeDistortion(nCameraIndex, flInputU, flInputV, *pflOutputU, *pflOutputV);
 }
 
 // Used for undistorted camera projection by both Room View and IVRTrackedCamera.
 bool CameraComponent::GetCameraProjection(uint32_t nCameraIndex, vr::EVRTrackedCameraFrameType eFrameType, float flZNear, float flZFar, vr::HmdMatrix44_t* pProjection)
 {
-	std::string message = std::format("CameraComponent: GetCameraProjection: {}, {}, {}, {}", nCameraIndex, (int)eFrameType, flZNear, flZFar);
-	vr::VRDriverLog()->Log(message.c_str());
-
-
-	float focalX = (nCameraIndex == 0) ? m_focalLeftX : m_focalRightX;
-	float focalY = (nCameraIndex == 0) ? m_focalLeftY : m_focalRightY;
-
-	float centerX = (nCameraIndex == 0) ? m_centerLeftX : m_centerRightX;
-	float centerY = (nCameraIndex == 0) ? m_centerLeftY : m_centerRightY;
-
-
-	memset(pProjection, 0, sizeof(vr::HmdMatrix44_t));
-
-	(*pProjection).m[0][0] = focalX / (float)m_frameWidth / 2.0f; // Focal length is relative to the entire rendertarget, which means the hoizontal one needs to be halved for side-by side frames.
-	(*pProjection).m[1][1] = focalY / (float)m_frameHeight;
-	(*pProjection).m[0][2] = centerX / (float)m_frameWidth; // The center is even weirder, and the horizontal needs to be 0.5 instead of 0 for a centered FoV.
-	(*pProjection).m[1][2] = centerY / (float)m_frameHeight - 0.5f; // The vertical is 0 for a centered FoV like a regular projection matrix.
-	(*pProjection).m[2][2] = -flZFar / (flZFar - flZNear);
-	(*pProjection).m[2][3] = -flZFar * flZNear / (flZFar - flZNear);
-	(*pProjection).m[3][2] = -1;
-
+	DRIVER_METRIC_SCOPE(Metric_GetCameraProjection);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraProjection, nCameraIndex, (int)eFrameType, flZNear, flZFar);
+	std::shared_lock lock(m_intrinsicsMutex);
+	DRIVER_LOG_RATE_LIMITED(1, "CameraComponent: GetCameraProjection: {}, {}, {}, {}", nCameraIndex, (int)eFrameType, flZNear, flZFar);
 
-	return true;
+	return m_rig.ComputeProjection(nCameraIndex, flZNear, flZFar, *pProjection);
 }
 
 // Does not seem to be called.
 bool CameraComponent::SetFrameRate(int nISPFrameRate, int nSensorFrameRate)
 {
-	std::string message = std::format("CameraComponent: SetFrameRate: {}, {}", nISPFrameRate, nSensorFrameRate);
-	vr::VRDriverLog()->Log(message.c_str());
+	DRIVER_METRIC_SCOPE(Metric_SetFrameRate);
+	DRIVER_TRACE_SCOPE(TraceEvent_SetFrameRate, nISPFrameRate, nSensorFrameRate);
+	VR_DRIVER_LOG_FORMAT("CameraComponent: SetFrameRate: {}, {}", nISPFrameRate, nSensorFrameRate);
 	return true;
 }
 
 // Called before video stream started. Calling back to the function seems to be redundant.
 bool CameraComponent::SetCameraVideoSinkCallback(vr::ICameraVideoSinkCallback* pCameraVideoSinkCallback)
 {
+	DRIVER_METRIC_SCOPE(Metric_SetCameraVideoSinkCallback);
+	DRIVER_TRACE_SCOPE(TraceEvent_SetCameraVideoSinkCallback, pCameraVideoSinkCallback != nullptr);
 	m_pCameraVideoSinkCallback = pCameraVideoSinkCallback;
-	vr::VRDriverLog()->Log("SetCameraVideoSinkCallback");
+	VR_DRIVER_LOG_FORMAT("SetCameraVideoSinkCallback");
 
 	// Requires returning true for room view to start.
 	return true;
@@ -624,15 +1750,18 @@ bool CameraComponent::SetCameraVideoSinkCallback(vr::ICameraVideoSinkCallback* p
 // Does not seem to be called.
 bool CameraComponent::GetCameraCompatibilityMode(vr::ECameraCompatibilityMode* pCameraCompatibilityMode)
 {
-	vr::VRDriverLog()->Log("GetCameraCompatibilityMode");
+	DRIVER_METRIC_SCOPE(Metric_GetCameraCompatibilityMode);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraCompatibilityMode);
+	VR_DRIVER_LOG_FORMAT("GetCameraCompatibilityMode");
 	return true;
 }
 
 // Does not seem to be called.
 bool CameraComponent::SetCameraCompatibilityMode(vr::ECameraCompatibilityMode nCameraCompatibilityMode)
 {
-	std::string message = std::format("CameraComponent: SetCameraCompatibilityMode: {}", (int)nCameraCompatibilityMode);
-	vr::VRDriverLog()->Log(message.c_str());
+	DRIVER_METRIC_SCOPE(Metric_SetCameraCompatibilityMode);
+	DRIVER_TRACE_SCOPE(TraceEvent_SetCameraCompatibilityMode, (int)nCameraCompatibilityMode);
+	VR_DRIVER_LOG_FORMAT("CameraComponent: SetCameraCompatibilityMode: {}", (int)nCameraCompatibilityMode);
 
 	return true;
 }
@@ -640,13 +1769,15 @@ bool CameraComponent::SetCameraCompatibilityMode(vr::ECameraCompatibilityMode nC
 // Used by both Room View and IVRTrackedCamera (only frame type 2 for Room View).
 bool CameraComponent::GetCameraFrameBounds(vr::EVRTrackedCameraFrameType eFrameType, uint32_t* pLeft, uint32_t* pTop, uint32_t* pWidth, uint32_t* pHeight)
 {
-	std::string message = std::format("CameraComponent: GetCameraFrameBounds: {}", (int)eFrameType);
-	vr::VRDriverLog()->Log(message.c_str());
+	DRIVER_METRIC_SCOPE(Metric_GetCameraFrameBounds);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraFrameBounds, (int)eFrameType);
+	std::shared_lock lock(m_intrinsicsMutex);
+	DRIVER_LOG_RATE_LIMITED(1, "CameraComponent: GetCameraFrameBounds: {}", (int)eFrameType);
 
 	*pLeft = 0;
 	*pTop = 0;
-	*pWidth = m_textureWidth;
-	*pHeight = m_textureHeight;
+	*pWidth = m_rig.textureWidth;
+	*pHeight = m_rig.textureHeight;
 
 	return true;
 }
@@ -654,29 +1785,11 @@ bool CameraComponent::GetCameraFrameBounds(vr::EVRTrackedCameraFrameType eFrameT
 // Used by both Room View and IVRTrackedCamera (only frame type 2 for Room View). The distortion parameters seem unused.
 bool CameraComponent::GetCameraIntrinsics(uint32_t nCameraIndex, vr::EVRTrackedCameraFrameType eFrameType, vr::HmdVector2_t* pFocalLength, vr::HmdVector2_t* pCenter, vr::EVRDistortionFunctionType* peDistortionType, double rCoefficients[vr::k_unMaxDistortionFunctionParameters])
 {
-	std::string message = std::format("CameraComponent: GetCameraIntrinsics: {}, {}", nCameraIndex, (int)eFrameType);
-	vr::VRDriverLog()->Log(message.c_str());
-
-	(*pFocalLength).v[0] = (nCameraIndex == 0) ? m_focalLeftX : m_focalRightX;
-	(*pFocalLength).v[1] = (nCameraIndex == 0) ? m_focalLeftY : m_focalRightY;
-
-	(*pCenter).v[0] = (nCameraIndex == 0) ? m_centerLeftX : m_centerRightX;
-	(*pCenter).v[1] = (nCameraIndex == 0) ? m_centerLeftY : m_centerRightY;
-
+	DRIVER_METRIC_SCOPE(Metric_GetCameraIntrinsics);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetCameraIntrinsics, nCameraIndex, (int)eFrameType);
+	std::shared_lock lock(m_intrinsicsMutex);
+	DRIVER_LOG_RATE_LIMITED(1, "CameraComponent: GetCameraIntrinsics: {}, {}", nCameraIndex, (int)eFrameType);
 
-	// Unknown if the below parameters are used or accessible anywhere.
-	int distIndex = (nCameraIndex == 0) ? 0 : 8;
-
-	*peDistortionType = (vr::EVRDistortionFunctionType)m_distortionFunction[nCameraIndex % 2];
-
-	rCoefficients[0] = m_distortionCoeff[distIndex + 0];
-	rCoefficients[1] = m_distortionCoeff[distIndex + 1];
-	rCoefficients[2] = m_distortionCoeff[distIndex + 2];
-	rCoefficients[3] = m_distortionCoeff[distIndex + 3];
-	rCoefficients[4] = m_distortionCoeff[distIndex + 4];
-	rCoefficients[5] = m_distortionCoeff[distIndex + 5];
-	rCoefficients[6] = m_distortionCoeff[distIndex + 6];
-	rCoefficients[7] = m_distortionCoeff[distIndex + 7];
-
-	return true;
+	// Unknown if the distortion parameters are used or accessible anywhere.
+	return m_rig.GetIntrinsics(nCameraIndex, *pFocalLength, *pCenter, *peDistortionType, rCoefficients);
 }
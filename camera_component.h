@@ -1,13 +1,92 @@
 #pragma once
 
+#include "frame_source.h"
+#include "thread_pool.h"
+#include "depth_mesh.h"
+#include "stereo_matcher.h"
+#include "stereo_rectify.h"
+#include "frame_sink.h"
+#include "frame_ring.h"
+#include "frame_arena.h"
+#include "sensor_isp.h"
+#include "bayer.h"
+#include "frame_pack.h"
+#include "frame_metadata.h"
+
+
+enum EJitterProfile
+{
+	JitterProfile_None = 0,
+	JitterProfile_Uniform,
+	JitterProfile_Gaussian,
+};
+
+// Stereo matching of the first two cameras after each frame is rendered.
+enum EStereoMode
+{
+	StereoMode_Off = 0,
+	StereoMode_Measure,
+	StereoMode_View, // Replaces the second camera view with the disparity map.
+};
+
+// Block queue the runtime reads the HMD camera frames from.
+#define CAMERA_QUEUE_PATH "/lighthouse/camera/raw_frames"
+
+// Identity of one simulated camera. The HMD camera is instance 0, and the load test cameras follow it.
+// Each instance takes its frame buffers from its own partition of the shared frame arena.
+// The set optional fields override the openvr_camera_sim_camera settings.
+struct CameraInstanceSettings
+{
+	uint32_t index = 0;
+
+	std::string queuePath = CAMERA_QUEUE_PATH;
+	std::optional<std::string> frameSource;
+	std::optional<double> frameRate;
+	std::optional<double> framePhase;
+};
+
+struct CameraIntrinsicsUpdate
+{
+	uint32_t cameraIndex;
+	float focalX;
+	float focalY;
+	float centerX;
+	float centerY;
+	bool bHasDistortion;
+	double distortion[4];
+};
+
+// Stream changes requested at runtime. Only the set fields are applied, at the next frame boundary.
+struct StreamReconfiguration
+{
+	std::optional<double> frameRate;
+	std::unique_ptr<FrameSource> frameSource;
+	std::optional<double> latency;
+	std::optional<double> jitter;
+	std::optional<EJitterProfile> jitterProfile;
+	std::optional<std::pair<uint32_t, uint32_t>> frameSize;
+	std::optional<double> readoutTime;
+	std::optional<uint32_t> numCameras;
+	std::optional<ERigFrameLayout> frameLayout;
+	std::optional<EStereoMode> stereoMode;
+	std::optional<bool> stereoRectify;
+	std::optional<SensorIspSettings> ispSettings;
+	std::optional<EBayerFormat> rawFormat;
+	std::optional<EPackFormat> packFormat;
+	std::vector<CameraIntrinsicsUpdate> intrinsics;
+};
+
 
 class CameraComponent : public vr::IVRCameraComponent
 {
 public:
 
-	CameraComponent();
+	CameraComponent(const CameraInstanceSettings& instance, ThreadPool& renderPool);
 	~CameraComponent();
 
+	// Starts the render workers shared by all instances, according to the render_threads setting.
+	static void StartRenderPool(ThreadPool& pool);
+
 	bool Init(vr::TrackedDeviceIndex_t HMDDeviceId);
 	void Deinit();
 
@@ -16,6 +95,11 @@ public:
 		return m_cameraName;
 	}
 
+	bool HandleDebugCommand(const std::string& request, std::string& response);
+
+	// The requests HandleDebugCommand takes, as comma separated JSON strings for the unknown request responses.
+	static std::string GetDebugRequestListJson();
+
 	// Inherited from IVRCameraComponent
 	virtual bool GetCameraFrameDimensions(vr::ECameraVideoStreamFormat nVideoStreamFormat, uint32_t* pWidth, uint32_t* pHeight) override;
 	virtual bool GetCameraFrameBufferingRequirements(int* pDefaultFrameQueueSize, uint32_t* pFrameBufferDataSize) override;
@@ -41,10 +125,26 @@ public:
 
 protected:
 	void ServeFrames();
+	void RenderFrames();
+	bool StartRenderThread();
+	bool StopRenderThread();
+	void ReleaseRenderBuffers();
+	void PublishCameraProperties();
+	bool CreateFrameQueue();
+	uint32_t GetServedBytesPerPixel() const;
+	int32_t GetServedFormat() const;
+	void MosaicFrame(RenderedFrame* pFrame);
+	void PackFrame(RenderedFrame* pFrame);
+	void ApplyPendingReconfiguration();
+	void ApplyPendingReconfigurationLocked();
+	void ComputeStereo(uint8_t* pBuffer);
+	void SleepUntil(int64_t targetTicks);
+	int64_t SampleDeliveryJitterTicks();
 
 	bool m_bIsInitialized = false;
-	bool m_bIsStreamActive = false;
-	bool m_bIsStreamPaused = false;
+	// Written by the runtime, and read by the serving thread and debug requests.
+	std::atomic<bool> m_bIsStreamActive = false;
+	std::atomic<bool> m_bIsStreamPaused = false;
 
 	vr::TrackedDeviceIndex_t m_HMDDeviceId = -1;
 	int m_deviceNum = 0;
@@ -52,25 +152,88 @@ protected:
 	vr::ECameraVideoStreamFormat m_streamFormat = vr::CVS_FORMAT_UNKNOWN;
 	std::string m_cameraName;
 
-	uint32_t m_textureWidth = 0;
-	uint32_t m_textureHeight = 0;
 	uint32_t m_textureBPP = 0;
 
-	uint32_t m_frameWidth = 0;
-	uint32_t m_frameHeight = 0;
+	// Camera count, frame layout, intrinsics and extrinsics.
+	CameraRig m_rig;
+
+	// Guards the rig against runtime reconfiguration.
+	std::shared_mutex m_intrinsicsMutex;
+
+	double m_frameRate = 60.0;
+
+	// Offset of the frame deadlines from the scheduler timeline, in seconds.
+	double m_framePhase = 0.0;
 
-	float m_focalLeftX = 0;
-	float m_focalLeftY = 0;
-	float m_centerLeftX = 0;
-	float m_centerLeftY = 0;
+	double m_latency = 0.040;
+	double m_jitter = 0.0;
+	EJitterProfile m_jitterProfile = JitterProfile_None;
+	std::mt19937 m_jitterRng;
 
-	float m_focalRightX = 0;
-	float m_focalRightY = 0;
-	float m_centerRightX = 0;
-	float m_centerRightY = 0;
+	// Rolling shutter readout duration in seconds. Zero for a global shutter.
+	double m_readoutTime = 0.0;
 
-	std::vector<int32_t> m_distortionFunction;
-	std::vector<double> m_distortionCoeff;
+	std::unique_ptr<FrameSource> m_frameSource;
+
+	CameraInstanceSettings m_instance;
+
+	// Renders row bands of the frame in parallel. Shared by all instances, which take turns.
+	ThreadPool& m_renderPool;
+
+	// Partition of the shared frame arena for this instance.
+	FrameArena& m_frameArena;
+
+	// Frames rendered ahead of their deadlines, owned by the render thread until ready.
+	FrameRing m_frameRing;
+	std::thread m_frameRenderThread;
+	std::atomic<bool> m_bRunRenderThread = false;
+
+	// Set when the render thread returns, which it also does on its own if the ring has no slots.
+	std::atomic<bool> m_bRenderThreadExited = false;
+
+	bool m_bDepthMeshEnabled = false;
+	double m_depthMeshRate = 30.0;
+	DepthMeshProducer m_depthMesh;
+
+	// IVRIOBuffer sinks fed from the ring frame after the block queue block is released.
+	FrameFanout m_frameFanout;
+
+	// Exposure, white balance, lens shading and noise applied to the rendered frames.
+	SensorIsp m_sensorIsp;
+
+	EStereoMode m_stereoMode = StereoMode_Off;
+	StereoMatcher m_stereoMatcher;
+
+	// Rectifies the first two views before matching. The maps are rebuilt on the next match after the rig changes.
+	bool m_bStereoRectify = false;
+	bool m_bRectifyMapsDirty = true;
+	StereoRectifier m_stereoRectifier;
+
+	// Arena slot holding the two rectified views, taken when the render thread starts with rectification enabled.
+	uint8_t* m_pRectifiedViews = nullptr;
+
+	// Frames are published as a Bayer mosaic of the rendered RGBX frame unless this is BayerFormat_None.
+	EBayerFormat m_rawFormat = BayerFormat_None;
+	BayerConverter m_bayerConverter;
+
+	// Frames are packed into this format, unless served as a Bayer mosaic. The packer kernel is picked when the render thread starts.
+	EPackFormat m_packFormat = PackFormat_RGBX32;
+	FramePacker m_framePacker;
+
+	// Arena slot the mosaic or packed frame is written into, which is then swapped with the ring slot of the frame.
+	uint8_t* m_pStagingFrame = nullptr;
+
+	// Copy of the latest matcher results for debug requests.
+	std::mutex m_stereoStatsMutex;
+	StereoStats m_stereoStats = {};
+	double m_stereoRectifyMs = 0.0;
+
+	std::mutex m_pendingReconfigurationMutex;
+
+	// Held while applying changes, and while the stream starts, so a debug request applies either before the serving thread or through it.
+	std::mutex m_applyReconfigurationMutex;
+	StreamReconfiguration m_pendingReconfiguration;
+	std::atomic<bool> m_bHasPendingReconfiguration = false;
 
 	uint64_t m_frameCount = 0;
 
@@ -94,10 +257,13 @@ protected:
 
 	vr::PropertyContainerHandle_t m_rawFrameQueue = 0;
 
-	vr::PathHandle_t m_frameSequenceHandle;
-	vr::PathHandle_t m_frameSizeHandle;
-	vr::PathHandle_t m_frameTimeMonotonicHandle;
-	vr::PathHandle_t m_serverTimeTicksHandle;
-	vr::PathHandle_t m_deliveryRateHandle;
-	vr::PathHandle_t m_elapsedTimeHandle;
+	// Block queue creation parameters. Every reader holding a block takes one out of rotation for the publisher.
+	uint32_t m_queueBlockCount = 4;
+	uint32_t m_queueHeaderSize = 512;
+
+	FrameMetadataPaths m_metadataPaths;
+
+	// Per-frame metadata of the served frame, and the path batch pointing into it. Only used by the serving thread.
+	FrameMetadata m_frameMetadata = {};
+	vr::PathWrite_t m_metadataWrite[FRAME_METADATA_WRITES] = {};
 };
\ No newline at end of file
@@ -1,16 +1,49 @@
 
 #include "pch.h"
 #include "camera_device.h"
+#include "driver_metrics.h"
+#include "driver_trace.h"
+#include "driver_scheduler.h"
+#include "driver_threads.h"
+#include "head_motion.h"
 
 
 
-#define FRAME_RATE 60;
+#define FRAME_RATE 60
 #define DISPLAY_CONFIG "openvr_camera_sim_display"
 
-CameraDevice::CameraDevice()
+
+struct DeviceDebugRequest
+{
+	const char* pName;
+	bool bTakesArgument;
+	std::string (*pHandler)(const std::string& argument);
+};
+
+// Driver wide debug requests taken by the HMD. Others go to the camera component, and unknown ones are answered with both lists.
+static const DeviceDebugRequest g_deviceDebugRequests[] =
+{
+	{ "metrics", false, [](const std::string&) { return g_driverMetrics.SnapshotJson(); } },
+	{ "metrics_reset", false, [](const std::string&) -> std::string { g_driverMetrics.Reset(); return "{\"result\":\"ok\"}"; } },
+	{ "log_stats", false, [](const std::string&) { return g_driverLog.GetStatsJson(); } },
+
+	// An empty path records to the default file in the temp directory.
+	{ "trace_start", true, [](const std::string& path) -> std::string
+		{
+			return g_driverTrace.Start(path) ? g_driverTrace.GetStatsJson() : "{\"error\":\"already recording or failed to open the trace file\"}";
+		} },
+	{ "trace_stop", false, [](const std::string&) { g_driverTrace.Stop(); return g_driverTrace.GetStatsJson(); } },
+	{ "trace_stats", false, [](const std::string&) { return g_driverTrace.GetStatsJson(); } },
+	{ "threads", false, [](const std::string&) { return g_driverThreads.GetStatusJson(); } },
+	{ "threads_reset", false, [](const std::string&) -> std::string { g_driverThreads.Reset(); return "{\"result\":\"ok\"}"; } },
+	{ "scheduler", false, [](const std::string&) { return g_driverScheduler.GetStatusJson(); } },
+	{ "scheduler_reset", false, [](const std::string&) -> std::string { g_driverScheduler.Reset(); return "{\"result\":\"ok\"}"; } },
+};
+
+CameraDevice::CameraDevice(ThreadPool& renderPool)
 	: m_deviceId(-1)
 {
-	m_cameraComponent = std::make_unique<CameraComponent>();
+	m_cameraComponent = std::make_unique<CameraComponent>(CameraInstanceSettings(), renderPool);
 	//m_displayComponent = std::make_unique<CameraDisplayComponent>();
 
 	m_windowPosX = vr::VRSettings()->GetInt32(DISPLAY_CONFIG, "window_x");
@@ -22,11 +55,18 @@ CameraDevice::CameraDevice()
 	m_renderWidth = vr::VRSettings()->GetInt32(DISPLAY_CONFIG, "render_width");
 	m_renderHeight = vr::VRSettings()->GetInt32(DISPLAY_CONFIG, "render_height");
 
-	QueryPerformanceCounter(&m_lastVsync);
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+	float posePhaseMs = vr::VRSettings()->GetFloat(DISPLAY_CONFIG, "pose_phase_ms", &settingsError);
+	m_posePhase = (settingsError == vr::VRSettingsError_None) ? posePhaseMs / 1000.0 : 0.0;
+
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+	m_lastVsyncTicks = currTime.QuadPart;
 };
 
 vr::EVRInitError CameraDevice::Activate(uint32_t unObjectId) 
 {
+	DRIVER_TRACE_SCOPE(TraceEvent_DeviceActivate, unObjectId);
 
 	std::string message = std::format("CameraDevice::Activate: {}", unObjectId);
 	vr::VRDriverLog()->Log(message.c_str());
@@ -112,20 +152,27 @@ vr::EVRInitError CameraDevice::Activate(uint32_t unObjectId)
 	vr::VRDriverInput()->CreateBooleanComponent(container, "/input/system/touch", &m_inputHandles[0]);
 	vr::VRDriverInput()->CreateBooleanComponent(container, "/input/system/click", &m_inputHandles[1]);
 
-	m_bRunThread = true;
-	m_poseThread = std::thread(&CameraDevice::RunPoseThread, this);
+	// Both run on the scheduler timeline, so the poses go out at a fixed phase from the simulated vsync,
+	// in the same wake-up when the phase is zero.
+	m_vsyncTask = g_driverScheduler.AddPeriodicTask("vsync", FRAME_RATE, 0.0, [this](int64_t deadlineTicks) { PublishVsync(deadlineTicks); });
+	m_poseTask = g_driverScheduler.AddPeriodicTask("pose", FRAME_RATE, m_posePhase, [this](int64_t) { PublishPose(); });
 	
 	return vr::VRInitError_None;
 }
 
-void CameraDevice::RunPoseThread()
+void CameraDevice::PublishPose()
 {
-	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	DRIVER_TRACE_SCOPE(TraceEvent_PoseUpdated, m_deviceId);
+	vr::VRServerDriverHost()->TrackedDevicePoseUpdated(m_deviceId, GetPose(), sizeof(vr::DriverPose_t));
+}
 
-	while (m_bRunThread)
+// Simulated vsync for when the compositor doesn't wait for it. Waiting presents take the vsync time from WaitForPresent instead.
+void CameraDevice::PublishVsync(int64_t vsyncTicks)
+{
+	if (m_bHasVSyncTime && !m_bWaitForVSync)
 	{
-		vr::VRServerDriverHost()->TrackedDevicePoseUpdated(m_deviceId, GetPose(), sizeof(vr::DriverPose_t));
-		std::this_thread::sleep_for(std::chrono::milliseconds(16));
+		m_lastVsyncTicks = vsyncTicks;
+		m_frameCount++;
 	}
 }
 
@@ -155,22 +202,30 @@ void CameraDevice::HandleEvent(const vr::VREvent_t& vrevent)
 
 bool CameraDevice::IsDisplayOnDesktop()
 {
+	DRIVER_METRIC_SCOPE(Metric_IsDisplayOnDesktop);
+	DRIVER_TRACE_SCOPE(TraceEvent_IsDisplayOnDesktop);
 	return false;
 }
 
 bool CameraDevice::IsDisplayRealDisplay()
 {
+	DRIVER_METRIC_SCOPE(Metric_IsDisplayRealDisplay);
+	DRIVER_TRACE_SCOPE(TraceEvent_IsDisplayRealDisplay);
 	return false;
 }
 
 void CameraDevice::GetRecommendedRenderTargetSize(uint32_t* pnWidth, uint32_t* pnHeight)
 {
+	DRIVER_METRIC_SCOPE(Metric_GetRecommendedRenderTargetSize);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetRecommendedRenderTargetSize);
 	*pnWidth = m_renderWidth;
 	*pnHeight = m_renderHeight;
 }
 
 void CameraDevice::GetEyeOutputViewport(vr::EVREye eEye, uint32_t* pnX, uint32_t* pnY, uint32_t* pnWidth, uint32_t* pnHeight)
 {
+	DRIVER_METRIC_SCOPE(Metric_GetEyeOutputViewport);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetEyeOutputViewport, (int)eEye);
 	*pnX = (eEye == vr::Eye_Left) ? 0 : m_renderWidth;
 	*pnY = 0;
 
@@ -180,6 +235,8 @@ void CameraDevice::GetEyeOutputViewport(vr::EVREye eEye, uint32_t* pnX, uint32_t
 
 void CameraDevice::GetProjectionRaw(vr::EVREye eEye, float* pfLeft, float* pfRight, float* pfTop, float* pfBottom)
 {
+	DRIVER_METRIC_SCOPE(Metric_GetProjectionRaw);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetProjectionRaw, (int)eEye);
 	*pfLeft = -1.0;
 	*pfRight = 1.0;
 	*pfTop = -1.0;
@@ -188,6 +245,8 @@ void CameraDevice::GetProjectionRaw(vr::EVREye eEye, float* pfLeft, float* pfRig
 
 vr::DistortionCoordinates_t CameraDevice::ComputeDistortion(vr::EVREye eEye, float fU, float fV)
 {
+	DRIVER_METRIC_SCOPE(Metric_ComputeDistortion);
+	DRIVER_TRACE_SCOPE(TraceEvent_ComputeDistortion, (int)eEye, fU, fV);
 	vr::DistortionCoordinates_t coordinates{};
 	coordinates.rfBlue[0] = fU;
 	coordinates.rfBlue[1] = fV;
@@ -200,6 +259,8 @@ vr::DistortionCoordinates_t CameraDevice::ComputeDistortion(vr::EVREye eEye, flo
 
 void CameraDevice::GetWindowBounds(int32_t* pnX, int32_t* pnY, uint32_t* pnWidth, uint32_t* pnHeight)
 {
+	DRIVER_METRIC_SCOPE(Metric_GetWindowBounds);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetWindowBounds);
 	*pnX = 0;
 	*pnY = 0;
 
@@ -210,26 +271,37 @@ void CameraDevice::GetWindowBounds(int32_t* pnX, int32_t* pnY, uint32_t* pnWidth
 
 bool CameraDevice::ComputeInverseDistortion(vr::HmdVector2_t* pResult, vr::EVREye eEye, uint32_t unChannel, float fU, float fV)
 {
+	DRIVER_METRIC_SCOPE(Metric_ComputeInverseDistortion);
+	DRIVER_TRACE_SCOPE(TraceEvent_ComputeInverseDistortion, (int)eEye, unChannel, fU, fV);
 	return false;
 }
 
 void CameraDevice::Deactivate() 
 {
+	DRIVER_TRACE_SCOPE(TraceEvent_DeviceDeactivate);
 	vr::VRDriverLog()->Log("Deactivate");
 
-	if (m_bRunThread.exchange(false))
+	if (m_poseTask != 0)
+	{
+		g_driverScheduler.RemoveTask(m_poseTask);
+		m_poseTask = 0;
+	}
+	if (m_vsyncTask != 0)
 	{
-		m_poseThread.join();
+		g_driverScheduler.RemoveTask(m_vsyncTask);
+		m_vsyncTask = 0;
 	}
 }
 
 void CameraDevice::EnterStandby() 
 {
+	DRIVER_TRACE_SCOPE(TraceEvent_DeviceEnterStandby);
 	vr::VRDriverLog()->Log("EnterStandby");
 }
 
 void* CameraDevice::GetComponent(const char* pchComponentNameAndVersion) 
 {
+	DRIVER_TRACE_SCOPE(TraceEvent_DeviceGetComponent, pchComponentNameAndVersion);
 	if (strcmp(pchComponentNameAndVersion, vr::IVRCameraComponent_Version) == 0)
 	{
 		vr::VRDriverLog()->Log("GetComponent: IVRCameraComponent");
@@ -268,59 +340,71 @@ void* CameraDevice::GetComponent(const char* pchComponentNameAndVersion)
 
 void CameraDevice::DebugRequest(const char* pchRequest, char* pchResponseBuffer, uint32_t unResponseBufferSize) 
 {
+	DRIVER_TRACE_SCOPE(TraceEvent_DeviceDebugRequest, unResponseBufferSize, pchRequest);
 	VR_DRIVER_LOG_FORMAT("DebugRequest: {} {}", pchRequest, unResponseBufferSize);
-	if (unResponseBufferSize >= 1)
+
+	if (unResponseBufferSize < 1)
 	{
-		pchResponseBuffer[0] = 0;
+		return;
 	}
-}
 
-// 3x3 or 3x4 matrix
-template < class T >
-vr::HmdQuaternion_t HmdQuaternion_FromMatrix(const T& matrix)
-{
-	vr::HmdQuaternion_t q{};
+	std::string request = pchRequest;
+	size_t separator = request.find(' ');
+	std::string name = request.substr(0, separator);
+	std::string argument = (separator != std::string::npos) ? request.substr(separator + 1) : "";
 
-	q.w = sqrt(fmax(0, 1 + matrix.m[0][0] + matrix.m[1][1] + matrix.m[2][2])) / 2;
-	q.x = sqrt(fmax(0, 1 + matrix.m[0][0] - matrix.m[1][1] - matrix.m[2][2])) / 2;
-	q.y = sqrt(fmax(0, 1 - matrix.m[0][0] + matrix.m[1][1] - matrix.m[2][2])) / 2;
-	q.z = sqrt(fmax(0, 1 - matrix.m[0][0] - matrix.m[1][1] + matrix.m[2][2])) / 2;
+	std::string response;
 
-	q.x = copysign(q.x, matrix.m[2][1] - matrix.m[1][2]);
-	q.y = copysign(q.y, matrix.m[0][2] - matrix.m[2][0]);
-	q.z = copysign(q.z, matrix.m[1][0] - matrix.m[0][1]);
+	const DeviceDebugRequest* pDeviceRequest = std::find_if(std::begin(g_deviceDebugRequests), std::end(g_deviceDebugRequests),
+		[&](const DeviceDebugRequest& deviceRequest) { return name == deviceRequest.pName && (deviceRequest.bTakesArgument || separator == std::string::npos); });
 
-	return q;
-}
+	if (pDeviceRequest != std::end(g_deviceDebugRequests))
+	{
+		response = pDeviceRequest->pHandler(argument);
+	}
+	else if (!m_cameraComponent->HandleDebugCommand(pchRequest, response))
+	{
+		std::string requests;
+		for (const DeviceDebugRequest& deviceRequest : g_deviceDebugRequests)
+		{
+			requests += std::format("\"{}\",", deviceRequest.pName);
+		}
+		response = std::format("{{\"error\":\"unknown request\",\"requests\":[{}{}]}}", requests, CameraComponent::GetDebugRequestListJson());
+	}
 
-vr::DriverPose_t CameraDevice::GetPose() 
-{
-	vr::DriverPose_t pose = { 0 };
+	// Report the required size rather than sending truncated JSON.
+	if (response.size() >= unResponseBufferSize)
+	{
+		response = std::format("{{\"error\":\"response buffer too small\",\"required_size\":{}}}", response.size() + 1);
+	}
 
-	pose.poseIsValid = true;
-	pose.result = vr::TrackingResult_Running_OK;
-	pose.deviceIsConnected = true;
-	pose.shouldApplyHeadModel = true;
+	if (response.size() >= unResponseBufferSize)
+	{
+		pchResponseBuffer[0] = 0;
+		return;
+	}
 
-	pose.qWorldFromDriverRotation.w = 1.f;
-	pose.qDriverFromHeadRotation.w = 1.f;
+	memcpy(pchResponseBuffer, response.c_str(), response.size() + 1);
+}
 
-	//pose.qRotation.w = fmod(m_frameCount * 0.0001, 2.0) - 1.0;
-	//pose.qRotation.y = sqrt(1.0 - pose.qRotation.w * pose.qRotation.w);
-	pose.qRotation.w = sin(m_frameCount * 0.0001);
-	pose.qRotation.y = cos(m_frameCount * 0.0001);
-	//pose.qRotation.w = 1.0;
-	//pose.qRotation.y = 0.0;
+vr::DriverPose_t CameraDevice::GetPose() 
+{
+	DRIVER_TRACE_SCOPE(TraceEvent_DeviceGetPose);
 
-	pose.vecPosition[1] = 1.5;
-	
-	pose.vecAngularVelocity[1] = -0.001;
+	// The clock is only needed for the simulated head motion.
+	LARGE_INTEGER currTime = {};
+	if (g_headMotion.IsEnabled())
+	{
+		QueryPerformanceCounter(&currTime);
+	}
 
-	return pose;
+	return g_headMotion.GetDriverPose(currTime.QuadPart, m_frameCount);
 }
 
 void CameraDevice::Present(const vr::PresentInfo_t* pPresentInfo, uint32_t unPresentInfoSize)
 {
+	DRIVER_METRIC_SCOPE(Metric_Present);
+	DRIVER_TRACE_SCOPE(TraceEvent_Present, (int)pPresentInfo->vsync, pPresentInfo->nFrameId, pPresentInfo->flVSyncTimeInSeconds);
 	//vr::VRDriverLog()->Log("Present()");
 
 	//std::string info = std::format("VSyncTime: {}, FrameId: {}, Vsync: {}, size: {}", pPresentInfo->flVSyncTimeInSeconds, pPresentInfo->nFrameId, (int)pPresentInfo->vsync, unPresentInfoSize);
@@ -333,6 +417,8 @@ void CameraDevice::Present(const vr::PresentInfo_t* pPresentInfo, uint32_t unPre
 
 void CameraDevice::WaitForPresent()
 {
+	DRIVER_METRIC_SCOPE(Metric_WaitForPresent);
+	DRIVER_TRACE_SCOPE(TraceEvent_WaitForPresent);
 	//vr::VRDriverLog()->Log("WaitForPresent()");
 
 	//Sleep(10);
@@ -340,27 +426,20 @@ void CameraDevice::WaitForPresent()
 	
 	if (!m_bHasVSyncTime || m_bWaitForVSync)
 	{
-		m_bHasVSyncTime = true;
-		QueryPerformanceCounter(&m_lastVsync);
-		m_frameCount++;
-	}
-	else
-	{
-		LARGE_INTEGER perfFrequency, currTime;
-		QueryPerformanceFrequency(&perfFrequency);
-
+		LARGE_INTEGER currTime;
 		QueryPerformanceCounter(&currTime);
 
-		uint64_t frameIntervalTicks = perfFrequency.QuadPart / FRAME_RATE;
-		uint64_t framesElaped = max((currTime.QuadPart - m_lastVsync.QuadPart) / frameIntervalTicks, 0);
-		m_lastVsync.QuadPart += framesElaped * frameIntervalTicks;
-		m_frameCount += framesElaped;
+		m_bHasVSyncTime = true;
+		m_lastVsyncTicks = currTime.QuadPart;
+		m_frameCount++;
 	}
 
 }
 
 bool CameraDevice::GetTimeSinceLastVsync(float* pfSecondsSinceLastVsync, uint64_t* pulFrameCounter)
 {
+	DRIVER_METRIC_SCOPE(Metric_GetTimeSinceLastVsync);
+	DRIVER_TRACE_SCOPE(TraceEvent_GetTimeSinceLastVsync);
 	//vr::VRDriverLog()->Log("GetTimeSinceLastVsync()");
 
 	LARGE_INTEGER currTime, perfFrequency;
@@ -368,7 +447,7 @@ bool CameraDevice::GetTimeSinceLastVsync(float* pfSecondsSinceLastVsync, uint64_
 	QueryPerformanceCounter(&currTime);
 	QueryPerformanceFrequency(&perfFrequency);
 
-	*pfSecondsSinceLastVsync = (currTime.QuadPart - m_lastVsync.QuadPart) / (float)perfFrequency.QuadPart;
+	*pfSecondsSinceLastVsync = (currTime.QuadPart - m_lastVsyncTicks) / (float)perfFrequency.QuadPart;
 	*pulFrameCounter = m_frameCount;
 
 	//std::string info = std::format("pfSecondsSinceLastVsync: {}", *pfSecondsSinceLastVsync);
@@ -9,7 +9,9 @@
 class CameraDevice : public vr::ITrackedDeviceServerDriver, public vr::IVRDisplayComponent, public vr::IVRVirtualDisplay
 {
 public:
-	CameraDevice();
+	// The camera component is instance 0, ahead of the LoadTestSettings::numCameras load test cameras. It renders on the shared
+	// render pool, and takes its frame buffers from partition 0 of the shared frame arena.
+	CameraDevice(ThreadPool& renderPool);
 
 	virtual vr::EVRInitError Activate(uint32_t unObjectId) override;
 	virtual void Deactivate() override;
@@ -18,7 +20,8 @@ public:
 	virtual void DebugRequest(const char* pchRequest, char* pchResponseBuffer, uint32_t unResponseBufferSize) override;
 	virtual vr::DriverPose_t GetPose() override;
 
-	void RunPoseThread();
+	void PublishPose();
+	void PublishVsync(int64_t vsyncTicks);
 	void RunFrame();
 	void HandleEvent(const vr::VREvent_t& vrevent);
 
@@ -43,18 +46,20 @@ private:
 	std::unique_ptr<DisplayWindow> m_window;
 	std::shared_ptr<D3D11Renderer> m_renderer;
 
-	std::thread m_poseThread;
-	std::atomic<bool> m_bRunThread = true;
+	// Periodic tasks on the driver scheduler.
+	uint32_t m_poseTask = 0;
+	uint32_t m_vsyncTask = 0;
+	double m_posePhase = 0.0;
 	std::atomic<int> m_frameNumber = 0;
 
 	vr::TrackedDeviceIndex_t m_deviceId = -1;
 
 	std::array<vr::VRInputComponentHandle_t, 2> m_inputHandles{};
 
-	bool m_bWaitForVSync = false;
-	bool m_bHasVSyncTime = false;
-	LARGE_INTEGER m_lastVsync;
-	uint64_t m_frameCount = 0;
+	std::atomic<bool> m_bWaitForVSync = false;
+	std::atomic<bool> m_bHasVSyncTime = false;
+	std::atomic<int64_t> m_lastVsyncTicks = 0;
+	std::atomic<uint64_t> m_frameCount = 0;
 
 	int32_t m_windowPosX = 0;
 	int32_t m_windowPosY = 0;
@@ -0,0 +1,276 @@
+// Shared memory interface for feeding frames from another process into the simulated camera.
+// Used both by the driver and by producers, so it only depends on the Windows and standard headers.
+//
+// The driver creates the mapping when the "inject" frame source is active, and writes the frame layout it expects into the header.
+// A producer writes whole frame textures into one of the slots, and publishes the slot as the latest frame.
+// On each frame the driver pins the latest slot and copies it out, so the producer never waits on the driver.
+//
+// The handshake uses a sequence number per slot, odd while the producer writes to it:
+//
+//   Producer: bump the sequence of a slot that is neither the latest nor pinned to odd, then check the pin again.
+//             If the driver pinned it in between, the sequence is restored and another slot is tried.
+//             Write the frame, bump the sequence to even and store the slot as the latest.
+//
+//   Driver:   pin the latest slot, then read its sequence. If it is odd the producer got there first, so try again.
+//
+// Both sides store before loading with sequentially consistent atomics, so at least one of them sees the other,
+// and with three slots there is always one the producer can write to. No kernel calls are made on either side after setup.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+
+#define CAMERA_INJECT_MAPPING_NAME L"Local\\openvr_camera_sim_inject"
+#define CAMERA_INJECT_MAGIC 0x4A4E4943 // "CINJ"
+#define CAMERA_INJECT_VERSION 1
+
+#define CAMERA_INJECT_SLOTS 3
+#define CAMERA_INJECT_MAX_CAMERAS 4
+#define CAMERA_INJECT_NO_SLOT 0xFFFFFFFF
+
+// Frame data starts at this offset, and each slot is aligned to it.
+#define CAMERA_INJECT_DATA_ALIGNMENT 4096
+
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && sizeof(std::atomic<int64_t>) == sizeof(int64_t),
+	"The shared atomics need to be plain integers");
+
+
+struct CameraInjectRegion
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+// Frame texture layout expected by the driver. The producer writes whole textures with the cameras in their regions.
+struct CameraInjectLayout
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesPerPixel;
+	uint32_t rowStride;
+
+	// vr::ECameraVideoStreamFormat, CVS_FORMAT_RGBX32 (8) is RGBA byte order.
+	uint32_t format;
+
+	uint32_t numCameras;
+	CameraInjectRegion regions[CAMERA_INJECT_MAX_CAMERAS];
+
+	// Changes whenever the layout does. Frames written for an older layout are ignored.
+	uint32_t generation;
+};
+
+struct alignas(64) CameraInjectSlot
+{
+	// Odd while the producer writes the slot.
+	std::atomic<uint32_t> sequence;
+	uint32_t layoutGeneration;
+
+	// QueryPerformanceCounter time of the exposure start, or zero to let the driver time the frame.
+	int64_t exposureTicks;
+	uint64_t frameNumber;
+};
+
+struct CameraInjectHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numSlots;
+	uint32_t dataOffset;
+	uint64_t slotStride;
+	uint64_t slotCapacity;
+
+	// Written by the driver. Odd while the layout is being changed.
+	alignas(64) std::atomic<uint32_t> layoutSequence;
+	CameraInjectLayout layout;
+
+	// Written by the producer.
+	alignas(64) std::atomic<uint32_t> latestSlot;
+	std::atomic<uint64_t> framesPublished;
+
+	// Written by the driver.
+	alignas(64) std::atomic<uint32_t> pinnedSlot;
+	std::atomic<int64_t> lastReadTicks;
+	std::atomic<uint64_t> framesRead;
+
+	CameraInjectSlot slots[CAMERA_INJECT_SLOTS];
+};
+
+
+inline uint64_t CameraInjectMappingSize(uint64_t slotCapacity)
+{
+	uint64_t slotStride = (slotCapacity + CAMERA_INJECT_DATA_ALIGNMENT - 1) / CAMERA_INJECT_DATA_ALIGNMENT * CAMERA_INJECT_DATA_ALIGNMENT;
+	return CAMERA_INJECT_DATA_ALIGNMENT + slotStride * CAMERA_INJECT_SLOTS;
+}
+
+inline uint8_t* CameraInjectSlotData(CameraInjectHeader* pHeader, uint32_t slot)
+{
+	return (uint8_t*)pHeader + pHeader->dataOffset + pHeader->slotStride * slot;
+}
+
+// Reads a consistent copy of the layout. Fails while the driver is changing it.
+inline bool CameraInjectReadLayout(const CameraInjectHeader* pHeader, CameraInjectLayout& outLayout)
+{
+	uint32_t sequence = pHeader->layoutSequence.load(std::memory_order_acquire);
+	if (sequence & 1)
+	{
+		return false;
+	}
+
+	memcpy(&outLayout, (const void*)&pHeader->layout, sizeof(outLayout));
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	return pHeader->layoutSequence.load(std::memory_order_relaxed) == sequence;
+}
+
+
+// Producer side of the injection mapping.
+//
+//   CameraInjectProducer producer;
+//   producer.Open();
+//   CameraInjectLayout layout;
+//   uint8_t* pFrame = producer.BeginFrame(layout);
+//   ... write layout.height rows of layout.rowStride bytes ...
+//   producer.EndFrame(exposureTicks);
+class CameraInjectProducer
+{
+public:
+	~CameraInjectProducer()
+	{
+		Close();
+	}
+
+	// Fails if the driver isn't running with the inject frame source.
+	bool Open()
+	{
+		Close();
+
+		m_hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, CAMERA_INJECT_MAPPING_NAME);
+		if (m_hMapping == nullptr)
+		{
+			return false;
+		}
+
+		m_pHeader = (CameraInjectHeader*)MapViewOfFile(m_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+		if (m_pHeader == nullptr || m_pHeader->magic != CAMERA_INJECT_MAGIC || m_pHeader->version != CAMERA_INJECT_VERSION)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_writeSlot != CAMERA_INJECT_NO_SLOT)
+		{
+			CancelFrame();
+		}
+		if (m_pHeader != nullptr)
+		{
+			UnmapViewOfFile(m_pHeader);
+			m_pHeader = nullptr;
+		}
+		if (m_hMapping != nullptr)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = nullptr;
+		}
+	}
+
+	bool IsOpen() const { return m_pHeader != nullptr; }
+
+	// QueryPerformanceCounter time the driver last read a frame, to tell whether anything is consuming them.
+	int64_t GetLastReadTicks() const
+	{
+		return m_pHeader ? m_pHeader->lastReadTicks.load(std::memory_order_relaxed) : 0;
+	}
+
+	// Claims a slot for the next frame and returns its data, laid out as described by outLayout.
+	// Returns nullptr if the layout is being changed or doesn't fit the mapping, in which case the frame should be skipped.
+	uint8_t* BeginFrame(CameraInjectLayout& outLayout)
+	{
+		if (m_pHeader == nullptr || m_writeSlot != CAMERA_INJECT_NO_SLOT)
+		{
+			return nullptr;
+		}
+
+		if (!CameraInjectReadLayout(m_pHeader, outLayout) || (uint64_t)outLayout.rowStride * outLayout.height > m_pHeader->slotCapacity)
+		{
+			return nullptr;
+		}
+
+		uint32_t latest = m_pHeader->latestSlot.load(std::memory_order_acquire);
+
+		for (uint32_t slot = 0; slot < CAMERA_INJECT_SLOTS; slot++)
+		{
+			if (slot == latest)
+			{
+				continue;
+			}
+
+			std::atomic<uint32_t>& sequence = m_pHeader->slots[slot].sequence;
+			sequence.fetch_add(1, std::memory_order_seq_cst);
+
+			if (m_pHeader->pinnedSlot.load(std::memory_order_seq_cst) == slot)
+			{
+				sequence.fetch_sub(1, std::memory_order_seq_cst);
+				continue;
+			}
+
+			m_writeSlot = slot;
+			m_layoutGeneration = outLayout.generation;
+			return CameraInjectSlotData(m_pHeader, slot);
+		}
+
+		return nullptr;
+	}
+
+	// Publishes the frame claimed with BeginFrame as the latest one.
+	void EndFrame(int64_t exposureTicks = 0)
+	{
+		if (m_writeSlot == CAMERA_INJECT_NO_SLOT)
+		{
+			return;
+		}
+
+		CameraInjectSlot& slot = m_pHeader->slots[m_writeSlot];
+		slot.layoutGeneration = m_layoutGeneration;
+		slot.exposureTicks = exposureTicks;
+		slot.frameNumber = ++m_frameNumber;
+		slot.sequence.fetch_add(1, std::memory_order_release);
+
+		m_pHeader->latestSlot.store(m_writeSlot, std::memory_order_release);
+		m_pHeader->framesPublished.fetch_add(1, std::memory_order_relaxed);
+		m_writeSlot = CAMERA_INJECT_NO_SLOT;
+	}
+
+	// Gives up the slot claimed with BeginFrame without publishing it.
+	void CancelFrame()
+	{
+		if (m_writeSlot == CAMERA_INJECT_NO_SLOT)
+		{
+			return;
+		}
+
+		// The slot was never the latest, so an even sequence is enough for the driver to ignore it.
+		m_pHeader->slots[m_writeSlot].sequence.fetch_add(1, std::memory_order_release);
+		m_writeSlot = CAMERA_INJECT_NO_SLOT;
+	}
+
+protected:
+	HANDLE m_hMapping = nullptr;
+	CameraInjectHeader* m_pHeader = nullptr;
+
+	uint32_t m_writeSlot = CAMERA_INJECT_NO_SLOT;
+	uint32_t m_layoutGeneration = 0;
+	uint64_t m_frameNumber = 0;
+};
@@ -0,0 +1,120 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "../camera_inject.h"
+
+
+// Writes a bar sweeping across each camera view into the driver's injection mapping.
+// Run SteamVR with the frame_source setting set to "inject", or send the debug request "set source inject".
+int main(int argc, char* argv[])
+{
+	std::cout << "OpenVR camera sim frame injection example\n\n";
+
+	double frameRate = 60.0;
+	if (argc > 1)
+	{
+		frameRate = atof(argv[1]);
+		if (frameRate <= 0.0)
+		{
+			std::cout << "Usage: camera_inject_example [frame rate]\n";
+			return 1;
+		}
+	}
+
+	CameraInjectProducer producer;
+
+	while (!producer.Open())
+	{
+		std::cout << "Waiting for the driver to create the injection mapping...\n";
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+
+	std::cout << "Connected, writing frames at " << frameRate << " Hz\n";
+
+	LARGE_INTEGER frequency, currTime;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&currTime);
+
+	int64_t frameInterval = (int64_t)(frequency.QuadPart / frameRate);
+	int64_t nextFrame = currTime.QuadPart;
+	int64_t nextReport = currTime.QuadPart + frequency.QuadPart;
+	uint64_t frameNumber = 0;
+	uint32_t framesWritten = 0;
+	uint32_t framesSkipped = 0;
+
+	while (true)
+	{
+		QueryPerformanceCounter(&currTime);
+		if (currTime.QuadPart < nextFrame)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds((nextFrame - currTime.QuadPart) * 1000000 / frequency.QuadPart));
+			continue;
+		}
+		nextFrame += frameInterval;
+		frameNumber++;
+
+		CameraInjectLayout layout;
+		uint8_t* pFrame = producer.BeginFrame(layout);
+		if (pFrame == nullptr)
+		{
+			// The driver is changing the layout, or the frame is larger than its slots.
+			framesSkipped++;
+			continue;
+		}
+
+		// The frame is timed from when it is written, as a capture tool would time it from the sensor exposure.
+		int64_t exposureTicks = currTime.QuadPart;
+
+		for (uint32_t y = 0; y < layout.height; y++)
+		{
+			memset(pFrame + (size_t)y * layout.rowStride, 40, layout.rowStride);
+		}
+
+		for (uint32_t camera = 0; camera < layout.numCameras; camera++)
+		{
+			const CameraInjectRegion& region = layout.regions[camera];
+			uint32_t barWidth = (std::max)(region.width / 16, 1u);
+			uint32_t barX = region.x + (uint32_t)((frameNumber * 4) % (region.width - barWidth + 1));
+
+			for (uint32_t y = region.y; y < region.y + region.height; y++)
+			{
+				uint8_t* pRow = pFrame + (size_t)y * layout.rowStride;
+				for (uint32_t x = barX; x < barX + barWidth; x++)
+				{
+					uint8_t* pPixel = pRow + (size_t)x * layout.bytesPerPixel;
+					pPixel[0] = (camera == 0) ? 255 : 0;
+					pPixel[1] = (camera == 1) ? 255 : 0;
+					pPixel[2] = (camera >= 2) ? 255 : 0;
+				}
+			}
+		}
+
+		producer.EndFrame(exposureTicks);
+		framesWritten++;
+
+		if (currTime.QuadPart >= nextReport)
+		{
+			double readAge = (currTime.QuadPart - producer.GetLastReadTicks()) / (double)frequency.QuadPart;
+
+			std::cout << layout.width << "x" << layout.height << ", " << framesWritten << " frames written, " << framesSkipped << " skipped";
+			if (readAge > 1.0)
+			{
+				std::cout << ", driver not reading";
+			}
+			std::cout << "\n";
+
+			framesWritten = 0;
+			framesSkipped = 0;
+			nextReport += frequency.QuadPart;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,246 @@
+#include "pch.h"
+#include "camera_rig.h"
+
+
+// Camera-to-head translation and yaw for the default rig configurations.
+// The first two cameras match the original stereo pair, the others are angled outwards like on quad-camera headsets.
+static const float g_defaultCameraOffsetX[MAX_RIG_CAMERAS] = { 0.05f, -0.05f, 0.08f, -0.08f };
+static const float g_defaultCameraOffsetY[MAX_RIG_CAMERAS] = { 0.0f, 0.0f, -0.02f, -0.02f };
+static const float g_defaultCameraYawDegrees[MAX_RIG_CAMERAS] = { 0.0f, 0.0f, 40.0f, -40.0f };
+
+
+void CameraRig::Configure(uint32_t cameraCount, ERigFrameLayout frameLayout, uint32_t cameraFrameWidth, uint32_t cameraFrameHeight)
+{
+	numCameras = (cameraCount < 1) ? 1 : (cameraCount > MAX_RIG_CAMERAS) ? MAX_RIG_CAMERAS : cameraCount;
+	layout = frameLayout;
+	frameWidth = cameraFrameWidth;
+	frameHeight = cameraFrameHeight;
+
+	for (uint32_t i = 0; i < MAX_RIG_CAMERAS; i++)
+	{
+		focalX[i] = 450.0f * frameWidth / 1024.0f;
+		focalY[i] = 450.0f * frameHeight / 1024.0f;
+		centerX[i] = frameWidth / 2.0f;
+		centerY[i] = frameHeight / 2.0f;
+
+		// Extended_FTheta used by Valve Index with 4 radial parameters. Unknown what the diffence between the two variants are.
+		distortionFunction[i] = (int32_t)vr::VRDistortionFunctionType_Extended_FTheta;
+
+		// Using the Valve Index coeffcients to test with.
+		// Note the coefficients being doubles per the comment in the docs
+		double* pCoeffs = &distortionCoeff[i * vr::k_unMaxDistortionFunctionParameters];
+		memset(pCoeffs, 0, sizeof(double) * vr::k_unMaxDistortionFunctionParameters);
+		pCoeffs[0] = 0.19;
+		pCoeffs[1] = 0.023;
+		pCoeffs[2] = -0.19;
+		pCoeffs[3] = 0.07;
+
+		float yaw = g_defaultCameraYawDegrees[i] * 3.14159265f / 180.0f;
+
+		vr::HmdMatrix34_t& transform = cameraToHead[i];
+		memset(&transform, 0, sizeof(transform));
+		transform.m[0][0] = cosf(yaw);
+		transform.m[0][2] = sinf(yaw);
+		transform.m[1][1] = 1;
+		transform.m[2][0] = -sinf(yaw);
+		transform.m[2][2] = cosf(yaw);
+		transform.m[0][3] = g_defaultCameraOffsetX[i];
+		transform.m[1][3] = g_defaultCameraOffsetY[i];
+	}
+
+	UpdateLayout();
+}
+
+void CameraRig::SetFrameSize(uint32_t cameraFrameWidth, uint32_t cameraFrameHeight)
+{
+	float scaleX = cameraFrameWidth / (float)frameWidth;
+	float scaleY = cameraFrameHeight / (float)frameHeight;
+
+	for (uint32_t i = 0; i < MAX_RIG_CAMERAS; i++)
+	{
+		focalX[i] *= scaleX;
+		centerX[i] *= scaleX;
+		focalY[i] *= scaleY;
+		centerY[i] *= scaleY;
+	}
+
+	frameWidth = cameraFrameWidth;
+	frameHeight = cameraFrameHeight;
+
+	UpdateLayout();
+}
+
+void CameraRig::UpdateLayout()
+{
+	switch (layout)
+	{
+	case RigFrameLayout_Vertical:
+		layoutColumns = 1;
+		layoutRows = numCameras;
+		break;
+
+	case RigFrameLayout_Grid:
+		layoutColumns = (numCameras > 1) ? 2 : 1;
+		layoutRows = (numCameras + layoutColumns - 1) / layoutColumns;
+		break;
+
+	default:
+		layoutColumns = numCameras;
+		layoutRows = 1;
+		break;
+	}
+
+	textureWidth = frameWidth * layoutColumns;
+	textureHeight = frameHeight * layoutRows;
+
+	for (uint32_t i = 0; i < numCameras; i++)
+	{
+		regions[i].x = (i % layoutColumns) * frameWidth;
+		regions[i].y = (i / layoutColumns) * frameHeight;
+		regions[i].width = frameWidth;
+		regions[i].height = frameHeight;
+	}
+}
+
+// The runtime only knows about mono and stereo layouts. Grid layouts are reported as horizontal, since that is how the first row is packed.
+int32_t CameraRig::GetFrameLayoutProperty() const
+{
+	if (numCameras == 1)
+	{
+		return vr::EVRTrackedCameraFrameLayout_Mono;
+	}
+
+	if (layout == RigFrameLayout_Vertical)
+	{
+		return vr::EVRTrackedCameraFrameLayout_Stereo | vr::EVRTrackedCameraFrameLayout_VerticalLayout;
+	}
+
+	return vr::EVRTrackedCameraFrameLayout_Stereo | vr::EVRTrackedCameraFrameLayout_HorizontalLayout;
+}
+
+bool CameraRig::ParseLayout(const std::string& name, ERigFrameLayout& outLayout)
+{
+	if (name == "horizontal") { outLayout = RigFrameLayout_Horizontal; }
+	else if (name == "vertical") { outLayout = RigFrameLayout_Vertical; }
+	else if (name == "grid") { outLayout = RigFrameLayout_Grid; }
+	else { return false; }
+
+	return true;
+}
+
+const char* CameraRig::GetLayoutName(ERigFrameLayout layout)
+{
+	switch (layout)
+	{
+	case RigFrameLayout_Vertical: return "vertical";
+	case RigFrameLayout_Grid: return "grid";
+	default: return "horizontal";
+	}
+}
+
+// Radial fisheye lens distortion correction as described here: https://docs.opencv.org/4.x/db/d58/group__calib3d__fisheye.html
+bool CameraRig::ComputeDistortion(uint32_t camera, float inputU, float inputV, float& outputU, float& outputV) const
+{
+	if (camera >= numCameras)
+	{
+		return false;
+	}
+
+	double normFocalX = focalX[camera] / (double)frameWidth;
+	double normFocalY = focalY[camera] / (double)frameHeight;
+
+	double normCenterX = centerX[camera] / (double)frameWidth - 0.5;
+	double normCenterY = centerY[camera] / (double)frameHeight - 0.5;
+
+	const double* pCoeffs = &distortionCoeff[camera * vr::k_unMaxDistortionFunctionParameters];
+
+	double UScaled = (inputU - 0.5) * 2.0 / normFocalX;
+	double VScaled = (inputV - 0.5) * 2.0 / normFocalY;
+
+	double radius = sqrt(UScaled * UScaled + VScaled * VScaled);
+
+	double theta = atan(radius);
+
+	double thetaD = theta +
+		pCoeffs[0] * pow(theta, 3) +
+		pCoeffs[1] * pow(theta, 5) +
+		pCoeffs[2] * pow(theta, 7) +
+		pCoeffs[3] * pow(theta, 9);
+
+	double radialFactor = thetaD / radius;
+
+	outputU = (float)(UScaled * radialFactor * normFocalX + normCenterX + 0.5);
+	outputV = (float)(VScaled * radialFactor * normFocalY + normCenterY + 0.5);
+
+	return true;
+}
+
+bool CameraRig::ComputeProjection(uint32_t camera, float zNear, float zFar, vr::HmdMatrix44_t& outProjection) const
+{
+	if (camera >= numCameras)
+	{
+		return false;
+	}
+
+	float columns = (float)layoutColumns;
+	float rows = (float)layoutRows;
+
+	memset(&outProjection, 0, sizeof(vr::HmdMatrix44_t));
+
+	// Focal length is relative to the entire rendertarget, which means it needs to be divided by the number of views packed along each axis.
+	outProjection.m[0][0] = focalX[camera] / (float)frameWidth / columns;
+	outProjection.m[1][1] = focalY[camera] / (float)frameHeight / rows;
+
+	// The center is even weirder. For side-by-side frames the horizontal needs to be 0.5 instead of 0 for a centered FoV, while the vertical is 0 like a regular projection matrix.
+	// Assumed to carry over to vertical and grid layouts, only verified for the horizontal stereo layout.
+	outProjection.m[0][2] = centerX[camera] / (float)frameWidth - ((columns > 1) ? 0.0f : 0.5f);
+	outProjection.m[1][2] = centerY[camera] / (float)frameHeight - ((rows > 1) ? 0.0f : 0.5f);
+	outProjection.m[2][2] = -zFar / (zFar - zNear);
+	outProjection.m[2][3] = -zFar * zNear / (zFar - zNear);
+	outProjection.m[3][2] = -1;
+
+	return true;
+}
+
+bool CameraRig::GetIntrinsics(uint32_t camera, vr::HmdVector2_t& outFocalLength, vr::HmdVector2_t& outCenter, vr::EVRDistortionFunctionType& outDistortionType, double outCoefficients[vr::k_unMaxDistortionFunctionParameters]) const
+{
+	if (camera >= numCameras)
+	{
+		return false;
+	}
+
+	outFocalLength.v[0] = focalX[camera];
+	outFocalLength.v[1] = focalY[camera];
+
+	outCenter.v[0] = centerX[camera];
+	outCenter.v[1] = centerY[camera];
+
+	outDistortionType = (vr::EVRDistortionFunctionType)distortionFunction[camera];
+
+	memcpy(outCoefficients, &distortionCoeff[camera * vr::k_unMaxDistortionFunctionParameters], sizeof(double) * vr::k_unMaxDistortionFunctionParameters);
+
+	return true;
+}
+
+bool CameraRig::GetRectifyCamera(uint32_t camera, StereoRectifyCamera& outCamera) const
+{
+	if (camera >= numCameras)
+	{
+		return false;
+	}
+
+	outCamera.focalX = focalX[camera];
+	outCamera.focalY = focalY[camera];
+	outCamera.centerX = centerX[camera];
+	outCamera.centerY = centerY[camera];
+	outCamera.bFisheye = distortionFunction[camera] == vr::VRDistortionFunctionType_FTheta || distortionFunction[camera] == vr::VRDistortionFunctionType_Extended_FTheta;
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		outCamera.coefficients[i] = distortionCoeff[camera * vr::k_unMaxDistortionFunctionParameters + i];
+	}
+
+	memcpy(outCamera.cameraToHead, cameraToHead[camera].m, sizeof(outCamera.cameraToHead));
+
+	return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "stereo_rectify.h"
+
+
+// The runtime header claims support for up to 4 cameras.
+#define MAX_RIG_CAMERAS 4
+
+enum ERigFrameLayout
+{
+	RigFrameLayout_Horizontal = 0,
+	RigFrameLayout_Vertical,
+	RigFrameLayout_Grid,
+};
+
+// Area of the frame texture covered by a single camera, in pixels.
+struct CameraRegion
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+
+// Intrinsics, extrinsics and frame layout of 1-4 cameras sharing one frame texture.
+// The per-camera parameters are stored as structure-of-arrays indexed by camera.
+struct CameraRig
+{
+	// Sets up the layout and fills in default parameters for all cameras.
+	void Configure(uint32_t cameraCount, ERigFrameLayout frameLayout, uint32_t cameraFrameWidth, uint32_t cameraFrameHeight);
+
+	// Changes the per-camera frame size, scaling the intrinsics to match.
+	void SetFrameSize(uint32_t cameraFrameWidth, uint32_t cameraFrameHeight);
+
+	// Value for Prop_CameraFrameLayout_Int32.
+	int32_t GetFrameLayoutProperty() const;
+
+	bool HasUncoveredArea() const { return layoutColumns * layoutRows > numCameras; }
+
+	// Maps undistorted normalized frame coordinates of a camera to distorted ones. Returns false for invalid cameras.
+	bool ComputeDistortion(uint32_t camera, float inputU, float inputV, float& outputU, float& outputV) const;
+
+	// Projection matrix in the form the runtime expects for the packed frame texture.
+	bool ComputeProjection(uint32_t camera, float zNear, float zFar, vr::HmdMatrix44_t& outProjection) const;
+
+	bool GetIntrinsics(uint32_t camera, vr::HmdVector2_t& outFocalLength, vr::HmdVector2_t& outCenter, vr::EVRDistortionFunctionType& outDistortionType, double outCoefficients[vr::k_unMaxDistortionFunctionParameters]) const;
+
+	// Parameters of a camera for StereoRectifier, as published to the runtime.
+	bool GetRectifyCamera(uint32_t camera, StereoRectifyCamera& outCamera) const;
+
+	static bool ParseLayout(const std::string& name, ERigFrameLayout& outLayout);
+	static const char* GetLayoutName(ERigFrameLayout layout);
+
+	uint32_t numCameras = 0;
+	ERigFrameLayout layout = RigFrameLayout_Horizontal;
+
+	// Per-camera frame size, and the size of the texture containing all of them.
+	uint32_t frameWidth = 0;
+	uint32_t frameHeight = 0;
+	uint32_t textureWidth = 0;
+	uint32_t textureHeight = 0;
+	uint32_t layoutColumns = 0;
+	uint32_t layoutRows = 0;
+
+	// Intrinsic values in terms of pixels relative to the camera frame size.
+	float focalX[MAX_RIG_CAMERAS] = {};
+	float focalY[MAX_RIG_CAMERAS] = {};
+	float centerX[MAX_RIG_CAMERAS] = {};
+	float centerY[MAX_RIG_CAMERAS] = {};
+
+	int32_t distortionFunction[MAX_RIG_CAMERAS] = {};
+
+	// Laid out per camera, matching Prop_CameraDistortionCoefficients_Float_Array.
+	double distortionCoeff[MAX_RIG_CAMERAS * vr::k_unMaxDistortionFunctionParameters] = {};
+
+	// Inverse poses of cameras relative to the HMD origin.
+	vr::HmdMatrix34_t cameraToHead[MAX_RIG_CAMERAS] = {};
+
+	CameraRegion regions[MAX_RIG_CAMERAS] = {};
+
+protected:
+	void UpdateLayout();
+};
@@ -0,0 +1,377 @@
+#include "pch.h"
+#include "capture_source.h"
+#include "driver_threads.h"
+
+
+// Same settings section as the rest of the camera configuration.
+#define CAPTURE_CONFIG "openvr_camera_sim_camera"
+
+CaptureSourceSettings CaptureSourceSettings::Load()
+{
+	CaptureSourceSettings settings;
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	char path[MAX_PATH] = {};
+	vr::VRSettings()->GetString(CAPTURE_CONFIG, "capture_path", path, sizeof(path), &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { settings.path = path; }
+
+	int32_t prefetchFrames = vr::VRSettings()->GetInt32(CAPTURE_CONFIG, "capture_prefetch", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && prefetchFrames > 0) { settings.prefetchFrames = (std::min)(prefetchFrames, 32); }
+
+	int32_t decodeThreads = vr::VRSettings()->GetInt32(CAPTURE_CONFIG, "capture_decode_threads", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && decodeThreads > 0) { settings.decodeThreads = (std::min)(decodeThreads, 16); }
+
+	return settings;
+}
+
+
+// Windows paths need their backslashes escaped in the JSON responses.
+static std::string EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '\\' || c == '"')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+
+CaptureFrameSource::CaptureFrameSource(const CaptureSourceSettings& settings)
+	: m_settings(settings)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksPerSecond = (double)frequency.QuadPart;
+
+	if (m_settings.path.empty() || !m_reader.Open(m_settings.path))
+	{
+		VR_DRIVER_LOG_FORMAT("CaptureFrameSource: Failed to open capture \"{}\"", m_settings.path);
+		return;
+	}
+
+	const FrameCaptureFileHeader& header = m_reader.GetHeader();
+	m_numFrames = m_reader.GetNumFrames();
+
+	uint64_t firstTicks = m_reader.GetIndexEntry(0).serverTimeTicks;
+	double ticksPerSecond = (header.ticksPerSecond > 0) ? (double)header.ticksPerSecond : m_ticksPerSecond;
+
+	m_frameTimes.resize(m_numFrames);
+	for (uint32_t i = 0; i < m_numFrames; i++)
+	{
+		uint64_t ticks = m_reader.GetIndexEntry(i).serverTimeTicks;
+		m_frameTimes[i] = (ticks > firstTicks) ? (ticks - firstTicks) / ticksPerSecond : 0.0;
+
+		// Keeps the times ordered if the recording has any out of order ticks.
+		if (i > 0) { m_frameTimes[i] = (std::max)(m_frameTimes[i], m_frameTimes[i - 1]); }
+	}
+
+	// The last frame is shown for the mean frame interval before looping.
+	m_loopDuration = (m_numFrames > 1) ? m_frameTimes.back() * m_numFrames / (m_numFrames - 1) : 0.0;
+
+	VR_DRIVER_LOG_FORMAT("CaptureFrameSource: {} frames of {}x{} format {}, {:.1f} s in {}{}", m_numFrames, header.width, header.height, header.format,
+		m_loopDuration, m_settings.path, m_reader.WasIndexRebuilt() ? ", index rebuilt" : "");
+}
+
+CaptureFrameSource::~CaptureFrameSource()
+{
+	StopDecoder();
+}
+
+void CaptureFrameSource::SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel)
+{
+	// The decoded frames are in the texture layout, so everything is decoded again.
+	StopDecoder();
+
+	FrameSource::SetFrameLayout(rig, bytesPerPixel);
+
+	m_pCurrentData = nullptr;
+	m_bHasStartTime = false;
+	m_bLayoutMatches = false;
+
+	if (m_numFrames == 0)
+	{
+		return;
+	}
+
+	if (m_reader.GetHeader().bytesPerPixel != m_textureBPP)
+	{
+		VR_DRIVER_LOG_FORMAT("CaptureFrameSource: Capture has {} bytes per pixel, the stream format {}", m_reader.GetHeader().bytesPerPixel, m_textureBPP);
+		return;
+	}
+
+	// The current frame, the decode window and the frame being decoded.
+	m_window = (std::min)(m_settings.prefetchFrames, m_numFrames - 1);
+	if (!m_cache.Reserve((size_t)m_textureWidth * m_textureHeight * m_textureBPP, m_window + 3))
+	{
+		return;
+	}
+
+	m_bLayoutMatches = true;
+	StartDecoder();
+}
+
+void CaptureFrameSource::StartDecoder()
+{
+	m_readyFrames.clear();
+	m_requestedFrame = 0;
+	m_nextDecode = 0;
+
+	// The decoder thread works on the bands too.
+	m_decodePool.Start(m_settings.decodeThreads - 1, [] { g_driverThreads.Register(DriverThread_CaptureWorker); });
+
+	m_bRunDecoder = true;
+	m_decodeThread = std::thread(&CaptureFrameSource::DecodeLoop, this);
+}
+
+void CaptureFrameSource::StopDecoder()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+		m_bRunDecoder = false;
+	}
+	m_requestCondition.notify_all();
+
+	if (m_decodeThread.joinable())
+	{
+		m_decodeThread.join();
+	}
+	m_decodePool.Stop();
+
+	ReleaseReadyFrames();
+	m_cache.ReleaseSlot(m_pCurrentData);
+	m_pCurrentData = nullptr;
+}
+
+uint32_t CaptureFrameSource::GetFramesAhead(uint32_t index) const
+{
+	return (index + m_numFrames - m_requestedFrame) % m_numFrames;
+}
+
+bool CaptureFrameSource::IsInWindow(uint32_t index) const
+{
+	return GetFramesAhead(index) <= m_window;
+}
+
+void CaptureFrameSource::ReleaseReadyFrames()
+{
+	for (CapturedFrame& frame : m_readyFrames)
+	{
+		m_cache.ReleaseSlot(frame.pData);
+	}
+	m_readyFrames.clear();
+}
+
+void CaptureFrameSource::DecodeLoop()
+{
+	g_driverThreads.Register(DriverThread_CaptureDecode);
+
+	CaptureParallelFor parallelFor = [this](uint32_t numTasks, const std::function<void(uint32_t)>& task)
+	{
+		m_decodePool.ParallelFor(numTasks, task);
+	};
+
+	while (true)
+	{
+		uint32_t index;
+		uint8_t* pSlot = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_frameMutex);
+			while (m_bRunDecoder)
+			{
+				if (IsInWindow(m_nextDecode) && (pSlot = m_cache.AcquireSlot()) != nullptr)
+				{
+					break;
+				}
+				m_requestCondition.wait(lock);
+			}
+
+			if (!m_bRunDecoder)
+			{
+				m_cache.ReleaseSlot(pSlot);
+				break;
+			}
+
+			index = m_nextDecode;
+			m_nextDecode = (index + 1) % m_numFrames;
+		}
+
+		LARGE_INTEGER decodeStart, decodeEnd;
+		QueryPerformanceCounter(&decodeStart);
+
+		const uint8_t* pFrame = m_reader.ReadFrame(index, nullptr, parallelFor);
+		if (pFrame != nullptr)
+		{
+			CopyToTexture(pFrame, pSlot);
+		}
+
+		QueryPerformanceCounter(&decodeEnd);
+		m_lastDecodeMs = (decodeEnd.QuadPart - decodeStart.QuadPart) * 1000.0 / m_ticksPerSecond;
+		m_framesDecoded = m_reader.GetFramesDecoded();
+
+		{
+			std::lock_guard<std::mutex> lock(m_frameMutex);
+
+			if (pFrame == nullptr)
+			{
+				DRIVER_LOG_RATE_LIMITED(1, "CaptureFrameSource: Failed to decode frame {}", index);
+				m_decodeErrors++;
+				m_cache.ReleaseSlot(pSlot);
+			}
+			else if (IsInWindow(index))
+			{
+				m_readyFrames.push_back({ index, pSlot });
+			}
+			else
+			{
+				// Playback moved past it while it was decoded.
+				m_cache.ReleaseSlot(pSlot);
+			}
+		}
+		m_decodedCondition.notify_all();
+	}
+}
+
+// Nearest neighbor scales the capture into the frame texture, if the sizes differ.
+void CaptureFrameSource::CopyToTexture(const uint8_t* pFrame, uint8_t* pDest) const
+{
+	const FrameCaptureFileHeader& header = m_reader.GetHeader();
+	const uint32_t captureWidth = header.rowSize / header.bytesPerPixel;
+	const uint32_t captureHeight = header.height;
+	const size_t stride = (size_t)m_textureWidth * m_textureBPP;
+
+	if (captureWidth == m_textureWidth && captureHeight == m_textureHeight && header.rowSize == stride)
+	{
+		memcpy(pDest, pFrame, stride * m_textureHeight);
+		return;
+	}
+
+	for (uint32_t y = 0; y < m_textureHeight; y++)
+	{
+		const uint8_t* pSourceRow = pFrame + (size_t)((uint64_t)y * captureHeight / m_textureHeight) * header.rowSize;
+		uint8_t* pDestRow = pDest + y * stride;
+
+		for (uint32_t x = 0; x < m_textureWidth; x++)
+		{
+			memcpy(pDestRow + (size_t)x * m_textureBPP, pSourceRow + (size_t)((uint64_t)x * captureWidth / m_textureWidth) * m_textureBPP, m_textureBPP);
+		}
+	}
+}
+
+void CaptureFrameSource::BeginFrame(FrameRenderInfo& info)
+{
+	if (!m_bLayoutMatches)
+	{
+		return;
+	}
+
+	if (!m_bHasStartTime)
+	{
+		m_startTicks = info.exposureStartTicks;
+		m_bHasStartTime = true;
+	}
+
+	double playbackTime = (std::max)((info.exposureStartTicks - m_startTicks) / m_ticksPerSecond, 0.0);
+	if (m_loopDuration > 0.0)
+	{
+		playbackTime = fmod(playbackTime, m_loopDuration);
+	}
+
+	// The last frame recorded at or before the playback time.
+	uint32_t index = (uint32_t)(std::upper_bound(m_frameTimes.begin(), m_frameTimes.end(), playbackTime) - m_frameTimes.begin());
+	index = (index > 0) ? index - 1 : 0;
+
+	std::unique_lock<std::mutex> lock(m_frameMutex);
+	m_requestedFrame = index;
+
+	// Decoding fell behind playback, so it restarts at the requested frame. Anything decoded so far is behind it too.
+	// Right after the window is where the decoder waits when it is ahead.
+	if (GetFramesAhead(m_nextDecode) > m_window + 1)
+	{
+		ReleaseReadyFrames();
+		m_nextDecode = index;
+		m_seeks++;
+		m_requestCondition.notify_one();
+	}
+
+	auto findFrame = [&]()
+	{
+		return std::find_if(m_readyFrames.begin(), m_readyFrames.end(), [&](const CapturedFrame& frame) { return frame.index == index; });
+	};
+
+	if (m_pCurrentData == nullptr && findFrame() == m_readyFrames.end())
+	{
+		// Nothing to repeat yet, give the decoder a moment for the first frame.
+		m_decodedCondition.wait_for(lock, std::chrono::milliseconds(CAPTURE_FIRST_FRAME_TIMEOUT_MS), [&]()
+		{
+			return findFrame() != m_readyFrames.end();
+		});
+	}
+
+	auto iter = findFrame();
+	if (iter != m_readyFrames.end())
+	{
+		m_cache.ReleaseSlot(m_pCurrentData);
+		m_pCurrentData = iter->pData;
+		m_currentFrame = index;
+		m_readyFrames.erase(iter);
+		m_framesShown++;
+	}
+	else if (m_currentFrame != index || m_pCurrentData == nullptr)
+	{
+		// Keep showing the previous frame.
+		m_misses++;
+	}
+
+	// Frames playback has passed free their slots for the decoder.
+	for (size_t i = 0; i < m_readyFrames.size();)
+	{
+		if (!IsInWindow(m_readyFrames[i].index))
+		{
+			m_cache.ReleaseSlot(m_readyFrames[i].pData);
+			m_readyFrames.erase(m_readyFrames.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	lock.unlock();
+	m_requestCondition.notify_all();
+}
+
+void CaptureFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	size_t stride = (size_t)m_textureWidth * m_textureBPP;
+
+	if (m_pCurrentData == nullptr)
+	{
+		memset(pBuffer + firstRow * stride, 0, (endRow - firstRow) * stride);
+		return;
+	}
+
+	memcpy(pBuffer + firstRow * stride, m_pCurrentData + firstRow * stride, (endRow - firstRow) * stride);
+}
+
+std::string CaptureFrameSource::GetStatusJson()
+{
+	uint32_t numReady;
+	uint32_t currentFrame;
+	{
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+		numReady = (uint32_t)m_readyFrames.size();
+		currentFrame = m_currentFrame;
+	}
+
+	const FrameCaptureFileHeader& header = m_reader.GetHeader();
+
+	return std::format("{{\"path\":\"{}\",\"frames\":{},\"width\":{},\"height\":{},\"format\":{},\"keyframe_interval\":{},\"index_rebuilt\":{},\"layout_matches\":{},\"frame\":{},\"duration\":{},"
+		"\"ready\":{},\"window\":{},\"shown\":{},\"misses\":{},\"seeks\":{},\"decoded\":{},\"decode_ms\":{},\"errors\":{}}}",
+		EscapeJson(m_settings.path), m_numFrames, header.width, header.height, header.format, header.keyframeInterval, m_reader.WasIndexRebuilt(), m_bLayoutMatches,
+		currentFrame, m_loopDuration, numReady, m_window, m_framesShown.load(), m_misses.load(), m_seeks.load(), m_framesDecoded.load(), m_lastDecodeMs.load(), m_decodeErrors.load());
+}
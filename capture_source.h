@@ -0,0 +1,103 @@
+#pragma once
+
+#include "frame_source.h"
+#include "frame_arena.h"
+#include "frame_capture.h"
+#include "thread_pool.h"
+
+
+#define CAPTURE_DEFAULT_PREFETCH 4
+#define CAPTURE_DEFAULT_DECODE_THREADS 4
+
+// How long the first frame is waited for before rendering black.
+#define CAPTURE_FIRST_FRAME_TIMEOUT_MS 500
+
+
+struct CaptureSourceSettings
+{
+	std::string path;
+	uint32_t prefetchFrames = CAPTURE_DEFAULT_PREFETCH;
+	uint32_t decodeThreads = CAPTURE_DEFAULT_DECODE_THREADS;
+
+	// Reads the capture_* driver settings.
+	static CaptureSourceSettings Load();
+};
+
+struct CapturedFrame
+{
+	uint32_t index;
+	uint8_t* pData;
+};
+
+
+// Plays a capture recorded by camera_buffer_snooper, looping, at the recorded frame times.
+//
+// Frames are decoded in order on a decoder thread, splitting the bands over its own thread pool, into a window of
+// frames ahead of playback. If playback gets ahead of the window, decoding restarts from the keyframe before it.
+// If a frame isn't decoded in time the previous one is repeated. Captures of a different size are scaled to the frame texture,
+// but the bytes per pixel have to match the stream format.
+class CaptureFrameSource : public FrameSource
+{
+public:
+	CaptureFrameSource(const CaptureSourceSettings& settings);
+	~CaptureFrameSource();
+
+	virtual const char* GetName() const override { return "capture"; }
+	virtual void SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel) override;
+	virtual void BeginFrame(FrameRenderInfo& info) override;
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+	virtual std::string GetStatusJson() override;
+
+	bool IsOpen() const { return m_reader.IsOpen(); }
+
+protected:
+	void StartDecoder();
+	void StopDecoder();
+	void DecodeLoop();
+	void CopyToTexture(const uint8_t* pFrame, uint8_t* pDest) const;
+
+	// Called with the frame mutex held.
+	uint32_t GetFramesAhead(uint32_t index) const;
+	bool IsInWindow(uint32_t index) const;
+	void ReleaseReadyFrames();
+
+	CaptureSourceSettings m_settings;
+	FrameCaptureReader m_reader;
+	uint32_t m_numFrames = 0;
+
+	// Seconds from the first frame, and the time after which playback loops.
+	std::vector<double> m_frameTimes;
+	double m_loopDuration = 0.0;
+
+	// Whether the capture can be copied into the frame texture.
+	bool m_bLayoutMatches = false;
+
+	FrameArena m_cache;
+	uint32_t m_window = 0;
+
+	std::mutex m_frameMutex;
+	std::condition_variable m_requestCondition;
+	std::condition_variable m_decodedCondition;
+	std::vector<CapturedFrame> m_readyFrames;
+	uint32_t m_requestedFrame = 0;
+	uint32_t m_nextDecode = 0;
+
+	// The frame being rendered.
+	uint32_t m_currentFrame = 0;
+	uint8_t* m_pCurrentData = nullptr;
+
+	bool m_bHasStartTime = false;
+	int64_t m_startTicks = 0;
+	double m_ticksPerSecond = 0.0;
+
+	std::atomic<uint64_t> m_framesShown = 0;
+	std::atomic<uint64_t> m_misses = 0;
+	std::atomic<uint64_t> m_seeks = 0;
+	std::atomic<uint64_t> m_framesDecoded = 0;
+	std::atomic<uint64_t> m_decodeErrors = 0;
+	std::atomic<double> m_lastDecodeMs = 0.0;
+
+	ThreadPool m_decodePool;
+	std::thread m_decodeThread;
+	bool m_bRunDecoder = false;
+};
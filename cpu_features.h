@@ -0,0 +1,46 @@
+#pragma once
+
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC allows AVX2 intrinsics in any function, GCC and Clang need them enabled per function.
+#if defined(CPU_X86) && !defined(_MSC_VER)
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#else
+#define CPU_TARGET_AVX2
+#endif
+
+
+// Whether the CPU and OS support AVX2, for picking kernels at runtime.
+inline bool CpuSupportsAVX2()
+{
+#if defined(CPU_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+
+	// AVX and OS support for saving the YMM registers.
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(CPU_X86)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+	return false;
+#endif
+}
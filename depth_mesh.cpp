@@ -0,0 +1,263 @@
+#include "pch.h"
+#include "depth_mesh.h"
+#include "driver_metrics.h"
+#include "driver_threads.h"
+#include "head_motion.h"
+
+
+#define DEPTH_MESH_VERTEX_FLOATS 3
+#define DEPTH_MESH_EYE_FLOATS (DEPTH_MESH_GRID_WIDTH * DEPTH_MESH_GRID_HEIGHT * DEPTH_MESH_VERTEX_FLOATS)
+
+
+DepthMeshProducer::~DepthMeshProducer()
+{
+	Stop();
+}
+
+void DepthMeshProducer::Start(vr::TrackedDeviceIndex_t HMDDeviceId, const CameraRig& rig, double updateRate)
+{
+	Stop();
+
+	m_HMDDeviceId = HMDDeviceId;
+	m_updateRate = (updateRate > 0.0) ? updateRate : 30.0;
+	SetRig(rig);
+
+	vr::VRPaths()->StringToHandle(&m_rawMeshHandle, "/lighthouse/depthAugmentedPassthrough/rawMesh");
+	vr::VRPaths()->StringToHandle(&m_meshWidthHandle, "/lighthouse/depthAugmentedPassthrough/meshWidth");
+	vr::VRPaths()->StringToHandle(&m_meshHeightHandle, "/lighthouse/depthAugmentedPassthrough/meshHeight");
+	vr::VRPaths()->StringToHandle(&m_leftElementCountHandle, "/lighthouse/depthAugmentedPassthrough/leftMeshElementCount");
+	vr::VRPaths()->StringToHandle(&m_rightElementCountHandle, "/lighthouse/depthAugmentedPassthrough/rightMeshElementCount");
+	vr::VRPaths()->StringToHandle(&m_meshIdHandle, "/lighthouse/depthAugmentedPassthrough/meshId");
+	vr::VRPaths()->StringToHandle(&m_meshIsUpToDateHandle, "/lighthouse/depthAugmentedPassthrough/meshIsUpToDate");
+
+	m_vertices.assign(DEPTH_MESH_EYE_FLOATS * 2, 0.0f);
+	m_nextVertices.assign(DEPTH_MESH_EYE_FLOATS * 2, 0.0f);
+	m_bHasMesh = false;
+
+	m_bRunThread = true;
+	m_thread = std::thread(&DepthMeshProducer::Run, this);
+}
+
+void DepthMeshProducer::Stop()
+{
+	m_bRunThread = false;
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void DepthMeshProducer::SetRig(const CameraRig& rig)
+{
+	std::lock_guard<std::mutex> lock(m_rigMutex);
+	m_rig = rig;
+	m_bRigChanged = true;
+}
+
+// Runs at a fixed rate independent of the frame serving, regenerating the mesh only when the head or rig has moved.
+void DepthMeshProducer::Run()
+{
+	g_driverThreads.Register(DriverThread_DepthMesh);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	std::chrono::microseconds interval((int64_t)(1000000.0 / m_updateRate));
+
+	while (m_bRunThread)
+	{
+		LARGE_INTEGER currTime;
+		QueryPerformanceCounter(&currTime);
+		HeadPoseSample pose = g_headMotion.Sample(currTime.QuadPart);
+
+		bool bRigChanged;
+		{
+			std::lock_guard<std::mutex> lock(m_rigMutex);
+			bRigChanged = m_bRigChanged;
+		}
+
+		if (!m_bHasMesh || bRigChanged || pose.yaw != m_lastHeadYaw || pose.pitch != m_lastHeadPitch)
+		{
+			DRIVER_METRIC_SCOPE(Metric_DepthMeshUpdate);
+
+			if (UpdateMesh(pose.yaw, pose.pitch) && !PublishMesh())
+			{
+				// Retry the upload on the next update.
+				m_bHasMesh = false;
+			}
+		}
+
+		std::this_thread::sleep_for(interval);
+	}
+}
+
+// Distance along a ray from inside the box to its walls, floor or ceiling.
+static float IntersectRoom(const DepthMeshScene& scene, const float origin[3], const float direction[3])
+{
+	const float minBounds[3] = { -scene.halfWidth, 0.0f, -scene.halfDepth };
+	const float maxBounds[3] = { scene.halfWidth, scene.ceilingHeight, scene.halfDepth };
+
+	float distance = FLT_MAX;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (direction[axis] > 1e-6f)
+		{
+			distance = (std::min)(distance, (maxBounds[axis] - origin[axis]) / direction[axis]);
+		}
+		else if (direction[axis] < -1e-6f)
+		{
+			distance = (std::min)(distance, (minBounds[axis] - origin[axis]) / direction[axis]);
+		}
+	}
+	return distance;
+}
+
+bool DepthMeshProducer::UpdateMesh(double headYaw, double headPitch)
+{
+	CameraRig rig;
+	{
+		std::lock_guard<std::mutex> lock(m_rigMutex);
+		rig = m_rig;
+		m_bRigChanged = false;
+	}
+
+	m_lastHeadYaw = headYaw;
+	m_lastHeadPitch = headPitch;
+
+	// Head rotation, yaw around Y followed by pitch around X.
+	float cy = (float)cos(headYaw), sy = (float)sin(headYaw);
+	float cp = (float)cos(headPitch), sp = (float)sin(headPitch);
+	float headRotation[3][3] =
+	{
+		{ cy, sy * sp, sy * cp },
+		{ 0.0f, cp, -sp },
+		{ -sy, cy * sp, cy * cp },
+	};
+
+	for (uint32_t eye = 0; eye < 2; eye++)
+	{
+		// Mono rigs show the same camera to both eyes.
+		uint32_t camera = (eye < rig.numCameras) ? eye : 0;
+		const vr::HmdMatrix34_t& cameraToHead = rig.cameraToHead[camera];
+
+		// Camera to room rotation and camera position in the room.
+		float rotation[3][3];
+		float origin[3];
+		for (int row = 0; row < 3; row++)
+		{
+			for (int col = 0; col < 3; col++)
+			{
+				rotation[row][col] = headRotation[row][0] * cameraToHead.m[0][col] + headRotation[row][1] * cameraToHead.m[1][col] + headRotation[row][2] * cameraToHead.m[2][col];
+			}
+			origin[row] = headRotation[row][0] * cameraToHead.m[0][3] + headRotation[row][1] * cameraToHead.m[1][3] + headRotation[row][2] * cameraToHead.m[2][3];
+		}
+		origin[1] += m_scene.eyeHeight;
+
+		float* pVertex = &m_nextVertices[eye * DEPTH_MESH_EYE_FLOATS];
+
+		for (uint32_t gridY = 0; gridY < DEPTH_MESH_GRID_HEIGHT; gridY++)
+		{
+			float pixelY = gridY * (rig.frameHeight - 1) / (float)(DEPTH_MESH_GRID_HEIGHT - 1);
+			float rayY = -(pixelY - rig.centerY[camera]) / rig.focalY[camera];
+
+			for (uint32_t gridX = 0; gridX < DEPTH_MESH_GRID_WIDTH; gridX++, pVertex += DEPTH_MESH_VERTEX_FLOATS)
+			{
+				float pixelX = gridX * (rig.frameWidth - 1) / (float)(DEPTH_MESH_GRID_WIDTH - 1);
+				float rayX = (pixelX - rig.centerX[camera]) / rig.focalX[camera];
+
+				// Camera looks down -Z.
+				float cameraRay[3] = { rayX, rayY, -1.0f };
+				float roomRay[3];
+				for (int row = 0; row < 3; row++)
+				{
+					roomRay[row] = rotation[row][0] * cameraRay[0] + rotation[row][1] * cameraRay[1] + rotation[row][2] * cameraRay[2];
+				}
+
+				float distance = IntersectRoom(m_scene, origin, roomRay);
+
+				pVertex[0] = cameraRay[0] * distance;
+				pVertex[1] = cameraRay[1] * distance;
+				pVertex[2] = cameraRay[2] * distance;
+			}
+		}
+	}
+
+	bool bChanged = !m_bHasMesh;
+	for (size_t i = 0; i < m_nextVertices.size() && !bChanged; i++)
+	{
+		bChanged = fabsf(m_nextVertices[i] - m_vertices[i]) > DEPTH_MESH_CHANGE_THRESHOLD;
+	}
+
+	if (!bChanged)
+	{
+		return false;
+	}
+
+	m_vertices.swap(m_nextVertices);
+	m_bHasMesh = true;
+	m_meshId++;
+	return true;
+}
+
+// Writes the mesh and its metadata in one batch, so readers never see the id of a mesh that is not there yet.
+bool DepthMeshProducer::PublishMesh()
+{
+	const vr::PropertyContainerHandle_t container = vr::VRProperties()->TrackedDeviceToPropertyContainer(m_HMDDeviceId);
+
+	int32_t meshWidth = DEPTH_MESH_GRID_WIDTH;
+	int32_t meshHeight = DEPTH_MESH_GRID_HEIGHT;
+	int32_t elementCount = DEPTH_MESH_GRID_WIDTH * DEPTH_MESH_GRID_HEIGHT;
+	uint64_t meshId = m_meshId;
+	bool bIsUpToDate = true;
+
+	vr::PathWrite_t write[7] = {};
+
+	write[0].ulPath = m_rawMeshHandle;
+	write[0].pvBuffer = m_vertices.data();
+	write[0].unBufferSize = (uint32_t)(m_vertices.size() * sizeof(float));
+	write[0].unTag = vr::k_unFloatPropertyTag;
+
+	write[1].ulPath = m_meshWidthHandle;
+	write[1].pvBuffer = &meshWidth;
+	write[1].unBufferSize = sizeof(meshWidth);
+	write[1].unTag = vr::k_unInt32PropertyTag;
+
+	write[2].ulPath = m_meshHeightHandle;
+	write[2].pvBuffer = &meshHeight;
+	write[2].unBufferSize = sizeof(meshHeight);
+	write[2].unTag = vr::k_unInt32PropertyTag;
+
+	write[3].ulPath = m_leftElementCountHandle;
+	write[3].pvBuffer = &elementCount;
+	write[3].unBufferSize = sizeof(elementCount);
+	write[3].unTag = vr::k_unInt32PropertyTag;
+
+	write[4].ulPath = m_rightElementCountHandle;
+	write[4].pvBuffer = &elementCount;
+	write[4].unBufferSize = sizeof(elementCount);
+	write[4].unTag = vr::k_unInt32PropertyTag;
+
+	write[5].ulPath = m_meshIdHandle;
+	write[5].pvBuffer = &meshId;
+	write[5].unBufferSize = sizeof(meshId);
+	write[5].unTag = vr::k_unUint64PropertyTag;
+
+	write[6].ulPath = m_meshIsUpToDateHandle;
+	write[6].pvBuffer = &bIsUpToDate;
+	write[6].unBufferSize = sizeof(bIsUpToDate);
+	write[6].unTag = vr::k_unBoolPropertyTag;
+
+	for (vr::PathWrite_t& entry : write)
+	{
+		entry.writeType = vr::PropertyWrite_Set;
+	}
+
+	vr::ETrackedPropertyError propError = vr::VRPaths()->WritePathBatch(container, write, 7);
+	if (propError != vr::TrackedProp_Success)
+	{
+		DRIVER_LOG_RATE_LIMITED(1, "DepthMeshProducer: Error writing depth mesh paths: {}", (int)propError);
+		return false;
+	}
+
+	return true;
+}
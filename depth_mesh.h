@@ -0,0 +1,77 @@
+#pragma once
+
+#include "camera_rig.h"
+
+
+// Vertices per eye in the depth mesh grid.
+#define DEPTH_MESH_GRID_WIDTH 32
+#define DEPTH_MESH_GRID_HEIGHT 24
+
+// Vertex movement in meters below which the mesh is not re-uploaded.
+#define DEPTH_MESH_CHANGE_THRESHOLD 0.001f
+
+
+// Simulated room the depth is derived from. Axis aligned box around the head, in meters.
+struct DepthMeshScene
+{
+	float halfWidth = 2.0f;
+	float halfDepth = 2.0f;
+	float ceilingHeight = 2.5f;
+	float eyeHeight = 1.5f;
+};
+
+
+// Generates the per-eye grid meshes for the depth augmented Room View 3D, and publishes them
+// on the /lighthouse/depthAugmentedPassthrough/ paths from its own thread.
+//
+// The layout of rawMesh is not documented. It is written as the left eye grid followed by the right,
+// with each vertex being the camera space position (x, y, z) in meters of the scene seen through the grid point,
+// in row major order. The element counts are the number of vertices per eye.
+class DepthMeshProducer
+{
+public:
+	~DepthMeshProducer();
+
+	void Start(vr::TrackedDeviceIndex_t HMDDeviceId, const CameraRig& rig, double updateRate);
+	void Stop();
+
+	// Forces a regeneration with the new intrinsics and camera poses.
+	void SetRig(const CameraRig& rig);
+
+	uint64_t GetMeshId() const { return m_meshId; }
+
+protected:
+	void Run();
+
+	// Regenerates the mesh for the given head pose. Returns false if no vertex moved enough to need an upload.
+	bool UpdateMesh(double headYaw, double headPitch);
+	bool PublishMesh();
+
+	vr::TrackedDeviceIndex_t m_HMDDeviceId = -1;
+	double m_updateRate = 30.0;
+	DepthMeshScene m_scene;
+
+	std::mutex m_rigMutex;
+	CameraRig m_rig = {};
+	bool m_bRigChanged = true;
+
+	// Vertex positions for both eyes, as last published and the scratch for the next update.
+	std::vector<float> m_vertices;
+	std::vector<float> m_nextVertices;
+
+	uint64_t m_meshId = 0;
+	double m_lastHeadYaw = 0.0;
+	double m_lastHeadPitch = 0.0;
+	bool m_bHasMesh = false;
+
+	vr::PathHandle_t m_rawMeshHandle = 0;
+	vr::PathHandle_t m_meshWidthHandle = 0;
+	vr::PathHandle_t m_meshHeightHandle = 0;
+	vr::PathHandle_t m_leftElementCountHandle = 0;
+	vr::PathHandle_t m_rightElementCountHandle = 0;
+	vr::PathHandle_t m_meshIdHandle = 0;
+	vr::PathHandle_t m_meshIsUpToDateHandle = 0;
+
+	std::thread m_thread;
+	std::atomic<bool> m_bRunThread = false;
+};
@@ -1,13 +1,24 @@
 
 #include "pch.h"
 #include "device_provider.h"
+#include "driver_trace.h"
+#include "driver_scheduler.h"
+#include "driver_threads.h"
 
 vr::EVRInitError DeviceProvider::Init(vr::IVRDriverContext* pDriverContext) 
 {
     VR_INIT_SERVER_DRIVER_CONTEXT(pDriverContext);
+    g_driverThreads.Start();
+    g_driverLog.Start();
+    g_driverScheduler.Start();
+    g_driverTrace.StartFromSettings();
+    DRIVER_TRACE_SCOPE(TraceEvent_ProviderInit);
     vr::VRDriverLog()->Log("DeviceProvider::Init");
 
-    m_cameraDevice = std::make_unique<CameraDevice>();
+    LoadTestSettings loadTest = LoadTestSettings::Load();
+
+    CameraComponent::StartRenderPool(m_renderPool);
+    m_cameraDevice = std::make_unique<CameraDevice>(m_renderPool);
 
     bool ret = vr::VRServerDriverHost()->TrackedDeviceAdded("openvr_camera_sim_virtual_display_001", vr::TrackedDeviceClass_HMD, m_cameraDevice.get());
 
@@ -16,11 +27,32 @@ vr::EVRInitError DeviceProvider::Init(vr::IVRDriverContext* pDriverContext)
         vr::VRDriverLog()->Log("TrackedDeviceAdded() succeeded!");
     }
 
+    // Only one HMD is allowed, so the load test cameras are added as trackers.
+    for (uint32_t i = 1; i <= loadTest.numCameras; i++)
+    {
+        std::unique_ptr<LoadTestCameraDevice> device = std::make_unique<LoadTestCameraDevice>(loadTest.GetInstance(i), m_renderPool, loadTest.bAutostart);
+
+        if (!vr::VRServerDriverHost()->TrackedDeviceAdded(device->GetSerialNumber().c_str(), vr::TrackedDeviceClass_GenericTracker, device.get()))
+        {
+            VR_DRIVER_LOG_FORMAT("DeviceProvider: Failed to add load test camera {}", i);
+            continue;
+        }
+        m_loadTestDevices.push_back(std::move(device));
+    }
+
     return vr::VRInitError_None;
 }
 
 void DeviceProvider::Cleanup() 
 {
+    // Marks the end of the session, the trace is closed right after.
+    {
+        DRIVER_TRACE_SCOPE(TraceEvent_ProviderCleanup);
+    }
+    g_driverScheduler.Stop();
+    g_driverTrace.Stop();
+    g_driverLog.Stop();
+    g_driverThreads.Stop();
     VR_CLEANUP_SERVER_DRIVER_CONTEXT();
 }
 
@@ -31,6 +63,7 @@ const char* const* DeviceProvider::GetInterfaceVersions()
 
 void DeviceProvider::RunFrame() 
 {
+    DRIVER_TRACE_SCOPE(TraceEvent_ProviderRunFrame);
     vr::VREvent_t vrevent;
     while (vr::VRServerDriverHost()->PollNextEvent(&vrevent, sizeof(vrevent))) 
     {
@@ -50,10 +83,12 @@ bool DeviceProvider::ShouldBlockStandbyMode()
 
 void DeviceProvider::EnterStandby() 
 {
+    DRIVER_TRACE_SCOPE(TraceEvent_ProviderEnterStandby);
 
 }
 
 void DeviceProvider::LeaveStandby() 
 {
+    DRIVER_TRACE_SCOPE(TraceEvent_ProviderLeaveStandby);
 
 }
\ No newline at end of file
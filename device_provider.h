@@ -2,6 +2,7 @@
 #include <memory>
 
 #include "camera_device.h"
+#include "load_test_device.h"
 
 class DeviceProvider : public vr::IServerTrackedDeviceProvider 
 {
@@ -16,6 +17,10 @@ public:
     void LeaveStandby() override;
 
 private:
+    // Shared by the camera components of all devices, so needs to outlive them.
+    ThreadPool m_renderPool;
+
     std::unique_ptr<CameraDevice> m_cameraDevice;
+    std::vector<std::unique_ptr<LoadTestCameraDevice>> m_loadTestDevices;
 
 };
\ No newline at end of file
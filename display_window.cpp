@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "display_window.h"
+#include "driver_threads.h"
 
 
 
@@ -31,6 +32,8 @@ DisplayWindow::~DisplayWindow()
 
 void DisplayWindow::RunThread()
 {
+    g_driverThreads.Register(DriverThread_DisplayWindow);
+
     if (!InitWindow())
     {
         m_bRunThread = false;
@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "driver_log.h"
+#include "driver_threads.h"
+
+
+DriverLog g_driverLog;
+
+
+DriverLog::DriverLog()
+{
+	m_records = new LogRecord[LOG_RING_SIZE];
+
+	for (uint64_t i = 0; i < LOG_RING_SIZE; i++)
+	{
+		m_records[i].sequence.store(i, std::memory_order_relaxed);
+		m_records[i].length = 0;
+	}
+
+	QueryPerformanceFrequency(&m_perfCounterFrequency);
+}
+
+DriverLog::~DriverLog()
+{
+	m_bRunThread = false;
+	if (m_flushThread.joinable())
+	{
+		m_flushThread.join();
+	}
+
+	delete[] m_records;
+}
+
+void DriverLog::Start()
+{
+	if (m_bRunThread.exchange(true))
+	{
+		return;
+	}
+
+	m_flushThread = std::thread(&DriverLog::RunFlushThread, this);
+}
+
+void DriverLog::Stop()
+{
+	if (m_bRunThread.exchange(false))
+	{
+		m_flushThread.join();
+	}
+
+	// Anything logged during shutdown.
+	Flush();
+}
+
+// Fixed one second windows per call site. The first message after a window with suppressed messages reports the count.
+bool DriverLog::CheckRateLimit(LogCallSite& site)
+{
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+
+	int64_t windowStart = site.windowStart.load(std::memory_order_relaxed);
+
+	if (currTime.QuadPart - windowStart >= m_perfCounterFrequency.QuadPart)
+	{
+		if (site.windowStart.compare_exchange_strong(windowStart, currTime.QuadPart, std::memory_order_relaxed))
+		{
+			site.windowCount.store(0, std::memory_order_relaxed);
+
+			uint32_t suppressed = site.suppressedCount.exchange(0, std::memory_order_relaxed);
+			if (suppressed > 0)
+			{
+				LogRecord* pRecord;
+				uint64_t position;
+
+				if (AcquireRecord(&pRecord, &position))
+				{
+					std::format_to_n_result<char*> result = std::format_to_n(pRecord->text, LOG_RECORD_TEXT_SIZE - 1, "[Suppressed {} messages from {}:{}]", suppressed, site.file, site.line);
+					pRecord->length = (uint32_t)(result.out - pRecord->text);
+					pRecord->text[pRecord->length] = 0;
+					CommitRecord(pRecord, position);
+				}
+			}
+		}
+	}
+
+	if (site.windowCount.fetch_add(1, std::memory_order_relaxed) >= site.maxPerSecond)
+	{
+		site.suppressedCount.fetch_add(1, std::memory_order_relaxed);
+		m_droppedRateLimited.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	return true;
+}
+
+// Bounded MPSC ring. Each record carries a sequence number telling whether it is free for the given enqueue position.
+bool DriverLog::AcquireRecord(LogRecord** ppRecord, uint64_t* pPosition)
+{
+	uint64_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+
+	while (true)
+	{
+		LogRecord& record = m_records[position % LOG_RING_SIZE];
+		uint64_t sequence = record.sequence.load(std::memory_order_acquire);
+		int64_t difference = (int64_t)sequence - (int64_t)position;
+
+		if (difference == 0)
+		{
+			if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				*ppRecord = &record;
+				*pPosition = position;
+				return true;
+			}
+		}
+		else if (difference < 0)
+		{
+			// The flush thread is behind by a full ring.
+			m_droppedQueueFull.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+		{
+			position = m_enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void DriverLog::CommitRecord(LogRecord* pRecord, uint64_t position)
+{
+	pRecord->sequence.store(position + 1, std::memory_order_release);
+}
+
+void DriverLog::RunFlushThread()
+{
+	g_driverThreads.Register(DriverThread_LogFlush);
+
+	while (m_bRunThread)
+	{
+		if (Flush() == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+}
+
+// Writes out all committed records. Returns the number of records consumed.
+uint32_t DriverLog::Flush()
+{
+	std::lock_guard<std::mutex> lock(m_flushMutex);
+
+	uint32_t numConsumed = 0;
+
+	while (true)
+	{
+		LogRecord& record = m_records[m_dequeuePosition % LOG_RING_SIZE];
+		uint64_t sequence = record.sequence.load(std::memory_order_acquire);
+
+		if (sequence != m_dequeuePosition + 1)
+		{
+			break;
+		}
+
+		WriteLine(record.text);
+
+		record.sequence.store(m_dequeuePosition + LOG_RING_SIZE, std::memory_order_release);
+		m_dequeuePosition++;
+		numConsumed++;
+	}
+
+	uint64_t totalDrops = m_droppedQueueFull.load(std::memory_order_relaxed) + m_droppedSinkBudget.load(std::memory_order_relaxed);
+
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+
+	// Drop reports bypass the sink budget, but are limited to one per second.
+	if (totalDrops != m_lastReportedDrops && currTime.QuadPart - m_lastDropReportTime >= m_perfCounterFrequency.QuadPart)
+	{
+		m_lastDropReportTime = currTime.QuadPart;
+		std::string message = std::format("DriverLog: {} messages dropped (queue full: {}, sink budget: {})", totalDrops - m_lastReportedDrops,
+			m_droppedQueueFull.load(std::memory_order_relaxed), m_droppedSinkBudget.load(std::memory_order_relaxed));
+		vr::VRDriverLog()->Log(message.c_str());
+		m_lastReportedDrops = totalDrops;
+	}
+
+	return numConsumed;
+}
+
+// Global line budget for the sink, so log storms can't fill the disk.
+void DriverLog::WriteLine(const char* line)
+{
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+
+	if (currTime.QuadPart - m_sinkWindowStart >= m_perfCounterFrequency.QuadPart)
+	{
+		m_sinkWindowStart = currTime.QuadPart;
+		m_sinkWindowCount = 0;
+	}
+
+	if (m_sinkWindowCount >= LOG_MAX_LINES_PER_SECOND)
+	{
+		m_droppedSinkBudget.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	m_sinkWindowCount++;
+	m_written.fetch_add(1, std::memory_order_relaxed);
+
+	vr::VRDriverLog()->Log(line);
+}
+
+void DriverLog::GetStats(LogStats& outStats)
+{
+	outStats.written = m_written.load(std::memory_order_relaxed);
+	outStats.droppedQueueFull = m_droppedQueueFull.load(std::memory_order_relaxed);
+	outStats.droppedRateLimited = m_droppedRateLimited.load(std::memory_order_relaxed);
+	outStats.droppedSinkBudget = m_droppedSinkBudget.load(std::memory_order_relaxed);
+}
+
+std::string DriverLog::GetStatsJson()
+{
+	LogStats stats;
+	GetStats(stats);
+
+	return std::format("{{\"written\":{},\"dropped_queue_full\":{},\"dropped_rate_limited\":{},\"dropped_sink_budget\":{},\"pending\":{}}}",
+		stats.written, stats.droppedQueueFull, stats.droppedRateLimited, stats.droppedSinkBudget,
+		m_enqueuePosition.load(std::memory_order_relaxed) - stats.written - stats.droppedSinkBudget);
+}
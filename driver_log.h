@@ -0,0 +1,136 @@
+#pragma once
+
+
+// Asynchronous driver logging. Messages are formatted by the caller into fixed-size records in a lock-free
+// ring, and written to VRDriverLog from a background thread. Callers never block on the log sink.
+
+#define LOG_RING_SIZE 1024
+#define LOG_RECORD_SIZE 512
+#define LOG_RECORD_TEXT_SIZE (LOG_RECORD_SIZE - 16)
+
+// Default maximum number of messages per second from a single call site.
+#define LOG_DEFAULT_SITE_RATE_LIMIT 10
+
+// Maximum number of lines per second written to the sink, across all call sites.
+#define LOG_MAX_LINES_PER_SECOND 200
+
+
+// Per call site state for rate limiting. Declared as a static local by the logging macros.
+struct LogCallSite
+{
+	LogCallSite(const char* file, int line, uint32_t maxPerSecond)
+		: file(file)
+		, line(line)
+		, maxPerSecond(maxPerSecond)
+	{}
+
+	const char* file;
+	int line;
+	uint32_t maxPerSecond;
+
+	std::atomic<int64_t> windowStart = 0;
+	std::atomic<uint32_t> windowCount = 0;
+	std::atomic<uint32_t> suppressedCount = 0;
+};
+
+struct alignas(64) LogRecord
+{
+	std::atomic<uint64_t> sequence;
+	uint32_t length;
+	char text[LOG_RECORD_TEXT_SIZE];
+};
+
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "Unexpected log record size");
+
+
+struct LogStats
+{
+	uint64_t written;
+	uint64_t droppedQueueFull;
+	uint64_t droppedRateLimited;
+	uint64_t droppedSinkBudget;
+};
+
+
+class DriverLog
+{
+public:
+
+	DriverLog();
+	~DriverLog();
+
+	// Starts the flush thread. The driver context has to be initialized before this.
+	void Start();
+
+	// Flushes the remaining records and stops the flush thread.
+	void Stop();
+
+	template<typename... Args>
+	void Log(LogCallSite& site, std::format_string<Args...> format, Args&&... args)
+	{
+		if (!CheckRateLimit(site))
+		{
+			return;
+		}
+
+		LogRecord* pRecord;
+		uint64_t position;
+
+		if (!AcquireRecord(&pRecord, &position))
+		{
+			return;
+		}
+
+		std::format_to_n_result<char*> result = std::format_to_n(pRecord->text, LOG_RECORD_TEXT_SIZE - 1, format, std::forward<Args>(args)...);
+
+		pRecord->length = (uint32_t)(result.out - pRecord->text);
+		pRecord->text[pRecord->length] = 0;
+
+		CommitRecord(pRecord, position);
+	}
+
+	void GetStats(LogStats& outStats);
+	std::string GetStatsJson();
+
+protected:
+
+	bool CheckRateLimit(LogCallSite& site);
+	bool AcquireRecord(LogRecord** ppRecord, uint64_t* pPosition);
+	void CommitRecord(LogRecord* pRecord, uint64_t position);
+
+	void RunFlushThread();
+	uint32_t Flush();
+	void WriteLine(const char* line);
+
+	LogRecord* m_records = nullptr;
+
+	alignas(64) std::atomic<uint64_t> m_enqueuePosition = 0;
+	alignas(64) uint64_t m_dequeuePosition = 0;
+
+	alignas(64) std::atomic<uint64_t> m_droppedQueueFull = 0;
+	std::atomic<uint64_t> m_droppedRateLimited = 0;
+	std::atomic<uint64_t> m_droppedSinkBudget = 0;
+	std::atomic<uint64_t> m_written = 0;
+
+	LARGE_INTEGER m_perfCounterFrequency;
+
+	// Sink budget, only touched by the flush thread.
+	int64_t m_sinkWindowStart = 0;
+	uint32_t m_sinkWindowCount = 0;
+	uint64_t m_lastReportedDrops = 0;
+	int64_t m_lastDropReportTime = 0;
+
+	std::thread m_flushThread;
+	std::atomic<bool> m_bRunThread = false;
+	std::mutex m_flushMutex;
+};
+
+extern DriverLog g_driverLog;
+
+
+#define DRIVER_LOG_RATE_LIMITED(maxPerSecond, ...) {\
+static LogCallSite _logCallSite(__FILE__, __LINE__, maxPerSecond); \
+g_driverLog.Log(_logCallSite, __VA_ARGS__); \
+}
+
+#define DRIVER_LOG(...) DRIVER_LOG_RATE_LIMITED(LOG_DEFAULT_SITE_RATE_LIMIT, __VA_ARGS__)
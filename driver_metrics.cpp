@@ -0,0 +1,244 @@
+#include "pch.h"
+#include "driver_metrics.h"
+
+
+DriverMetrics g_driverMetrics;
+
+thread_local ThreadMetrics* DriverMetrics::t_pThreadMetrics = nullptr;
+
+static const char* g_metricNames[] =
+{
+	"CameraComponent::GetCameraFrameDimensions",
+	"CameraComponent::GetCameraFrameBufferingRequirements",
+	"CameraComponent::SetCameraFrameBuffering",
+	"CameraComponent::SetCameraVideoStreamFormat",
+	"CameraComponent::GetCameraVideoStreamFormat",
+	"CameraComponent::StartVideoStream",
+	"CameraComponent::StopVideoStream",
+	"CameraComponent::IsVideoStreamActive",
+	"CameraComponent::GetVideoStreamFrame",
+	"CameraComponent::ReleaseVideoStreamFrame",
+	"CameraComponent::SetAutoExposure",
+	"CameraComponent::PauseVideoStream",
+	"CameraComponent::ResumeVideoStream",
+	"CameraComponent::GetCameraDistortion",
+	"CameraComponent::GetCameraProjection",
+	"CameraComponent::SetFrameRate",
+	"CameraComponent::SetCameraVideoSinkCallback",
+	"CameraComponent::GetCameraCompatibilityMode",
+	"CameraComponent::SetCameraCompatibilityMode",
+	"CameraComponent::GetCameraFrameBounds",
+	"CameraComponent::GetCameraIntrinsics",
+
+	"CameraDevice::IsDisplayOnDesktop",
+	"CameraDevice::IsDisplayRealDisplay",
+	"CameraDevice::GetRecommendedRenderTargetSize",
+	"CameraDevice::GetEyeOutputViewport",
+	"CameraDevice::GetProjectionRaw",
+	"CameraDevice::ComputeDistortion",
+	"CameraDevice::GetWindowBounds",
+	"CameraDevice::ComputeInverseDistortion",
+
+	"CameraDevice::Present",
+	"CameraDevice::WaitForPresent",
+	"CameraDevice::GetTimeSinceLastVsync",
+
+	"ServeFrames::Frame",
+	"ServeFrames::Acquire",
+	"ServeFrames::Metadata",
+	"ServeFrames::Release",
+	"ServeFrames::Fanout",
+	"ServeFrames::Copy",
+	"ServeFrames::BlockHold",
+
+	"RenderFrames::Fill",
+	"RenderFrames::Stereo",
+	"RenderFrames::Isp",
+	"RenderFrames::Mosaic",
+	"RenderFrames::Pack",
+
+	"DepthMeshProducer::Update",
+};
+
+static_assert(sizeof(g_metricNames) / sizeof(g_metricNames[0]) == Metric_Count, "Metric name table out of sync with EDriverMetric");
+
+
+DriverMetrics::DriverMetrics()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksToNs = 1.0e9 / (double)frequency.QuadPart;
+
+	QueryPerformanceCounter(&m_startTime);
+}
+
+const char* DriverMetrics::GetMetricName(EDriverMetric metric)
+{
+	if (metric < 0 || metric >= Metric_Count)
+	{
+		return "Unknown";
+	}
+	return g_metricNames[metric];
+}
+
+ThreadMetrics* DriverMetrics::RegisterThread()
+{
+	// Zero initialized through value-initialization of the atomics.
+	std::unique_ptr<ThreadMetrics> threadMetrics = std::make_unique<ThreadMetrics>();
+	ThreadMetrics* pThreadMetrics = threadMetrics.get();
+
+	{
+		std::lock_guard<std::mutex> lock(m_threadListMutex);
+		m_threadList.push_back(std::move(threadMetrics));
+	}
+
+	t_pThreadMetrics = pThreadMetrics;
+	return pThreadMetrics;
+}
+
+void DriverMetrics::SnapshotRaw(std::array<MetricSnapshot, Metric_Count>& outSnapshot)
+{
+	outSnapshot.fill(MetricSnapshot());
+
+	std::lock_guard<std::mutex> lock(m_threadListMutex);
+
+	for (const std::unique_ptr<ThreadMetrics>& thread : m_threadList)
+	{
+		for (int i = 0; i < Metric_Count; i++)
+		{
+			const MetricSlot& slot = thread->slots[i];
+			MetricSnapshot& snapshot = outSnapshot[i];
+
+			snapshot.count += slot.count.load(std::memory_order_relaxed);
+			snapshot.totalNs += slot.totalNs.load(std::memory_order_relaxed);
+
+			uint64_t maxNs = slot.maxNs.load(std::memory_order_relaxed);
+			if (maxNs > snapshot.maxNs)
+			{
+				snapshot.maxNs = maxNs;
+			}
+
+			for (int bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; bucket++)
+			{
+				snapshot.buckets[bucket] += slot.buckets[bucket].load(std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+void DriverMetrics::Snapshot(std::array<MetricSnapshot, Metric_Count>& outSnapshot)
+{
+	SnapshotRaw(outSnapshot);
+
+	std::lock_guard<std::mutex> lock(m_baselineMutex);
+
+	for (int i = 0; i < Metric_Count; i++)
+	{
+		MetricSnapshot& snapshot = outSnapshot[i];
+		const MetricSnapshot& baseline = m_baseline[i];
+
+		snapshot.count -= baseline.count;
+		snapshot.totalNs -= baseline.totalNs;
+
+		for (int bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; bucket++)
+		{
+			snapshot.buckets[bucket] -= baseline.buckets[bucket];
+		}
+	}
+}
+
+void DriverMetrics::Reset()
+{
+	std::array<MetricSnapshot, Metric_Count> current;
+	SnapshotRaw(current);
+
+	std::lock_guard<std::mutex> lock(m_baselineMutex);
+	m_baseline = current;
+}
+
+// Upper bound of a histogram bucket in microseconds.
+static double BucketUpperBoundUs(int bucket)
+{
+	return (double)(1ull << (bucket + METRIC_HISTOGRAM_BASE_SHIFT)) / 1000.0;
+}
+
+// Approximates a percentile as the upper bound of the bucket containing it.
+static double HistogramPercentileUs(const MetricSnapshot& snapshot, double percentile)
+{
+	if (snapshot.count == 0)
+	{
+		return 0.0;
+	}
+
+	uint64_t target = (uint64_t)ceil(snapshot.count * percentile);
+	uint64_t accumulated = 0;
+
+	for (int bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; bucket++)
+	{
+		accumulated += snapshot.buckets[bucket];
+		if (accumulated >= target)
+		{
+			return BucketUpperBoundUs(bucket);
+		}
+	}
+
+	return BucketUpperBoundUs(METRIC_HISTOGRAM_BUCKETS - 1);
+}
+
+std::string DriverMetrics::SnapshotJson()
+{
+	std::array<MetricSnapshot, Metric_Count> snapshot;
+	Snapshot(snapshot);
+
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+
+	size_t numThreads;
+	{
+		std::lock_guard<std::mutex> lock(m_threadListMutex);
+		numThreads = m_threadList.size();
+	}
+
+	std::string json = std::format("{{\"uptime_s\":{:.3f},\"threads\":{},\"histogram_base_us\":{:.3f},\"metrics\":{{",
+		(currTime.QuadPart - m_startTime.QuadPart) * m_ticksToNs / 1.0e9, numThreads, BucketUpperBoundUs(0));
+
+	bool bFirst = true;
+
+	for (int i = 0; i < Metric_Count; i++)
+	{
+		const MetricSnapshot& metric = snapshot[i];
+		if (metric.count == 0)
+		{
+			continue;
+		}
+
+		// Trailing empty buckets are trimmed to keep the response small.
+		int lastBucket = METRIC_HISTOGRAM_BUCKETS - 1;
+		while (lastBucket > 0 && metric.buckets[lastBucket] == 0)
+		{
+			lastBucket--;
+		}
+
+		std::string histogram;
+		for (int bucket = 0; bucket <= lastBucket; bucket++)
+		{
+			histogram += std::format("{}{}", (bucket > 0) ? "," : "", metric.buckets[bucket]);
+		}
+
+		json += std::format("{}\"{}\":{{\"count\":{},\"total_us\":{:.3f},\"mean_us\":{:.3f},\"max_us\":{:.3f},\"p50_us\":{:.3f},\"p99_us\":{:.3f},\"histogram\":[{}]}}",
+			bFirst ? "" : ",",
+			g_metricNames[i],
+			metric.count,
+			metric.totalNs / 1000.0,
+			metric.totalNs / 1000.0 / metric.count,
+			metric.maxNs / 1000.0,
+			HistogramPercentileUs(metric, 0.5),
+			HistogramPercentileUs(metric, 0.99),
+			histogram);
+
+		bFirst = false;
+	}
+
+	json += "}}";
+	return json;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+
+// Identifiers for every instrumented driver entry point. Keep in sync with g_metricNames in driver_metrics.cpp.
+enum EDriverMetric
+{
+	// IVRCameraComponent
+	Metric_GetCameraFrameDimensions = 0,
+	Metric_GetCameraFrameBufferingRequirements,
+	Metric_SetCameraFrameBuffering,
+	Metric_SetCameraVideoStreamFormat,
+	Metric_GetCameraVideoStreamFormat,
+	Metric_StartVideoStream,
+	Metric_StopVideoStream,
+	Metric_IsVideoStreamActive,
+	Metric_GetVideoStreamFrame,
+	Metric_ReleaseVideoStreamFrame,
+	Metric_SetAutoExposure,
+	Metric_PauseVideoStream,
+	Metric_ResumeVideoStream,
+	Metric_GetCameraDistortion,
+	Metric_GetCameraProjection,
+	Metric_SetFrameRate,
+	Metric_SetCameraVideoSinkCallback,
+	Metric_GetCameraCompatibilityMode,
+	Metric_SetCameraCompatibilityMode,
+	Metric_GetCameraFrameBounds,
+	Metric_GetCameraIntrinsics,
+
+	// IVRDisplayComponent
+	Metric_IsDisplayOnDesktop,
+	Metric_IsDisplayRealDisplay,
+	Metric_GetRecommendedRenderTargetSize,
+	Metric_GetEyeOutputViewport,
+	Metric_GetProjectionRaw,
+	Metric_ComputeDistortion,
+	Metric_GetWindowBounds,
+	Metric_ComputeInverseDistortion,
+
+	// IVRVirtualDisplay
+	Metric_Present,
+	Metric_WaitForPresent,
+	Metric_GetTimeSinceLastVsync,
+
+	// ServeFrames stages
+	Metric_ServeFrame,
+	Metric_ServeAcquire,
+	Metric_ServeMetadata,
+	Metric_ServeRelease,
+	Metric_ServeFanout,
+	Metric_ServeCopy,
+	Metric_ServeBlockHold,
+
+	// RenderFrames stages
+	Metric_RenderFill,
+	Metric_RenderStereo,
+	Metric_RenderIsp,
+	Metric_RenderMosaic,
+	Metric_RenderPack,
+
+	// Background work
+	Metric_DepthMeshUpdate,
+
+	Metric_Count
+};
+
+
+// Number of log2 latency buckets. Bucket 0 holds everything under 256 ns, the last one everything above ~2 s.
+#define METRIC_HISTOGRAM_BUCKETS 24
+#define METRIC_HISTOGRAM_BASE_SHIFT 8
+
+
+// Counters for one metric on one thread. Only the owning thread writes, so relaxed stores are enough.
+// Padded to whole cache lines to avoid false sharing between neighbouring slots.
+struct alignas(64) MetricSlot
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> totalNs;
+	std::atomic<uint64_t> maxNs;
+	std::atomic<uint64_t> buckets[METRIC_HISTOGRAM_BUCKETS];
+};
+
+struct ThreadMetrics
+{
+	MetricSlot slots[Metric_Count];
+};
+
+
+// Aggregate of all threads for a single metric.
+struct MetricSnapshot
+{
+	uint64_t count = 0;
+	uint64_t totalNs = 0;
+	uint64_t maxNs = 0;
+	uint64_t buckets[METRIC_HISTOGRAM_BUCKETS] = {};
+};
+
+
+class DriverMetrics
+{
+public:
+
+	DriverMetrics();
+
+	inline void Record(EDriverMetric metric, uint64_t durationTicks)
+	{
+		ThreadMetrics* pThread = t_pThreadMetrics;
+		if (pThread == nullptr)
+		{
+			pThread = RegisterThread();
+		}
+
+		MetricSlot& slot = pThread->slots[metric];
+		uint64_t durationNs = (uint64_t)(durationTicks * m_ticksToNs);
+
+		slot.count.store(slot.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		slot.totalNs.store(slot.totalNs.load(std::memory_order_relaxed) + durationNs, std::memory_order_relaxed);
+
+		if (durationNs > slot.maxNs.load(std::memory_order_relaxed))
+		{
+			slot.maxNs.store(durationNs, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64_t>& bucket = slot.buckets[GetBucket(durationNs)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// Sums the slots of all threads that have ever recorded, minus the last reset baseline.
+	void Snapshot(std::array<MetricSnapshot, Metric_Count>& outSnapshot);
+
+	// Serializes a snapshot as a JSON object. Metrics that were never hit are left out.
+	std::string SnapshotJson();
+
+	// Makes later snapshots relative to the current counts. The max values are kept as they can't be baselined.
+	void Reset();
+
+	static const char* GetMetricName(EDriverMetric metric);
+
+protected:
+
+	static inline uint32_t GetBucket(uint64_t durationNs)
+	{
+		uint32_t bucket = (uint32_t)std::bit_width(durationNs >> METRIC_HISTOGRAM_BASE_SHIFT);
+		return (bucket < METRIC_HISTOGRAM_BUCKETS) ? bucket : METRIC_HISTOGRAM_BUCKETS - 1;
+	}
+
+	void SnapshotRaw(std::array<MetricSnapshot, Metric_Count>& outSnapshot);
+	ThreadMetrics* RegisterThread();
+
+	static thread_local ThreadMetrics* t_pThreadMetrics;
+
+	double m_ticksToNs = 0.0;
+	LARGE_INTEGER m_startTime;
+
+	// Thread blocks are never freed, so counts from exited threads remain in the totals.
+	std::mutex m_threadListMutex;
+	std::vector<std::unique_ptr<ThreadMetrics>> m_threadList;
+
+	std::mutex m_baselineMutex;
+	std::array<MetricSnapshot, Metric_Count> m_baseline;
+};
+
+extern DriverMetrics g_driverMetrics;
+
+
+// Times the enclosing scope and records it under the given metric.
+class ScopedMetric
+{
+public:
+	inline ScopedMetric(EDriverMetric metric)
+		: m_metric(metric)
+	{
+		QueryPerformanceCounter(&m_startTime);
+	}
+
+	inline ~ScopedMetric()
+	{
+		LARGE_INTEGER endTime;
+		QueryPerformanceCounter(&endTime);
+		g_driverMetrics.Record(m_metric, endTime.QuadPart - m_startTime.QuadPart);
+	}
+
+private:
+	EDriverMetric m_metric;
+	LARGE_INTEGER m_startTime;
+};
+
+#define DRIVER_METRIC_CONCAT_INNER(a, b) a##b
+#define DRIVER_METRIC_CONCAT(a, b) DRIVER_METRIC_CONCAT_INNER(a, b)
+#define DRIVER_METRIC_SCOPE(metric) ScopedMetric DRIVER_METRIC_CONCAT(_scopedMetric, __LINE__)(metric)
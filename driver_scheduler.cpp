@@ -0,0 +1,352 @@
+#include "pch.h"
+#include "driver_scheduler.h"
+#include "driver_threads.h"
+
+
+DriverScheduler g_driverScheduler;
+
+
+static int64_t GetCurrentTicks()
+{
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+	return currTime.QuadPart;
+}
+
+
+DriverScheduler::DriverScheduler()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	m_ticksPerSecond = frequency.QuadPart;
+	m_epochTicks = GetCurrentTicks();
+	m_wheelTickTicks = (std::max)(m_ticksPerSecond * SCHEDULER_WHEEL_TICK_US / 1000000, (int64_t)1);
+	m_spinTicks = m_ticksPerSecond * SCHEDULER_SPIN_MARGIN_US / 1000000;
+	m_statsStartTicks = m_epochTicks;
+}
+
+DriverScheduler::~DriverScheduler()
+{
+	Stop();
+}
+
+void DriverScheduler::Start()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_bRunThread)
+	{
+		return;
+	}
+
+	m_cursorTick = GetWheelTick(GetCurrentTicks());
+	m_bRunThread = true;
+	m_thread = std::thread(&DriverScheduler::RunThread, this);
+}
+
+void DriverScheduler::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bRunThread = false;
+	}
+	m_condition.notify_all();
+
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+uint32_t DriverScheduler::AddPeriodicTask(const std::string& name, double rate, double phaseSeconds, const ScheduledTaskCallback& callback)
+{
+	std::unique_ptr<ScheduledTask> task = std::make_unique<ScheduledTask>();
+	task->name = name;
+	task->callback = callback;
+	task->periodTicks = m_ticksPerSecond / (std::max)(rate, 0.001);
+	task->phaseTicks = (int64_t)(phaseSeconds * m_ticksPerSecond);
+
+	// Starts from the next deadline rather than catching up from the epoch.
+	int64_t currTicks = GetCurrentTicks();
+	task->periodIndex = (int64_t)ceil((currTicks - m_epochTicks - task->phaseTicks) / task->periodTicks);
+	task->deadline = m_epochTicks + task->phaseTicks + (int64_t)(task->periodIndex * task->periodTicks);
+
+	uint32_t id;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		id = m_nextTaskId++;
+		task->id = id;
+
+		InsertTask(task.get());
+		m_tasks.push_back(std::move(task));
+	}
+	m_condition.notify_all();
+
+	VR_DRIVER_LOG_FORMAT("DriverScheduler: Added task {} at {} Hz, phase {} ms", name, rate, phaseSeconds * 1000.0);
+
+	return id;
+}
+
+void DriverScheduler::RemoveTask(uint32_t id)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	auto iter = std::find_if(m_tasks.begin(), m_tasks.end(), [id](const std::unique_ptr<ScheduledTask>& task) { return task->id == id; });
+	if (iter == m_tasks.end())
+	{
+		return;
+	}
+
+	std::unique_ptr<ScheduledTask> task = std::move(*iter);
+	m_tasks.erase(iter);
+	RemoveFromWheel(task.get());
+
+	// Tasks that aren't listed anymore are neither run nor put back in the wheel by the scheduler thread.
+	m_runCondition.wait(lock, [&] { return m_runningTaskId != id; });
+}
+
+int64_t DriverScheduler::GetNextDeadline(double rate, double phaseSeconds, int64_t afterTicks) const
+{
+	double periodTicks = m_ticksPerSecond / (std::max)(rate, 0.001);
+	int64_t phaseTicks = (int64_t)(phaseSeconds * m_ticksPerSecond);
+
+	int64_t periodIndex = (int64_t)ceil((afterTicks - m_epochTicks - phaseTicks) / periodTicks);
+	return m_epochTicks + phaseTicks + (int64_t)(periodIndex * periodTicks);
+}
+
+ScheduledTask* DriverScheduler::FindTask(uint32_t id) const
+{
+	auto iter = std::find_if(m_tasks.begin(), m_tasks.end(), [id](const std::unique_ptr<ScheduledTask>& task) { return task->id == id; });
+	return (iter != m_tasks.end()) ? iter->get() : nullptr;
+}
+
+void DriverScheduler::InsertTask(ScheduledTask* pTask)
+{
+	// Overdue tasks go in the slot under the cursor, so they are picked up on the next pass.
+	pTask->wheelTick = (std::max)(GetWheelTick(pTask->deadline), m_cursorTick);
+	m_wheel[pTask->wheelTick % SCHEDULER_WHEEL_SLOTS].push_back(pTask);
+}
+
+void DriverScheduler::RemoveFromWheel(ScheduledTask* pTask)
+{
+	std::vector<ScheduledTask*>& slot = m_wheel[pTask->wheelTick % SCHEDULER_WHEEL_SLOTS];
+	slot.erase(std::remove(slot.begin(), slot.end(), pTask), slot.end());
+}
+
+// Walks the wheel from the cursor for the first slot with a task due in the current round.
+// Only tasks more than a revolution away need the full scan.
+int64_t DriverScheduler::FindNextDeadline() const
+{
+	for (int64_t tick = m_cursorTick; tick < m_cursorTick + SCHEDULER_WHEEL_SLOTS; tick++)
+	{
+		int64_t nextDeadline = INT64_MAX;
+		for (ScheduledTask* pTask : m_wheel[tick % SCHEDULER_WHEEL_SLOTS])
+		{
+			if (pTask->wheelTick <= tick)
+			{
+				nextDeadline = (std::min)(nextDeadline, pTask->deadline);
+			}
+		}
+
+		if (nextDeadline != INT64_MAX)
+		{
+			return nextDeadline;
+		}
+	}
+
+	int64_t nextDeadline = INT64_MAX;
+	for (const std::vector<ScheduledTask*>& slot : m_wheel)
+	{
+		for (ScheduledTask* pTask : slot)
+		{
+			nextDeadline = (std::min)(nextDeadline, pTask->deadline);
+		}
+	}
+	return nextDeadline;
+}
+
+void DriverScheduler::CollectDueTasks(int64_t currTicks, std::vector<DueTask>& outDue)
+{
+	outDue.clear();
+
+	int64_t currTick = GetWheelTick(currTicks);
+
+	// After a stall longer than a revolution every slot is visited once.
+	int64_t firstTick = (std::max)(m_cursorTick, currTick - SCHEDULER_WHEEL_SLOTS + 1);
+
+	for (int64_t tick = firstTick; tick <= currTick; tick++)
+	{
+		std::vector<ScheduledTask*>& slot = m_wheel[tick % SCHEDULER_WHEEL_SLOTS];
+
+		for (size_t i = 0; i < slot.size();)
+		{
+			ScheduledTask* pTask = slot[i];
+			if (pTask->wheelTick <= currTick && pTask->deadline <= currTicks)
+			{
+				outDue.push_back({ pTask->id, pTask->deadline });
+				slot[i] = slot.back();
+				slot.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	// The current tick may still hold tasks due later within it.
+	m_cursorTick = (std::max)(m_cursorTick, currTick);
+
+	// Run in deadline order, so tasks sharing a wake-up keep their phase order.
+	std::sort(outDue.begin(), outDue.end(), [](const DueTask& a, const DueTask& b) { return a.deadline < b.deadline; });
+}
+
+// Moves the task to its first deadline after the current time, counting the periods skipped on the way.
+void DriverScheduler::AdvanceTask(ScheduledTask* pTask, int64_t currTicks)
+{
+	pTask->periodIndex++;
+
+	int64_t nextIndex = (int64_t)ceil((currTicks - m_epochTicks - pTask->phaseTicks) / pTask->periodTicks);
+	if (nextIndex > pTask->periodIndex)
+	{
+		pTask->missed += nextIndex - pTask->periodIndex;
+		pTask->periodIndex = nextIndex;
+	}
+
+	pTask->deadline = m_epochTicks + pTask->phaseTicks + (int64_t)(pTask->periodIndex * pTask->periodTicks);
+	InsertTask(pTask);
+}
+
+void DriverScheduler::RunThread()
+{
+	g_driverThreads.Register(DriverThread_Scheduler);
+
+	double ticksToNs = 1.0e9 / (double)m_ticksPerSecond;
+	std::vector<DueTask> dueTasks;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (m_bRunThread)
+	{
+		int64_t nextDeadline = FindNextDeadline();
+		if (nextDeadline == INT64_MAX)
+		{
+			m_condition.wait(lock);
+			continue;
+		}
+
+		// Woken early by task changes, the deadline is looked up again.
+		int64_t sleepTicks = nextDeadline - GetCurrentTicks() - m_spinTicks;
+		if (sleepTicks > 0)
+		{
+			m_condition.wait_for(lock, std::chrono::microseconds(sleepTicks * 1000000 / m_ticksPerSecond));
+			continue;
+		}
+
+		lock.unlock();
+
+		int64_t currTicks;
+		while ((currTicks = GetCurrentTicks()) < nextDeadline)
+		{
+			YieldProcessor();
+		}
+
+		g_driverThreads.RecordWake(currTicks - nextDeadline);
+
+		lock.lock();
+
+		m_wakes++;
+		CollectDueTasks(currTicks, dueTasks);
+
+		for (const DueTask& due : dueTasks)
+		{
+			// Removed while an earlier task ran outside the mutex.
+			ScheduledTask* pTask = FindTask(due.id);
+			if (pTask == nullptr)
+			{
+				continue;
+			}
+
+			int64_t deadline = pTask->deadline;
+			m_runningTaskId = due.id;
+			lock.unlock();
+
+			int64_t startTicks = GetCurrentTicks();
+			pTask->callback(deadline);
+			int64_t endTicks = GetCurrentTicks();
+
+			lock.lock();
+			m_runningTaskId = 0;
+
+			uint64_t latenessNs = (uint64_t)((startTicks - deadline) * ticksToNs);
+			uint64_t runtimeNs = (uint64_t)((endTicks - startTicks) * ticksToNs);
+
+			pTask->runs++;
+			pTask->totalLatenessNs += latenessNs;
+			pTask->maxLatenessNs = (std::max)(pTask->maxLatenessNs, latenessNs);
+			pTask->totalRuntimeNs += runtimeNs;
+			pTask->maxRuntimeNs = (std::max)(pTask->maxRuntimeNs, runtimeNs);
+
+			// Tasks removed while running were taken out of the task list.
+			if (FindTask(due.id) != nullptr)
+			{
+				AdvanceTask(pTask, endTicks);
+			}
+
+			m_runCondition.notify_all();
+		}
+	}
+}
+
+void DriverScheduler::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (std::unique_ptr<ScheduledTask>& task : m_tasks)
+	{
+		task->runs = 0;
+		task->missed = 0;
+		task->totalLatenessNs = 0;
+		task->maxLatenessNs = 0;
+		task->totalRuntimeNs = 0;
+		task->maxRuntimeNs = 0;
+	}
+
+	m_wakes = 0;
+	m_statsStartTicks = GetCurrentTicks();
+}
+
+std::string DriverScheduler::GetStatusJson()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	double elapsed = (GetCurrentTicks() - m_statsStartTicks) / (double)m_ticksPerSecond;
+
+	std::string json = std::format("{{\"running\":{},\"wakes\":{},\"wakes_per_s\":{:.1f},\"tasks\":[",
+		m_bRunThread ? "true" : "false", m_wakes, (elapsed > 0.0) ? m_wakes / elapsed : 0.0);
+
+	bool bFirst = true;
+
+	for (const std::unique_ptr<ScheduledTask>& task : m_tasks)
+	{
+		json += std::format("{}{{\"name\":\"{}\",\"rate\":{:.3f},\"phase_ms\":{:.3f},\"runs\":{},\"missed\":{},"
+			"\"mean_lateness_us\":{:.3f},\"max_lateness_us\":{:.3f},\"mean_runtime_us\":{:.3f},\"max_runtime_us\":{:.3f}}}",
+			bFirst ? "" : ",",
+			task->name,
+			m_ticksPerSecond / task->periodTicks,
+			task->phaseTicks * 1000.0 / m_ticksPerSecond,
+			task->runs,
+			task->missed,
+			(task->runs > 0) ? task->totalLatenessNs / 1000.0 / task->runs : 0.0,
+			task->maxLatenessNs / 1000.0,
+			(task->runs > 0) ? task->totalRuntimeNs / 1000.0 / task->runs : 0.0,
+			task->maxRuntimeNs / 1000.0);
+
+		bFirst = false;
+	}
+
+	json += "]}";
+	return json;
+}
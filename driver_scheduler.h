@@ -0,0 +1,115 @@
+#pragma once
+
+
+// Wheel slots and the time each covers. Deadlines more than a revolution ahead wait in their slot for later rounds.
+#define SCHEDULER_WHEEL_SLOTS 64
+#define SCHEDULER_WHEEL_TICK_US 1000
+
+// Waits end with a spin for the last stretch before the deadline, as sleeps can overshoot by the scheduler granularity.
+#define SCHEDULER_SPIN_MARGIN_US 1500
+
+
+// Called with the deadline of the period it runs for, in performance counter ticks.
+typedef std::function<void(int64_t deadlineTicks)> ScheduledTaskCallback;
+
+struct ScheduledTask
+{
+	uint32_t id = 0;
+	std::string name;
+	ScheduledTaskCallback callback;
+
+	// Deadlines are at epoch + phase + n * period, so tasks sharing a rate stay phase-locked to each other.
+	double periodTicks = 0.0;
+	int64_t phaseTicks = 0;
+	int64_t periodIndex = 0;
+	int64_t deadline = 0;
+
+	// Wheel tick the task is filed under, at or after the wheel cursor.
+	int64_t wheelTick = 0;
+
+	uint64_t runs = 0;
+	uint64_t missed = 0;
+	uint64_t totalLatenessNs = 0;
+	uint64_t maxLatenessNs = 0;
+	uint64_t totalRuntimeNs = 0;
+	uint64_t maxRuntimeNs = 0;
+};
+
+
+// Single thread running all periodic driver work off a hashed timer wheel, at absolute deadlines on a shared timeline.
+// Tasks due at the same time run on the same wake-up, and a late task skips the periods it missed rather than bunching up.
+// Callbacks should be short, as a long one delays every task due after it.
+class DriverScheduler
+{
+public:
+
+	DriverScheduler();
+	~DriverScheduler();
+
+	void Start();
+	void Stop();
+
+	// Runs the callback rate times per second, offset by phaseSeconds from the scheduler timeline. Returns the task id.
+	uint32_t AddPeriodicTask(const std::string& name, double rate, double phaseSeconds, const ScheduledTaskCallback& callback);
+
+	// Returns once the task can no longer run, so anything its callback uses can be released afterwards.
+	// Must not be called from a task callback.
+	void RemoveTask(uint32_t id);
+
+	// First deadline of the given rate and phase on the scheduler timeline at or after the given time,
+	// for deadline driven work paced by its own thread, such as the camera frames.
+	int64_t GetNextDeadline(double rate, double phaseSeconds, int64_t afterTicks) const;
+
+	// Serializes the tasks with their lateness and runtime statistics as a JSON object.
+	std::string GetStatusJson();
+
+	// Clears the task statistics.
+	void Reset();
+
+protected:
+
+	// Task picked up by a wake-up. Held by id, as it may be removed while the tasks before it run outside the mutex.
+	struct DueTask
+	{
+		uint32_t id;
+		int64_t deadline;
+	};
+
+	void RunThread();
+
+	inline int64_t GetWheelTick(int64_t ticks) const { return (ticks - m_epochTicks) / m_wheelTickTicks; }
+
+	// Called with the mutex held.
+	ScheduledTask* FindTask(uint32_t id) const;
+	void InsertTask(ScheduledTask* pTask);
+	void RemoveFromWheel(ScheduledTask* pTask);
+	int64_t FindNextDeadline() const;
+	void CollectDueTasks(int64_t currTicks, std::vector<DueTask>& outDue);
+	void AdvanceTask(ScheduledTask* pTask, int64_t currTicks);
+
+	int64_t m_ticksPerSecond = 0;
+	int64_t m_epochTicks = 0;
+	int64_t m_wheelTickTicks = 0;
+	int64_t m_spinTicks = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::condition_variable m_runCondition;
+
+	std::vector<std::unique_ptr<ScheduledTask>> m_tasks;
+	std::array<std::vector<ScheduledTask*>, SCHEDULER_WHEEL_SLOTS> m_wheel;
+	int64_t m_cursorTick = 0;
+	// Ids are never reused, so a task removed and another added at the same address can't be mistaken for each other.
+	uint32_t m_nextTaskId = 1;
+
+	// Id of the task whose callback is running outside the mutex, or zero.
+	uint32_t m_runningTaskId = 0;
+
+	uint64_t m_wakes = 0;
+	int64_t m_statsStartTicks = 0;
+
+	std::thread m_thread;
+	bool m_bRunThread = false;
+};
+
+extern DriverScheduler g_driverScheduler;
@@ -0,0 +1,364 @@
+#include "pch.h"
+#include "driver_threads.h"
+
+#include <timeapi.h>
+#include <avrt.h>
+
+
+#define THREADS_CONFIG "openvr_camera_sim_threads"
+
+
+DriverThreads g_driverThreads;
+
+thread_local RegisteredThread* DriverThreads::t_pThread = nullptr;
+
+// Settings key prefixes and thread names.
+static const char* g_threadRoleNames[] =
+{
+	"frame_serve",
+	"frame_render",
+	"render_worker",
+	"scheduler",
+	"display_window",
+	"depth_mesh",
+	"sequence_decode",
+	"capture_decode",
+	"capture_worker",
+	"log_flush",
+	"trace_flush",
+};
+
+static_assert(sizeof(g_threadRoleNames) / sizeof(g_threadRoleNames[0]) == DriverThread_Count, "Thread role name table out of sync with EDriverThread");
+
+struct ThreadPriorityName
+{
+	const char* name;
+	int32_t priority;
+};
+
+static const ThreadPriorityName g_threadPriorityNames[] =
+{
+	{ "lowest", THREAD_PRIORITY_LOWEST },
+	{ "below_normal", THREAD_PRIORITY_BELOW_NORMAL },
+	{ "normal", THREAD_PRIORITY_NORMAL },
+	{ "above_normal", THREAD_PRIORITY_ABOVE_NORMAL },
+	{ "highest", THREAD_PRIORITY_HIGHEST },
+	{ "time_critical", THREAD_PRIORITY_TIME_CRITICAL },
+};
+
+static const char* GetPriorityName(int32_t priority)
+{
+	for (const ThreadPriorityName& entry : g_threadPriorityNames)
+	{
+		if (entry.priority == priority)
+		{
+			return entry.name;
+		}
+	}
+	return "unknown";
+}
+
+// Parses a processor list such as "2,3" or "4-7" into a mask. Returns false on malformed lists.
+static bool ParseAffinity(const std::string& text, uint64_t& outMask)
+{
+	outMask = 0;
+
+	std::stringstream stream(text);
+	std::string range;
+
+	while (std::getline(stream, range, ','))
+	{
+		if (range.empty())
+		{
+			continue;
+		}
+
+		uint32_t first = 0;
+		uint32_t last = 0;
+		char separator = 0;
+		std::stringstream rangeStream(range);
+
+		rangeStream >> first;
+		if (rangeStream.fail())
+		{
+			return false;
+		}
+
+		last = first;
+		if (rangeStream >> separator)
+		{
+			if (separator != '-' || !(rangeStream >> last))
+			{
+				return false;
+			}
+		}
+
+		if (last < first || last >= 64)
+		{
+			return false;
+		}
+
+		for (uint32_t processor = first; processor <= last; processor++)
+		{
+			outMask |= 1ull << processor;
+		}
+	}
+
+	return true;
+}
+
+// Unregisters the thread at exit, so the registry doesn't rely on every thread function cleaning up after itself.
+struct ThreadRegistration
+{
+	RegisteredThread* pThread = nullptr;
+	HANDLE mmcssHandle = nullptr;
+
+	~ThreadRegistration()
+	{
+		if (pThread != nullptr)
+		{
+			g_driverThreads.Unregister(pThread, mmcssHandle);
+		}
+	}
+};
+
+static thread_local ThreadRegistration t_registration;
+
+
+DriverThreads::DriverThreads()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksToNs = 1.0e9 / (double)frequency.QuadPart;
+}
+
+const char* DriverThreads::GetRoleName(EDriverThread role)
+{
+	if (role < 0 || role >= DriverThread_Count)
+	{
+		return "unknown";
+	}
+	return g_threadRoleNames[role];
+}
+
+void DriverThreads::Start()
+{
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	for (int i = 0; i < DriverThread_Count; i++)
+	{
+		ThreadRoleSettings& settings = m_roleSettings[i];
+		settings = ThreadRoleSettings();
+
+		std::string prefix = g_threadRoleNames[i];
+		char value[256] = {};
+
+		vr::VRSettings()->GetString(THREADS_CONFIG, (prefix + "_priority").c_str(), value, sizeof(value), &settingsError);
+		if (settingsError == vr::VRSettingsError_None && value[0] != 0)
+		{
+			bool bFound = false;
+			for (const ThreadPriorityName& entry : g_threadPriorityNames)
+			{
+				if (strcmp(value, entry.name) == 0)
+				{
+					settings.priority = entry.priority;
+					bFound = true;
+				}
+			}
+			if (!bFound)
+			{
+				VR_DRIVER_LOG_FORMAT("DriverThreads: Unknown priority \"{}\" for {}", value, prefix);
+			}
+		}
+
+		value[0] = 0;
+		vr::VRSettings()->GetString(THREADS_CONFIG, (prefix + "_affinity").c_str(), value, sizeof(value), &settingsError);
+		if (settingsError == vr::VRSettingsError_None && value[0] != 0 && !ParseAffinity(value, settings.affinityMask))
+		{
+			VR_DRIVER_LOG_FORMAT("DriverThreads: Invalid affinity \"{}\" for {}", value, prefix);
+			settings.affinityMask = 0;
+		}
+
+		value[0] = 0;
+		vr::VRSettings()->GetString(THREADS_CONFIG, (prefix + "_mmcss").c_str(), value, sizeof(value), &settingsError);
+		if (settingsError == vr::VRSettingsError_None)
+		{
+			settings.mmcssTask = value;
+		}
+	}
+
+	int32_t timerResolutionMs = vr::VRSettings()->GetInt32(THREADS_CONFIG, "timer_resolution_ms", &settingsError);
+	if (settingsError != vr::VRSettingsError_None || timerResolutionMs < 0)
+	{
+		timerResolutionMs = 0;
+	}
+
+	// The resolution request is process wide, and lasts until the matching timeEndPeriod.
+	m_timerResolutionMs = (uint32_t)timerResolutionMs;
+	if (m_timerResolutionMs > 0 && !m_bTimerResolutionSet)
+	{
+		m_bTimerResolutionSet = (timeBeginPeriod(m_timerResolutionMs) == TIMERR_NOERROR);
+		if (!m_bTimerResolutionSet)
+		{
+			VR_DRIVER_LOG_FORMAT("DriverThreads: Failed to set the timer resolution to {} ms", m_timerResolutionMs);
+		}
+	}
+}
+
+void DriverThreads::Stop()
+{
+	if (m_bTimerResolutionSet)
+	{
+		timeEndPeriod(m_timerResolutionMs);
+		m_bTimerResolutionSet = false;
+	}
+}
+
+void DriverThreads::Register(EDriverThread role)
+{
+	if (t_registration.pThread != nullptr)
+	{
+		return;
+	}
+
+	RegisteredThread* pThread = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_threadListMutex);
+
+		uint32_t roleCount = 0;
+		for (std::unique_ptr<RegisteredThread>& thread : m_threadList)
+		{
+			if (thread->role != role)
+			{
+				continue;
+			}
+			if (!thread->bActive && pThread == nullptr)
+			{
+				pThread = thread.get();
+			}
+			roleCount++;
+		}
+
+		if (pThread == nullptr)
+		{
+			std::unique_ptr<RegisteredThread> thread = std::make_unique<RegisteredThread>();
+			thread->role = role;
+			thread->roleIndex = roleCount;
+			pThread = thread.get();
+			m_threadList.push_back(std::move(thread));
+		}
+
+		pThread->threadId = GetCurrentThreadId();
+		pThread->bActive = true;
+		pThread->starts++;
+	}
+
+	const ThreadRoleSettings& settings = m_roleSettings[role];
+	HANDLE thread = GetCurrentThread();
+
+	std::string name = std::format("openvr_camera_sim {} {}", g_threadRoleNames[role], pThread->roleIndex);
+	SetThreadDescription(thread, std::wstring(name.begin(), name.end()).c_str());
+
+	pThread->priorityError = 0;
+	if (settings.priority != THREAD_PRIORITY_NORMAL && !SetThreadPriority(thread, settings.priority))
+	{
+		pThread->priorityError = GetLastError();
+	}
+
+	pThread->affinityError = 0;
+	if (settings.affinityMask != 0 && SetThreadAffinityMask(thread, (DWORD_PTR)settings.affinityMask) == 0)
+	{
+		pThread->affinityError = GetLastError();
+	}
+
+	// MMCSS boosts the thread into the realtime range for the task's share of each period, without needing admin rights.
+	pThread->mmcssError = 0;
+	HANDLE mmcssHandle = nullptr;
+	if (!settings.mmcssTask.empty())
+	{
+		DWORD taskIndex = 0;
+		mmcssHandle = AvSetMmThreadCharacteristicsW(std::wstring(settings.mmcssTask.begin(), settings.mmcssTask.end()).c_str(), &taskIndex);
+		if (mmcssHandle == nullptr)
+		{
+			pThread->mmcssError = GetLastError();
+		}
+	}
+
+	if (pThread->priorityError != 0 || pThread->affinityError != 0 || pThread->mmcssError != 0)
+	{
+		VR_DRIVER_LOG_FORMAT("DriverThreads: Failed to apply settings to {}: priority error {}, affinity error {}, mmcss error {}",
+			name, pThread->priorityError.load(), pThread->affinityError.load(), pThread->mmcssError.load());
+	}
+
+	t_registration.pThread = pThread;
+	t_registration.mmcssHandle = mmcssHandle;
+	t_pThread = pThread;
+}
+
+void DriverThreads::Unregister(RegisteredThread* pThread, HANDLE mmcssHandle)
+{
+	if (mmcssHandle != nullptr)
+	{
+		AvRevertMmThreadCharacteristics(mmcssHandle);
+	}
+
+	t_pThread = nullptr;
+
+	std::lock_guard<std::mutex> lock(m_threadListMutex);
+	pThread->bActive = false;
+}
+
+void DriverThreads::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_threadListMutex);
+
+	for (std::unique_ptr<RegisteredThread>& thread : m_threadList)
+	{
+		thread->baselineWakes = thread->wakes.load(std::memory_order_relaxed);
+		thread->baselineLateWakes = thread->lateWakes.load(std::memory_order_relaxed);
+		thread->baselineLatenessNs = thread->totalLatenessNs.load(std::memory_order_relaxed);
+	}
+}
+
+std::string DriverThreads::GetStatusJson()
+{
+	std::string json = std::format("{{\"timer_resolution_ms\":{},\"late_threshold_us\":{},\"threads\":[",
+		m_bTimerResolutionSet ? m_timerResolutionMs : 0, THREAD_WAKE_LATE_THRESHOLD_US);
+
+	std::lock_guard<std::mutex> lock(m_threadListMutex);
+
+	bool bFirst = true;
+
+	for (std::unique_ptr<RegisteredThread>& thread : m_threadList)
+	{
+		const ThreadRoleSettings& settings = m_roleSettings[thread->role];
+
+		uint64_t wakes = thread->wakes.load(std::memory_order_relaxed) - thread->baselineWakes;
+		uint64_t lateWakes = thread->lateWakes.load(std::memory_order_relaxed) - thread->baselineLateWakes;
+		uint64_t latenessNs = thread->totalLatenessNs.load(std::memory_order_relaxed) - thread->baselineLatenessNs;
+
+		json += std::format("{}{{\"role\":\"{}\",\"index\":{},\"thread_id\":{},\"active\":{},\"starts\":{},\"priority\":\"{}\",\"affinity\":\"0x{:x}\",\"mmcss\":\"{}\","
+			"\"priority_error\":{},\"affinity_error\":{},\"mmcss_error\":{},\"wakes\":{},\"late_wakes\":{},\"mean_lateness_us\":{:.3f},\"max_lateness_us\":{:.3f}}}",
+			bFirst ? "" : ",",
+			g_threadRoleNames[thread->role],
+			thread->roleIndex,
+			thread->threadId.load(),
+			thread->bActive.load() ? "true" : "false",
+			thread->starts.load(),
+			GetPriorityName(settings.priority),
+			settings.affinityMask,
+			settings.mmcssTask,
+			thread->priorityError.load(),
+			thread->affinityError.load(),
+			thread->mmcssError.load(),
+			wakes,
+			lateWakes,
+			(wakes > 0) ? latenessNs / 1000.0 / wakes : 0.0,
+			thread->maxLatenessNs.load(std::memory_order_relaxed) / 1000.0);
+
+		bFirst = false;
+	}
+
+	json += "]}";
+	return json;
+}
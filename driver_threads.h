@@ -0,0 +1,135 @@
+#pragma once
+
+
+// Roles of the driver threads. Keep in sync with g_threadRoleNames in driver_threads.cpp.
+enum EDriverThread
+{
+	DriverThread_FrameServe = 0,
+	DriverThread_FrameRender,
+	DriverThread_RenderWorker,
+	DriverThread_Scheduler,
+	DriverThread_DisplayWindow,
+	DriverThread_DepthMesh,
+	DriverThread_SequenceDecode,
+	DriverThread_CaptureDecode,
+	DriverThread_CaptureWorker,
+	DriverThread_LogFlush,
+	DriverThread_TraceFlush,
+
+	DriverThread_Count
+};
+
+// Wake-ups later than this past their deadline are counted as late.
+#define THREAD_WAKE_LATE_THRESHOLD_US 500
+
+
+// Scheduling settings of one thread role, from the <role>_* keys of the openvr_camera_sim_threads settings.
+struct ThreadRoleSettings
+{
+	// THREAD_PRIORITY_* value, or THREAD_PRIORITY_NORMAL to leave the priority alone.
+	int32_t priority = THREAD_PRIORITY_NORMAL;
+
+	// Processor mask within the first processor group, zero for any.
+	uint64_t affinityMask = 0;
+
+	// Multimedia Class Scheduler task, such as "Capture" or "Pro Audio", empty for none.
+	std::string mmcssTask;
+};
+
+// One registered thread. Entries are reused by the next thread registering with the same role, and never freed.
+struct RegisteredThread
+{
+	EDriverThread role;
+	uint32_t roleIndex = 0;
+
+	std::atomic<uint32_t> threadId = 0;
+	std::atomic<bool> bActive = false;
+	std::atomic<uint32_t> starts = 0;
+
+	// Settings that failed to apply, as Win32 error codes, or zero.
+	std::atomic<uint32_t> priorityError = 0;
+	std::atomic<uint32_t> affinityError = 0;
+	std::atomic<uint32_t> mmcssError = 0;
+
+	// Only the owning thread writes, so relaxed stores are enough.
+	std::atomic<uint64_t> wakes = 0;
+	std::atomic<uint64_t> lateWakes = 0;
+	std::atomic<uint64_t> totalLatenessNs = 0;
+	std::atomic<uint64_t> maxLatenessNs = 0;
+
+	// Counts at the last reset, guarded by the thread list mutex.
+	uint64_t baselineWakes = 0;
+	uint64_t baselineLateWakes = 0;
+	uint64_t baselineLatenessNs = 0;
+};
+
+
+// Names every driver thread and applies its scheduling settings: OS priority, processor affinity and MMCSS task.
+// Also sets the system timer resolution for the session, and keeps per-thread statistics of how late the
+// deadline driven threads wake up, to tell scheduler placement apart from work overruns.
+class DriverThreads
+{
+public:
+
+	DriverThreads();
+
+	// Reads the openvr_camera_sim_threads settings and sets the timer resolution. Called before any thread is started.
+	void Start();
+
+	// Restores the timer resolution.
+	void Stop();
+
+	// Names the calling thread and applies the settings of its role. The thread is unregistered when it exits.
+	void Register(EDriverThread role);
+
+	// Records how many ticks past its deadline the calling thread woke up. Does nothing on unregistered threads.
+	inline void RecordWake(int64_t lateTicks)
+	{
+		RegisteredThread* pThread = t_pThread;
+		if (pThread == nullptr)
+		{
+			return;
+		}
+
+		uint64_t latenessNs = (lateTicks > 0) ? (uint64_t)(lateTicks * m_ticksToNs) : 0;
+
+		pThread->wakes.store(pThread->wakes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		pThread->totalLatenessNs.store(pThread->totalLatenessNs.load(std::memory_order_relaxed) + latenessNs, std::memory_order_relaxed);
+
+		if (latenessNs > pThread->maxLatenessNs.load(std::memory_order_relaxed))
+		{
+			pThread->maxLatenessNs.store(latenessNs, std::memory_order_relaxed);
+		}
+		if (latenessNs > THREAD_WAKE_LATE_THRESHOLD_US * 1000)
+		{
+			pThread->lateWakes.store(pThread->lateWakes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+	}
+
+	// Serializes the registered threads, their settings and wake-up statistics as a JSON object.
+	std::string GetStatusJson();
+
+	// Makes the later wake-up statistics relative to the current counts. The max values are kept as they can't be baselined.
+	void Reset();
+
+	static const char* GetRoleName(EDriverThread role);
+
+protected:
+
+	friend struct ThreadRegistration;
+
+	void Unregister(RegisteredThread* pThread, HANDLE mmcssHandle);
+
+	static thread_local RegisteredThread* t_pThread;
+
+	double m_ticksToNs = 0.0;
+
+	std::array<ThreadRoleSettings, DriverThread_Count> m_roleSettings;
+	uint32_t m_timerResolutionMs = 0;
+	bool m_bTimerResolutionSet = false;
+
+	std::mutex m_threadListMutex;
+	std::vector<std::unique_ptr<RegisteredThread>> m_threadList;
+};
+
+extern DriverThreads g_driverThreads;
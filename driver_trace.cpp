@@ -0,0 +1,373 @@
+#include "pch.h"
+#include "driver_trace.h"
+#include "driver_threads.h"
+
+
+#define TRACE_CONFIG "openvr_camera_sim"
+
+
+DriverTrace g_driverTrace;
+
+thread_local TraceThreadBuffer* DriverTrace::t_pThreadBuffer = nullptr;
+
+// Releases the thread's ring at exit, so it can be reused by a later thread.
+struct TraceThreadRegistration
+{
+	TraceThreadBuffer* pBuffer = nullptr;
+
+	~TraceThreadRegistration()
+	{
+		if (pBuffer != nullptr)
+		{
+			g_driverTrace.ReleaseThread(pBuffer);
+		}
+	}
+};
+
+static thread_local TraceThreadRegistration t_traceRegistration;
+
+
+// Windows paths need their backslashes escaped in the JSON responses.
+static std::string EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '\\' || c == '"')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+
+DriverTrace::DriverTrace()
+{
+}
+
+DriverTrace::~DriverTrace()
+{
+	Stop();
+}
+
+bool DriverTrace::Start(const std::string& requestedPath)
+{
+	std::lock_guard<std::mutex> lock(m_controlMutex);
+
+	if (m_bRecording)
+	{
+		return false;
+	}
+
+	std::string path = requestedPath;
+
+	if (path.empty())
+	{
+		// Named by the start time, so consecutive sessions don't overwrite each other.
+		path = (std::filesystem::temp_directory_path() / std::format("openvr_camera_sim_{}.trace", time(nullptr))).string();
+	}
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER startTime;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&startTime);
+
+	{
+		std::lock_guard<std::mutex> fileLock(m_fileMutex);
+
+		m_file.open(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+		if (!m_file.is_open())
+		{
+			VR_DRIVER_LOG_FORMAT("DriverTrace: Failed to open trace file {}", path);
+			return false;
+		}
+
+		DriverTraceFileHeader header = {};
+		header.magic = DRIVER_TRACE_MAGIC;
+		header.version = DRIVER_TRACE_VERSION;
+		header.recordSize = sizeof(DriverTraceRecord);
+		header.ticksPerSecond = frequency.QuadPart;
+		header.startTicks = startTime.QuadPart;
+
+		m_file.write((const char*)&header, sizeof(header));
+
+		m_path = path;
+		m_startTicks = startTime.QuadPart;
+
+		// Drops from an earlier recording are not reported again.
+		std::lock_guard<std::mutex> listLock(m_threadListMutex);
+		for (std::unique_ptr<TraceThreadBuffer>& buffer : m_threadList)
+		{
+			buffer->reportedDropped = buffer->dropped.load(std::memory_order_relaxed);
+		}
+	}
+
+	m_recordsWritten = 0;
+	m_recordsDropped = 0;
+	m_bytesWritten = sizeof(DriverTraceFileHeader);
+
+	m_bRunThread = true;
+	m_flushThread = std::thread(&DriverTrace::RunFlushThread, this);
+
+	m_bRecording.store(true, std::memory_order_release);
+
+	VR_DRIVER_LOG_FORMAT("DriverTrace: Recording to {}", path);
+
+	return true;
+}
+
+void DriverTrace::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_controlMutex);
+
+	if (!m_bRecording.exchange(false))
+	{
+		return;
+	}
+
+	m_bRunThread = false;
+	m_flushThread.join();
+
+	// Anything recorded before the flag was cleared. Scopes still open on other threads stay in their rings,
+	// and are skipped by the next recording as they started before it.
+	Flush();
+
+	{
+		std::lock_guard<std::mutex> fileLock(m_fileMutex);
+		m_file.close();
+	}
+
+	VR_DRIVER_LOG_FORMAT("DriverTrace: Stopped, wrote {} records to {}, {} dropped", m_recordsWritten.load(), m_path, m_recordsDropped.load());
+}
+
+void DriverTrace::StartFromSettings()
+{
+	vr::EVRSettingsError error = vr::VRSettingsError_None;
+
+	bool bEnable = vr::VRSettings()->GetBool(TRACE_CONFIG, "trace_enable", &error);
+	if (error != vr::VRSettingsError_None || !bEnable)
+	{
+		return;
+	}
+
+	char path[1024] = {};
+	vr::VRSettings()->GetString(TRACE_CONFIG, "trace_path", path, sizeof(path), &error);
+
+	Start((error == vr::VRSettingsError_None) ? path : "");
+}
+
+TraceThreadBuffer* DriverTrace::RegisterThread()
+{
+	TraceThreadBuffer* pBuffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_threadListMutex);
+
+		// A released ring can only be reused once the flush thread has read everything its last owner wrote.
+		// The positions keep counting up from where they are, as the flush thread may still hold them.
+		for (std::unique_ptr<TraceThreadBuffer>& buffer : m_threadList)
+		{
+			if (buffer->bReleased.load(std::memory_order_acquire) &&
+				buffer->readPosition.load(std::memory_order_acquire) == buffer->writePosition.load(std::memory_order_relaxed))
+			{
+				pBuffer = buffer.get();
+				break;
+			}
+		}
+
+		if (pBuffer == nullptr)
+		{
+			m_threadList.push_back(std::make_unique<TraceThreadBuffer>());
+			pBuffer = m_threadList.back().get();
+		}
+
+		pBuffer->threadId.store(GetCurrentThreadId(), std::memory_order_relaxed);
+		pBuffer->bReleased.store(false, std::memory_order_relaxed);
+	}
+
+	t_traceRegistration.pBuffer = pBuffer;
+	t_pThreadBuffer = pBuffer;
+
+	return pBuffer;
+}
+
+// Called when the owning thread exits, after its last write.
+void DriverTrace::ReleaseThread(TraceThreadBuffer* pBuffer)
+{
+	t_pThreadBuffer = nullptr;
+
+	std::lock_guard<std::mutex> lock(m_threadListMutex);
+	pBuffer->bReleased.store(true, std::memory_order_release);
+}
+
+void DriverTrace::Write(const DriverTraceRecord& record, const char* pText)
+{
+	TraceThreadBuffer* pBuffer = t_pThreadBuffer;
+	if (pBuffer == nullptr)
+	{
+		pBuffer = RegisterThread();
+	}
+
+	// The text is kept zero terminated across the continuation records.
+	size_t textLength = (pText != nullptr) ? strnlen(pText, DRIVER_TRACE_MAX_TEXT - 1) : 0;
+	uint32_t textRecords = (pText != nullptr) ? (uint32_t)((textLength + DRIVER_TRACE_RECORD_TEXT) / DRIVER_TRACE_RECORD_TEXT) : 0;
+
+	uint64_t writePosition = pBuffer->writePosition.load(std::memory_order_relaxed);
+	uint64_t readPosition = pBuffer->readPosition.load(std::memory_order_acquire);
+
+	if (writePosition - readPosition + 1 + textRecords > TRACE_RING_RECORDS)
+	{
+		pBuffer->dropped.fetch_add(1, std::memory_order_relaxed);
+		m_recordsDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	uint32_t threadId = pBuffer->threadId.load(std::memory_order_relaxed);
+
+	DriverTraceRecord& slot = pBuffer->records[writePosition % TRACE_RING_RECORDS];
+	slot = record;
+	slot.threadId = threadId;
+	slot.textRecords = (uint16_t)textRecords;
+
+	for (uint32_t i = 0; i < textRecords; i++)
+	{
+		DriverTraceRecord& textSlot = pBuffer->records[(writePosition + 1 + i) % TRACE_RING_RECORDS];
+		memset(&textSlot, 0, sizeof(textSlot));
+		textSlot.startTicks = record.startTicks;
+		textSlot.threadId = threadId;
+		textSlot.event = TraceEvent_Text;
+
+		size_t offset = (size_t)i * DRIVER_TRACE_RECORD_TEXT;
+		if (offset < textLength)
+		{
+			memcpy(textSlot.args.text, pText + offset, (std::min)(textLength - offset, (size_t)DRIVER_TRACE_RECORD_TEXT));
+		}
+	}
+
+	pBuffer->writePosition.store(writePosition + 1 + textRecords, std::memory_order_release);
+}
+
+void DriverTrace::RunFlushThread()
+{
+	g_driverThreads.Register(DriverThread_TraceFlush);
+
+	while (m_bRunThread)
+	{
+		Flush();
+		std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_FLUSH_INTERVAL_MS));
+	}
+}
+
+// Writes out the committed records of every thread ring. Released rings are skipped once drained.
+void DriverTrace::Flush()
+{
+	std::vector<TraceThreadBuffer*> buffers;
+	{
+		std::lock_guard<std::mutex> lock(m_threadListMutex);
+		for (std::unique_ptr<TraceThreadBuffer>& buffer : m_threadList)
+		{
+			bool bIdle = buffer->bReleased.load(std::memory_order_acquire) &&
+				buffer->readPosition.load(std::memory_order_relaxed) == buffer->writePosition.load(std::memory_order_acquire) &&
+				buffer->dropped.load(std::memory_order_relaxed) == buffer->reportedDropped;
+
+			if (!bIdle)
+			{
+				buffers.push_back(buffer.get());
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> fileLock(m_fileMutex);
+
+	if (!m_file.is_open())
+	{
+		return;
+	}
+
+	for (TraceThreadBuffer* pBuffer : buffers)
+	{
+		uint64_t readPosition = pBuffer->readPosition.load(std::memory_order_relaxed);
+		uint64_t writePosition = pBuffer->writePosition.load(std::memory_order_acquire);
+
+		m_flushBatch.clear();
+
+		for (uint64_t position = readPosition; position < writePosition; position++)
+		{
+			const DriverTraceRecord& record = pBuffer->records[position % TRACE_RING_RECORDS];
+
+			// Left over from before the recording started.
+			if (record.startTicks < m_startTicks)
+			{
+				continue;
+			}
+
+			m_flushBatch.push_back(record);
+		}
+
+		uint64_t dropped = pBuffer->dropped.load(std::memory_order_relaxed);
+		if (dropped != pBuffer->reportedDropped)
+		{
+			LARGE_INTEGER currTime;
+			QueryPerformanceCounter(&currTime);
+
+			DriverTraceRecord dropRecord = {};
+			dropRecord.startTicks = currTime.QuadPart;
+			dropRecord.threadId = pBuffer->threadId.load(std::memory_order_relaxed);
+			dropRecord.event = TraceEvent_Dropped;
+			dropRecord.args.i[0] = dropRecord.threadId;
+			dropRecord.args.i[1] = (int64_t)(dropped - pBuffer->reportedDropped);
+
+			m_flushBatch.push_back(dropRecord);
+			pBuffer->reportedDropped = dropped;
+		}
+
+		// Last, as a drained ring may be handed to a new thread right away.
+		pBuffer->readPosition.store(writePosition, std::memory_order_release);
+
+		if (!m_flushBatch.empty())
+		{
+			size_t numBytes = m_flushBatch.size() * sizeof(DriverTraceRecord);
+			m_file.write((const char*)m_flushBatch.data(), numBytes);
+
+			m_recordsWritten.fetch_add(m_flushBatch.size(), std::memory_order_relaxed);
+			m_bytesWritten.fetch_add(numBytes, std::memory_order_relaxed);
+		}
+	}
+
+	// Keeps the file usable if the process goes down.
+	m_file.flush();
+}
+
+void DriverTrace::GetStats(TraceStats& outStats)
+{
+	outStats.bRecording = IsRecording();
+	outStats.records = m_recordsWritten.load(std::memory_order_relaxed);
+	outStats.dropped = m_recordsDropped.load(std::memory_order_relaxed);
+	outStats.bytes = m_bytesWritten.load(std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(m_threadListMutex);
+	outStats.threads = 0;
+	for (std::unique_ptr<TraceThreadBuffer>& buffer : m_threadList)
+	{
+		if (!buffer->bReleased.load(std::memory_order_relaxed))
+		{
+			outStats.threads++;
+		}
+	}
+}
+
+std::string DriverTrace::GetStatsJson()
+{
+	TraceStats stats;
+	GetStats(stats);
+
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(m_fileMutex);
+		path = m_path;
+	}
+
+	return std::format("{{\"recording\":{},\"path\":\"{}\",\"records\":{},\"dropped\":{},\"bytes\":{},\"threads\":{}}}",
+		stats.bRecording, EscapeJson(path), stats.records, stats.dropped, stats.bytes, stats.threads);
+}
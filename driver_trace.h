@@ -0,0 +1,176 @@
+#pragma once
+
+#include "driver_trace_format.h"
+
+
+// Binary recording of every driver entry point, for replaying sessions with trace_replay.
+// Each thread writes fixed-size records into its own ring, which a background thread drains to the trace file.
+// When not recording, an entry point costs a single relaxed load.
+
+// Records per thread ring. A full ring drops records and counts them, rather than blocking the caller.
+#define TRACE_RING_RECORDS 4096
+
+#define TRACE_FLUSH_INTERVAL_MS 20
+
+
+// Records of one thread. Only the owning thread writes, and only the flush thread reads.
+// When the owning thread exits the ring is released, and the next thread to register reuses it once it has been drained.
+struct TraceThreadBuffer
+{
+	DriverTraceRecord records[TRACE_RING_RECORDS];
+
+	alignas(64) std::atomic<uint64_t> writePosition = 0;
+	alignas(64) std::atomic<uint64_t> readPosition = 0;
+	std::atomic<uint64_t> dropped = 0;
+
+	// Drops already written to the trace, only touched by the flush thread.
+	uint64_t reportedDropped = 0;
+
+	std::atomic<uint32_t> threadId = 0;
+	std::atomic<bool> bReleased = false;
+};
+
+struct TraceStats
+{
+	bool bRecording;
+	uint64_t records;
+	uint64_t dropped;
+	uint64_t bytes;
+	uint32_t threads;
+};
+
+
+class DriverTrace
+{
+public:
+
+	DriverTrace();
+	~DriverTrace();
+
+	// Opens the trace file and starts the flush thread. Returns false if already recording or the file can't be opened.
+	// An empty path records to a new file in the temp directory.
+	bool Start(const std::string& requestedPath);
+
+	// Flushes the remaining records and closes the file.
+	void Stop();
+
+	// Reads the trace_enable and trace_path driver settings, and starts recording if enabled.
+	void StartFromSettings();
+
+	inline bool IsRecording() const { return m_bRecording.load(std::memory_order_relaxed); }
+
+	// Copies the record and the text into the calling thread's ring. The text is split into TraceEvent_Text records.
+	void Write(const DriverTraceRecord& record, const char* pText);
+
+	void GetStats(TraceStats& outStats);
+	std::string GetStatsJson();
+
+protected:
+
+	friend struct TraceThreadRegistration;
+
+	TraceThreadBuffer* RegisterThread();
+	void ReleaseThread(TraceThreadBuffer* pBuffer);
+
+	void RunFlushThread();
+	void Flush();
+
+	static thread_local TraceThreadBuffer* t_pThreadBuffer;
+
+	std::atomic<bool> m_bRecording = false;
+	int64_t m_startTicks = 0;
+
+	// Thread rings are never freed, so a thread can keep its pointer between recordings. Released rings are reused,
+	// so the list only grows to the most threads that have written records at the same time.
+	std::mutex m_threadListMutex;
+	std::vector<std::unique_ptr<TraceThreadBuffer>> m_threadList;
+
+	// Serializes Start and Stop.
+	std::mutex m_controlMutex;
+
+	std::mutex m_fileMutex;
+	std::ofstream m_file;
+	std::string m_path;
+
+	// Records gathered from a ring before writing, only used under m_fileMutex.
+	std::vector<DriverTraceRecord> m_flushBatch;
+
+	std::thread m_flushThread;
+	std::atomic<bool> m_bRunThread = false;
+
+	std::atomic<uint64_t> m_recordsWritten = 0;
+	std::atomic<uint64_t> m_recordsDropped = 0;
+	std::atomic<uint64_t> m_bytesWritten = 0;
+};
+
+extern DriverTrace g_driverTrace;
+
+
+// Records the enclosing scope with its start time, duration and arguments if recording.
+// Numeric arguments are stored in order, a const char* argument is stored as the record text.
+class ScopedTrace
+{
+public:
+	template<typename... Args>
+	inline ScopedTrace(ETraceEvent event, Args... args)
+	{
+		m_bActive = g_driverTrace.IsRecording();
+		if (!m_bActive)
+		{
+			return;
+		}
+
+		memset(&m_record, 0, sizeof(m_record));
+		m_record.event = event;
+
+		[[maybe_unused]] uint32_t index = 0;
+		(SetArg(index, args), ...);
+
+		LARGE_INTEGER startTime;
+		QueryPerformanceCounter(&startTime);
+		m_record.startTicks = startTime.QuadPart;
+	}
+
+	inline ~ScopedTrace()
+	{
+		if (!m_bActive)
+		{
+			return;
+		}
+
+		LARGE_INTEGER endTime;
+		QueryPerformanceCounter(&endTime);
+		m_record.durationTicks = endTime.QuadPart - m_record.startTicks;
+
+		g_driverTrace.Write(m_record, m_pText);
+	}
+
+private:
+	template<typename T>
+	inline void SetArg(uint32_t& index, T value)
+	{
+		if constexpr (std::is_pointer_v<T>)
+		{
+			m_pText = value;
+		}
+		else if (index < DRIVER_TRACE_RECORD_ARGS)
+		{
+			if constexpr (std::is_floating_point_v<T>)
+			{
+				m_record.args.d[index++] = (double)value;
+			}
+			else
+			{
+				m_record.args.i[index++] = (int64_t)value;
+			}
+		}
+	}
+
+	bool m_bActive;
+	DriverTraceRecord m_record;
+	const char* m_pText = nullptr;
+};
+
+#define DRIVER_TRACE_CONCAT_INNER(a, b) a##b
+#define DRIVER_TRACE_CONCAT(a, b) DRIVER_TRACE_CONCAT_INNER(a, b)
+#define DRIVER_TRACE_SCOPE(...) ScopedTrace DRIVER_TRACE_CONCAT(_scopedTrace, __LINE__)(__VA_ARGS__)
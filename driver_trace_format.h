@@ -0,0 +1,195 @@
+#pragma once
+
+// Shared between the driver and trace_replay, so this does not use the driver precompiled header.
+#include <cstdint>
+
+
+// Trace files start with a DriverTraceFileHeader, followed by DriverTraceRecords.
+// Records are grouped per thread in flush order, so readers sort them by startTicks, thread and file position.
+#define DRIVER_TRACE_MAGIC 0x54435653 // "SVCT"
+#define DRIVER_TRACE_VERSION 1
+
+#define DRIVER_TRACE_RECORD_ARGS 5
+#define DRIVER_TRACE_RECORD_TEXT 40
+
+// Longest string argument kept, in continuation records after the event.
+#define DRIVER_TRACE_MAX_TEXT 1024
+
+
+// Recorded events. The arguments are listed in the order they are stored in DriverTraceRecord::args,
+// integers as int64, floating point values as double, and strings in TraceEvent_Text continuation records.
+// Values are only ever appended, so older traces stay readable.
+enum ETraceEvent : uint16_t
+{
+	TraceEvent_None = 0,
+
+	// Continuation of the string argument of the previous record on the same thread.
+	TraceEvent_Text,
+
+	// Records lost on a thread since the last flush because its ring was full: thread id, count.
+	TraceEvent_Dropped,
+
+	// IServerTrackedDeviceProvider
+	TraceEvent_ProviderInit,
+	TraceEvent_ProviderCleanup,
+	TraceEvent_ProviderRunFrame,
+	TraceEvent_ProviderEnterStandby,
+	TraceEvent_ProviderLeaveStandby,
+
+	// ITrackedDeviceServerDriver
+	TraceEvent_DeviceActivate, // object id
+	TraceEvent_DeviceDeactivate,
+	TraceEvent_DeviceEnterStandby,
+	TraceEvent_DeviceGetComponent, // text: component name and version
+	TraceEvent_DeviceDebugRequest, // response buffer size, text: request
+	TraceEvent_DeviceGetPose,
+
+	// IVRCameraComponent
+	TraceEvent_GetCameraFrameDimensions, // format
+	TraceEvent_GetCameraFrameBufferingRequirements,
+	TraceEvent_SetCameraFrameBuffering, // buffer count, buffer size
+	TraceEvent_SetCameraVideoStreamFormat, // format
+	TraceEvent_GetCameraVideoStreamFormat,
+	TraceEvent_StartVideoStream,
+	TraceEvent_StopVideoStream,
+	TraceEvent_IsVideoStreamActive,
+	TraceEvent_GetVideoStreamFrame,
+	TraceEvent_ReleaseVideoStreamFrame,
+	TraceEvent_SetAutoExposure, // enable
+	TraceEvent_PauseVideoStream,
+	TraceEvent_ResumeVideoStream,
+	TraceEvent_GetCameraDistortion, // camera, u, v
+	TraceEvent_GetCameraProjection, // camera, frame type, near, far
+	TraceEvent_SetFrameRate, // ISP frame rate, sensor frame rate
+	TraceEvent_SetCameraVideoSinkCallback, // whether a callback was set
+	TraceEvent_GetCameraCompatibilityMode,
+	TraceEvent_SetCameraCompatibilityMode, // mode
+	TraceEvent_GetCameraFrameBounds, // frame type
+	TraceEvent_GetCameraIntrinsics, // camera, frame type
+
+	// IVRDisplayComponent
+	TraceEvent_IsDisplayOnDesktop,
+	TraceEvent_IsDisplayRealDisplay,
+	TraceEvent_GetRecommendedRenderTargetSize,
+	TraceEvent_GetEyeOutputViewport, // eye
+	TraceEvent_GetProjectionRaw, // eye
+	TraceEvent_ComputeDistortion, // eye, u, v
+	TraceEvent_GetWindowBounds,
+	TraceEvent_ComputeInverseDistortion, // eye, channel, u, v
+
+	// IVRVirtualDisplay
+	TraceEvent_Present, // vsync mode, frame id, vsync time in seconds
+	TraceEvent_WaitForPresent,
+	TraceEvent_GetTimeSinceLastVsync,
+
+	// Work started by the driver itself. Not replayed, but compared between the recording and the replay.
+	TraceEvent_PoseUpdated, // device id
+	TraceEvent_ServeFrame, // frame count, frame size
+
+	TraceEvent_Count
+};
+
+
+struct DriverTraceFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t reserved;
+
+	// Performance counter frequency and value when recording started.
+	int64_t ticksPerSecond;
+	int64_t startTicks;
+};
+
+struct DriverTraceRecord
+{
+	int64_t startTicks;
+	int64_t durationTicks;
+	uint32_t threadId;
+	uint16_t event;
+
+	// Number of TraceEvent_Text records following this one.
+	uint16_t textRecords;
+
+	union
+	{
+		int64_t i[DRIVER_TRACE_RECORD_ARGS];
+		double d[DRIVER_TRACE_RECORD_ARGS];
+		char text[DRIVER_TRACE_RECORD_TEXT];
+	} args;
+};
+
+static_assert(sizeof(DriverTraceRecord) == 64, "Unexpected trace record size");
+
+
+// Whether the runtime calls into the driver for this event, so it can be replayed.
+inline bool IsTraceEventReplayed(uint16_t event)
+{
+	return event >= TraceEvent_ProviderInit && event < TraceEvent_PoseUpdated;
+}
+
+inline const char* GetTraceEventName(uint16_t event)
+{
+	static const char* const names[] =
+	{
+		"None",
+		"Text",
+		"Dropped",
+
+		"DeviceProvider::Init",
+		"DeviceProvider::Cleanup",
+		"DeviceProvider::RunFrame",
+		"DeviceProvider::EnterStandby",
+		"DeviceProvider::LeaveStandby",
+
+		"CameraDevice::Activate",
+		"CameraDevice::Deactivate",
+		"CameraDevice::EnterStandby",
+		"CameraDevice::GetComponent",
+		"CameraDevice::DebugRequest",
+		"CameraDevice::GetPose",
+
+		"GetCameraFrameDimensions",
+		"GetCameraFrameBufferingRequirements",
+		"SetCameraFrameBuffering",
+		"SetCameraVideoStreamFormat",
+		"GetCameraVideoStreamFormat",
+		"StartVideoStream",
+		"StopVideoStream",
+		"IsVideoStreamActive",
+		"GetVideoStreamFrame",
+		"ReleaseVideoStreamFrame",
+		"SetAutoExposure",
+		"PauseVideoStream",
+		"ResumeVideoStream",
+		"GetCameraDistortion",
+		"GetCameraProjection",
+		"SetFrameRate",
+		"SetCameraVideoSinkCallback",
+		"GetCameraCompatibilityMode",
+		"SetCameraCompatibilityMode",
+		"GetCameraFrameBounds",
+		"GetCameraIntrinsics",
+
+		"IsDisplayOnDesktop",
+		"IsDisplayRealDisplay",
+		"GetRecommendedRenderTargetSize",
+		"GetEyeOutputViewport",
+		"GetProjectionRaw",
+		"ComputeDistortion",
+		"GetWindowBounds",
+		"ComputeInverseDistortion",
+
+		"Present",
+		"WaitForPresent",
+		"GetTimeSinceLastVsync",
+
+		"TrackedDevicePoseUpdated",
+		"ServeFrames::Frame",
+	};
+
+	static_assert(sizeof(names) / sizeof(names[0]) == TraceEvent_Count, "Trace event name table out of sync with ETraceEvent");
+
+	return (event < TraceEvent_Count) ? names[event] : "Unknown";
+}
@@ -0,0 +1,237 @@
+#include "pch.h"
+#include "frame_arena.h"
+
+
+SharedFrameArena g_frameArena;
+
+
+// Large pages need SeLockMemoryPrivilege, which has to be granted to the user ("Lock pages in memory") and enabled per process.
+static bool EnableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	bool bSuccess = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+		GetLastError() == ERROR_SUCCESS; // Succeeds with ERROR_NOT_ALL_ASSIGNED if the user does not have the right.
+
+	CloseHandle(token);
+	return bSuccess;
+}
+
+static uint8_t* AllocatePages(size_t size, DWORD flags, int32_t numaNode)
+{
+	if (numaNode >= 0)
+	{
+		return (uint8_t*)VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, flags, PAGE_READWRITE, (DWORD)numaNode);
+	}
+	return (uint8_t*)VirtualAlloc(nullptr, size, flags, PAGE_READWRITE);
+}
+
+
+FrameArena::~FrameArena()
+{
+	Free();
+}
+
+void FrameArena::SetOptions(bool bUseLargePages, int32_t numaNode)
+{
+	std::lock_guard<std::mutex> lock(m_reserveMutex);
+	m_bUseLargePages = bUseLargePages;
+	m_numaNode = numaNode;
+}
+
+bool FrameArena::Reserve(size_t slotSize, uint32_t numSlots)
+{
+	std::lock_guard<std::mutex> lock(m_reserveMutex);
+
+	if (m_pMemory != nullptr && slotSize <= m_slotSize && numSlots <= m_numSlots)
+	{
+		return true;
+	}
+
+	// Closes the arena to AcquireSlot, unless a slot is held by another thread, whose memory would be freed underneath it.
+	uint32_t slotsInUse = 0;
+	if (!m_slotsInUse.compare_exchange_strong(slotsInUse, FRAME_ARENA_REALLOCATING, std::memory_order_acquire, std::memory_order_relaxed))
+	{
+		VR_DRIVER_LOG_FORMAT("FrameArena: Can't grow to {} x {} bytes with {} slots in use", numSlots, slotSize, slotsInUse);
+		return false;
+	}
+
+	Free();
+	bool bSuccess = Allocate(slotSize, numSlots);
+
+	m_slotsInUse.fetch_sub(FRAME_ARENA_REALLOCATING, std::memory_order_release);
+	return bSuccess;
+}
+
+bool FrameArena::Allocate(size_t slotSize, uint32_t numSlots)
+{
+	size_t largePageSize = GetLargePageMinimum();
+
+	if (m_bUseLargePages && largePageSize > 0 && EnableLockMemoryPrivilege())
+	{
+		// Large page allocations are committed and locked up front, so they don't need pre-faulting.
+		m_slotSize = (slotSize + largePageSize - 1) / largePageSize * largePageSize;
+		m_pMemory = AllocatePages(m_slotSize * numSlots, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, m_numaNode);
+		m_bIsUsingLargePages = (m_pMemory != nullptr);
+	}
+
+	if (m_pMemory == nullptr)
+	{
+		m_slotSize = (slotSize + FRAME_ARENA_SMALL_ALIGNMENT - 1) / FRAME_ARENA_SMALL_ALIGNMENT * FRAME_ARENA_SMALL_ALIGNMENT;
+		m_pMemory = AllocatePages(m_slotSize * numSlots, MEM_RESERVE | MEM_COMMIT, m_numaNode);
+
+		if (m_pMemory == nullptr)
+		{
+			VR_DRIVER_LOG_FORMAT("FrameArena: Failed to allocate {} x {} bytes: {}", numSlots, m_slotSize, GetLastError());
+			m_slotSize = 0;
+			return false;
+		}
+
+		// Touch every page now rather than on the first frames.
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo(&systemInfo);
+		for (size_t offset = 0; offset < m_slotSize * numSlots; offset += systemInfo.dwPageSize)
+		{
+			m_pMemory[offset] = 0;
+		}
+	}
+
+	m_numSlots = numSlots;
+	m_nextFree = std::make_unique<std::atomic<uint32_t>[]>(numSlots);
+	m_freeHead = FRAME_ARENA_INVALID_SLOT;
+
+	for (uint32_t i = numSlots; i-- > 0;)
+	{
+		PushSlot(i);
+	}
+
+	VR_DRIVER_LOG_FORMAT("FrameArena: Reserved {} x {} bytes{}{}", numSlots, m_slotSize, m_bIsUsingLargePages ? " in large pages" : "",
+		(m_numaNode >= 0) ? std::format(" on NUMA node {}", m_numaNode) : "");
+	return true;
+}
+
+void FrameArena::Free()
+{
+	if (m_pMemory != nullptr)
+	{
+		VirtualFree(m_pMemory, 0, MEM_RELEASE);
+		m_pMemory = nullptr;
+	}
+
+	m_slotSize = 0;
+	m_numSlots = 0;
+	m_bIsUsingLargePages = false;
+	m_nextFree.reset();
+	m_freeHead = FRAME_ARENA_INVALID_SLOT;
+}
+
+void FrameArena::PushSlot(uint32_t index)
+{
+	uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+	uint64_t newHead;
+
+	do
+	{
+		m_nextFree[index].store((uint32_t)head, std::memory_order_relaxed);
+		newHead = (((head >> 32) + 1) << 32) | index;
+	}
+	while (!m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint8_t* FrameArena::AcquireSlot()
+{
+	// Counted first, so Reserve can't reallocate between taking the slot and returning it.
+	if (m_slotsInUse.fetch_add(1, std::memory_order_acquire) & FRAME_ARENA_REALLOCATING)
+	{
+		m_slotsInUse.fetch_sub(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	uint64_t head = m_freeHead.load(std::memory_order_acquire);
+	uint64_t newHead;
+	uint32_t index;
+
+	do
+	{
+		index = (uint32_t)head;
+		if (index == FRAME_ARENA_INVALID_SLOT)
+		{
+			m_slotsInUse.fetch_sub(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		// The tag makes the exchange fail if the slot was taken and returned in between.
+		newHead = (((head >> 32) + 1) << 32) | m_nextFree[index].load(std::memory_order_relaxed);
+	}
+	while (!m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire));
+
+	return m_pMemory + (size_t)index * m_slotSize;
+}
+
+void FrameArena::ReleaseSlot(uint8_t* pSlot)
+{
+	if (pSlot == nullptr)
+	{
+		return;
+	}
+
+	PushSlot((uint32_t)((pSlot - m_pMemory) / m_slotSize));
+	m_slotsInUse.fetch_sub(1, std::memory_order_release);
+}
+
+
+void SharedFrameArena::SetOptions(bool bUseLargePages, int32_t numaNode)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_bUseLargePages = bUseLargePages;
+	m_numaNode = numaNode;
+
+	for (std::unique_ptr<FrameArena>& partition : m_partitions)
+	{
+		if (partition)
+		{
+			partition->SetOptions(bUseLargePages, numaNode);
+		}
+	}
+}
+
+FrameArena& SharedFrameArena::GetPartition(uint32_t instance)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (instance >= m_partitions.size())
+	{
+		m_partitions.resize(instance + 1);
+	}
+
+	if (!m_partitions[instance])
+	{
+		m_partitions[instance] = std::make_unique<FrameArena>();
+		m_partitions[instance]->SetOptions(m_bUseLargePages, m_numaNode);
+	}
+	return *m_partitions[instance];
+}
+
+bool SharedFrameArena::IsUsingLargePages()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (std::unique_ptr<FrameArena>& partition : m_partitions)
+	{
+		if (partition && partition->IsUsingLargePages())
+		{
+			return true;
+		}
+	}
+	return false;
+}
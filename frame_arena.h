@@ -0,0 +1,88 @@
+#pragma once
+
+#include "frame_ring.h"
+
+
+// Frame slots reserved in the arena: the render-ahead ring plus spares for frame sources and staging.
+#define FRAME_ARENA_SPARE_SLOTS 4
+#define FRAME_ARENA_SLOTS (RENDER_AHEAD_FRAMES + FRAME_ARENA_SPARE_SLOTS)
+
+// Slot alignment when large pages are not available.
+#define FRAME_ARENA_SMALL_ALIGNMENT 65536
+
+#define FRAME_ARENA_INVALID_SLOT 0xFFFFFFFF
+
+// Set in the slot count while the memory is reallocated, making AcquireSlot fail.
+#define FRAME_ARENA_REALLOCATING 0x80000000
+
+
+// Fixed size frame buffers in one pre-faulted allocation, backed by 2 MB large pages when the process is allowed to lock pages.
+// Slots are handed out through a lock-free free list, so any thread can acquire and release them.
+// The memory is only reallocated while no slot is held, and AcquireSlot fails for the duration.
+class FrameArena
+{
+public:
+	~FrameArena();
+
+	// Applied on the next reallocation. A negative node leaves the placement to the OS.
+	void SetOptions(bool bUseLargePages, int32_t numaNode);
+
+	// Makes sure there are numSlots slots of at least slotSize bytes. Existing memory is kept if it is large enough,
+	// otherwise it is reallocated, which fails while any slot is still acquired. Callers are serialized.
+	bool Reserve(size_t slotSize, uint32_t numSlots);
+
+	// Returns nullptr if all slots are in use.
+	uint8_t* AcquireSlot();
+	void ReleaseSlot(uint8_t* pSlot);
+
+	size_t GetSlotSize() const { return m_slotSize; }
+	uint32_t GetNumSlots() const { return m_numSlots; }
+	uint32_t GetSlotsInUse() const { return m_slotsInUse & ~FRAME_ARENA_REALLOCATING; }
+	bool IsUsingLargePages() const { return m_bIsUsingLargePages; }
+
+protected:
+	bool Allocate(size_t slotSize, uint32_t numSlots);
+	void Free();
+	void PushSlot(uint32_t index);
+
+	// Serializes Reserve and SetOptions.
+	std::mutex m_reserveMutex;
+
+	bool m_bUseLargePages = true;
+	int32_t m_numaNode = -1;
+
+	uint8_t* m_pMemory = nullptr;
+	size_t m_slotSize = 0;
+	uint32_t m_numSlots = 0;
+	bool m_bIsUsingLargePages = false;
+
+	// Treiber stack of free slot indices. The head packs an ABA tag in the upper 32 bits.
+	std::unique_ptr<std::atomic<uint32_t>[]> m_nextFree;
+	std::atomic<uint64_t> m_freeHead = FRAME_ARENA_INVALID_SLOT;
+
+	// Counted before a slot is taken from the free list and after it is returned, so the memory stays mapped while it is nonzero.
+	std::atomic<uint32_t> m_slotsInUse = 0;
+};
+
+
+// Frame arena shared by the camera instances, split into one partition per instance. The partitions are allocated separately,
+// so a frame size change on one camera only reallocates its own slots, and can't take slots from the others.
+class SharedFrameArena
+{
+public:
+	// Applied to all partitions on their next reallocation.
+	void SetOptions(bool bUseLargePages, int32_t numaNode);
+
+	// Returns the partition of a camera instance, created empty on first use. Partitions live as long as the arena.
+	FrameArena& GetPartition(uint32_t instance);
+
+	bool IsUsingLargePages();
+
+protected:
+	std::mutex m_mutex;
+	bool m_bUseLargePages = true;
+	int32_t m_numaNode = -1;
+	std::vector<std::unique_ptr<FrameArena>> m_partitions;
+};
+
+extern SharedFrameArena g_frameArena;
@@ -0,0 +1,434 @@
+#include "frame_capture.h"
+#include "frame_codec.h"
+
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+
+// Large sequential writes keep the file system overhead per frame low.
+#define FRAME_CAPTURE_FILE_BUFFER (1024 * 1024)
+
+
+static void RunTasks(uint32_t numTasks, const std::function<void(uint32_t)>& task, const CaptureParallelFor& parallelFor)
+{
+	if (parallelFor)
+	{
+		parallelFor(numTasks, task);
+		return;
+	}
+
+	for (uint32_t i = 0; i < numTasks; i++)
+	{
+		task(i);
+	}
+}
+
+static bool IsHeaderValid(const FrameCaptureFileHeader& header)
+{
+	return header.magic == FRAME_CAPTURE_MAGIC && header.version == FRAME_CAPTURE_VERSION && header.height > 0 && header.frameSize > 0 &&
+		header.bandRows > 0 && header.bytesPerPixel > 0 && (uint64_t)header.rowSize * header.height == header.frameSize;
+}
+
+
+bool FrameCaptureWriter::Open(const std::string& path, const FrameCaptureFileHeader& header, uint32_t maxQueuedFrames)
+{
+	Close();
+
+	m_header = header;
+	m_header.magic = FRAME_CAPTURE_MAGIC;
+	m_header.version = FRAME_CAPTURE_VERSION;
+	m_header.bandRows = FRAME_CAPTURE_BAND_ROWS;
+	m_header.keyframeInterval = (header.keyframeInterval > 0) ? header.keyframeInterval : FRAME_CAPTURE_DEFAULT_KEYFRAME_INTERVAL;
+	m_header.numFrames = 0;
+	m_header.indexOffset = 0;
+
+	// Frames are whole rows of the texture, whatever the format.
+	m_header.rowSize = (header.height > 0) ? header.frameSize / header.height : 0;
+	m_header.bytesPerPixel = (header.width > 0) ? (std::max)(m_header.rowSize / header.width, 1u) : 1;
+
+	if (!IsHeaderValid(m_header))
+	{
+		return false;
+	}
+
+	m_numBands = (m_header.height + m_header.bandRows - 1) / m_header.bandRows;
+	size_t bandSize = (size_t)m_header.rowSize * m_header.bandRows;
+	m_bandCapacity = FrameBandBound(bandSize);
+
+	m_fileBuffer.resize(FRAME_CAPTURE_FILE_BUFFER);
+	m_file.rdbuf()->pubsetbuf(m_fileBuffer.data(), m_fileBuffer.size());
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+	{
+		return false;
+	}
+
+	m_file.write((const char*)&m_header, sizeof(m_header));
+	m_writtenOffset = sizeof(m_header);
+
+	m_prevFrame.assign(m_header.frameSize, 0);
+	m_scratch.resize(bandSize * m_numBands);
+	m_frameCount = 0;
+	m_index.clear();
+	m_stats = {};
+
+	m_encodedFrames.resize((std::max)(maxQueuedFrames, 1u));
+	for (EncodedFrame& frame : m_encodedFrames)
+	{
+		frame.bandSizes.resize(m_numBands);
+		frame.data.resize(m_bandCapacity * m_numBands);
+		m_freeFrames.push_back(&frame);
+	}
+
+	m_bWriteError = false;
+	m_bStop = false;
+	m_writerThread = std::thread(&FrameCaptureWriter::WriterLoop, this);
+
+	return true;
+}
+
+void FrameCaptureWriter::Close()
+{
+	if (m_writerThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bStop = true;
+		}
+		m_condition.notify_all();
+		m_writerThread.join();
+	}
+
+	if (m_file.is_open())
+	{
+		m_header.indexOffset = m_writtenOffset;
+		m_header.numFrames = (uint32_t)m_index.size();
+
+		m_file.write((const char*)m_index.data(), m_index.size() * sizeof(FrameCaptureIndexEntry));
+		m_file.seekp(0);
+		m_file.write((const char*)&m_header, sizeof(m_header));
+		m_file.close();
+	}
+
+	m_freeFrames.clear();
+	m_queuedFrames.clear();
+	m_encodedFrames.clear();
+	m_prevFrame.clear();
+	m_scratch.clear();
+}
+
+bool FrameCaptureWriter::WriteFrame(const uint8_t* pFrame, const FrameCaptureMetadata& metadata, const CaptureParallelFor& parallelFor)
+{
+	if (!IsOpen())
+	{
+		return false;
+	}
+
+	EncodedFrame* pEncoded;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// The frame isn't encoded at all when dropped, so the next one is still predicted from the last one written.
+		if (m_bWriteError || m_freeFrames.empty())
+		{
+			m_stats.framesDropped++;
+			return false;
+		}
+
+		pEncoded = m_freeFrames.front();
+		m_freeFrames.pop_front();
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	bool bKeyframe = (m_frameCount % m_header.keyframeInterval) == 0;
+
+	RunTasks(m_numBands, [&](uint32_t band)
+	{
+		uint32_t firstRow = band * m_header.bandRows;
+		uint32_t numRows = (std::min)(m_header.bandRows, (uint32_t)m_header.height - firstRow);
+		size_t offset = (size_t)firstRow * m_header.rowSize;
+
+		pEncoded->bandSizes[band] = (uint32_t)EncodeFrameBand(pFrame + offset, bKeyframe ? nullptr : m_prevFrame.data() + offset, m_header.rowSize, numRows, m_header.bytesPerPixel,
+			m_scratch.data() + offset, pEncoded->data.data() + band * m_bandCapacity, m_bandCapacity);
+
+		memcpy(m_prevFrame.data() + offset, pFrame + offset, (size_t)numRows * m_header.rowSize);
+	}, parallelFor);
+
+	uint64_t payloadSize = (uint64_t)m_numBands * sizeof(uint32_t);
+	for (uint32_t size : pEncoded->bandSizes)
+	{
+		payloadSize += size;
+	}
+
+	pEncoded->record = {};
+	pEncoded->record.magic = FRAME_CAPTURE_RECORD_MAGIC;
+	pEncoded->record.flags = bKeyframe ? FRAME_CAPTURE_FLAG_KEYFRAME : 0;
+	pEncoded->record.numBands = m_numBands;
+	pEncoded->record.payloadSize = payloadSize;
+	pEncoded->record.metadata = metadata;
+
+	m_frameCount++;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queuedFrames.push_back(pEncoded);
+
+		m_stats.framesWritten++;
+		m_stats.keyframes += bKeyframe ? 1 : 0;
+		m_stats.rawBytes += m_header.frameSize;
+		m_stats.encodedBytes += sizeof(FrameCaptureRecordHeader) + payloadSize;
+		m_stats.lastEncodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	}
+	m_condition.notify_one();
+
+	return true;
+}
+
+void FrameCaptureWriter::WriterLoop()
+{
+	while (true)
+	{
+		EncodedFrame* pEncoded;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [&]() { return m_bStop || !m_queuedFrames.empty(); });
+
+			// Stopping still writes out everything queued.
+			if (m_queuedFrames.empty())
+			{
+				break;
+			}
+
+			pEncoded = m_queuedFrames.front();
+			m_queuedFrames.pop_front();
+		}
+
+		FrameCaptureIndexEntry entry = {};
+		entry.offset = m_writtenOffset;
+		entry.serverTimeTicks = pEncoded->record.metadata.serverTimeTicks;
+		entry.flags = pEncoded->record.flags;
+
+		m_file.write((const char*)&pEncoded->record, sizeof(pEncoded->record));
+		m_file.write((const char*)pEncoded->bandSizes.data(), m_numBands * sizeof(uint32_t));
+		for (uint32_t band = 0; band < m_numBands; band++)
+		{
+			m_file.write((const char*)pEncoded->data.data() + band * m_bandCapacity, pEncoded->bandSizes[band]);
+		}
+
+		m_writtenOffset += sizeof(pEncoded->record) + pEncoded->record.payloadSize;
+		m_index.push_back(entry);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bWriteError = m_bWriteError || !m_file.good();
+			m_freeFrames.push_back(pEncoded);
+		}
+	}
+}
+
+FrameCaptureStats FrameCaptureWriter::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+
+bool FrameCaptureReader::Open(const std::string& path)
+{
+	Close();
+
+	m_file.open(path, std::ios::binary);
+	if (!m_file.is_open())
+	{
+		return false;
+	}
+
+	if (!m_file.read((char*)&m_header, sizeof(m_header)) || !IsHeaderValid(m_header))
+	{
+		Close();
+		return false;
+	}
+
+	m_numBands = (m_header.height + m_header.bandRows - 1) / m_header.bandRows;
+
+	if (m_header.indexOffset == 0 || !ReadIndex())
+	{
+		RebuildIndex();
+	}
+
+	if (m_index.empty())
+	{
+		Close();
+		return false;
+	}
+
+	m_frame.resize(m_header.frameSize);
+	m_scratch.resize((size_t)m_header.rowSize * m_header.bandRows * m_numBands);
+	m_decodedFrame = -1;
+	m_framesDecoded = 0;
+
+	return true;
+}
+
+void FrameCaptureReader::Close()
+{
+	if (m_file.is_open())
+	{
+		m_file.close();
+	}
+	m_file.clear();
+
+	m_index.clear();
+	m_bIndexRebuilt = false;
+	m_frame.clear();
+	m_scratch.clear();
+	m_payload.clear();
+	m_decodedFrame = -1;
+}
+
+bool FrameCaptureReader::ReadIndex()
+{
+	m_index.resize(m_header.numFrames);
+
+	m_file.seekg(m_header.indexOffset);
+	if (!m_file.read((char*)m_index.data(), m_index.size() * sizeof(FrameCaptureIndexEntry)))
+	{
+		m_file.clear();
+		m_index.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool FrameCaptureReader::RebuildIndex()
+{
+	m_index.clear();
+	m_bIndexRebuilt = true;
+
+	m_file.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)m_file.tellg();
+	uint64_t offset = sizeof(FrameCaptureFileHeader);
+
+	// A capture that wasn't closed can end in a partly written record, which is left out.
+	while (offset + sizeof(FrameCaptureRecordHeader) <= fileSize)
+	{
+		FrameCaptureRecordHeader record;
+		m_file.seekg(offset);
+		if (!m_file.read((char*)&record, sizeof(record)) || record.magic != FRAME_CAPTURE_RECORD_MAGIC ||
+			offset + sizeof(record) + record.payloadSize > fileSize)
+		{
+			break;
+		}
+
+		FrameCaptureIndexEntry entry = {};
+		entry.offset = offset;
+		entry.serverTimeTicks = record.metadata.serverTimeTicks;
+		entry.flags = record.flags;
+		m_index.push_back(entry);
+
+		offset += sizeof(record) + record.payloadSize;
+	}
+
+	m_file.clear();
+	return !m_index.empty();
+}
+
+const uint8_t* FrameCaptureReader::ReadFrame(uint32_t frame, FrameCaptureMetadata* pMetadata, const CaptureParallelFor& parallelFor)
+{
+	if (frame >= m_index.size())
+	{
+		return nullptr;
+	}
+
+	// Continues from the decoded frame if it is on the way, otherwise from the keyframe before.
+	uint32_t start = frame;
+	while (start > 0 && !(m_index[start].flags & FRAME_CAPTURE_FLAG_KEYFRAME))
+	{
+		start--;
+	}
+
+	if (m_decodedFrame >= start && m_decodedFrame <= frame)
+	{
+		start = (uint32_t)m_decodedFrame + 1;
+	}
+	else if (!(m_index[start].flags & FRAME_CAPTURE_FLAG_KEYFRAME))
+	{
+		return nullptr;
+	}
+
+	for (uint32_t i = start; i <= frame; i++)
+	{
+		if (!DecodeRecord(i, parallelFor))
+		{
+			m_decodedFrame = -1;
+			return nullptr;
+		}
+	}
+
+	if (pMetadata != nullptr)
+	{
+		*pMetadata = m_metadata;
+	}
+
+	return m_frame.data();
+}
+
+bool FrameCaptureReader::DecodeRecord(uint32_t frame, const CaptureParallelFor& parallelFor)
+{
+	FrameCaptureRecordHeader record;
+	m_file.seekg(m_index[frame].offset);
+
+	if (!m_file.read((char*)&record, sizeof(record)) || record.magic != FRAME_CAPTURE_RECORD_MAGIC || record.numBands != m_numBands ||
+		record.payloadSize < m_numBands * sizeof(uint32_t))
+	{
+		m_file.clear();
+		return false;
+	}
+
+	m_payload.resize(record.payloadSize);
+	if (!m_file.read((char*)m_payload.data(), m_payload.size()))
+	{
+		m_file.clear();
+		return false;
+	}
+
+	const uint32_t* pBandSizes = (const uint32_t*)m_payload.data();
+	std::vector<size_t> bandOffsets(m_numBands);
+	size_t offset = m_numBands * sizeof(uint32_t);
+
+	for (uint32_t band = 0; band < m_numBands; band++)
+	{
+		bandOffsets[band] = offset;
+		offset += pBandSizes[band];
+	}
+
+	if (offset != m_payload.size())
+	{
+		return false;
+	}
+
+	bool bKeyframe = (record.flags & FRAME_CAPTURE_FLAG_KEYFRAME) != 0;
+	std::atomic<bool> bSuccess(true);
+
+	RunTasks(m_numBands, [&](uint32_t band)
+	{
+		uint32_t firstRow = band * m_header.bandRows;
+		uint32_t numRows = (std::min)(m_header.bandRows, (uint32_t)m_header.height - firstRow);
+		size_t frameOffset = (size_t)firstRow * m_header.rowSize;
+
+		if (!DecodeFrameBand(m_payload.data() + bandOffsets[band], pBandSizes[band], bKeyframe, m_header.rowSize, numRows, m_header.bytesPerPixel,
+			m_scratch.data() + frameOffset, m_frame.data() + frameOffset))
+		{
+			bSuccess = false;
+		}
+	}, parallelFor);
+
+	m_framesDecoded++;
+	m_metadata = record.metadata;
+	m_decodedFrame = frame;
+
+	return bSuccess;
+}
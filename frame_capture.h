@@ -0,0 +1,214 @@
+#pragma once
+
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+
+// Capture files start with a FrameCaptureFileHeader, followed by the frame records in capture order.
+// Each record is a FrameCaptureRecordHeader, the encoded size of each band as uint32, and the encoded bands.
+// Closing the capture appends an index of FrameCaptureIndexEntry and fills in its offset in the file header.
+// Captures that weren't closed have no index, and readers find the frames by walking the records.
+#define FRAME_CAPTURE_MAGIC 0x46435653 // "SVCF"
+#define FRAME_CAPTURE_RECORD_MAGIC 0x52435653 // "SVCR"
+#define FRAME_CAPTURE_VERSION 1
+
+// Rows per band. Bands are encoded and decoded in parallel.
+#define FRAME_CAPTURE_BAND_ROWS 32
+
+// Frames between keyframes, which decode without the frames before them. Seeking decodes from the keyframe before the target.
+#define FRAME_CAPTURE_DEFAULT_KEYFRAME_INTERVAL 60
+
+// Encoded frames waiting for the file writer. Frames arriving while all are queued are dropped.
+#define FRAME_CAPTURE_DEFAULT_QUEUED_FRAMES 8
+
+#define FRAME_CAPTURE_FLAG_KEYFRAME 0x1
+
+
+struct FrameCaptureFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+
+	// As in the /format, /width, /height and /bayer_format paths of the raw frame queue.
+	int32_t format;
+	int32_t width;
+	int32_t height;
+	int32_t bayerFormat;
+
+	uint32_t frameSize;
+	uint32_t rowSize;
+	uint32_t bytesPerPixel;
+	uint32_t bandRows;
+	uint32_t keyframeInterval;
+	uint32_t numFrames;
+
+	// Performance counter frequency of the server time ticks.
+	int64_t ticksPerSecond;
+
+	// Zero if the capture wasn't closed.
+	uint64_t indexOffset;
+};
+
+// The per-frame paths of the raw frame queue.
+struct FrameCaptureMetadata
+{
+	uint64_t frameSequence;
+	uint64_t serverTimeTicks;
+	double frameTimeMonotonic;
+	double deliveryRate;
+	double elapsedTime;
+	double readoutTime;
+	int32_t frameSize;
+	uint32_t reserved;
+};
+
+struct FrameCaptureRecordHeader
+{
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t numBands;
+	uint32_t reserved;
+
+	// Size of the band table and bands following the header.
+	uint64_t payloadSize;
+
+	FrameCaptureMetadata metadata;
+};
+
+struct FrameCaptureIndexEntry
+{
+	uint64_t offset;
+	uint64_t serverTimeTicks;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(FrameCaptureFileHeader) == 64, "Unexpected capture header size");
+static_assert(sizeof(FrameCaptureRecordHeader) == 80, "Unexpected capture record size");
+static_assert(sizeof(FrameCaptureIndexEntry) == 24, "Unexpected capture index entry size");
+
+
+// Runs task(0) to task(numTasks - 1) and returns when all have finished.
+typedef std::function<void(uint32_t numTasks, const std::function<void(uint32_t)>& task)> CaptureParallelFor;
+
+struct FrameCaptureStats
+{
+	uint64_t framesWritten;
+	uint64_t framesDropped;
+	uint64_t keyframes;
+	uint64_t rawBytes;
+	uint64_t encodedBytes;
+	double lastEncodeMs;
+};
+
+
+// Writes a capture file. Frames are encoded on the calling thread in parallel bands, against a copy of the previous frame,
+// and handed to a writer thread, so the file writes don't hold up the caller.
+class FrameCaptureWriter
+{
+public:
+	~FrameCaptureWriter() { Close(); }
+
+	// The header needs the stream format, frame size and tick frequency filled in. The rest is filled in by the writer.
+	bool Open(const std::string& path, const FrameCaptureFileHeader& header, uint32_t maxQueuedFrames = FRAME_CAPTURE_DEFAULT_QUEUED_FRAMES);
+
+	// Writes the queued frames and the index.
+	void Close();
+
+	bool IsOpen() const { return m_file.is_open(); }
+
+	// Returns false if the frame was dropped because the writer is behind, or the file couldn't be written.
+	bool WriteFrame(const uint8_t* pFrame, const FrameCaptureMetadata& metadata, const CaptureParallelFor& parallelFor = nullptr);
+
+	FrameCaptureStats GetStats();
+
+protected:
+	struct EncodedFrame
+	{
+		FrameCaptureRecordHeader record;
+		std::vector<uint32_t> bandSizes;
+
+		// Each band is encoded at its own fixed offset, and written out from there.
+		std::vector<uint8_t> data;
+	};
+
+	void WriterLoop();
+
+	std::ofstream m_file;
+	std::vector<char> m_fileBuffer;
+	FrameCaptureFileHeader m_header = {};
+	uint32_t m_numBands = 0;
+	size_t m_bandCapacity = 0;
+
+	std::vector<uint8_t> m_prevFrame;
+	std::vector<uint8_t> m_scratch;
+	uint64_t m_frameCount = 0;
+
+	std::vector<EncodedFrame> m_encodedFrames;
+	std::vector<FrameCaptureIndexEntry> m_index;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<EncodedFrame*> m_freeFrames;
+	std::deque<EncodedFrame*> m_queuedFrames;
+	bool m_bWriteError = false;
+	bool m_bStop = false;
+	std::thread m_writerThread;
+
+	uint64_t m_writtenOffset = 0;
+	FrameCaptureStats m_stats = {};
+};
+
+
+// Reads a capture file. Frames decode in order cheaply, since each only applies its changes to the previous one.
+// Any other frame is reached by decoding from the keyframe before it.
+class FrameCaptureReader
+{
+public:
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return m_file.is_open(); }
+
+	const FrameCaptureFileHeader& GetHeader() const { return m_header; }
+	uint32_t GetNumFrames() const { return (uint32_t)m_index.size(); }
+	const FrameCaptureIndexEntry& GetIndexEntry(uint32_t frame) const { return m_index[frame]; }
+
+	// Whether the index was rebuilt from the frame records, because the capture wasn't closed.
+	bool WasIndexRebuilt() const { return m_bIndexRebuilt; }
+
+	// Decodes a frame and returns a pointer to it, valid until the next call. Returns nullptr on a read or decode error.
+	const uint8_t* ReadFrame(uint32_t frame, FrameCaptureMetadata* pMetadata = nullptr, const CaptureParallelFor& parallelFor = nullptr);
+
+	// Frames decoded to reach the requested ones, including themselves.
+	uint64_t GetFramesDecoded() const { return m_framesDecoded; }
+
+protected:
+	bool ReadIndex();
+	bool RebuildIndex();
+	bool DecodeRecord(uint32_t frame, const CaptureParallelFor& parallelFor);
+
+	std::ifstream m_file;
+	FrameCaptureFileHeader m_header = {};
+	uint32_t m_numBands = 0;
+	std::vector<FrameCaptureIndexEntry> m_index;
+	bool m_bIndexRebuilt = false;
+
+	std::vector<uint8_t> m_frame;
+	std::vector<uint8_t> m_scratch;
+	std::vector<uint8_t> m_payload;
+
+	// Frame held in m_frame and its metadata, or -1.
+	int64_t m_decodedFrame = -1;
+	FrameCaptureMetadata m_metadata = {};
+	uint64_t m_framesDecoded = 0;
+};
@@ -0,0 +1,328 @@
+#include "frame_codec.h"
+
+#include <cstring>
+#include <algorithm>
+
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t Read64(const uint8_t* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t HashSequence(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Lengths that don't fit in their 4 bit token field continue in bytes of 255 and a final smaller one.
+static uint8_t* WriteLength(uint8_t* pOut, size_t length)
+{
+	while (length >= 255)
+	{
+		*pOut++ = 255;
+		length -= 255;
+	}
+	*pOut++ = (uint8_t)length;
+	return pOut;
+}
+
+static bool ReadLength(const uint8_t*& pIn, const uint8_t* pInEnd, size_t& length)
+{
+	uint8_t byte;
+	do
+	{
+		if (pIn >= pInEnd)
+		{
+			return false;
+		}
+		byte = *pIn++;
+		length += byte;
+	}
+	while (byte == 255);
+
+	return true;
+}
+
+
+size_t LZCompress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstCapacity)
+{
+	const uint8_t* pEnd = pSrc + srcSize;
+	const uint8_t* pAnchor = pSrc;
+	const uint8_t* pIn = pSrc;
+	uint8_t* pOut = pDst;
+	uint8_t* pOutEnd = pDst + dstCapacity;
+
+	// Positions relative to pSrc. Stale and colliding entries are caught by comparing the bytes.
+	uint32_t table[1 << LZ_HASH_BITS] = {};
+
+	const uint8_t* pSearchEnd = (srcSize > LZ_MIN_MATCH) ? pEnd - LZ_MIN_MATCH : pSrc;
+
+	while (pIn < pSearchEnd)
+	{
+		uint32_t sequence = Read32(pIn);
+		uint32_t hash = HashSequence(sequence);
+		const uint8_t* pMatch = pSrc + table[hash];
+		table[hash] = (uint32_t)(pIn - pSrc);
+
+		if (pMatch >= pIn || pIn - pMatch > LZ_MAX_OFFSET || Read32(pMatch) != sequence)
+		{
+			// Steps further the longer nothing has matched, so incompressible data passes quickly.
+			pIn += 1 + ((pIn - pAnchor) >> 6);
+			continue;
+		}
+
+		while (pIn > pAnchor && pMatch > pSrc && pIn[-1] == pMatch[-1])
+		{
+			pIn--;
+			pMatch--;
+		}
+
+		size_t matchLength = LZ_MIN_MATCH;
+		while (pIn + matchLength + 8 <= pEnd && Read64(pIn + matchLength) == Read64(pMatch + matchLength))
+		{
+			matchLength += 8;
+		}
+		while (pIn + matchLength < pEnd && pIn[matchLength] == pMatch[matchLength])
+		{
+			matchLength++;
+		}
+
+		size_t literalLength = pIn - pAnchor;
+		size_t matchCode = matchLength - LZ_MIN_MATCH;
+
+		// Token, literals, offset, and the length bytes of both.
+		if ((size_t)(pOutEnd - pOut) < 1 + literalLength / 255 + 1 + literalLength + 2 + matchCode / 255 + 1)
+		{
+			return 0;
+		}
+
+		uint8_t* pToken = pOut++;
+		*pToken = (uint8_t)(((std::min)(literalLength, (size_t)15) << 4) | (std::min)(matchCode, (size_t)15));
+
+		if (literalLength >= 15)
+		{
+			pOut = WriteLength(pOut, literalLength - 15);
+		}
+		memcpy(pOut, pAnchor, literalLength);
+		pOut += literalLength;
+
+		size_t offset = pIn - pMatch;
+		*pOut++ = (uint8_t)offset;
+		*pOut++ = (uint8_t)(offset >> 8);
+
+		if (matchCode >= 15)
+		{
+			pOut = WriteLength(pOut, matchCode - 15);
+		}
+
+		pIn += matchLength;
+		pAnchor = pIn;
+
+		// Adds a position from the end of the match, so runs continuing past it are found.
+		if (pIn < pSearchEnd)
+		{
+			table[HashSequence(Read32(pIn - 2))] = (uint32_t)(pIn - 2 - pSrc);
+		}
+	}
+
+	// The last sequence has only literals.
+	size_t literalLength = pEnd - pAnchor;
+	if ((size_t)(pOutEnd - pOut) < 1 + literalLength / 255 + 1 + literalLength)
+	{
+		return 0;
+	}
+
+	*pOut++ = (uint8_t)((std::min)(literalLength, (size_t)15) << 4);
+	if (literalLength >= 15)
+	{
+		pOut = WriteLength(pOut, literalLength - 15);
+	}
+	memcpy(pOut, pAnchor, literalLength);
+	pOut += literalLength;
+
+	return pOut - pDst;
+}
+
+// Matches closer than 8 bytes overlap their own output, repeating the last offset bytes. Those are expanded a byte at a time
+// to a multiple of the offset of at least 8 bytes, after which the pattern repeats at that distance and is copied in whole words.
+static inline void CopyMatch(uint8_t* pOut, size_t offset, size_t length)
+{
+	size_t distance = offset;
+	size_t i = 0;
+
+	if (offset < 8)
+	{
+		distance = offset * ((8 + offset - 1) / offset);
+		for (; i < distance && i < length; i++)
+		{
+			pOut[i] = pOut[i - offset];
+		}
+	}
+
+	for (; i + 8 <= length; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, pOut + i - distance, sizeof(word));
+		memcpy(pOut + i, &word, sizeof(word));
+	}
+
+	for (; i < length; i++)
+	{
+		pOut[i] = pOut[i - distance];
+	}
+}
+
+bool LZDecompress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstSize)
+{
+	const uint8_t* pIn = pSrc;
+	const uint8_t* pInEnd = pSrc + srcSize;
+	uint8_t* pOut = pDst;
+	uint8_t* pOutEnd = pDst + dstSize;
+
+	while (pIn < pInEnd)
+	{
+		uint8_t token = *pIn++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !ReadLength(pIn, pInEnd, literalLength))
+		{
+			return false;
+		}
+		if (literalLength > (size_t)(pInEnd - pIn) || literalLength > (size_t)(pOutEnd - pOut))
+		{
+			return false;
+		}
+
+		memcpy(pOut, pIn, literalLength);
+		pIn += literalLength;
+		pOut += literalLength;
+
+		if (pIn == pInEnd)
+		{
+			break;
+		}
+
+		if (pInEnd - pIn < 2)
+		{
+			return false;
+		}
+		size_t offset = pIn[0] | ((size_t)pIn[1] << 8);
+		pIn += 2;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !ReadLength(pIn, pInEnd, matchLength))
+		{
+			return false;
+		}
+		matchLength += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(pOut - pDst) || matchLength > (size_t)(pOutEnd - pOut))
+		{
+			return false;
+		}
+
+		CopyMatch(pOut, offset, matchLength);
+		pOut += matchLength;
+	}
+
+	return pOut == pOutEnd;
+}
+
+
+size_t EncodeFrameBand(const uint8_t* pBand, const uint8_t* pPrevBand, uint32_t rowSize, uint32_t numRows, uint32_t bytesPerPixel, uint8_t* pScratch, uint8_t* pDst, size_t dstCapacity)
+{
+	size_t bandSize = (size_t)rowSize * numRows;
+
+	if (pPrevBand != nullptr)
+	{
+		for (size_t i = 0; i < bandSize; i++)
+		{
+			pScratch[i] = (uint8_t)(pBand[i] - pPrevBand[i]);
+		}
+	}
+	else
+	{
+		for (uint32_t y = 0; y < numRows; y++)
+		{
+			const uint8_t* pRow = pBand + (size_t)y * rowSize;
+			uint8_t* pResiduals = pScratch + (size_t)y * rowSize;
+
+			memcpy(pResiduals, pRow, (std::min)(bytesPerPixel, rowSize));
+			for (uint32_t x = bytesPerPixel; x < rowSize; x++)
+			{
+				pResiduals[x] = (uint8_t)(pRow[x] - pRow[x - bytesPerPixel]);
+			}
+		}
+	}
+
+	size_t compressedSize = (dstCapacity > 1) ? LZCompress(pScratch, bandSize, pDst + 1, dstCapacity - 1) : 0;
+	if (compressedSize > 0 && compressedSize < bandSize)
+	{
+		pDst[0] = FRAME_BAND_LZ;
+		return compressedSize + 1;
+	}
+
+	if (dstCapacity < bandSize + 1)
+	{
+		return 0;
+	}
+
+	pDst[0] = FRAME_BAND_STORED;
+	memcpy(pDst + 1, pScratch, bandSize);
+	return bandSize + 1;
+}
+
+bool DecodeFrameBand(const uint8_t* pSrc, size_t srcSize, bool bKeyframe, uint32_t rowSize, uint32_t numRows, uint32_t bytesPerPixel, uint8_t* pScratch, uint8_t* pBand)
+{
+	size_t bandSize = (size_t)rowSize * numRows;
+	const uint8_t* pResiduals;
+
+	if (srcSize >= 1 && pSrc[0] == FRAME_BAND_LZ)
+	{
+		if (!LZDecompress(pSrc + 1, srcSize - 1, pScratch, bandSize))
+		{
+			return false;
+		}
+		pResiduals = pScratch;
+	}
+	else if (srcSize == bandSize + 1 && pSrc[0] == FRAME_BAND_STORED)
+	{
+		pResiduals = pSrc + 1;
+	}
+	else
+	{
+		return false;
+	}
+
+	if (!bKeyframe)
+	{
+		for (size_t i = 0; i < bandSize; i++)
+		{
+			pBand[i] = (uint8_t)(pBand[i] + pResiduals[i]);
+		}
+		return true;
+	}
+
+	for (uint32_t y = 0; y < numRows; y++)
+	{
+		uint8_t* pRow = pBand + (size_t)y * rowSize;
+		const uint8_t* pRowResiduals = pResiduals + (size_t)y * rowSize;
+
+		memcpy(pRow, pRowResiduals, (std::min)(bytesPerPixel, rowSize));
+		for (uint32_t x = bytesPerPixel; x < rowSize; x++)
+		{
+			pRow[x] = (uint8_t)(pRowResiduals[x] + pRow[x - bytesPerPixel]);
+		}
+	}
+
+	return true;
+}
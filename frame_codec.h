@@ -0,0 +1,49 @@
+#pragma once
+
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include <cstdint>
+#include <cstddef>
+
+
+// Matches shorter than this are stored as literals. Offsets reach back at most LZ_MAX_OFFSET bytes.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// Size of the match finder hash table, in entries.
+#define LZ_HASH_BITS 13
+
+// First byte of an encoded band.
+#define FRAME_BAND_STORED 0
+#define FRAME_BAND_LZ 1
+
+
+// Largest output of LZCompress for an input of the given size, when it can't compress it.
+inline size_t LZCompressBound(size_t srcSize)
+{
+	return srcSize + srcSize / 255 + 16;
+}
+
+// Byte oriented LZ compressor in the LZ4 block layout: sequences of a token with the literal and match lengths,
+// the literals, and a 16 bit match offset. The match finder is a single hash table probe, which is what keeps it fast
+// enough for full rate capture. Returns the compressed size, or zero if it doesn't fit in dstCapacity.
+size_t LZCompress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstCapacity);
+
+// Returns false if the input is malformed or doesn't decompress to exactly dstSize bytes.
+bool LZDecompress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstSize);
+
+
+// Largest encoded size of a band of the given size.
+inline size_t FrameBandBound(size_t bandSize)
+{
+	return 1 + LZCompressBound(bandSize);
+}
+
+// Encodes rows of a frame. Delta frames are predicted from the same rows of the previous frame, which leaves zeros
+// wherever the image didn't change. Keyframes have no previous frame and are predicted from the pixel to the left.
+// The residuals are LZ compressed, or stored as they are if that doesn't make them smaller.
+// pScratch holds bandSize bytes. Returns the encoded size.
+size_t EncodeFrameBand(const uint8_t* pBand, const uint8_t* pPrevBand, uint32_t rowSize, uint32_t numRows, uint32_t bytesPerPixel, uint8_t* pScratch, uint8_t* pDst, size_t dstCapacity);
+
+// Decodes an encoded band in place over the same rows of the previous frame, or over anything for keyframes.
+// pScratch holds bandSize bytes.
+bool DecodeFrameBand(const uint8_t* pSrc, size_t srcSize, bool bKeyframe, uint32_t rowSize, uint32_t numRows, uint32_t bytesPerPixel, uint8_t* pScratch, uint8_t* pBand);
@@ -0,0 +1,36 @@
+#include "pch.h"
+#include "frame_metadata.h"
+
+
+void FrameMetadataPaths::Resolve()
+{
+	vr::VRPaths()->StringToHandle(&frameSequence, "/frame_sequence");
+	vr::VRPaths()->StringToHandle(&frameSize, "/frame_size");
+	vr::VRPaths()->StringToHandle(&frameTimeMonotonic, "/frame_time_monotonic");
+	vr::VRPaths()->StringToHandle(&serverTimeTicks, "/server_time_ticks");
+	vr::VRPaths()->StringToHandle(&deliveryRate, "/delivery_rate");
+	vr::VRPaths()->StringToHandle(&elapsedTime, "/elapsed_time");
+	vr::VRPaths()->StringToHandle(&readoutTime, "/readout_time");
+}
+
+static inline void SetWrite(vr::PathWrite_t& write, vr::PathHandle_t path, void* pValue, uint32_t size, vr::PropertyTypeTag_t tag)
+{
+	write.writeType = vr::PropertyWrite_Set;
+	write.ulPath = path;
+	write.pvBuffer = pValue;
+	write.unBufferSize = size;
+	write.unTag = tag;
+}
+
+void BuildFrameMetadataBatch(const FrameMetadataPaths& paths, FrameMetadata& metadata, vr::PathWrite_t (&outWrite)[FRAME_METADATA_WRITES])
+{
+	memset(outWrite, 0, sizeof(outWrite));
+
+	SetWrite(outWrite[0], paths.frameSize, &metadata.frameSize, sizeof(metadata.frameSize), vr::k_unInt32PropertyTag);
+	SetWrite(outWrite[1], paths.frameSequence, &metadata.frameSequence, sizeof(metadata.frameSequence), vr::k_unUint64PropertyTag);
+	SetWrite(outWrite[2], paths.frameTimeMonotonic, &metadata.frameTimeMonotonic, sizeof(metadata.frameTimeMonotonic), vr::k_unDoublePropertyTag);
+	SetWrite(outWrite[3], paths.serverTimeTicks, &metadata.serverTimeTicks, sizeof(metadata.serverTimeTicks), vr::k_unUint64PropertyTag);
+	SetWrite(outWrite[4], paths.deliveryRate, &metadata.deliveryRate, sizeof(metadata.deliveryRate), vr::k_unDoublePropertyTag);
+	SetWrite(outWrite[5], paths.elapsedTime, &metadata.elapsedTime, sizeof(metadata.elapsedTime), vr::k_unDoublePropertyTag);
+	SetWrite(outWrite[6], paths.readoutTime, &metadata.readoutTime, sizeof(metadata.readoutTime), vr::k_unDoublePropertyTag);
+}
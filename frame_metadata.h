@@ -0,0 +1,35 @@
+#pragma once
+
+
+#define FRAME_METADATA_WRITES 7
+
+// Property paths of the per-frame metadata written along with each served frame.
+struct FrameMetadataPaths
+{
+	vr::PathHandle_t frameSize = 0;
+	vr::PathHandle_t frameSequence = 0;
+	vr::PathHandle_t frameTimeMonotonic = 0;
+	vr::PathHandle_t serverTimeTicks = 0;
+	vr::PathHandle_t deliveryRate = 0;
+	vr::PathHandle_t elapsedTime = 0;
+	vr::PathHandle_t readoutTime = 0;
+
+	void Resolve();
+};
+
+// Values of the per-frame metadata. The write batch points into this, so it must outlive the batch.
+struct FrameMetadata
+{
+	int32_t frameSize;
+	uint64_t frameSequence;
+	double frameTimeMonotonic;
+	uint64_t serverTimeTicks;
+	double deliveryRate;
+	double elapsedTime;
+
+	// Exposure time difference between the first and last row, server_time_ticks is the first row.
+	double readoutTime;
+};
+
+// Fills in the path writes for WritePathBatch, replacing any previous contents.
+void BuildFrameMetadataBatch(const FrameMetadataPaths& paths, FrameMetadata& metadata, vr::PathWrite_t (&outWrite)[FRAME_METADATA_WRITES]);
@@ -0,0 +1,274 @@
+#include "pch.h"
+#include "frame_pack.h"
+#include "cpu_features.h"
+
+
+static const char* g_packFormatNames[] =
+{
+	"rgbx32",
+	"rgb24",
+	"yuyv16",
+};
+
+static_assert(sizeof(g_packFormatNames) / sizeof(g_packFormatNames[0]) == PackFormat_Count, "Pack format name table out of sync with EPackFormat");
+
+uint32_t PackBytesPerPixel(EPackFormat format)
+{
+	switch (format)
+	{
+	case PackFormat_RGBX32: return 4;
+	case PackFormat_RGB24: return 3;
+	case PackFormat_YUYV16: return 2;
+	default: return 0;
+	}
+}
+
+bool ParsePackFormat(const std::string& name, EPackFormat& outFormat)
+{
+	for (int i = 0; i < PackFormat_Count; i++)
+	{
+		if (name == g_packFormatNames[i])
+		{
+			outFormat = (EPackFormat)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* PackFormatName(EPackFormat format)
+{
+	return (format >= 0 && format < PackFormat_Count) ? g_packFormatNames[format] : "unknown";
+}
+
+
+// Mirrors CameraRig::UpdateLayout.
+static constexpr uint32_t GetLayoutColumns(ERigFrameLayout layout, uint32_t numCameras)
+{
+	return (layout == RigFrameLayout_Vertical) ? 1 : (layout == RigFrameLayout_Grid) ? ((numCameras > 1) ? 2 : 1) : numCameras;
+}
+
+template<EPackFormat Format>
+struct PackTraits;
+
+template<>
+struct PackTraits<PackFormat_RGB24>
+{
+	static constexpr uint32_t bytesPerPixel = 3;
+
+	// Packs pixels [x, width) of the span, four at a time as three whole words.
+	static inline void PackSpan(const uint8_t* pSource, uint8_t* pDest, uint32_t x, uint32_t width)
+	{
+		pSource += (size_t)x * 4;
+		pDest += (size_t)x * 3;
+
+		for (; x + 4 <= width; x += 4, pSource += 16, pDest += 12)
+		{
+			uint32_t pixels[4];
+			memcpy(pixels, pSource, 16);
+
+			uint32_t words[3] =
+			{
+				(pixels[0] & 0xFFFFFF) | (pixels[1] << 24),
+				((pixels[1] >> 8) & 0xFFFF) | (pixels[2] << 16),
+				((pixels[2] >> 16) & 0xFF) | (pixels[3] << 8),
+			};
+			memcpy(pDest, words, 12);
+		}
+		for (; x < width; x++, pSource += 4, pDest += 3)
+		{
+			pDest[0] = pSource[0];
+			pDest[1] = pSource[1];
+			pDest[2] = pSource[2];
+		}
+	}
+
+#ifdef CPU_X86
+	// Eight pixels per step. Returns the pixels packed, the rest is left to PackSpan.
+	CPU_TARGET_AVX2 static uint32_t PackSpanAVX2(const uint8_t* pSource, uint8_t* pDest, uint32_t width)
+	{
+		const __m256i dropX = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		const __m256i joinLanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+		uint32_t x = 0;
+		for (; x + 8 <= width; x += 8, pSource += 32, pDest += 24)
+		{
+			__m256i pixels = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)pSource), dropX);
+			pixels = _mm256_permutevar8x32_epi32(pixels, joinLanes);
+
+			// Exactly 24 bytes, as the bytes after the span may belong to a row another band is writing.
+			_mm_storeu_si128((__m128i*)pDest, _mm256_castsi256_si128(pixels));
+			_mm_storel_epi64((__m128i*)(pDest + 16), _mm256_extracti128_si256(pixels, 1));
+		}
+		return x;
+	}
+#endif
+};
+
+template<>
+struct PackTraits<PackFormat_YUYV16>
+{
+	static constexpr uint32_t bytesPerPixel = 2;
+
+	// BT.601 limited range in 8 bit fixed point. The chroma takes the sums of two pixels.
+	static inline uint8_t GetLuma(int32_t r, int32_t g, int32_t b)
+	{
+		return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+	}
+
+	static inline void PackPair(const uint8_t* pSource0, const uint8_t* pSource1, uint8_t* pDest)
+	{
+		int32_t r = pSource0[0] + pSource1[0];
+		int32_t g = pSource0[1] + pSource1[1];
+		int32_t b = pSource0[2] + pSource1[2];
+
+		pDest[0] = GetLuma(pSource0[0], pSource0[1], pSource0[2]);
+		pDest[1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 256) >> 9) + 128);
+		pDest[2] = GetLuma(pSource1[0], pSource1[1], pSource1[2]);
+		pDest[3] = (uint8_t)(((112 * r - 94 * g - 18 * b + 256) >> 9) + 128);
+	}
+
+	// Packs pixels [x, width) of the span, x being even. An odd last pixel is paired with itself, and its second luma sample dropped.
+	static inline void PackSpan(const uint8_t* pSource, uint8_t* pDest, uint32_t x, uint32_t width)
+	{
+		pSource += (size_t)x * 4;
+		pDest += (size_t)x * 2;
+
+		for (; x + 2 <= width; x += 2, pSource += 8, pDest += 4)
+		{
+			PackPair(pSource, pSource + 4, pDest);
+		}
+		if (x < width)
+		{
+			uint8_t pair[4];
+			PackPair(pSource, pSource, pair);
+			pDest[0] = pair[0];
+			pDest[1] = pair[1];
+		}
+	}
+
+#ifdef CPU_X86
+	// Eight pixels per step, giving the same results as PackPair. Returns the pixels packed, the rest is left to PackSpan.
+	CPU_TARGET_AVX2 static uint32_t PackSpanAVX2(const uint8_t* pSource, uint8_t* pDest, uint32_t width)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i lumaWeights = _mm256_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0, 66, 129, 25, 0, 66, 129, 25, 0);
+
+		// The pair sum is in both halves of each pixel pair, the first weighted for U and the second for V.
+		const __m256i chromaWeights = _mm256_setr_epi16(-38, -74, 112, 0, 112, -94, -18, 0, -38, -74, 112, 0, 112, -94, -18, 0);
+		const __m256i lumaRound = _mm256_set1_epi32(128);
+		const __m256i chromaRound = _mm256_set1_epi32(256);
+		const __m256i lumaOffset = _mm256_set1_epi32(16);
+		const __m256i chromaOffset = _mm256_set1_epi32(128);
+
+		uint32_t x = 0;
+		for (; x + 8 <= width; x += 8, pSource += 32, pDest += 16)
+		{
+			__m256i pixels = _mm256_loadu_si256((const __m256i*)pSource);
+
+			// Pixels 0, 1 and 2, 3 of each lane as 16 bit channels.
+			__m256i firstPair = _mm256_unpacklo_epi8(pixels, zero);
+			__m256i secondPair = _mm256_unpackhi_epi8(pixels, zero);
+
+			__m256i luma = _mm256_hadd_epi32(_mm256_madd_epi16(firstPair, lumaWeights), _mm256_madd_epi16(secondPair, lumaWeights));
+			luma = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(luma, lumaRound), 8), lumaOffset);
+
+			__m256i firstSum = _mm256_add_epi16(firstPair, _mm256_shuffle_epi32(firstPair, _MM_SHUFFLE(1, 0, 3, 2)));
+			__m256i secondSum = _mm256_add_epi16(secondPair, _mm256_shuffle_epi32(secondPair, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			__m256i chroma = _mm256_hadd_epi32(_mm256_madd_epi16(firstSum, chromaWeights), _mm256_madd_epi16(secondSum, chromaWeights));
+			chroma = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(chroma, chromaRound), 9), chromaOffset);
+
+			// Y0 U Y1 V Y2 U Y3 V per lane. The values are within 16-240, so the saturating packs don't change them.
+			__m256i words = _mm256_packs_epi32(_mm256_unpacklo_epi32(luma, chroma), _mm256_unpackhi_epi32(luma, chroma));
+			__m256i bytes = _mm256_packus_epi16(words, words);
+
+			_mm_storel_epi64((__m128i*)pDest, _mm256_castsi256_si128(bytes));
+			_mm_storel_epi64((__m128i*)(pDest + 8), _mm256_extracti128_si256(bytes, 1));
+		}
+		return x;
+	}
+#endif
+};
+
+template<EPackFormat Format, ERigFrameLayout Layout, uint32_t NumCameras, bool bUseAVX2>
+static void PackRowsKernel(const uint8_t* pSource, uint8_t* pDest, uint32_t frameWidth, uint32_t firstRow, uint32_t endRow)
+{
+	constexpr uint32_t columns = GetLayoutColumns(Layout, NumCameras);
+	constexpr uint32_t destBytesPerPixel = PackTraits<Format>::bytesPerPixel;
+
+	const size_t sourceRowStride = (size_t)frameWidth * columns * 4;
+	const size_t destRowStride = (size_t)frameWidth * columns * destBytesPerPixel;
+
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		const uint8_t* pSourceRow = pSource + y * sourceRowStride;
+		uint8_t* pDestRow = pDest + y * destRowStride;
+
+		// The view count is a constant, so this unrolls. Empty grid cells are packed like the views, as the sources clear them.
+		for (uint32_t column = 0; column < columns; column++)
+		{
+			const uint8_t* pSourceView = pSourceRow + (size_t)column * frameWidth * 4;
+			uint8_t* pDestView = pDestRow + (size_t)column * frameWidth * destBytesPerPixel;
+
+			uint32_t x = 0;
+#ifdef CPU_X86
+			if constexpr (bUseAVX2)
+			{
+				x = PackTraits<Format>::PackSpanAVX2(pSourceView, pDestView, frameWidth);
+			}
+#endif
+			PackTraits<Format>::PackSpan(pSourceView, pDestView, x, frameWidth);
+		}
+	}
+}
+
+
+#define PACK_NUM_LAYOUTS 3
+
+static_assert(RigFrameLayout_Grid == PACK_NUM_LAYOUTS - 1, "Pack kernel table out of sync with ERigFrameLayout");
+static_assert(MAX_RIG_CAMERAS == 4, "Pack kernel table out of sync with MAX_RIG_CAMERAS");
+
+#define PACK_KERNELS_FOR_LAYOUT(format, layout, avx2) \
+	{ &PackRowsKernel<format, layout, 1, avx2>, &PackRowsKernel<format, layout, 2, avx2>, &PackRowsKernel<format, layout, 3, avx2>, &PackRowsKernel<format, layout, 4, avx2> }
+
+#define PACK_KERNELS_FOR_FORMAT(format, avx2) \
+	{ PACK_KERNELS_FOR_LAYOUT(format, RigFrameLayout_Horizontal, avx2), PACK_KERNELS_FOR_LAYOUT(format, RigFrameLayout_Vertical, avx2), PACK_KERNELS_FOR_LAYOUT(format, RigFrameLayout_Grid, avx2) }
+
+// Indexed by AVX2 support, format, layout and camera count - 1. RGBX32 frames are served as rendered.
+static const FramePackRowsFunc g_packKernels[2][PackFormat_Count][PACK_NUM_LAYOUTS][MAX_RIG_CAMERAS] =
+{
+	{
+		{},
+		PACK_KERNELS_FOR_FORMAT(PackFormat_RGB24, false),
+		PACK_KERNELS_FOR_FORMAT(PackFormat_YUYV16, false),
+	},
+	{
+		{},
+		PACK_KERNELS_FOR_FORMAT(PackFormat_RGB24, true),
+		PACK_KERNELS_FOR_FORMAT(PackFormat_YUYV16, true),
+	},
+};
+
+
+FramePacker::FramePacker()
+{
+	m_bUseAVX2 = CpuSupportsAVX2();
+}
+
+
+bool FramePacker::Configure(EPackFormat format, const CameraRig& rig)
+{
+	m_format = format;
+	m_frameWidth = rig.frameWidth;
+	m_pPackRows = nullptr;
+
+	if (format <= PackFormat_RGBX32 || format >= PackFormat_Count || rig.layout < 0 || rig.layout >= PACK_NUM_LAYOUTS ||
+		rig.numCameras < 1 || rig.numCameras > MAX_RIG_CAMERAS)
+	{
+		return false;
+	}
+
+	m_pPackRows = g_packKernels[m_bUseAVX2 ? 1 : 0][format][rig.layout][rig.numCameras - 1];
+	return m_pPackRows != nullptr;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "camera_rig.h"
+
+
+// Frame rows per parallel task when packing whole frames.
+#define PACK_BAND_ROWS 32
+
+
+// Formats the rendered RGBX32 frames can be served in, besides the raw Bayer formats. Keep in sync with g_packFormatNames.
+// YUYV16 is BT.601 limited range, with the chroma of each pixel pair averaged.
+enum EPackFormat
+{
+	PackFormat_RGBX32 = 0,
+	PackFormat_RGB24,
+	PackFormat_YUYV16,
+
+	PackFormat_Count
+};
+
+uint32_t PackBytesPerPixel(EPackFormat format);
+bool ParsePackFormat(const std::string& name, EPackFormat& outFormat);
+const char* PackFormatName(EPackFormat format);
+
+// Packs texture rows [firstRow, endRow) of an RGBX32 frame.
+typedef void (*FramePackRowsFunc)(const uint8_t* pSource, uint8_t* pDest, uint32_t frameWidth, uint32_t firstRow, uint32_t endRow);
+
+
+// Converts rendered RGBX32 frames into a packed format. The kernels are specialized at compile time for each format,
+// frame layout and camera count, so the pixel sizes and view offsets are constants and the inner loops don't branch.
+// Each view is packed on its own, keeping the YUYV pixel pairs within a view at odd view widths.
+// The kernels use AVX2 when the CPU supports it, which gives the same results as the scalar ones.
+class FramePacker
+{
+public:
+	FramePacker();
+
+	// Picks the kernel for the format and rig, once per stream rather than per frame. Returns false if no packing is needed.
+	bool Configure(EPackFormat format, const CameraRig& rig);
+
+	bool IsConfigured() const { return m_pPackRows != nullptr; }
+	EPackFormat GetFormat() const { return m_format; }
+	bool IsUsingAVX2() const { return m_bUseAVX2; }
+
+	// The source and destination frames must not overlap.
+	inline void PackRows(const uint8_t* pSource, uint8_t* pDest, uint32_t firstRow, uint32_t endRow) const
+	{
+		m_pPackRows(pSource, pDest, m_frameWidth, firstRow, endRow);
+	}
+
+protected:
+	FramePackRowsFunc m_pPackRows = nullptr;
+	EPackFormat m_format = PackFormat_RGBX32;
+	uint32_t m_frameWidth = 0;
+	bool m_bUseAVX2 = false;
+};
@@ -0,0 +1,216 @@
+#include "pch.h"
+#include "frame_ring.h"
+#include "frame_arena.h"
+
+
+FrameRing::~FrameRing()
+{
+	Free();
+}
+
+void FrameRing::Free()
+{
+	for (RenderedFrame& frame : m_frames)
+	{
+		if (m_pArena != nullptr)
+		{
+			m_pArena->ReleaseSlot(frame.pData);
+		}
+		frame.pData = nullptr;
+	}
+	m_frameSize = 0;
+}
+
+bool FrameRing::Reset(FrameArena& arena, uint32_t frameSize)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// The slots are returned first, so the arena can grow for a larger frame size.
+	Free();
+	m_pArena = &arena;
+
+	if (!arena.Reserve(frameSize, FRAME_ARENA_SLOTS))
+	{
+		return false;
+	}
+
+	for (RenderedFrame& frame : m_frames)
+	{
+		frame.pData = arena.AcquireSlot();
+		frame.state = RenderedFrame_Free;
+
+		if (frame.pData == nullptr)
+		{
+			VR_DRIVER_LOG_FORMAT("FrameRing: Frame arena is out of slots");
+			Free();
+			return false;
+		}
+	}
+	m_frameSize = frameSize;
+	return true;
+}
+
+RenderedFrame* FrameRing::AcquireFree(const std::atomic<bool>& bRun)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	RenderedFrame* pFree = nullptr;
+
+	m_freeCondition.wait(lock, [&]()
+	{
+		if (!bRun || m_frameSize == 0)
+		{
+			return true;
+		}
+		for (RenderedFrame& frame : m_frames)
+		{
+			if (frame.state == RenderedFrame_Free)
+			{
+				pFree = &frame;
+				return true;
+			}
+		}
+		return false;
+	});
+
+	if (!bRun || pFree == nullptr)
+	{
+		return nullptr;
+	}
+
+	pFree->state = RenderedFrame_Rendering;
+	return pFree;
+}
+
+void FrameRing::MarkReady(RenderedFrame* pFrame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pFrame->state = RenderedFrame_Ready;
+	}
+	m_readyCondition.notify_one();
+}
+
+bool FrameRing::WaitForReady(uint32_t timeoutMs, uint64_t& outDeadlineTicks)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	auto findEarliest = [&]()
+	{
+		bool bFound = false;
+		for (const RenderedFrame& frame : m_frames)
+		{
+			if (frame.state == RenderedFrame_Ready && (!bFound || frame.deadlineTicks < outDeadlineTicks))
+			{
+				outDeadlineTicks = frame.deadlineTicks;
+				bFound = true;
+			}
+		}
+		return bFound;
+	};
+
+	return m_readyCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), findEarliest);
+}
+
+RenderedFrame* FrameRing::TakeDue(uint64_t currentTicks)
+{
+	RenderedFrame* pNewest = nullptr;
+	uint32_t numFreed = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (RenderedFrame& frame : m_frames)
+		{
+			if (frame.state != RenderedFrame_Ready || frame.deadlineTicks > currentTicks)
+			{
+				continue;
+			}
+
+			if (pNewest == nullptr || frame.deadlineTicks > pNewest->deadlineTicks)
+			{
+				if (pNewest != nullptr)
+				{
+					pNewest->state = RenderedFrame_Free;
+					numFreed++;
+				}
+				pNewest = &frame;
+			}
+			else
+			{
+				frame.state = RenderedFrame_Free;
+				numFreed++;
+			}
+		}
+
+		if (pNewest != nullptr)
+		{
+			pNewest->state = RenderedFrame_Publishing;
+		}
+	}
+
+	if (numFreed > 0)
+	{
+		m_droppedFrames.fetch_add(numFreed, std::memory_order_relaxed);
+		m_freeCondition.notify_one();
+	}
+
+	return pNewest;
+}
+
+void FrameRing::Release(RenderedFrame* pFrame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pFrame->state = RenderedFrame_Free;
+	}
+	m_freeCondition.notify_one();
+}
+
+void FrameRing::Wake()
+{
+	// Taking the lock makes sure a waiter can't miss the notification between checking its predicate and sleeping.
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_freeCondition.notify_all();
+	m_readyCondition.notify_all();
+}
+
+
+void StreamFrameCopy(void* pDest, const void* pSource, size_t size)
+{
+	uint8_t* pDst = (uint8_t*)pDest;
+	const uint8_t* pSrc = (const uint8_t*)pSource;
+
+	// The block queue buffers are not guaranteed to be aligned, so the head is copied normally.
+	size_t headSize = (16 - ((uintptr_t)pDst & 15)) & 15;
+	if (headSize > size)
+	{
+		headSize = size;
+	}
+	memcpy(pDst, pSrc, headSize);
+	pDst += headSize;
+	pSrc += headSize;
+	size -= headSize;
+
+	size_t numBlocks = size / 64;
+	for (size_t i = 0; i < numBlocks; i++)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(pSrc + 0));
+		__m128i b = _mm_loadu_si128((const __m128i*)(pSrc + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(pSrc + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(pSrc + 48));
+		_mm_stream_si128((__m128i*)(pDst + 0), a);
+		_mm_stream_si128((__m128i*)(pDst + 16), b);
+		_mm_stream_si128((__m128i*)(pDst + 32), c);
+		_mm_stream_si128((__m128i*)(pDst + 48), d);
+		pSrc += 64;
+		pDst += 64;
+	}
+
+	memcpy(pDst, pSrc, size - numBlocks * 64);
+
+	// Makes the streamed data visible before the block is released to the readers.
+	_mm_sfence();
+}
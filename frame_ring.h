@@ -0,0 +1,78 @@
+#pragma once
+
+class FrameArena;
+
+// Number of frames the render thread can get ahead of the publisher.
+#define RENDER_AHEAD_FRAMES 3
+
+
+enum ERenderedFrameState
+{
+	RenderedFrame_Free = 0,
+	RenderedFrame_Rendering,
+	RenderedFrame_Ready,
+	RenderedFrame_Publishing,
+};
+
+// A frame rendered ahead of time, waiting for its delivery deadline.
+struct RenderedFrame
+{
+	// While rendering, the render thread may exchange the slot for another one of the same arena.
+	uint8_t* pData = nullptr;
+	ERenderedFrameState state = RenderedFrame_Free;
+
+	uint64_t frameCount = 0;
+	uint64_t deadlineTicks = 0;
+	uint64_t exposureTicks = 0;
+	double readoutTime = 0.0;
+};
+
+
+// Private ring of rendered frames between the render thread and the publisher.
+// The render thread fills free slots in deadline order, and the publisher takes the newest one whose deadline has passed.
+class FrameRing
+{
+public:
+	~FrameRing();
+
+	// Takes the slots from the arena for the given frame size, and marks all of them free. Neither side may hold a slot.
+	// Returns false if the arena has no room, leaving the ring without slots.
+	bool Reset(FrameArena& arena, uint32_t frameSize);
+
+	uint32_t GetFrameSize() const { return m_frameSize; }
+
+	// Blocks until a slot is free, or returns nullptr once bRun is cleared and Wake() called.
+	RenderedFrame* AcquireFree(const std::atomic<bool>& bRun);
+	void MarkReady(RenderedFrame* pFrame);
+
+	// Waits up to timeoutMs for a ready frame, and returns the earliest deadline of the ready ones.
+	bool WaitForReady(uint32_t timeoutMs, uint64_t& outDeadlineTicks);
+
+	// Takes the newest ready frame due at currentTicks. Older due frames are freed and counted as dropped.
+	RenderedFrame* TakeDue(uint64_t currentTicks);
+	void Release(RenderedFrame* pFrame);
+
+	// Wakes up any thread blocked in AcquireFree or WaitForReady.
+	void Wake();
+
+	uint64_t GetDroppedFrames() const { return m_droppedFrames; }
+
+protected:
+	void Free();
+
+	std::mutex m_mutex;
+	std::condition_variable m_freeCondition;
+	std::condition_variable m_readyCondition;
+
+	RenderedFrame m_frames[RENDER_AHEAD_FRAMES];
+	uint32_t m_frameSize = 0;
+
+	// The arena the slots were taken from.
+	FrameArena* m_pArena = nullptr;
+
+	std::atomic<uint64_t> m_droppedFrames = 0;
+};
+
+
+// Copies a frame with non-temporal stores, so publishing does not evict the caches of the render threads.
+void StreamFrameCopy(void* pDest, const void* pSource, size_t size);
@@ -0,0 +1,202 @@
+#include "pch.h"
+#include "frame_sink.h"
+
+
+void FrameSink::SetPacing(double maxRate, EFrameSinkDropPolicy dropPolicy)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	m_maxRate = (maxRate > 0.0) ? maxRate : 0.0;
+	m_dropPolicy = dropPolicy;
+	m_minIntervalTicks = (m_maxRate > 0.0) ? (int64_t)(frequency.QuadPart / m_maxRate) : 0;
+	m_nextFrameTicks = 0;
+}
+
+void FrameSink::Submit(const uint8_t* pFrame, uint32_t frameSize, uint64_t frameTicks, vr::PathWrite_t* pMetadata, uint32_t metadataCount)
+{
+	if (m_minIntervalTicks > 0)
+	{
+		// A quarter interval of slack keeps e.g. a 30 Hz sink on every other frame of a 60 Hz camera despite rounding.
+		int64_t ticks = (int64_t)frameTicks;
+		if (ticks < m_nextFrameTicks - m_minIntervalTicks / 4)
+		{
+			m_droppedPacing.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		// Don't try to catch up after pauses.
+		m_nextFrameTicks = (ticks - m_nextFrameTicks > m_minIntervalTicks) ? ticks + m_minIntervalTicks : m_nextFrameTicks + m_minIntervalTicks;
+	}
+
+	if (m_dropPolicy == FrameSinkDrop_WithoutReaders && !HasReaders())
+	{
+		m_droppedNoReaders.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	if (Publish(pFrame, frameSize, pMetadata, metadataCount))
+	{
+		m_published.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		m_errors.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+FrameSinkStats FrameSink::GetStats() const
+{
+	FrameSinkStats stats;
+	stats.published = m_published.load(std::memory_order_relaxed);
+	stats.droppedPacing = m_droppedPacing.load(std::memory_order_relaxed);
+	stats.droppedNoReaders = m_droppedNoReaders.load(std::memory_order_relaxed);
+	stats.errors = m_errors.load(std::memory_order_relaxed);
+	return stats;
+}
+
+
+IOBufferFrameSink::IOBufferFrameSink(const char* path)
+	: m_path(path)
+{
+}
+
+IOBufferFrameSink::~IOBufferFrameSink()
+{
+	Close();
+}
+
+bool IOBufferFrameSink::Open(const CameraRig& rig, uint32_t bpp, int32_t streamFormat)
+{
+	Close();
+
+	m_elementSize = rig.textureWidth * rig.textureHeight * bpp;
+
+	vr::EIOBufferError error = vr::VRIOBuffer()->Open(m_path.c_str(), (vr::EIOBufferMode)(vr::IOBufferMode_Write | vr::IOBufferMode_Create), m_elementSize, IOBUFFER_SINK_ELEMENTS, &m_buffer);
+	if (error != vr::IOBuffer_Success)
+	{
+		VR_DRIVER_LOG_FORMAT("IOBufferFrameSink: Error opening {}: {}", m_path, (int)error);
+		m_buffer = vr::k_ulInvalidIOBufferHandle;
+		return false;
+	}
+
+	int32_t frameFormat = streamFormat;
+	int32_t frameWidth = rig.textureWidth;
+	int32_t frameHeight = rig.textureHeight;
+
+	vr::PathHandle_t formatHandle, widthHandle, heightHandle;
+	vr::VRPaths()->StringToHandle(&formatHandle, "/format");
+	vr::VRPaths()->StringToHandle(&widthHandle, "/width");
+	vr::VRPaths()->StringToHandle(&heightHandle, "/height");
+
+	const vr::PathHandle_t handles[3] = { formatHandle, widthHandle, heightHandle };
+	int32_t* values[3] = { &frameFormat, &frameWidth, &frameHeight };
+
+	vr::PropertyContainerHandle_t container = vr::VRIOBuffer()->PropertyContainer(m_buffer);
+
+	// Written one at a time, same as on the block queue.
+	for (int i = 0; i < 3; i++)
+	{
+		vr::PathWrite_t write = {};
+		write.ulPath = handles[i];
+		write.writeType = vr::PropertyWrite_Set;
+		write.unTag = vr::k_unInt32PropertyTag;
+		write.unBufferSize = sizeof(int32_t);
+		write.pvBuffer = values[i];
+
+		vr::ETrackedPropertyError propError = vr::VRPaths()->WritePathBatch(container, &write, 1);
+		if (propError != vr::TrackedProp_Success)
+		{
+			VR_DRIVER_LOG_FORMAT("IOBufferFrameSink: Error writing frame format to {}: {}", m_path, (int)propError);
+		}
+	}
+
+	VR_DRIVER_LOG_FORMAT("IOBufferFrameSink: Opened {} ({} bytes x {})", m_path, m_elementSize, IOBUFFER_SINK_ELEMENTS);
+	return true;
+}
+
+void IOBufferFrameSink::Close()
+{
+	if (m_buffer != vr::k_ulInvalidIOBufferHandle)
+	{
+		vr::VRIOBuffer()->Close(m_buffer);
+		m_buffer = vr::k_ulInvalidIOBufferHandle;
+	}
+}
+
+bool IOBufferFrameSink::HasReaders()
+{
+	return m_buffer != vr::k_ulInvalidIOBufferHandle && vr::VRIOBuffer()->HasReaders(m_buffer);
+}
+
+bool IOBufferFrameSink::Publish(const uint8_t* pFrame, uint32_t frameSize, vr::PathWrite_t* pMetadata, uint32_t metadataCount)
+{
+	if (m_buffer == vr::k_ulInvalidIOBufferHandle || frameSize > m_elementSize)
+	{
+		return false;
+	}
+
+	// The only copy of the frame for this sink, straight from the render ring slot.
+	vr::EIOBufferError error = vr::VRIOBuffer()->Write(m_buffer, (void*)pFrame, frameSize);
+	if (error != vr::IOBuffer_Success)
+	{
+		DRIVER_LOG_RATE_LIMITED(1, "IOBufferFrameSink: Write to {} failed: {}", m_path, (int)error);
+		return false;
+	}
+
+	vr::ETrackedPropertyError propError = vr::VRPaths()->WritePathBatch(vr::VRIOBuffer()->PropertyContainer(m_buffer), pMetadata, metadataCount);
+	if (propError != vr::TrackedProp_Success)
+	{
+		DRIVER_LOG_RATE_LIMITED(1, "IOBufferFrameSink: Error writing frame data to {}: {}", m_path, (int)propError);
+	}
+
+	return true;
+}
+
+
+void FrameFanout::AddSink(std::unique_ptr<FrameSink> sink)
+{
+	m_sinks.push_back(std::move(sink));
+}
+
+void FrameFanout::Open(const CameraRig& rig, uint32_t bpp, int32_t streamFormat)
+{
+	for (std::unique_ptr<FrameSink>& sink : m_sinks)
+	{
+		sink->Open(rig, bpp, streamFormat);
+	}
+}
+
+void FrameFanout::Close()
+{
+	for (std::unique_ptr<FrameSink>& sink : m_sinks)
+	{
+		sink->Close();
+	}
+}
+
+void FrameFanout::Submit(const uint8_t* pFrame, uint32_t frameSize, uint64_t frameTicks, vr::PathWrite_t* pMetadata, uint32_t metadataCount)
+{
+	for (std::unique_ptr<FrameSink>& sink : m_sinks)
+	{
+		sink->Submit(pFrame, frameSize, frameTicks, pMetadata, metadataCount);
+	}
+}
+
+std::string FrameFanout::GetStatsJson() const
+{
+	std::string json = "[";
+
+	for (size_t i = 0; i < m_sinks.size(); i++)
+	{
+		const FrameSink& sink = *m_sinks[i];
+		FrameSinkStats stats = sink.GetStats();
+
+		json += std::format("{}{{\"name\":\"{}\",\"max_rate\":{},\"drop_without_readers\":{},\"published\":{},\"dropped_pacing\":{},\"dropped_no_readers\":{},\"errors\":{}}}",
+			(i > 0) ? "," : "", sink.GetName(), sink.GetMaxRate(), sink.GetDropPolicy() == FrameSinkDrop_WithoutReaders,
+			stats.published, stats.droppedPacing, stats.droppedNoReaders, stats.errors);
+	}
+
+	json += "]";
+	return json;
+}
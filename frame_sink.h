@@ -0,0 +1,103 @@
+#pragma once
+
+#include "camera_rig.h"
+
+
+// Frames buffered in each IVRIOBuffer sink.
+#define IOBUFFER_SINK_ELEMENTS 3
+
+
+enum EFrameSinkDropPolicy
+{
+	FrameSinkDrop_WithoutReaders = 0, // Skip the copy while no reader has the sink open.
+	FrameSinkDrop_Never,
+};
+
+struct FrameSinkStats
+{
+	uint64_t published;
+	uint64_t droppedPacing;
+	uint64_t droppedNoReaders;
+	uint64_t errors;
+};
+
+
+// Secondary consumer of the rendered frames. Sinks are handed the render ring slot the frame was rendered into, after
+// the block queue block has been released, so nothing is rendered twice and each sink makes at most one copy of it.
+// Submit is only called from the serving thread. Open and Close are called from Init and Deinit, and when a
+// reconfiguration is applied, which happens on the serving thread between frames, or on the DebugRequest thread while
+// the stream is stopped. They never run alongside Submit. The stats can be read from any thread.
+class FrameSink
+{
+public:
+	virtual ~FrameSink() {}
+
+	virtual const char* GetName() const = 0;
+	virtual bool Open(const CameraRig& rig, uint32_t bpp, int32_t streamFormat) = 0;
+	virtual void Close() = 0;
+
+	// Limits the sink to maxRate frames per second, or the camera rate if zero.
+	void SetPacing(double maxRate, EFrameSinkDropPolicy dropPolicy);
+
+	// Publishes the frame unless the pacing or drop policy rejects it. The metadata is the per-frame path batch of the block queue.
+	void Submit(const uint8_t* pFrame, uint32_t frameSize, uint64_t frameTicks, vr::PathWrite_t* pMetadata, uint32_t metadataCount);
+
+	FrameSinkStats GetStats() const;
+	double GetMaxRate() const { return m_maxRate; }
+	EFrameSinkDropPolicy GetDropPolicy() const { return m_dropPolicy; }
+
+protected:
+	virtual bool HasReaders() = 0;
+	virtual bool Publish(const uint8_t* pFrame, uint32_t frameSize, vr::PathWrite_t* pMetadata, uint32_t metadataCount) = 0;
+
+	double m_maxRate = 0.0;
+	EFrameSinkDropPolicy m_dropPolicy = FrameSinkDrop_WithoutReaders;
+	int64_t m_minIntervalTicks = 0;
+	int64_t m_nextFrameTicks = 0;
+
+	std::atomic<uint64_t> m_published = 0;
+	std::atomic<uint64_t> m_droppedPacing = 0;
+	std::atomic<uint64_t> m_droppedNoReaders = 0;
+	std::atomic<uint64_t> m_errors = 0;
+};
+
+
+// Publishes frames to an IVRIOBuffer path, with the same format and per-frame paths as the block queue.
+class IOBufferFrameSink : public FrameSink
+{
+public:
+	IOBufferFrameSink(const char* path);
+	~IOBufferFrameSink();
+
+	virtual const char* GetName() const override { return m_path.c_str(); }
+	virtual bool Open(const CameraRig& rig, uint32_t bpp, int32_t streamFormat) override;
+	virtual void Close() override;
+
+protected:
+	virtual bool HasReaders() override;
+	virtual bool Publish(const uint8_t* pFrame, uint32_t frameSize, vr::PathWrite_t* pMetadata, uint32_t metadataCount) override;
+
+	std::string m_path;
+	vr::IOBufferHandle_t m_buffer = vr::k_ulInvalidIOBufferHandle;
+	uint32_t m_elementSize = 0;
+};
+
+
+// Hands each rendered frame to every registered sink.
+class FrameFanout
+{
+public:
+	void AddSink(std::unique_ptr<FrameSink> sink);
+	bool HasSinks() const { return !m_sinks.empty(); }
+
+	// Reopens all sinks for the current frame size. Called again after the rig is resized.
+	void Open(const CameraRig& rig, uint32_t bpp, int32_t streamFormat);
+	void Close();
+
+	void Submit(const uint8_t* pFrame, uint32_t frameSize, uint64_t frameTicks, vr::PathWrite_t* pMetadata, uint32_t metadataCount);
+
+	std::string GetStatsJson() const;
+
+protected:
+	std::vector<std::unique_ptr<FrameSink>> m_sinks;
+};
@@ -0,0 +1,143 @@
+#include "pch.h"
+#include "frame_source.h"
+#include "head_motion.h"
+
+
+// Blue channel value per camera, to tell the views apart.
+static const uint8_t g_cameraTint[MAX_RIG_CAMERAS] = { 127, 0, 255, 64 };
+
+void GradientFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	const uint32_t regionWidth = m_rig.frameWidth;
+	const uint32_t regionHeight = m_rig.frameHeight;
+
+	// Draw image to framebuffer, walking the texture in memory order and switching camera at region edges.
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		uint32_t regionRow = y / regionHeight;
+		uint32_t localY = y - regionRow * regionHeight;
+		uint8_t green = (uint8_t)(((localY * 256) / regionHeight) % 256);
+		bool bRowLine = localY % 64 == (regionHeight / 2) % 64;
+
+		uint8_t* pRow = pBuffer + (size_t)y * m_textureWidth * 4;
+
+		for (uint32_t column = 0; column < m_rig.layoutColumns; column++)
+		{
+			uint32_t camera = regionRow * m_rig.layoutColumns + column;
+			uint8_t* pPixel = pRow + (size_t)column * regionWidth * 4;
+
+			// Empty grid cell
+			if (camera >= m_rig.numCameras)
+			{
+				memset(pPixel, 0, (size_t)regionWidth * 4);
+				continue;
+			}
+
+			for (uint32_t localX = 0; localX < regionWidth; localX++, pPixel += 4)
+			{
+				// Draw grid lines
+				if (bRowLine || localX % 64 == (regionWidth / 2) % 64)
+				{
+					pPixel[0] = 160;
+					pPixel[1] = 160;
+					pPixel[2] = 160;
+					pPixel[3] = 255;
+				}
+				else
+				{
+					pPixel[0] = ((localX * 256) / regionWidth) % 256;
+					pPixel[1] = green;
+					pPixel[2] = g_cameraTint[camera];
+					pPixel[3] = 255;
+				}
+			}
+		}
+	}
+}
+
+void SolidFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	uint32_t numPixels = m_textureWidth * (endRow - firstRow);
+	uint32_t* pPixels = (uint32_t*)pBuffer + (size_t)firstRow * m_textureWidth;
+
+	for (uint32_t i = 0; i < numPixels; i++)
+	{
+		pPixels[i] = 0xFF808080;
+	}
+}
+
+void WorldFrameSource::SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel)
+{
+	FrameSource::SetFrameLayout(rig, bytesPerPixel);
+
+	for (uint32_t camera = 0; camera < rig.numCameras; camera++)
+	{
+		m_columnAngles[camera].resize(rig.frameWidth);
+		m_rowAngles[camera].resize(rig.frameHeight);
+
+		// Pixels right of the center look towards negative yaw, pixels below it towards negative pitch.
+		for (uint32_t x = 0; x < rig.frameWidth; x++)
+		{
+			m_columnAngles[camera][x] = -atanf((x + 0.5f - rig.centerX[camera]) / rig.focalX[camera]);
+		}
+		for (uint32_t y = 0; y < rig.frameHeight; y++)
+		{
+			m_rowAngles[camera][y] = -atanf((y + 0.5f - rig.centerY[camera]) / rig.focalY[camera]);
+		}
+
+		const vr::HmdMatrix34_t& transform = rig.cameraToHead[camera];
+		m_cameraYaw[camera] = atan2f(transform.m[0][2], transform.m[0][0]);
+	}
+}
+
+// Checker cell size in radians (10 degrees), with a red marker column every 90 degrees of yaw.
+#define WORLD_CELL_ANGLE 0.17453293f
+#define WORLD_CELLS_PER_MARKER 9
+
+void WorldFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	const uint32_t regionWidth = m_rig.frameWidth;
+	const uint32_t regionHeight = m_rig.frameHeight;
+
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		uint32_t regionRow = y / regionHeight;
+		uint32_t localY = y - regionRow * regionHeight;
+
+		// The rows of all cameras in the same layout row are exposed at the same time.
+		HeadPoseSample pose = g_headMotion.Sample(info.GetRowExposureTicks(localY, regionHeight));
+
+		uint32_t* pRow = (uint32_t*)pBuffer + (size_t)y * m_textureWidth;
+
+		for (uint32_t column = 0; column < m_rig.layoutColumns; column++)
+		{
+			uint32_t camera = regionRow * m_rig.layoutColumns + column;
+			uint32_t* pPixel = pRow + (size_t)column * regionWidth;
+
+			if (camera >= m_rig.numCameras)
+			{
+				memset(pPixel, 0, (size_t)regionWidth * 4);
+				continue;
+			}
+
+			// Small angle approximation for the pitch, the checkerboard does not need to be geometrically exact.
+			int32_t pitchCell = (int32_t)floorf((m_rowAngles[camera][localY] + (float)pose.pitch) / WORLD_CELL_ANGLE);
+			float yawOffset = m_cameraYaw[camera] + (float)pose.yaw;
+			const float* pColumnAngles = m_columnAngles[camera].data();
+
+			for (uint32_t localX = 0; localX < regionWidth; localX++)
+			{
+				int32_t yawCell = (int32_t)floorf((pColumnAngles[localX] + yawOffset) / WORLD_CELL_ANGLE);
+
+				uint32_t value = ((yawCell + pitchCell) & 1) ? 0xFFC0C0C0 : 0xFF404040;
+
+				// Red marker columns to make the yaw direction unambiguous
+				if (yawCell % WORLD_CELLS_PER_MARKER == 0)
+				{
+					value = 0xFF2020E0;
+				}
+				pPixel[localX] = value;
+			}
+		}
+	}
+}
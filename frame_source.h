@@ -0,0 +1,109 @@
+#pragma once
+
+#include "camera_rig.h"
+
+
+// Height of the row bands the frame is split into for parallel rendering.
+#define RENDER_BAND_ROWS 32
+
+// Per-frame timing passed to the frame sources.
+struct FrameRenderInfo
+{
+	uint64_t frameCount;
+
+	// Exposure time of the first row of each camera.
+	int64_t exposureStartTicks;
+
+	// Time between the exposure of the first and last row of each camera. Zero for a global shutter.
+	int64_t readoutTicks;
+
+	// Exposure time of a row relative to the top of its camera region.
+	inline int64_t GetRowExposureTicks(uint32_t regionRow, uint32_t regionHeight) const
+	{
+		return exposureStartTicks + (regionHeight > 1 ? readoutTicks * regionRow / (regionHeight - 1) : 0);
+	}
+};
+
+
+// Generates the image content of the served frames.
+class FrameSource
+{
+public:
+	virtual ~FrameSource() {}
+
+	virtual const char* GetName() const = 0;
+
+	// Called before the first frame and whenever the camera count or frame dimensions change.
+	virtual void SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel)
+	{
+		m_rig = rig;
+		m_textureWidth = rig.textureWidth;
+		m_textureHeight = rig.textureHeight;
+		m_textureBPP = bytesPerPixel;
+	}
+
+	// Called once per frame on the render thread, before the rows are rendered.
+	// Sources with their own capture times may replace the exposure time of the frame.
+	virtual void BeginFrame(FrameRenderInfo& info) {}
+
+	// Renders the texture rows [firstRow, endRow) covering all cameras. Called concurrently for disjoint row ranges.
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) = 0;
+
+	// Renders the regions of all cameras into the frame texture.
+	void RenderFrame(uint8_t* pBuffer, const FrameRenderInfo& info)
+	{
+		RenderRows(pBuffer, info, 0, m_textureHeight);
+	}
+
+	// Source specific state for the "get source" debug request, as a JSON object.
+	virtual std::string GetStatusJson() { return "{}"; }
+
+protected:
+	CameraRig m_rig = {};
+	uint32_t m_textureWidth = 0;
+	uint32_t m_textureHeight = 0;
+	uint32_t m_textureBPP = 0;
+};
+
+
+// Gradient with grid lines, each camera view tinted a different shade of blue.
+class GradientFrameSource : public FrameSource
+{
+public:
+	virtual const char* GetName() const override { return "gradient"; }
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+};
+
+
+// Flat grey frame. Useful for measuring the serving overhead without any content cost.
+class SolidFrameSource : public FrameSource
+{
+public:
+	virtual const char* GetName() const override { return "solid"; }
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+};
+
+
+// World-fixed checkerboard seen through the cameras, following the simulated head motion.
+// Each row is rendered from the head pose at its own exposure time, producing rolling shutter skew with a nonzero readout time.
+// Uses an undistorted pinhole projection.
+class WorldFrameSource : public FrameSource
+{
+public:
+	virtual const char* GetName() const override { return "world"; }
+	virtual void SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel) override;
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+
+protected:
+	// View angle of each pixel column and row relative to the camera axis, per camera.
+	std::vector<float> m_columnAngles[MAX_RIG_CAMERAS];
+	std::vector<float> m_rowAngles[MAX_RIG_CAMERAS];
+	float m_cameraYaw[MAX_RIG_CAMERAS] = {};
+};
+
+
+// Returns nullptr for unknown names, or if the source can't use the argument.
+std::unique_ptr<FrameSource> CreateFrameSource(const std::string& name, const std::string& argument = "");
+
+// Comma separated list of the names accepted by CreateFrameSource.
+const char* GetFrameSourceNames();
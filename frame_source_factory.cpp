@@ -0,0 +1,114 @@
+#include "pch.h"
+#include "frame_source.h"
+#include "image_sequence_source.h"
+#include "inject_source.h"
+#include "capture_source.h"
+#include "pattern_source.h"
+
+
+#define PATTERN_CONFIG "openvr_camera_sim_camera"
+
+
+PatternSettings PatternSettings::Load()
+{
+	PatternSettings settings;
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	char name[64] = {};
+	vr::VRSettings()->GetString(PATTERN_CONFIG, "pattern", name, sizeof(name), &settingsError);
+	if (settingsError == vr::VRSettingsError_None && name[0] != 0 && !FindPattern(name, settings.pattern))
+	{
+		VR_DRIVER_LOG_FORMAT("PatternFrameSource: Unknown pattern \"{}\"", name);
+	}
+
+	name[0] = 0;
+	vr::VRSettings()->GetString(PATTERN_CONFIG, "pattern_motion", name, sizeof(name), &settingsError);
+	if (settingsError == vr::VRSettingsError_None && name[0] != 0 && !FindMotion(name, settings.motion))
+	{
+		VR_DRIVER_LOG_FORMAT("PatternFrameSource: Unknown pattern motion \"{}\"", name);
+	}
+
+	int32_t speed = vr::VRSettings()->GetInt32(PATTERN_CONFIG, "pattern_speed", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && speed >= 0) { settings.speed = (std::min)((uint32_t)speed, (uint32_t)PATTERN_MAX_SPEED); }
+
+	int32_t counterRows = vr::VRSettings()->GetInt32(PATTERN_CONFIG, "pattern_counter_rows", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && counterRows >= 0) { settings.counterRows = (uint32_t)counterRows; }
+
+	return settings;
+}
+
+
+// Kept apart from the pattern sources, which don't depend on the file and shared memory sources.
+std::unique_ptr<FrameSource> CreateFrameSource(const std::string& name, const std::string& argument)
+{
+	if (name == "gradient")
+	{
+		return std::make_unique<GradientFrameSource>();
+	}
+	else if (name == "solid")
+	{
+		return std::make_unique<SolidFrameSource>();
+	}
+	else if (name == "world")
+	{
+		return std::make_unique<WorldFrameSource>();
+	}
+	else if (name == "pattern")
+	{
+		// The argument overrides the pattern settings, as "<pattern> [motion] [speed]".
+		PatternSettings settings = PatternSettings::Load();
+		if (!argument.empty() && !settings.Parse(argument))
+		{
+			return nullptr;
+		}
+		return std::make_unique<PatternFrameSource>(settings);
+	}
+	else if (name == "sequence")
+	{
+		// The directory defaults to the sequence_path setting.
+		ImageSequenceSettings settings = ImageSequenceSettings::Load();
+		if (!argument.empty())
+		{
+			settings.path = argument;
+		}
+
+		std::unique_ptr<ImageSequenceFrameSource> source = std::make_unique<ImageSequenceFrameSource>(settings);
+		if (source->GetNumFrames() == 0)
+		{
+			return nullptr;
+		}
+		return source;
+	}
+	else if (name == "capture")
+	{
+		// The file defaults to the capture_path setting.
+		CaptureSourceSettings settings = CaptureSourceSettings::Load();
+		if (!argument.empty())
+		{
+			settings.path = argument;
+		}
+
+		std::unique_ptr<CaptureFrameSource> source = std::make_unique<CaptureFrameSource>(settings);
+		if (!source->IsOpen())
+		{
+			return nullptr;
+		}
+		return source;
+	}
+	else if (name == "inject")
+	{
+		std::unique_ptr<InjectFrameSource> source = std::make_unique<InjectFrameSource>(InjectFrameSource::LoadMaxFrameMB());
+		if (!source->IsOpen())
+		{
+			return nullptr;
+		}
+		return source;
+	}
+
+	return nullptr;
+}
+
+const char* GetFrameSourceNames()
+{
+	return "gradient,solid,world,pattern,sequence,capture,inject";
+}
@@ -9,24 +9,37 @@ using Microsoft::WRL::ComPtr;
 #include <unknwn.h>
 #include <fileapi.h>
 #include <profileapi.h>
+#include <intrin.h>
 
 #include <d3d11_4.h>
 #include <dxgi1_6.h>
 #include <d3dcompiler.h>
+#include <wincodec.h>
 
 #include <vector>
+#include <algorithm>
 #include <format>
 #include <memory>
 #include <array>
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <shared_mutex>
+#include <bit>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <chrono>
+#include <cfloat>
+#include <filesystem>
+#include <deque>
+#include <fstream>
 
 #include "openvr_driver.h"
 #include "vr_blockqueue.h"
+#include "driver_log.h"
 
-#define VR_DRIVER_LOG_FORMAT(...) {\
-std::string _message = std::format(__VA_ARGS__); \
-vr::VRDriverLog()->Log(_message.c_str()); \
-}
\ No newline at end of file
+// Formatted logging through the asynchronous, rate limited driver log.
+#define VR_DRIVER_LOG_FORMAT(...) DRIVER_LOG(__VA_ARGS__)
\ No newline at end of file
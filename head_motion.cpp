@@ -0,0 +1,99 @@
+#include "pch.h"
+#include "head_motion.h"
+
+
+#define HEAD_MOTION_PI 3.14159265358979323846
+
+HeadMotion g_headMotion;
+
+
+HeadMotion::HeadMotion()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksToSeconds = 1.0 / (double)frequency.QuadPart;
+
+	LARGE_INTEGER startTime;
+	QueryPerformanceCounter(&startTime);
+	m_startTicks = startTime.QuadPart;
+}
+
+void HeadMotion::SetMotion(double yawAmplitudeDegrees, double frequency)
+{
+	m_frequency.store(frequency, std::memory_order_relaxed);
+	m_yawAmplitude.store(yawAmplitudeDegrees * HEAD_MOTION_PI / 180.0, std::memory_order_relaxed);
+}
+
+double HeadMotion::GetYawAmplitudeDegrees() const
+{
+	return m_yawAmplitude.load(std::memory_order_relaxed) * 180.0 / HEAD_MOTION_PI;
+}
+
+HeadPoseSample HeadMotion::Sample(int64_t ticks) const
+{
+	HeadPoseSample sample = {};
+
+	double yawAmplitude = m_yawAmplitude.load(std::memory_order_relaxed);
+	if (yawAmplitude <= 0.0)
+	{
+		return sample;
+	}
+
+	double pitchAmplitude = yawAmplitude * 0.25;
+	double yawRate = 2.0 * HEAD_MOTION_PI * m_frequency.load(std::memory_order_relaxed);
+	double pitchRate = yawRate * 1.5;
+	double time = (ticks - m_startTicks) * m_ticksToSeconds;
+
+	sample.yaw = yawAmplitude * sin(yawRate * time);
+	sample.yawVelocity = yawAmplitude * yawRate * cos(yawRate * time);
+	sample.pitch = pitchAmplitude * sin(pitchRate * time);
+	sample.pitchVelocity = pitchAmplitude * pitchRate * cos(pitchRate * time);
+
+	return sample;
+}
+
+vr::DriverPose_t HeadMotion::GetDriverPose(int64_t ticks, uint64_t frameCount) const
+{
+	vr::DriverPose_t pose = { 0 };
+
+	pose.poseIsValid = true;
+	pose.result = vr::TrackingResult_Running_OK;
+	pose.deviceIsConnected = true;
+	pose.shouldApplyHeadModel = true;
+
+	pose.qWorldFromDriverRotation.w = 1.f;
+	pose.qDriverFromHeadRotation.w = 1.f;
+
+	pose.vecPosition[1] = 1.5;
+
+	// Report the same motion the camera frames are rendered with.
+	if (IsEnabled())
+	{
+		HeadPoseSample sample = Sample(ticks);
+
+		// Yaw around Y followed by pitch around X.
+		double cy = cos(sample.yaw * 0.5), sy = sin(sample.yaw * 0.5);
+		double cp = cos(sample.pitch * 0.5), sp = sin(sample.pitch * 0.5);
+
+		pose.qRotation.w = cy * cp;
+		pose.qRotation.x = cy * sp;
+		pose.qRotation.y = sy * cp;
+		pose.qRotation.z = -sy * sp;
+
+		pose.vecAngularVelocity[0] = sample.pitchVelocity;
+		pose.vecAngularVelocity[1] = sample.yawVelocity;
+
+		return pose;
+	}
+
+	//pose.qRotation.w = fmod(frameCount * 0.0001, 2.0) - 1.0;
+	//pose.qRotation.y = sqrt(1.0 - pose.qRotation.w * pose.qRotation.w);
+	pose.qRotation.w = sin(frameCount * 0.0001);
+	pose.qRotation.y = cos(frameCount * 0.0001);
+	//pose.qRotation.w = 1.0;
+	//pose.qRotation.y = 0.0;
+	
+	pose.vecAngularVelocity[1] = -0.001;
+
+	return pose;
+}
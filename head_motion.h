@@ -0,0 +1,62 @@
+#pragma once
+
+
+struct HeadPoseSample
+{
+	// Radians, positive yaw turns left and positive pitch looks up.
+	double yaw;
+	double pitch;
+
+	// Radians per second.
+	double yawVelocity;
+	double pitchVelocity;
+};
+
+
+// Deterministic head rotation as a function of time, shared by the HMD pose and the camera frames
+// so that consumers have exact ground truth for every exposure.
+class HeadMotion
+{
+public:
+	HeadMotion();
+
+	// Sinusoidal yaw sweep with a smaller pitch nod at 1.5x the frequency. Zero amplitude disables the motion.
+	void SetMotion(double yawAmplitudeDegrees, double frequency);
+
+	bool IsEnabled() const { return m_yawAmplitude.load(std::memory_order_relaxed) > 0.0; }
+	double GetYawAmplitudeDegrees() const;
+	double GetFrequency() const { return m_frequency.load(std::memory_order_relaxed); }
+
+	// Pose at the given performance counter time.
+	HeadPoseSample Sample(int64_t ticks) const;
+
+	// HMD pose reported to the runtime. Without motion, the HMD slowly spins with the presented frame count instead.
+	vr::DriverPose_t GetDriverPose(int64_t ticks, uint64_t frameCount) const;
+
+protected:
+	std::atomic<double> m_yawAmplitude = 0.0;
+	std::atomic<double> m_frequency = 0.0;
+	double m_ticksToSeconds = 0.0;
+	int64_t m_startTicks = 0;
+};
+
+extern HeadMotion g_headMotion;
+
+
+// 3x3 or 3x4 matrix
+template < class T >
+vr::HmdQuaternion_t HmdQuaternion_FromMatrix(const T& matrix)
+{
+	vr::HmdQuaternion_t q{};
+
+	q.w = sqrt(fmax(0, 1 + matrix.m[0][0] + matrix.m[1][1] + matrix.m[2][2])) / 2;
+	q.x = sqrt(fmax(0, 1 + matrix.m[0][0] - matrix.m[1][1] - matrix.m[2][2])) / 2;
+	q.y = sqrt(fmax(0, 1 - matrix.m[0][0] + matrix.m[1][1] - matrix.m[2][2])) / 2;
+	q.z = sqrt(fmax(0, 1 - matrix.m[0][0] - matrix.m[1][1] + matrix.m[2][2])) / 2;
+
+	q.x = copysign(q.x, matrix.m[2][1] - matrix.m[1][2]);
+	q.y = copysign(q.y, matrix.m[0][2] - matrix.m[2][0]);
+	q.z = copysign(q.z, matrix.m[1][0] - matrix.m[0][1]);
+
+	return q;
+}
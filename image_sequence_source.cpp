@@ -0,0 +1,617 @@
+#include "pch.h"
+#include "image_sequence_source.h"
+#include "driver_threads.h"
+
+
+// Same settings section as the rest of the camera configuration.
+#define SEQUENCE_CONFIG "openvr_camera_sim_camera"
+
+ImageSequenceSettings ImageSequenceSettings::Load()
+{
+	ImageSequenceSettings settings;
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	char path[MAX_PATH] = {};
+	vr::VRSettings()->GetString(SEQUENCE_CONFIG, "sequence_path", path, sizeof(path), &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { settings.path = path; }
+
+	float frameRate = vr::VRSettings()->GetFloat(SEQUENCE_CONFIG, "sequence_fps", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && frameRate > 0.0f) { settings.frameRate = frameRate; }
+
+	int32_t cacheMB = vr::VRSettings()->GetInt32(SEQUENCE_CONFIG, "sequence_cache_mb", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && cacheMB > 0) { settings.cacheMB = cacheMB; }
+
+	int32_t prefetchFrames = vr::VRSettings()->GetInt32(SEQUENCE_CONFIG, "sequence_prefetch", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && prefetchFrames >= 0) { settings.prefetchFrames = prefetchFrames; }
+
+	int32_t decodeThreads = vr::VRSettings()->GetInt32(SEQUENCE_CONFIG, "sequence_decode_threads", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && decodeThreads > 0) { settings.decodeThreads = (std::min)(decodeThreads, 16); }
+
+	return settings;
+}
+
+
+static std::string GetLowerExtension(const std::filesystem::path& path)
+{
+	std::string extension = path.extension().string();
+	for (char& c : extension)
+	{
+		c = (char)tolower((unsigned char)c);
+	}
+	return extension;
+}
+
+static bool IsImageFile(const std::filesystem::path& path)
+{
+	std::string extension = GetLowerExtension(path);
+	return extension == ".png" || extension == ".bmp" || extension == ".tga";
+}
+
+// Windows paths need their backslashes escaped in the JSON responses.
+static std::string EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '\\' || c == '"')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+static std::vector<std::filesystem::path> ListImages(const std::filesystem::path& directory)
+{
+	std::vector<std::filesystem::path> files;
+	std::error_code error;
+
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (entry.is_regular_file() && IsImageFile(entry.path()))
+		{
+			files.push_back(entry.path());
+		}
+	}
+
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+
+// Minimal TGA reader, since WIC has no TGA codec. Handles uncompressed and RLE true color and grayscale images.
+static bool DecodeTGA(const std::filesystem::path& path, std::vector<uint8_t>& outPixels, uint32_t& outWidth, uint32_t& outHeight)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (data.size() < 18)
+	{
+		return false;
+	}
+
+	uint8_t idLength = data[0];
+	uint8_t colorMapType = data[1];
+	uint8_t imageType = data[2];
+	uint32_t width = data[12] | (data[13] << 8);
+	uint32_t height = data[14] | (data[15] << 8);
+	uint32_t bytesPerPixel = data[16] / 8;
+	bool bTopOrigin = (data[17] & 0x20) != 0;
+
+	bool bRLE = imageType == 10 || imageType == 11;
+	bool bGray = imageType == 3 || imageType == 11;
+
+	if (colorMapType != 0 || (imageType != 2 && imageType != 3 && !bRLE) || width == 0 || height == 0 ||
+		(bGray ? bytesPerPixel != 1 : (bytesPerPixel != 3 && bytesPerPixel != 4)))
+	{
+		return false;
+	}
+
+	size_t offset = 18 + idLength;
+	size_t numPixels = (size_t)width * height;
+	outPixels.resize(numPixels * 4);
+
+	auto readPixel = [&](size_t pixel) -> bool
+	{
+		if (offset + bytesPerPixel > data.size())
+		{
+			return false;
+		}
+
+		// Stored bottom up unless flagged otherwise, in BGR(A) order.
+		size_t x = pixel % width;
+		size_t y = pixel / width;
+		uint8_t* pOut = &outPixels[((bTopOrigin ? y : height - 1 - y) * width + x) * 4];
+		const uint8_t* pIn = &data[offset];
+
+		pOut[0] = bGray ? pIn[0] : pIn[2];
+		pOut[1] = bGray ? pIn[0] : pIn[1];
+		pOut[2] = pIn[0];
+		pOut[3] = 255;
+		return true;
+	};
+
+	size_t pixel = 0;
+	while (pixel < numPixels)
+	{
+		uint32_t count = 1;
+		bool bRepeat = false;
+
+		if (bRLE)
+		{
+			if (offset >= data.size())
+			{
+				return false;
+			}
+			uint8_t packet = data[offset++];
+			count = (packet & 0x7F) + 1;
+			bRepeat = (packet & 0x80) != 0;
+		}
+
+		for (uint32_t i = 0; i < count && pixel < numPixels; i++, pixel++)
+		{
+			if (!readPixel(pixel))
+			{
+				return false;
+			}
+			if (!bRepeat)
+			{
+				offset += bytesPerPixel;
+			}
+		}
+
+		if (bRepeat)
+		{
+			offset += bytesPerPixel;
+		}
+	}
+
+	outWidth = width;
+	outHeight = height;
+	return true;
+}
+
+static bool DecodeImage(IWICImagingFactory* pFactory, const std::filesystem::path& path, std::vector<uint8_t>& outPixels, uint32_t& outWidth, uint32_t& outHeight)
+{
+	if (GetLowerExtension(path) == ".tga")
+	{
+		return DecodeTGA(path, outPixels, outWidth, outHeight);
+	}
+
+	if (pFactory == nullptr)
+	{
+		return false;
+	}
+
+	ComPtr<IWICBitmapDecoder> decoder;
+	ComPtr<IWICBitmapFrameDecode> frame;
+	ComPtr<IWICFormatConverter> converter;
+
+	if (FAILED(pFactory->CreateDecoderFromFilename(path.wstring().c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder)) ||
+		FAILED(decoder->GetFrame(0, &frame)) ||
+		FAILED(pFactory->CreateFormatConverter(&converter)) ||
+		FAILED(converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom)))
+	{
+		return false;
+	}
+
+	UINT width, height;
+	if (FAILED(converter->GetSize(&width, &height)) || width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	outPixels.resize((size_t)width * height * 4);
+	if (FAILED(converter->CopyPixels(nullptr, width * 4, (UINT)outPixels.size(), outPixels.data())))
+	{
+		return false;
+	}
+
+	outWidth = width;
+	outHeight = height;
+	return true;
+}
+
+// Nearest neighbor scales an RGBA image into a region of the frame texture.
+static void BlitImage(const uint8_t* pImage, uint32_t imageWidth, uint32_t imageHeight, uint8_t* pDest, uint32_t destStride, uint32_t destWidth, uint32_t destHeight)
+{
+	if (imageWidth == destWidth && imageHeight == destHeight)
+	{
+		for (uint32_t y = 0; y < destHeight; y++)
+		{
+			memcpy(pDest + (size_t)y * destStride, pImage + (size_t)y * imageWidth * 4, (size_t)destWidth * 4);
+		}
+		return;
+	}
+
+	std::vector<uint32_t> sourceColumns(destWidth);
+	for (uint32_t x = 0; x < destWidth; x++)
+	{
+		sourceColumns[x] = (uint32_t)((uint64_t)x * imageWidth / destWidth);
+	}
+
+	for (uint32_t y = 0; y < destHeight; y++)
+	{
+		const uint32_t* pSourceRow = (const uint32_t*)pImage + (size_t)((uint64_t)y * imageHeight / destHeight) * imageWidth;
+		uint32_t* pDestRow = (uint32_t*)(pDest + (size_t)y * destStride);
+
+		for (uint32_t x = 0; x < destWidth; x++)
+		{
+			pDestRow[x] = pSourceRow[sourceColumns[x]];
+		}
+	}
+}
+
+
+ImageSequenceFrameSource::ImageSequenceFrameSource(const ImageSequenceSettings& settings)
+	: m_settings(settings)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksPerSecond = (double)frequency.QuadPart;
+
+	if (ScanDirectory())
+	{
+		VR_DRIVER_LOG_FORMAT("ImageSequenceFrameSource: {} {} frames in {}", m_numFrames, m_bPerCamera ? "per-camera" : "whole", m_settings.path);
+	}
+}
+
+ImageSequenceFrameSource::~ImageSequenceFrameSource()
+{
+	StopDecoders();
+}
+
+bool ImageSequenceFrameSource::ScanDirectory()
+{
+	std::filesystem::path directory = std::filesystem::u8path(m_settings.path);
+	std::error_code error;
+
+	if (m_settings.path.empty() || !std::filesystem::is_directory(directory, error))
+	{
+		VR_DRIVER_LOG_FORMAT("ImageSequenceFrameSource: \"{}\" is not a directory", m_settings.path);
+		return false;
+	}
+
+	if (std::filesystem::is_directory(directory / "left", error) && std::filesystem::is_directory(directory / "right", error))
+	{
+		m_bPerCamera = true;
+		m_framePaths[0] = ListImages(directory / "left");
+		m_framePaths[1] = ListImages(directory / "right");
+		m_numFrames = (uint32_t)(std::min)(m_framePaths[0].size(), m_framePaths[1].size());
+	}
+	else
+	{
+		m_framePaths[0] = ListImages(directory);
+		m_numFrames = (uint32_t)m_framePaths[0].size();
+	}
+
+	if (m_numFrames == 0)
+	{
+		VR_DRIVER_LOG_FORMAT("ImageSequenceFrameSource: No PNG, BMP or TGA images found in {}", m_settings.path);
+		return false;
+	}
+
+	return true;
+}
+
+void ImageSequenceFrameSource::SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel)
+{
+	// The cached frames are in the texture layout, so everything is decoded again.
+	StopDecoders();
+
+	FrameSource::SetFrameLayout(rig, bytesPerPixel);
+
+	m_frames.assign(m_numFrames, DecodedFrame());
+	m_requests.clear();
+	m_pCurrentData = nullptr;
+	m_bHasStartTime = false;
+
+	if (m_numFrames == 0)
+	{
+		return;
+	}
+
+	size_t frameSize = (size_t)m_textureWidth * m_textureHeight * m_textureBPP;
+	size_t budgetFrames = (size_t)m_settings.cacheMB * 1024 * 1024 / frameSize;
+
+	// Room for the current frame and the prefetch window at least, and no more than the whole sequence.
+	m_cacheCapacity = (uint32_t)(std::max)(budgetFrames, (size_t)m_settings.prefetchFrames + 2);
+	m_cacheCapacity = (std::min)(m_cacheCapacity, m_numFrames + 1);
+
+	if (!m_cache.Reserve(frameSize, m_cacheCapacity))
+	{
+		m_cacheCapacity = 0;
+		return;
+	}
+
+	StartDecoders();
+
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	for (uint32_t i = 0; i <= m_settings.prefetchFrames && i < m_numFrames; i++)
+	{
+		RequestDecode(i, false);
+	}
+	m_requestCondition.notify_all();
+}
+
+void ImageSequenceFrameSource::StartDecoders()
+{
+	m_bRunDecoders = true;
+	for (uint32_t i = 0; i < m_settings.decodeThreads; i++)
+	{
+		m_decodeThreads.emplace_back(&ImageSequenceFrameSource::DecodeLoop, this);
+	}
+}
+
+void ImageSequenceFrameSource::StopDecoders()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		m_bRunDecoders = false;
+	}
+	m_requestCondition.notify_all();
+
+	for (std::thread& thread : m_decodeThreads)
+	{
+		thread.join();
+	}
+	m_decodeThreads.clear();
+
+	for (DecodedFrame& frame : m_frames)
+	{
+		m_cache.ReleaseSlot(frame.pData);
+		frame = DecodedFrame();
+	}
+}
+
+void ImageSequenceFrameSource::RequestDecode(uint32_t index, bool bUrgent)
+{
+	DecodedFrame& frame = m_frames[index];
+	frame.lastUsed = m_useCounter;
+
+	if (frame.state != DecodedFrame_Empty)
+	{
+		return;
+	}
+
+	frame.state = DecodedFrame_Queued;
+	if (bUrgent)
+	{
+		m_requests.push_front(index);
+	}
+	else
+	{
+		m_requests.push_back(index);
+	}
+}
+
+uint8_t* ImageSequenceFrameSource::AcquireCacheSlot()
+{
+	uint8_t* pSlot = m_cache.AcquireSlot();
+	if (pSlot != nullptr)
+	{
+		return pSlot;
+	}
+
+	// Evict the least recently used decoded frame, other than the one being shown.
+	DecodedFrame* pOldest = nullptr;
+	for (uint32_t i = 0; i < m_numFrames; i++)
+	{
+		DecodedFrame& frame = m_frames[i];
+		if (frame.state == DecodedFrame_Ready && frame.pData != m_pCurrentData && (pOldest == nullptr || frame.lastUsed < pOldest->lastUsed))
+		{
+			pOldest = &frame;
+		}
+	}
+
+	if (pOldest == nullptr)
+	{
+		return nullptr;
+	}
+
+	m_cache.ReleaseSlot(pOldest->pData);
+	pOldest->pData = nullptr;
+	pOldest->state = DecodedFrame_Empty;
+
+	return m_cache.AcquireSlot();
+}
+
+void ImageSequenceFrameSource::DecodeLoop()
+{
+	g_driverThreads.Register(DriverThread_SequenceDecode);
+
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	bool bComInitialized = SUCCEEDED(hr);
+
+	ComPtr<IWICImagingFactory> factory;
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+	{
+		VR_DRIVER_LOG_FORMAT("ImageSequenceFrameSource: Failed to create WIC factory, only TGA images can be decoded");
+	}
+
+	while (true)
+	{
+		uint32_t index;
+		uint8_t* pSlot;
+		{
+			std::unique_lock<std::mutex> lock(m_cacheMutex);
+			m_requestCondition.wait(lock, [&]() { return !m_bRunDecoders || !m_requests.empty(); });
+
+			if (!m_bRunDecoders)
+			{
+				break;
+			}
+
+			index = m_requests.front();
+			m_requests.pop_front();
+
+			if (m_frames[index].state != DecodedFrame_Queued)
+			{
+				continue;
+			}
+
+			pSlot = AcquireCacheSlot();
+			if (pSlot == nullptr)
+			{
+				// Cache full of frames that are still needed. Requested again when the playback gets closer.
+				m_frames[index].state = DecodedFrame_Empty;
+				continue;
+			}
+			m_frames[index].state = DecodedFrame_Decoding;
+		}
+
+		bool bSuccess = DecodeFrame(factory.Get(), index, pSlot);
+
+		{
+			std::lock_guard<std::mutex> lock(m_cacheMutex);
+			DecodedFrame& frame = m_frames[index];
+
+			if (bSuccess)
+			{
+				frame.pData = pSlot;
+				frame.state = DecodedFrame_Ready;
+				m_framesDecoded++;
+			}
+			else
+			{
+				m_cache.ReleaseSlot(pSlot);
+				frame.state = DecodedFrame_Failed;
+				m_decodeErrors++;
+			}
+		}
+		m_decodedCondition.notify_all();
+	}
+
+	factory.Reset();
+	if (bComInitialized)
+	{
+		CoUninitialize();
+	}
+}
+
+bool ImageSequenceFrameSource::DecodeFrame(IWICImagingFactory* pFactory, uint32_t index, uint8_t* pDest)
+{
+	const uint32_t stride = m_textureWidth * m_textureBPP;
+	std::vector<uint8_t> pixels;
+	uint32_t width = 0, height = 0;
+
+	if (!m_bPerCamera)
+	{
+		const std::filesystem::path& path = m_framePaths[0][index];
+		if (!DecodeImage(pFactory, path, pixels, width, height))
+		{
+			DRIVER_LOG_RATE_LIMITED(1, "ImageSequenceFrameSource: Failed to decode {}", path.string());
+			return false;
+		}
+
+		BlitImage(pixels.data(), width, height, pDest, stride, m_textureWidth, m_textureHeight);
+		return true;
+	}
+
+	// Per-camera images fill the first two camera regions. Any other cameras and empty grid cells are black.
+	memset(pDest, 0, (size_t)stride * m_textureHeight);
+
+	for (uint32_t camera = 0; camera < 2 && camera < m_rig.numCameras; camera++)
+	{
+		const std::filesystem::path& path = m_framePaths[camera][index];
+		if (!DecodeImage(pFactory, path, pixels, width, height))
+		{
+			DRIVER_LOG_RATE_LIMITED(1, "ImageSequenceFrameSource: Failed to decode {}", path.string());
+			return false;
+		}
+
+		const CameraRegion& region = m_rig.regions[camera];
+		uint8_t* pRegion = pDest + (size_t)region.y * stride + (size_t)region.x * m_textureBPP;
+		BlitImage(pixels.data(), width, height, pRegion, stride, region.width, region.height);
+	}
+
+	return true;
+}
+
+void ImageSequenceFrameSource::BeginFrame(FrameRenderInfo& info)
+{
+	if (m_numFrames == 0 || m_cacheCapacity == 0)
+	{
+		return;
+	}
+
+	if (!m_bHasStartTime)
+	{
+		m_startTicks = info.exposureStartTicks;
+		m_bHasStartTime = true;
+	}
+
+	// Exposures at matching rates land right on the frame boundaries, so a little slack keeps timer rounding from lagging a frame.
+	double playbackTime = (info.exposureStartTicks - m_startTicks) / m_ticksPerSecond;
+	uint32_t index = (uint32_t)((uint64_t)((std::max)(playbackTime, 0.0) * m_settings.frameRate + 0.01) % m_numFrames);
+
+	std::unique_lock<std::mutex> lock(m_cacheMutex);
+	m_useCounter++;
+
+	DecodedFrame& frame = m_frames[index];
+
+	if (frame.state != DecodedFrame_Ready && m_pCurrentData == nullptr)
+	{
+		// Nothing to repeat yet, give the decoders a moment for the first frame.
+		RequestDecode(index, true);
+		m_requestCondition.notify_one();
+		m_decodedCondition.wait_for(lock, std::chrono::milliseconds(SEQUENCE_FIRST_FRAME_TIMEOUT_MS), [&]()
+		{
+			return frame.state == DecodedFrame_Ready || frame.state == DecodedFrame_Failed;
+		});
+	}
+
+	if (frame.state == DecodedFrame_Ready)
+	{
+		m_cacheHits++;
+		frame.lastUsed = m_useCounter;
+		m_currentFrame = index;
+		m_pCurrentData = frame.pData;
+	}
+	else
+	{
+		// Keep showing the previous frame.
+		m_cacheMisses++;
+		RequestDecode(index, true);
+	}
+
+	for (uint32_t i = 1; i <= m_settings.prefetchFrames && i < m_numFrames; i++)
+	{
+		RequestDecode((index + i) % m_numFrames, false);
+	}
+
+	lock.unlock();
+	m_requestCondition.notify_all();
+}
+
+void ImageSequenceFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	size_t stride = (size_t)m_textureWidth * m_textureBPP;
+
+	if (m_pCurrentData == nullptr)
+	{
+		memset(pBuffer + firstRow * stride, 0, (endRow - firstRow) * stride);
+		return;
+	}
+
+	memcpy(pBuffer + firstRow * stride, m_pCurrentData + firstRow * stride, (endRow - firstRow) * stride);
+}
+
+std::string ImageSequenceFrameSource::GetStatusJson()
+{
+	uint32_t numCached = 0;
+	uint32_t currentFrame;
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		for (const DecodedFrame& frame : m_frames)
+		{
+			numCached += (frame.state == DecodedFrame_Ready) ? 1 : 0;
+		}
+		currentFrame = m_currentFrame;
+	}
+
+	return std::format("{{\"path\":\"{}\",\"frames\":{},\"per_camera\":{},\"frame\":{},\"fps\":{},\"cached\":{},\"cache_capacity\":{},\"large_pages\":{},\"hits\":{},\"misses\":{},\"decoded\":{},\"errors\":{}}}",
+		EscapeJson(m_settings.path), m_numFrames, m_bPerCamera, currentFrame, m_settings.frameRate, numCached, m_cacheCapacity, m_cache.IsUsingLargePages(),
+		m_cacheHits.load(), m_cacheMisses.load(), m_framesDecoded.load(), m_decodeErrors.load());
+}
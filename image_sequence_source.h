@@ -0,0 +1,110 @@
+#pragma once
+
+#include "frame_source.h"
+#include "frame_arena.h"
+
+
+#define SEQUENCE_DEFAULT_FRAME_RATE 30.0
+#define SEQUENCE_DEFAULT_CACHE_MB 512
+#define SEQUENCE_DEFAULT_PREFETCH 8
+#define SEQUENCE_DEFAULT_DECODE_THREADS 2
+
+// How long the first frame is waited for before rendering black.
+#define SEQUENCE_FIRST_FRAME_TIMEOUT_MS 500
+
+
+struct ImageSequenceSettings
+{
+	std::string path;
+	double frameRate = SEQUENCE_DEFAULT_FRAME_RATE;
+	uint32_t cacheMB = SEQUENCE_DEFAULT_CACHE_MB;
+	uint32_t prefetchFrames = SEQUENCE_DEFAULT_PREFETCH;
+	uint32_t decodeThreads = SEQUENCE_DEFAULT_DECODE_THREADS;
+
+	// Reads the sequence_* driver settings.
+	static ImageSequenceSettings Load();
+};
+
+
+enum EDecodedFrameState
+{
+	DecodedFrame_Empty = 0,
+	DecodedFrame_Queued,
+	DecodedFrame_Decoding,
+	DecodedFrame_Ready,
+	DecodedFrame_Failed,
+};
+
+struct DecodedFrame
+{
+	EDecodedFrameState state = DecodedFrame_Empty;
+	uint8_t* pData = nullptr;
+	uint64_t lastUsed = 0;
+};
+
+
+// Plays a directory of PNG, BMP or TGA images, looping.
+// Either each image is a whole frame, scaled to the frame texture, or the directory has left and right
+// subdirectories with per-camera images that are paired in file name order.
+//
+// Images are decoded and converted to the frame texture layout on worker threads, prefetching ahead of the playback position.
+// The converted frames are kept in an LRU cache in its own frame arena, so loops that fit in it play from memory.
+// If a frame isn't decoded in time the previous one is repeated.
+class ImageSequenceFrameSource : public FrameSource
+{
+public:
+	ImageSequenceFrameSource(const ImageSequenceSettings& settings);
+	~ImageSequenceFrameSource();
+
+	virtual const char* GetName() const override { return "sequence"; }
+	virtual void SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel) override;
+	virtual void BeginFrame(FrameRenderInfo& info) override;
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+	virtual std::string GetStatusJson() override;
+
+	uint32_t GetNumFrames() const { return m_numFrames; }
+
+protected:
+	bool ScanDirectory();
+	void StartDecoders();
+	void StopDecoders();
+	void DecodeLoop();
+	bool DecodeFrame(IWICImagingFactory* pFactory, uint32_t index, uint8_t* pDest);
+
+	// Called with the cache mutex held.
+	void RequestDecode(uint32_t index, bool bUrgent);
+	uint8_t* AcquireCacheSlot();
+
+	ImageSequenceSettings m_settings;
+
+	// Whole frame images in [0], or per-camera images for the left and right cameras.
+	std::vector<std::filesystem::path> m_framePaths[2];
+	bool m_bPerCamera = false;
+	uint32_t m_numFrames = 0;
+
+	FrameArena m_cache;
+	uint32_t m_cacheCapacity = 0;
+
+	std::mutex m_cacheMutex;
+	std::condition_variable m_requestCondition;
+	std::condition_variable m_decodedCondition;
+	std::vector<DecodedFrame> m_frames;
+	std::deque<uint32_t> m_requests;
+	uint64_t m_useCounter = 0;
+
+	// The frame being rendered is never evicted.
+	uint32_t m_currentFrame = 0;
+	uint8_t* m_pCurrentData = nullptr;
+
+	bool m_bHasStartTime = false;
+	int64_t m_startTicks = 0;
+	double m_ticksPerSecond = 0.0;
+
+	std::atomic<uint64_t> m_cacheHits = 0;
+	std::atomic<uint64_t> m_cacheMisses = 0;
+	std::atomic<uint64_t> m_framesDecoded = 0;
+	std::atomic<uint64_t> m_decodeErrors = 0;
+
+	std::vector<std::thread> m_decodeThreads;
+	std::atomic<bool> m_bRunDecoders = false;
+};
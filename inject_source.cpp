@@ -0,0 +1,249 @@
+#include "pch.h"
+#include "inject_source.h"
+
+
+// Same settings section as the rest of the camera configuration.
+#define INJECT_CONFIG "openvr_camera_sim_camera"
+
+// Pinning only fails if the producer publishes and starts overwriting a slot in between, so a few tries are plenty.
+#define INJECT_PIN_ATTEMPTS 4
+
+
+uint32_t InjectFrameSource::LoadMaxFrameMB()
+{
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	int32_t maxFrameMB = vr::VRSettings()->GetInt32(INJECT_CONFIG, "inject_max_frame_mb", &settingsError);
+	if (settingsError != vr::VRSettingsError_None || maxFrameMB <= 0) { return INJECT_DEFAULT_MAX_FRAME_MB; }
+
+	return (std::min)((uint32_t)maxFrameMB, 1024u);
+}
+
+
+InjectFrameSource::InjectFrameSource(uint32_t maxFrameMB)
+{
+	uint64_t slotCapacity = (uint64_t)maxFrameMB * 1024 * 1024;
+	uint64_t mappingSize = CameraInjectMappingSize(slotCapacity);
+
+	m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(mappingSize >> 32), (DWORD)mappingSize, CAMERA_INJECT_MAPPING_NAME);
+	if (m_hMapping == nullptr)
+	{
+		VR_DRIVER_LOG_FORMAT("InjectFrameSource: Failed to create the shared memory mapping: {}", GetLastError());
+		return;
+	}
+
+	// A producer holding the mapping open keeps it alive between driver sessions.
+	bool bExisting = (GetLastError() == ERROR_ALREADY_EXISTS);
+
+	m_pHeader = (CameraInjectHeader*)MapViewOfFile(m_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+	if (m_pHeader == nullptr)
+	{
+		VR_DRIVER_LOG_FORMAT("InjectFrameSource: Failed to map the shared memory: {}", GetLastError());
+		CloseHandle(m_hMapping);
+		m_hMapping = nullptr;
+		return;
+	}
+
+	if (bExisting && m_pHeader->magic == CAMERA_INJECT_MAGIC && m_pHeader->version == CAMERA_INJECT_VERSION)
+	{
+		m_layoutGeneration = m_pHeader->layout.generation;
+		m_pHeader->pinnedSlot.store(CAMERA_INJECT_NO_SLOT);
+		VR_DRIVER_LOG_FORMAT("InjectFrameSource: Reusing the existing mapping with {} byte slots", m_pHeader->slotCapacity);
+		return;
+	}
+	else if (bExisting)
+	{
+		VR_DRIVER_LOG_FORMAT("InjectFrameSource: The shared memory mapping exists with an unknown version");
+		UnmapViewOfFile(m_pHeader);
+		m_pHeader = nullptr;
+		CloseHandle(m_hMapping);
+		m_hMapping = nullptr;
+		return;
+	}
+
+	// New mappings are zero filled.
+	m_pHeader->numSlots = CAMERA_INJECT_SLOTS;
+	m_pHeader->dataOffset = CAMERA_INJECT_DATA_ALIGNMENT;
+	m_pHeader->slotStride = (mappingSize - CAMERA_INJECT_DATA_ALIGNMENT) / CAMERA_INJECT_SLOTS;
+	m_pHeader->slotCapacity = slotCapacity;
+	m_pHeader->latestSlot.store(CAMERA_INJECT_NO_SLOT);
+	m_pHeader->pinnedSlot.store(CAMERA_INJECT_NO_SLOT);
+	m_pHeader->version = CAMERA_INJECT_VERSION;
+
+	// Producers check the magic last.
+	std::atomic_thread_fence(std::memory_order_release);
+	m_pHeader->magic = CAMERA_INJECT_MAGIC;
+
+	VR_DRIVER_LOG_FORMAT("InjectFrameSource: Created the shared memory mapping with {} x {} byte slots", CAMERA_INJECT_SLOTS, slotCapacity);
+}
+
+InjectFrameSource::~InjectFrameSource()
+{
+	if (m_pHeader != nullptr)
+	{
+		m_pHeader->pinnedSlot.store(CAMERA_INJECT_NO_SLOT);
+		UnmapViewOfFile(m_pHeader);
+	}
+	if (m_hMapping != nullptr)
+	{
+		CloseHandle(m_hMapping);
+	}
+}
+
+void InjectFrameSource::SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel)
+{
+	FrameSource::SetFrameLayout(rig, bytesPerPixel);
+
+	m_pFrameData = nullptr;
+	m_lastSlot = CAMERA_INJECT_NO_SLOT;
+
+	if (m_pHeader == nullptr)
+	{
+		return;
+	}
+
+	if ((uint64_t)rig.textureWidth * rig.textureHeight * bytesPerPixel > m_pHeader->slotCapacity)
+	{
+		VR_DRIVER_LOG_FORMAT("InjectFrameSource: {}x{} frames don't fit the {} byte slots, raise inject_max_frame_mb", rig.textureWidth, rig.textureHeight, m_pHeader->slotCapacity);
+	}
+
+	CameraInjectLayout layout = {};
+	layout.width = rig.textureWidth;
+	layout.height = rig.textureHeight;
+	layout.bytesPerPixel = bytesPerPixel;
+	layout.rowStride = rig.textureWidth * bytesPerPixel;
+	layout.format = vr::CVS_FORMAT_RGBX32;
+	layout.numCameras = (std::min)(rig.numCameras, (uint32_t)CAMERA_INJECT_MAX_CAMERAS);
+
+	for (uint32_t i = 0; i < layout.numCameras; i++)
+	{
+		layout.regions[i] = { rig.regions[i].x, rig.regions[i].y, rig.regions[i].width, rig.regions[i].height };
+	}
+
+	// Starts from one, so zeroed slots never match.
+	layout.generation = ++m_layoutGeneration;
+
+	uint32_t sequence = m_pHeader->layoutSequence.load(std::memory_order_relaxed);
+	m_pHeader->layoutSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memcpy((void*)&m_pHeader->layout, &layout, sizeof(layout));
+
+	m_pHeader->layoutSequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool InjectFrameSource::PinLatestSlot(uint32_t& outSlot)
+{
+	for (uint32_t attempt = 0; attempt < INJECT_PIN_ATTEMPTS; attempt++)
+	{
+		uint32_t slot = m_pHeader->latestSlot.load(std::memory_order_acquire);
+		if (slot >= CAMERA_INJECT_SLOTS)
+		{
+			break;
+		}
+
+		// Pairs with the producer bumping the sequence before checking the pin, see camera_inject.h.
+		m_pHeader->pinnedSlot.store(slot, std::memory_order_seq_cst);
+		uint32_t sequence = m_pHeader->slots[slot].sequence.load(std::memory_order_seq_cst);
+
+		if ((sequence & 1) == 0)
+		{
+			outSlot = slot;
+			return true;
+		}
+		m_pinRetries++;
+	}
+
+	return false;
+}
+
+void InjectFrameSource::BeginFrame(FrameRenderInfo& info)
+{
+	if (m_pHeader == nullptr)
+	{
+		m_emptyFrames++;
+		return;
+	}
+
+	LARGE_INTEGER currTime;
+	QueryPerformanceCounter(&currTime);
+	m_pHeader->lastReadTicks.store(currTime.QuadPart, std::memory_order_relaxed);
+
+	uint32_t slot;
+	if (!PinLatestSlot(slot))
+	{
+		// The previous slot may not be pinned anymore, so it can't be repeated.
+		m_pHeader->pinnedSlot.store(CAMERA_INJECT_NO_SLOT, std::memory_order_seq_cst);
+		m_pFrameData = nullptr;
+		m_lastSlot = CAMERA_INJECT_NO_SLOT;
+		m_emptyFrames++;
+		return;
+	}
+
+	const CameraInjectSlot& slotInfo = m_pHeader->slots[slot];
+
+	if (slotInfo.layoutGeneration != m_layoutGeneration ||
+		(uint64_t)m_textureWidth * m_textureHeight * m_textureBPP > m_pHeader->slotCapacity)
+	{
+		m_pFrameData = nullptr;
+		m_lastSlot = CAMERA_INJECT_NO_SLOT;
+		m_emptyFrames++;
+		return;
+	}
+
+	uint32_t sequence = slotInfo.sequence.load(std::memory_order_relaxed);
+
+	if (slot == m_lastSlot && sequence == m_lastSequence)
+	{
+		m_repeatedFrames++;
+	}
+	else
+	{
+		m_newFrames++;
+		m_lastNewFrameTicks = currTime.QuadPart;
+		m_lastSlot = slot;
+		m_lastSequence = sequence;
+		m_lastExposureTicks = slotInfo.exposureTicks;
+		m_pHeader->framesRead.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	m_pFrameData = CameraInjectSlotData(m_pHeader, slot);
+
+	// Frames captured by the producer keep their own exposure time.
+	if (m_lastExposureTicks != 0)
+	{
+		info.exposureStartTicks = m_lastExposureTicks;
+	}
+}
+
+void InjectFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	size_t stride = (size_t)m_textureWidth * m_textureBPP;
+
+	if (m_pFrameData == nullptr)
+	{
+		memset(pBuffer + firstRow * stride, 0, (endRow - firstRow) * stride);
+		return;
+	}
+
+	memcpy(pBuffer + firstRow * stride, m_pFrameData + firstRow * stride, (endRow - firstRow) * stride);
+}
+
+std::string InjectFrameSource::GetStatusJson()
+{
+	if (m_pHeader == nullptr)
+	{
+		return "{\"open\":false}";
+	}
+
+	LARGE_INTEGER currTime, frequency;
+	QueryPerformanceCounter(&currTime);
+	QueryPerformanceFrequency(&frequency);
+
+	int64_t lastNewFrameTicks = m_lastNewFrameTicks;
+	double lastFrameAge = lastNewFrameTicks ? (currTime.QuadPart - lastNewFrameTicks) * 1000.0 / frequency.QuadPart : -1.0;
+
+	return std::format("{{\"open\":true,\"slot_bytes\":{},\"layout_generation\":{},\"published\":{},\"new\":{},\"repeated\":{},\"empty\":{},\"pin_retries\":{},\"last_frame_age_ms\":{:.1f}}}",
+		m_pHeader->slotCapacity, m_layoutGeneration, m_pHeader->framesPublished.load(), m_newFrames.load(), m_repeatedFrames.load(),
+		m_emptyFrames.load(), m_pinRetries.load(), lastFrameAge);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "frame_source.h"
+#include "camera_inject.h"
+
+
+#define INJECT_DEFAULT_MAX_FRAME_MB 32
+
+
+// Serves frames written by another process into the shared memory mapping described in camera_inject.h.
+// The latest complete frame is copied out on every served frame, so the producer can run at any rate.
+// The last frame is repeated if the producer falls behind, and black is served until the first one arrives.
+class InjectFrameSource : public FrameSource
+{
+public:
+	InjectFrameSource(uint32_t maxFrameMB);
+	~InjectFrameSource();
+
+	// Reads the inject_max_frame_mb driver setting.
+	static uint32_t LoadMaxFrameMB();
+
+	bool IsOpen() const { return m_pHeader != nullptr; }
+
+	virtual const char* GetName() const override { return "inject"; }
+	virtual void SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel) override;
+	virtual void BeginFrame(FrameRenderInfo& info) override;
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+	virtual std::string GetStatusJson() override;
+
+protected:
+	bool PinLatestSlot(uint32_t& outSlot);
+
+	HANDLE m_hMapping = nullptr;
+	CameraInjectHeader* m_pHeader = nullptr;
+
+	uint32_t m_layoutGeneration = 0;
+
+	// Frame being copied out, null if there is none for the current layout.
+	const uint8_t* m_pFrameData = nullptr;
+	uint32_t m_lastSlot = CAMERA_INJECT_NO_SLOT;
+	uint32_t m_lastSequence = 0;
+	int64_t m_lastExposureTicks = 0;
+
+	std::atomic<uint64_t> m_newFrames = 0;
+	std::atomic<uint64_t> m_repeatedFrames = 0;
+	std::atomic<uint64_t> m_emptyFrames = 0;
+	std::atomic<uint64_t> m_pinRetries = 0;
+	std::atomic<int64_t> m_lastNewFrameTicks = 0;
+};
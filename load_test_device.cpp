@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "load_test_device.h"
+#include "head_motion.h"
+
+
+#define LOAD_TEST_CONFIG "openvr_camera_sim_load_test"
+
+// Upper bound on the load test cameras, to keep a typo in the settings from exhausting memory.
+#define LOAD_TEST_MAX_CAMERAS 32
+
+
+LoadTestSettings LoadTestSettings::Load()
+{
+	LoadTestSettings settings;
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	int32_t numCameras = vr::VRSettings()->GetInt32(LOAD_TEST_CONFIG, "cameras", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && numCameras > 0)
+	{
+		settings.numCameras = (std::min)((uint32_t)numCameras, (uint32_t)LOAD_TEST_MAX_CAMERAS);
+	}
+
+	char frameSources[256] = {};
+	vr::VRSettings()->GetString(LOAD_TEST_CONFIG, "frame_sources", frameSources, sizeof(frameSources), &settingsError);
+	if (settingsError == vr::VRSettingsError_None)
+	{
+		std::stringstream stream(frameSources);
+		std::string name;
+		while (std::getline(stream, name, ','))
+		{
+			if (!name.empty())
+			{
+				settings.frameSources.push_back(name);
+			}
+		}
+	}
+
+	float frameRate = vr::VRSettings()->GetFloat(LOAD_TEST_CONFIG, "fps", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && frameRate > 0.0f) { settings.frameRate = frameRate; }
+
+	bool bStaggerPhases = vr::VRSettings()->GetBool(LOAD_TEST_CONFIG, "stagger_phases", &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { settings.bStaggerPhases = bStaggerPhases; }
+
+	bool bAutostart = vr::VRSettings()->GetBool(LOAD_TEST_CONFIG, "autostart", &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { settings.bAutostart = bAutostart; }
+
+	return settings;
+}
+
+CameraInstanceSettings LoadTestSettings::GetInstance(uint32_t index) const
+{
+	CameraInstanceSettings instance;
+	instance.index = index;
+	instance.queuePath = std::format(LOAD_TEST_QUEUE_PATH_FORMAT, index);
+	instance.frameRate = frameRate;
+
+	if (!frameSources.empty())
+	{
+		instance.frameSource = frameSources[(index - 1) % frameSources.size()];
+	}
+
+	instance.framePhase = bStaggerPhases ? (double)(index - 1) / numCameras / frameRate : 0.0;
+
+	return instance;
+}
+
+
+LoadTestCameraDevice::LoadTestCameraDevice(const CameraInstanceSettings& instance, ThreadPool& renderPool, bool bAutostart)
+	: m_serialNumber(std::format("openvr_camera_sim_load_camera_{:03}", instance.index))
+	, m_bAutostart(bAutostart)
+{
+	m_cameraComponent = std::make_unique<CameraComponent>(instance, renderPool);
+}
+
+vr::EVRInitError LoadTestCameraDevice::Activate(uint32_t unObjectId)
+{
+	VR_DRIVER_LOG_FORMAT("LoadTestCameraDevice::Activate: {} {}", m_serialNumber, unObjectId);
+
+	m_deviceId = unObjectId;
+
+	const vr::PropertyContainerHandle_t container = vr::VRProperties()->TrackedDeviceToPropertyContainer(m_deviceId);
+	vr::VRProperties()->SetStringProperty(container, vr::Prop_ModelNumber_String, "openvr_camera_sim_load_camera");
+
+	if (!m_cameraComponent->Init(m_deviceId))
+	{
+		VR_DRIVER_LOG_FORMAT("LoadTestCameraDevice: Camera component failed on {}", m_serialNumber);
+		return vr::VRInitError_Driver_Failed;
+	}
+
+	if (m_bAutostart)
+	{
+		m_cameraComponent->StartVideoStream();
+	}
+
+	vr::VRServerDriverHost()->TrackedDevicePoseUpdated(m_deviceId, GetPose(), sizeof(vr::DriverPose_t));
+
+	return vr::VRInitError_None;
+}
+
+void LoadTestCameraDevice::Deactivate()
+{
+	m_cameraComponent->StopVideoStream();
+	m_cameraComponent->Deinit();
+}
+
+void* LoadTestCameraDevice::GetComponent(const char* pchComponentNameAndVersion)
+{
+	if (strcmp(pchComponentNameAndVersion, vr::IVRCameraComponent_Version) == 0)
+	{
+		return m_cameraComponent.get();
+	}
+	return nullptr;
+}
+
+// Takes the camera stream requests of the HMD, such as get config and set fps.
+void LoadTestCameraDevice::DebugRequest(const char* pchRequest, char* pchResponseBuffer, uint32_t unResponseBufferSize)
+{
+	if (unResponseBufferSize < 1)
+	{
+		return;
+	}
+
+	std::string response;
+
+	if (!m_cameraComponent->HandleDebugCommand(pchRequest, response))
+	{
+		response = std::format("{{\"error\":\"unknown request\",\"requests\":[{}]}}", CameraComponent::GetDebugRequestListJson());
+	}
+
+	// Report the required size rather than sending truncated JSON.
+	if (response.size() >= unResponseBufferSize)
+	{
+		response = std::format("{{\"error\":\"response buffer too small\",\"required_size\":{}}}", response.size() + 1);
+	}
+
+	if (response.size() >= unResponseBufferSize)
+	{
+		pchResponseBuffer[0] = 0;
+		return;
+	}
+
+	memcpy(pchResponseBuffer, response.c_str(), response.size() + 1);
+}
+
+// Follows the simulated head, as the frames of the world source are rendered from its pose.
+vr::DriverPose_t LoadTestCameraDevice::GetPose()
+{
+	LARGE_INTEGER currTime = {};
+	if (g_headMotion.IsEnabled())
+	{
+		QueryPerformanceCounter(&currTime);
+	}
+
+	return g_headMotion.GetDriverPose(currTime.QuadPart, 0);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "camera_component.h"
+
+
+// Queue path of the load test cameras, by instance index.
+#define LOAD_TEST_QUEUE_PATH_FORMAT "/openvr_camera_sim/load_camera_{}/raw_frames"
+
+
+struct LoadTestSettings
+{
+	uint32_t numCameras = 0;
+
+	// Frame source names, assigned to the cameras in turn.
+	std::vector<std::string> frameSources;
+
+	double frameRate = 60.0;
+
+	// Spreads the frame deadlines of the cameras evenly over the frame interval, rather than serving all at once.
+	bool bStaggerPhases = true;
+
+	// Serves frames from activation, instead of waiting for the runtime to start the stream.
+	bool bAutostart = true;
+
+	// Reads the openvr_camera_sim_load_test driver settings.
+	static LoadTestSettings Load();
+
+	// Identity of load test camera n, counting from 1 as the HMD camera is instance 0.
+	CameraInstanceSettings GetInstance(uint32_t index) const;
+};
+
+
+// Generic tracker with only a camera component, serving frames to its own block queue.
+// Any number of them can be added next to the HMD, to measure how frame serving scales with the aggregate bandwidth.
+// They share the render pool and frame arena with the HMD camera, and take the rest of the camera settings from it.
+class LoadTestCameraDevice : public vr::ITrackedDeviceServerDriver
+{
+public:
+	LoadTestCameraDevice(const CameraInstanceSettings& instance, ThreadPool& renderPool, bool bAutostart);
+
+	virtual vr::EVRInitError Activate(uint32_t unObjectId) override;
+	virtual void Deactivate() override;
+	virtual void EnterStandby() override {}
+	virtual void* GetComponent(const char* pchComponentNameAndVersion) override;
+	virtual void DebugRequest(const char* pchRequest, char* pchResponseBuffer, uint32_t unResponseBufferSize) override;
+	virtual vr::DriverPose_t GetPose() override;
+
+	const std::string& GetSerialNumber() const { return m_serialNumber; }
+
+private:
+	std::unique_ptr<CameraComponent> m_cameraComponent;
+	std::string m_serialNumber;
+	bool m_bAutostart = true;
+
+	vr::TrackedDeviceIndex_t m_deviceId = -1;
+};
@@ -0,0 +1,379 @@
+#include "pch.h"
+#include "pattern_source.h"
+
+
+#define PATTERN_PI 3.14159265f
+
+// Spokes of the Siemens star, and the line widths of the resolution chart blocks in pixels.
+#define PATTERN_STAR_SPOKES 36
+static const uint32_t g_resolutionLineWidths[] = { 1, 2, 3, 4, 6, 8, 12, 16 };
+
+static const char* g_patternNames[] =
+{
+	"checkerboard",
+	"siemens_star",
+	"bars",
+	"resolution",
+	"color_id",
+	"counter",
+};
+
+static_assert(sizeof(g_patternNames) / sizeof(g_patternNames[0]) == Pattern_Count, "Pattern name table out of sync with EPatternType");
+
+static const char* g_patternMotionNames[] =
+{
+	"none",
+	"horizontal",
+	"vertical",
+	"diagonal",
+};
+
+static_assert(sizeof(g_patternMotionNames) / sizeof(g_patternMotionNames[0]) == PatternMotion_Count, "Pattern motion name table out of sync with EPatternMotion");
+
+
+// Pixels are stored RGBX, so red is the low byte.
+static inline uint32_t PatternColor(uint8_t red, uint8_t green, uint8_t blue)
+{
+	return 0xFF000000 | ((uint32_t)blue << 16) | ((uint32_t)green << 8) | red;
+}
+
+static const uint32_t g_patternWhite = PatternColor(255, 255, 255);
+static const uint32_t g_patternBlack = PatternColor(0, 0, 0);
+static const uint32_t g_patternGrey = PatternColor(128, 128, 128);
+
+// Color of each camera in the color ID pattern: red, green, blue and yellow.
+static const uint32_t g_cameraColors[MAX_RIG_CAMERAS] =
+{
+	PatternColor(224, 32, 32),
+	PatternColor(32, 224, 32),
+	PatternColor(32, 32, 224),
+	PatternColor(224, 224, 32),
+};
+
+
+template<typename T>
+static bool FindName(const char* const* pNames, int count, const std::string& name, T& outValue)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (name == pNames[i])
+		{
+			outValue = (T)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PatternSettings::FindPattern(const std::string& name, EPatternType& outPattern)
+{
+	return FindName(g_patternNames, Pattern_Count, name, outPattern);
+}
+
+bool PatternSettings::FindMotion(const std::string& name, EPatternMotion& outMotion)
+{
+	return FindName(g_patternMotionNames, PatternMotion_Count, name, outMotion);
+}
+
+bool PatternSettings::Parse(const std::string& text)
+{
+	std::stringstream stream(text);
+	std::string name;
+
+	if (!(stream >> name) || !FindPattern(name, pattern))
+	{
+		return false;
+	}
+
+	if (stream >> name && !FindMotion(name, motion))
+	{
+		return false;
+	}
+
+	uint32_t newSpeed = 0;
+	if (stream >> newSpeed)
+	{
+		speed = (std::min)(newSpeed, (uint32_t)PATTERN_MAX_SPEED);
+	}
+
+	return true;
+}
+
+const char* PatternSettings::GetPatternName(EPatternType pattern)
+{
+	return (pattern >= 0 && pattern < Pattern_Count) ? g_patternNames[pattern] : "unknown";
+}
+
+const char* PatternSettings::GetMotionName(EPatternMotion motion)
+{
+	return (motion >= 0 && motion < PatternMotion_Count) ? g_patternMotionNames[motion] : "unknown";
+}
+
+
+// Value of one pixel of a pattern period. Only called when building the scroll buffers.
+static uint32_t GetPatternPixel(EPatternType pattern, uint32_t camera, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	switch (pattern)
+	{
+	case Pattern_Checkerboard:
+		return ((x / PATTERN_CELL_SIZE + y / PATTERN_CELL_SIZE) & 1) ? PatternColor(192, 192, 192) : PatternColor(64, 64, 64);
+
+	case Pattern_SiemensStar:
+	{
+		float dx = x + 0.5f - width * 0.5f;
+		float dy = y + 0.5f - height * 0.5f;
+		float radius = sqrtf(dx * dx + dy * dy);
+
+		// The spokes merge below a few pixels from the center, so it is left grey.
+		if (radius > (std::min)(width, height) * 0.5f - 2.0f || radius < 4.0f)
+		{
+			return g_patternGrey;
+		}
+
+		int32_t sector = (int32_t)floorf((atan2f(dy, dx) + PATTERN_PI) / (2.0f * PATTERN_PI) * 2.0f * PATTERN_STAR_SPOKES);
+		return (sector & 1) ? g_patternWhite : g_patternBlack;
+	}
+
+	case Pattern_Bars:
+		// White vertical bars over yellow horizontal ones, so motion in either direction shows.
+		if (x % PATTERN_BAR_PERIOD < PATTERN_BAR_PERIOD / 4)
+		{
+			return g_patternWhite;
+		}
+		return (y % PATTERN_BAR_PERIOD < PATTERN_BAR_PERIOD / 8) ? PatternColor(224, 224, 32) : PatternColor(32, 32, 32);
+
+	case Pattern_Resolution:
+	{
+		// Blocks of vertical lines on the top half and horizontal lines on the bottom half, the lines widening to the right.
+		const uint32_t numBlocks = sizeof(g_resolutionLineWidths) / sizeof(g_resolutionLineWidths[0]);
+		uint32_t blockWidth = (std::max)(width / numBlocks, 1u);
+		uint32_t block = (std::min)(x / blockWidth, numBlocks - 1);
+		uint32_t lineWidth = g_resolutionLineWidths[block];
+
+		if (x % blockWidth < 2 || y == height / 2)
+		{
+			return g_patternGrey;
+		}
+
+		uint32_t position = (y < height / 2) ? x : y;
+		return ((position / lineWidth) & 1) ? g_patternWhite : g_patternBlack;
+	}
+
+	case Pattern_ColorId:
+	{
+		uint32_t color = g_cameraColors[camera % MAX_RIG_CAMERAS];
+
+		// One white square per camera number in the center, on a grid of darker lines.
+		const uint32_t squareSize = 16;
+		uint32_t markerWidth = (camera * 2 + 1) * squareSize;
+		uint32_t markerX = x - (width - markerWidth) / 2;
+		uint32_t markerY = y - (height - squareSize) / 2;
+
+		if (markerX < markerWidth && markerY < squareSize && (markerX / squareSize) % 2 == 0)
+		{
+			return g_patternWhite;
+		}
+		if (x % 64 == 0 || y % 64 == 0)
+		{
+			return ((color >> 1) & 0x007F7F7F) | 0xFF000000;
+		}
+		return color;
+	}
+
+	default:
+		return g_patternGrey;
+	}
+}
+
+
+PatternFrameSource::PatternFrameSource(const PatternSettings& settings)
+	: m_settings(settings)
+{
+}
+
+PatternFrameSource::~PatternFrameSource()
+{
+	ReleaseScrollBuffers();
+}
+
+void PatternFrameSource::SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel)
+{
+	FrameSource::SetFrameLayout(rig, bytesPerPixel);
+
+	LARGE_INTEGER startTime, endTime, frequency;
+	QueryPerformanceCounter(&startTime);
+
+	// All buffers of a pattern have the same size. The slots are returned first, so the arena can grow.
+	ReleaseScrollBuffers();
+
+	uint32_t periodX, periodY;
+	GetScrollPeriod(periodX, periodY);
+	uint32_t numBuffers = (m_settings.pattern == Pattern_ColorId) ? rig.numCameras : 1;
+
+	if (m_bufferArena.Reserve((size_t)(periodX + rig.frameWidth) * periodY * 4, numBuffers))
+	{
+		m_buffers.resize(numBuffers);
+		for (uint32_t i = 0; i < numBuffers; i++)
+		{
+			m_buffers[i].pPixels = (uint32_t*)m_bufferArena.AcquireSlot();
+			BuildScrollBuffer(m_buffers[i], i);
+		}
+	}
+
+	m_counterStripeWidth = (std::max)(rig.frameWidth / PATTERN_COUNTER_BITS, 1u);
+	uint32_t gap = (m_counterStripeWidth >= 4) ? (std::max)(m_counterStripeWidth / 8, 1u) : 0;
+
+	for (uint32_t bit = 0; bit < 2; bit++)
+	{
+		m_counterStripes[bit].assign(m_counterStripeWidth, bit ? g_patternWhite : g_patternBlack);
+		std::fill(m_counterStripes[bit].end() - gap, m_counterStripes[bit].end(), g_patternGrey);
+	}
+
+	QueryPerformanceCounter(&endTime);
+	QueryPerformanceFrequency(&frequency);
+	m_buildMs = (endTime.QuadPart - startTime.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+// Periodic patterns only need one period stored, the others wrap around at the view size.
+void PatternFrameSource::GetScrollPeriod(uint32_t& outPeriodX, uint32_t& outPeriodY) const
+{
+	switch (m_settings.pattern)
+	{
+	case Pattern_Checkerboard:
+		outPeriodX = PATTERN_CELL_SIZE * 2;
+		outPeriodY = PATTERN_CELL_SIZE * 2;
+		break;
+
+	case Pattern_Bars:
+		outPeriodX = PATTERN_BAR_PERIOD;
+		outPeriodY = PATTERN_BAR_PERIOD;
+		break;
+
+	case Pattern_Counter:
+		outPeriodX = 1;
+		outPeriodY = 1;
+		break;
+
+	default:
+		outPeriodX = m_rig.frameWidth;
+		outPeriodY = m_rig.frameHeight;
+		break;
+	}
+}
+
+// The pixels must be a slot large enough for the period and view width.
+void PatternFrameSource::BuildScrollBuffer(PatternScrollBuffer& buffer, uint32_t camera) const
+{
+	const uint32_t width = m_rig.frameWidth;
+	const uint32_t height = m_rig.frameHeight;
+
+	GetScrollPeriod(buffer.periodX, buffer.periodY);
+	buffer.stride = buffer.periodX + width;
+
+	for (uint32_t y = 0; y < buffer.periodY; y++)
+	{
+		uint32_t* pRow = buffer.pPixels + (size_t)y * buffer.stride;
+
+		for (uint32_t x = 0; x < buffer.periodX; x++)
+		{
+			pRow[x] = GetPatternPixel(m_settings.pattern, camera, x, y, width, height);
+		}
+		for (uint32_t x = buffer.periodX; x < buffer.stride; x++)
+		{
+			pRow[x] = pRow[x - buffer.periodX];
+		}
+	}
+}
+
+void PatternFrameSource::ReleaseScrollBuffers()
+{
+	for (PatternScrollBuffer& buffer : m_buffers)
+	{
+		m_bufferArena.ReleaseSlot((uint8_t*)buffer.pPixels);
+	}
+	m_buffers.clear();
+}
+
+void PatternFrameSource::RenderCounter(uint32_t* pRow, uint32_t count) const
+{
+	const uint32_t regionWidth = m_rig.frameWidth;
+
+	// Views narrower than the stripes show the low bits.
+	uint32_t numBits = (std::min)((uint32_t)PATTERN_COUNTER_BITS, regionWidth / m_counterStripeWidth);
+	uint32_t* pPixel = pRow;
+
+	for (uint32_t i = numBits; i > 0; i--, pPixel += m_counterStripeWidth)
+	{
+		memcpy(pPixel, m_counterStripes[(count >> (i - 1)) & 1].data(), (size_t)m_counterStripeWidth * 4);
+	}
+	std::fill(pPixel, pRow + regionWidth, g_patternGrey);
+}
+
+void PatternFrameSource::RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow)
+{
+	const uint32_t regionWidth = m_rig.frameWidth;
+	const uint32_t regionHeight = m_rig.frameHeight;
+	const bool bPerCamera = m_buffers.size() > 1;
+	const uint32_t counterRows = (m_settings.pattern == Pattern_Counter) ? regionHeight : m_settings.counterRows;
+
+	if (m_buffers.empty())
+	{
+		memset(pBuffer + (size_t)firstRow * m_textureWidth * 4, 0, (size_t)(endRow - firstRow) * m_textureWidth * 4);
+		return;
+	}
+
+	// The pattern moves right and down by the speed each frame.
+	const uint32_t periodX = m_buffers[0].periodX;
+	const uint32_t periodY = m_buffers[0].periodY;
+	const uint64_t offset = info.frameCount * m_settings.speed;
+
+	uint32_t offsetX = 0;
+	uint32_t offsetY = 0;
+	if (m_settings.motion == PatternMotion_Horizontal || m_settings.motion == PatternMotion_Diagonal)
+	{
+		offsetX = (periodX - (uint32_t)(offset % periodX)) % periodX;
+	}
+	if (m_settings.motion == PatternMotion_Vertical || m_settings.motion == PatternMotion_Diagonal)
+	{
+		offsetY = (periodY - (uint32_t)(offset % periodY)) % periodY;
+	}
+
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		uint32_t regionRow = y / regionHeight;
+		uint32_t localY = y - regionRow * regionHeight;
+		uint32_t sourceRow = (localY + offsetY) % periodY;
+
+		uint32_t* pRow = (uint32_t*)pBuffer + (size_t)y * m_textureWidth;
+
+		for (uint32_t column = 0; column < m_rig.layoutColumns; column++)
+		{
+			uint32_t camera = regionRow * m_rig.layoutColumns + column;
+			uint32_t* pPixel = pRow + (size_t)column * regionWidth;
+
+			if (camera >= m_rig.numCameras)
+			{
+				memset(pPixel, 0, (size_t)regionWidth * 4);
+				continue;
+			}
+
+			if (localY < counterRows)
+			{
+				RenderCounter(pPixel, (uint32_t)info.frameCount);
+				continue;
+			}
+
+			const PatternScrollBuffer& buffer = m_buffers[bPerCamera ? camera : 0];
+			memcpy(pPixel, buffer.pPixels + (size_t)sourceRow * buffer.stride + offsetX, (size_t)regionWidth * 4);
+		}
+	}
+}
+
+std::string PatternFrameSource::GetStatusJson()
+{
+	size_t bufferBytes = m_buffers.size() * m_bufferArena.GetSlotSize();
+
+	return std::format("{{\"pattern\":\"{}\",\"motion\":\"{}\",\"speed\":{},\"counter_rows\":{},\"buffers\":{},\"buffer_mb\":{:.2f},\"large_pages\":{},\"build_ms\":{:.3f}}}",
+		PatternSettings::GetPatternName(m_settings.pattern), PatternSettings::GetMotionName(m_settings.motion), m_settings.speed, m_settings.counterRows,
+		m_buffers.size(), bufferBytes / (1024.0 * 1024.0), m_bufferArena.IsUsingLargePages(), m_buildMs);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "frame_source.h"
+#include "frame_arena.h"
+
+
+// Keep in sync with g_patternNames in pattern_source.cpp.
+enum EPatternType
+{
+	Pattern_Checkerboard = 0,
+	Pattern_SiemensStar,
+	Pattern_Bars,
+	Pattern_Resolution,
+	Pattern_ColorId,
+	Pattern_Counter,
+
+	Pattern_Count
+};
+
+// Keep in sync with g_patternMotionNames in pattern_source.cpp.
+enum EPatternMotion
+{
+	PatternMotion_None = 0,
+	PatternMotion_Horizontal,
+	PatternMotion_Vertical,
+	PatternMotion_Diagonal,
+
+	PatternMotion_Count
+};
+
+// Checker cell size, and the period of the moving bars.
+#define PATTERN_CELL_SIZE 32
+#define PATTERN_BAR_PERIOD 128
+
+// Bits of the frame count shown by the counter stripes, most significant on the left.
+#define PATTERN_COUNTER_BITS 32
+
+#define PATTERN_MAX_SPEED 256
+
+
+struct PatternSettings
+{
+	EPatternType pattern = Pattern_Checkerboard;
+	EPatternMotion motion = PatternMotion_Horizontal;
+
+	// Pixels moved per frame. Whole pixels keep every frame a plain copy, and make a dropped or repeated frame an uneven step.
+	uint32_t speed = 4;
+
+	// Rows at the top of each view showing the frame count as stripes, zero for none.
+	uint32_t counterRows = 16;
+
+	// Reads the pattern_* driver settings. Defined with the frame source factory, keeping this file free of the runtime for the benchmarks.
+	static PatternSettings Load();
+
+	// Parses "<pattern> [motion] [speed]", as given to set source. Returns false on unknown names.
+	bool Parse(const std::string& text);
+
+	static bool FindPattern(const std::string& name, EPatternType& outPattern);
+	static bool FindMotion(const std::string& name, EPatternMotion& outMotion);
+	static const char* GetPatternName(EPatternType pattern);
+	static const char* GetMotionName(EPatternMotion motion);
+};
+
+// A pattern pre-rendered for scrolling. Rows are stored one horizontal period plus a view wide, repeating the pattern,
+// so a view row at any horizontal offset is one contiguous copy. Rows wrap around vertically.
+struct PatternScrollBuffer
+{
+	// Slot of the source's frame arena.
+	uint32_t* pPixels = nullptr;
+	uint32_t periodX = 0;
+	uint32_t periodY = 0;
+	uint32_t stride = 0;
+};
+
+
+// Test patterns for checking the frames on the reader side: checkerboard, Siemens star, moving bars, resolution chart,
+// per-camera color ID, and frame counter stripes. Patterns are rendered once per layout into scroll buffers, and animated
+// by copying each row from an offset into the buffer, so unlike the gradient a frozen or dropped frame is visible.
+class PatternFrameSource : public FrameSource
+{
+public:
+	PatternFrameSource(const PatternSettings& settings);
+	~PatternFrameSource();
+
+	virtual const char* GetName() const override { return "pattern"; }
+	virtual void SetFrameLayout(const CameraRig& rig, uint32_t bytesPerPixel) override;
+	virtual void RenderRows(uint8_t* pBuffer, const FrameRenderInfo& info, uint32_t firstRow, uint32_t endRow) override;
+	virtual std::string GetStatusJson() override;
+
+protected:
+	void GetScrollPeriod(uint32_t& outPeriodX, uint32_t& outPeriodY) const;
+	void BuildScrollBuffer(PatternScrollBuffer& buffer, uint32_t camera) const;
+	void ReleaseScrollBuffers();
+	void RenderCounter(uint32_t* pRow, uint32_t count) const;
+
+	PatternSettings m_settings;
+
+	// One buffer shared by all cameras, or one per camera for the color ID. Empty if the arena could not be reserved.
+	std::vector<PatternScrollBuffer> m_buffers;
+	FrameArena m_bufferArena;
+
+	// One counter stripe per bit value, each a stripe wide with a gap at the end.
+	std::vector<uint32_t> m_counterStripes[2];
+	uint32_t m_counterStripeWidth = 0;
+
+	double m_buildMs = 0.0;
+};
@@ -0,0 +1,396 @@
+#include "pch.h"
+#include "sensor_isp.h"
+#include "cpu_features.h"
+
+
+// Same settings section as the rest of the camera configuration.
+#define ISP_CONFIG "openvr_camera_sim_camera"
+
+// Runtime settings section with the forced camera controls.
+#define ISP_RUNTIME_CAMERA_SECTION "camera"
+
+// Random generator lanes, matching an AVX2 register of 32-bit lanes. Eight pixels are processed per step.
+#define ISP_NOISE_LANES 8
+
+// Sum of four uniform random bytes: mean 510, standard deviation sqrt(4 * (256^2 - 1) / 12).
+#define ISP_NOISE_MEAN 510.0f
+#define ISP_NOISE_SCALE (1.0f / 147.8006f)
+
+
+SensorIspSettings SensorIspSettings::Load()
+{
+	SensorIspSettings settings;
+	vr::EVRSettingsError settingsError = vr::VRSettingsError_None;
+
+	bool bEnabled = vr::VRSettings()->GetBool(ISP_CONFIG, "isp_enable", &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { settings.bEnabled = bEnabled; }
+
+	float exposureMs = vr::VRSettings()->GetFloat(ISP_CONFIG, "isp_exposure_ms", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && exposureMs > 0.0f) { settings.exposureMs = exposureMs; }
+
+	float gain = vr::VRSettings()->GetFloat(ISP_CONFIG, "isp_gain", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && gain > 0.0f) { settings.gain = gain; }
+
+	const char* whiteBalanceKeys[3] = { "isp_white_balance_r", "isp_white_balance_g", "isp_white_balance_b" };
+	for (int i = 0; i < 3; i++)
+	{
+		float whiteBalance = vr::VRSettings()->GetFloat(ISP_CONFIG, whiteBalanceKeys[i], &settingsError);
+		if (settingsError == vr::VRSettingsError_None && whiteBalance > 0.0f) { settings.whiteBalance[i] = whiteBalance; }
+	}
+
+	float vignetting = vr::VRSettings()->GetFloat(ISP_CONFIG, "isp_vignetting", &settingsError);
+	if (settingsError == vr::VRSettingsError_None) { settings.vignetting = std::clamp(vignetting, 0.0f, 1.0f); }
+
+	float shotNoise = vr::VRSettings()->GetFloat(ISP_CONFIG, "isp_shot_noise", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && shotNoise >= 0.0f) { settings.shotNoise = shotNoise; }
+
+	float readNoise = vr::VRSettings()->GetFloat(ISP_CONFIG, "isp_read_noise", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && readNoise >= 0.0f) { settings.readNoise = readNoise; }
+
+	float budgetMs = vr::VRSettings()->GetFloat(ISP_CONFIG, "isp_budget_ms", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && budgetMs > 0.0f) { settings.budgetMs = budgetMs; }
+
+	// The units of the runtime settings are not known. The exposure time is assumed to be in milliseconds,
+	// and the white balance a string of three multipliers.
+	float forcedExposureTime = vr::VRSettings()->GetFloat(ISP_RUNTIME_CAMERA_SECTION, "forcedExposureTime", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && forcedExposureTime > 0.0f) { settings.exposureMs = forcedExposureTime; }
+
+	float forcedGlobalGain = vr::VRSettings()->GetFloat(ISP_RUNTIME_CAMERA_SECTION, "forcedGlobalGain", &settingsError);
+	if (settingsError == vr::VRSettingsError_None && forcedGlobalGain > 0.0f) { settings.gain = forcedGlobalGain; }
+
+	char forcedWhiteBalance[64] = {};
+	vr::VRSettings()->GetString(ISP_RUNTIME_CAMERA_SECTION, "forcedWhiteBalance", forcedWhiteBalance, sizeof(forcedWhiteBalance), &settingsError);
+	if (settingsError == vr::VRSettingsError_None)
+	{
+		std::string text = forcedWhiteBalance;
+		std::replace(text.begin(), text.end(), ',', ' ');
+		std::istringstream stream(text);
+
+		float r = 0.0f, g = 0.0f, b = 0.0f;
+		if ((stream >> r >> g >> b) && r > 0.0f && g > 0.0f && b > 0.0f)
+		{
+			settings.whiteBalance[0] = r;
+			settings.whiteBalance[1] = g;
+			settings.whiteBalance[2] = b;
+		}
+	}
+
+	return settings;
+}
+
+
+static inline void XorShiftLanes(uint32_t* pState)
+{
+	for (int lane = 0; lane < ISP_NOISE_LANES; lane++)
+	{
+		uint32_t x = pState[lane];
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		pState[lane] = x;
+	}
+}
+
+static inline float NoiseSample(uint32_t random)
+{
+	int32_t sum = (random & 0xFF) + ((random >> 8) & 0xFF) + ((random >> 16) & 0xFF) + (random >> 24);
+	return ((float)sum - ISP_NOISE_MEAN) * ISP_NOISE_SCALE;
+}
+
+// Same rounding as the AVX2 mulhrs instruction.
+static inline int32_t MulHighRound(int32_t a, int32_t b)
+{
+	return (a * b + 0x4000) >> 15;
+}
+
+// Processes numPixels RGBX32 pixels. The noise uses one random number per channel, ISP_NOISE_LANES channels at a time.
+static void ProcessPixelsScalar(uint8_t* pPixels, const uint16_t* pShading, uint32_t numPixels, const int16_t* pChannelGains,
+	bool bNoise, float readVariance, float shotScale, uint32_t* pNoiseState)
+{
+	float noise[ISP_NOISE_LANES * 4];
+
+	for (uint32_t group = 0; group < numPixels; group += ISP_NOISE_LANES)
+	{
+		uint32_t groupPixels = (std::min)(numPixels - group, (uint32_t)ISP_NOISE_LANES);
+
+		if (bNoise)
+		{
+			for (int step = 0; step < 4; step++)
+			{
+				XorShiftLanes(pNoiseState);
+				for (int lane = 0; lane < ISP_NOISE_LANES; lane++)
+				{
+					noise[step * ISP_NOISE_LANES + lane] = NoiseSample(pNoiseState[lane]);
+				}
+			}
+		}
+
+		for (uint32_t i = 0; i < groupPixels; i++)
+		{
+			uint8_t* pPixel = pPixels + (group + i) * 4;
+			int32_t shading = pShading[group + i];
+
+			for (int channel = 0; channel < 3; channel++)
+			{
+				int32_t gain = MulHighRound(shading, pChannelGains[channel]);
+				int32_t value = MulHighRound(pPixel[channel] << 7, gain);
+
+				if (bNoise)
+				{
+					float level = (float)value;
+					float sigma = sqrtf(readVariance + shotScale * level);
+					value = (int32_t)lrintf(level + noise[i * 4 + channel] * sigma);
+				}
+
+				pPixel[channel] = (uint8_t)std::clamp(value, 0, 255);
+			}
+		}
+	}
+}
+
+#ifdef CPU_X86
+
+// Noise for eight channels from the generator state, which is stepped first.
+CPU_TARGET_AVX2 static inline __m256 NoiseSamplesAVX2(__m256i& state)
+{
+	state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+	state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+	state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+
+	__m256i sum = _mm256_madd_epi16(_mm256_maddubs_epi16(state, _mm256_set1_epi8(1)), _mm256_set1_epi16(1));
+	return _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(sum), _mm256_set1_ps(ISP_NOISE_MEAN)), _mm256_set1_ps(ISP_NOISE_SCALE));
+}
+
+CPU_TARGET_AVX2 static inline __m256i AddNoiseAVX2(__m128i levels, __m256 noise, __m256 readVariance, __m256 shotScale)
+{
+	__m256 level = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(levels));
+	__m256 sigma = _mm256_sqrt_ps(_mm256_add_ps(readVariance, _mm256_mul_ps(shotScale, level)));
+	return _mm256_cvtps_epi32(_mm256_add_ps(level, _mm256_mul_ps(noise, sigma)));
+}
+
+// Eight pixels per iteration, the remainder is left to the scalar kernel. Matches its output exactly.
+CPU_TARGET_AVX2 static uint32_t ProcessPixelsAVX2(uint8_t* pPixels, const uint16_t* pShading, uint32_t numPixels, const int16_t* pChannelGains,
+	bool bNoise, float readVariance, float shotScale, uint32_t* pNoiseState)
+{
+	const __m256i channelGains = _mm256_set_epi16(
+		pChannelGains[3], pChannelGains[2], pChannelGains[1], pChannelGains[0], pChannelGains[3], pChannelGains[2], pChannelGains[1], pChannelGains[0],
+		pChannelGains[3], pChannelGains[2], pChannelGains[1], pChannelGains[0], pChannelGains[3], pChannelGains[2], pChannelGains[1], pChannelGains[0]);
+	const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+	const __m256 readVarianceVector = _mm256_set1_ps(readVariance);
+	const __m256 shotScaleVector = _mm256_set1_ps(shotScale);
+
+	__m256i state = _mm256_loadu_si256((const __m256i*)pNoiseState);
+
+	uint32_t x = 0;
+	for (; x + 8 <= numPixels; x += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)(pPixels + x * 4));
+
+		// Each pixel's shading repeated over its four channels.
+		__m128i shading = _mm_loadu_si128((const __m128i*)(pShading + x));
+		__m128i shadingLow = _mm_unpacklo_epi16(shading, shading);
+		__m128i shadingHigh = _mm_unpackhi_epi16(shading, shading);
+		__m256i shading0 = _mm256_set_m128i(_mm_unpackhi_epi32(shadingLow, shadingLow), _mm_unpacklo_epi32(shadingLow, shadingLow));
+		__m256i shading1 = _mm256_set_m128i(_mm_unpackhi_epi32(shadingHigh, shadingHigh), _mm_unpacklo_epi32(shadingHigh, shadingHigh));
+
+		__m256i values0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels));
+		__m256i values1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels, 1));
+
+		values0 = _mm256_mulhrs_epi16(_mm256_slli_epi16(values0, 7), _mm256_mulhrs_epi16(shading0, channelGains));
+		values1 = _mm256_mulhrs_epi16(_mm256_slli_epi16(values1, 7), _mm256_mulhrs_epi16(shading1, channelGains));
+
+		__m256i result;
+
+		if (bNoise)
+		{
+			__m256i levels0 = AddNoiseAVX2(_mm256_castsi256_si128(values0), NoiseSamplesAVX2(state), readVarianceVector, shotScaleVector);
+			__m256i levels1 = AddNoiseAVX2(_mm256_extracti128_si256(values0, 1), NoiseSamplesAVX2(state), readVarianceVector, shotScaleVector);
+			__m256i levels2 = AddNoiseAVX2(_mm256_castsi256_si128(values1), NoiseSamplesAVX2(state), readVarianceVector, shotScaleVector);
+			__m256i levels3 = AddNoiseAVX2(_mm256_extracti128_si256(values1, 1), NoiseSamplesAVX2(state), readVarianceVector, shotScaleVector);
+
+			// The packs work within 128-bit lanes, so the 64-bit quarters are put back in order after each.
+			__m256i words0 = _mm256_permute4x64_epi64(_mm256_packs_epi32(levels0, levels1), 0xD8);
+			__m256i words1 = _mm256_permute4x64_epi64(_mm256_packs_epi32(levels2, levels3), 0xD8);
+			result = _mm256_permute4x64_epi64(_mm256_packus_epi16(words0, words1), 0xD8);
+		}
+		else
+		{
+			result = _mm256_permute4x64_epi64(_mm256_packus_epi16(values0, values1), 0xD8);
+		}
+
+		result = _mm256_blendv_epi8(result, pixels, alphaMask);
+		_mm256_storeu_si256((__m256i*)(pPixels + x * 4), result);
+	}
+
+	_mm256_storeu_si256((__m256i*)pNoiseState, state);
+	return x;
+}
+
+#endif
+
+
+SensorIsp::SensorIsp()
+{
+	m_bUseAVX2 = CpuSupportsAVX2();
+	UpdateGains();
+}
+
+void SensorIsp::SetSettings(const SensorIspSettings& settings)
+{
+	bool bVignettingChanged = (settings.vignetting != m_settings.vignetting);
+	m_settings = settings;
+	UpdateGains();
+
+	if (bVignettingChanged && m_textureWidth > 0)
+	{
+		// Forces the map to be rebuilt.
+		CameraRig rig = m_rig;
+		m_textureWidth = 0;
+		Configure(rig);
+	}
+}
+
+void SensorIsp::UpdateGains()
+{
+	float exposureScale = m_settings.exposureMs / ISP_REFERENCE_EXPOSURE_MS;
+
+	for (int channel = 0; channel < 3; channel++)
+	{
+		float gain = (std::min)(exposureScale * m_settings.gain * m_settings.whiteBalance[channel], ISP_MAX_CHANNEL_GAIN);
+		m_channelGains[channel] = (int16_t)lrintf(gain * 256.0f);
+	}
+	m_channelGains[3] = 256;
+
+	// Shot noise variance grows linearly with the analog gain, read noise deviation proportionally.
+	float readSigma = m_settings.readNoise * m_settings.gain;
+	m_readVariance = readSigma * readSigma;
+	m_shotScale = m_settings.shotNoise * m_settings.gain;
+}
+
+void SensorIsp::Configure(const CameraRig& rig)
+{
+	bool bChanged = (rig.textureWidth != m_textureWidth || rig.textureHeight != m_textureHeight || rig.numCameras != m_rig.numCameras);
+
+	for (uint32_t camera = 0; camera < rig.numCameras && !bChanged; camera++)
+	{
+		bChanged = rig.focalX[camera] != m_rig.focalX[camera] || rig.focalY[camera] != m_rig.focalY[camera] ||
+			rig.centerX[camera] != m_rig.centerX[camera] || rig.centerY[camera] != m_rig.centerY[camera] ||
+			rig.regions[camera].x != m_rig.regions[camera].x || rig.regions[camera].y != m_rig.regions[camera].y;
+	}
+
+	if (!bChanged)
+	{
+		return;
+	}
+
+	m_rig = rig;
+	m_textureWidth = rig.textureWidth;
+	m_textureHeight = rig.textureHeight;
+	m_shadingMap.assign((size_t)m_textureWidth * m_textureHeight, 32767);
+
+	// Relative illumination of a pinhole camera falls off with cos^4 of the angle from the optical axis.
+	for (uint32_t camera = 0; camera < rig.numCameras; camera++)
+	{
+		const CameraRegion& region = rig.regions[camera];
+
+		for (uint32_t y = 0; y < region.height; y++)
+		{
+			float dy = (y + 0.5f - rig.centerY[camera]) / rig.focalY[camera];
+			uint16_t* pRow = &m_shadingMap[(size_t)(region.y + y) * m_textureWidth + region.x];
+
+			for (uint32_t x = 0; x < region.width; x++)
+			{
+				float dx = (x + 0.5f - rig.centerX[camera]) / rig.focalX[camera];
+				float cos2 = 1.0f / (1.0f + dx * dx + dy * dy);
+				float shading = 1.0f - m_settings.vignetting * (1.0f - cos2 * cos2);
+				pRow[x] = (uint16_t)lrintf(shading * 32767.0f);
+			}
+		}
+	}
+}
+
+void SensorIsp::ProcessTile(uint8_t* pBuffer, uint32_t tile, uint64_t frameCount, bool bNoise)
+{
+	uint32_t firstRow = tile * ISP_TILE_ROWS;
+	uint32_t endRow = (std::min)(firstRow + ISP_TILE_ROWS, m_textureHeight);
+
+	// Seeded from the frame and tile, so the noise is independent of which thread runs the tile.
+	uint32_t noiseState[ISP_NOISE_LANES];
+	uint64_t seed = frameCount * 0x9E3779B97F4A7C15ull + tile * 0xBF58476D1CE4E5B9ull;
+	for (int lane = 0; lane < ISP_NOISE_LANES; lane++)
+	{
+		seed += 0x9E3779B97F4A7C15ull;
+		uint64_t z = seed;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		noiseState[lane] = (uint32_t)(z ^ (z >> 31)) | 1;
+	}
+
+	for (uint32_t row = firstRow; row < endRow; row++)
+	{
+		uint8_t* pRow = pBuffer + (size_t)row * m_textureWidth * 4;
+		const uint16_t* pShading = &m_shadingMap[(size_t)row * m_textureWidth];
+		uint32_t x = 0;
+
+#ifdef CPU_X86
+		if (m_bUseAVX2)
+		{
+			x = ProcessPixelsAVX2(pRow, pShading, m_textureWidth, m_channelGains, bNoise, m_readVariance, m_shotScale, noiseState);
+		}
+#endif
+
+		ProcessPixelsScalar(pRow + x * 4, pShading + x, m_textureWidth - x, m_channelGains, bNoise, m_readVariance, m_shotScale, noiseState);
+	}
+}
+
+void SensorIsp::Process(uint8_t* pBuffer, uint64_t frameCount, ThreadPool& pool)
+{
+	if (m_shadingMap.empty())
+	{
+		return;
+	}
+
+	LARGE_INTEGER startTime, frequency;
+	QueryPerformanceCounter(&startTime);
+	QueryPerformanceFrequency(&frequency);
+
+	int64_t budgetEnd = startTime.QuadPart + (int64_t)(m_settings.budgetMs * 0.001 * frequency.QuadPart);
+	bool bNoise = m_settings.HasNoise();
+	uint32_t numTiles = (m_textureHeight + ISP_TILE_ROWS - 1) / ISP_TILE_ROWS;
+
+	m_tilesOverBudget = 0;
+
+	pool.ParallelFor(numTiles, [&](uint32_t tile)
+	{
+		// The noise is the expensive part, so late tiles drop it rather than delay the frame.
+		bool bTileNoise = bNoise;
+		if (bNoise)
+		{
+			LARGE_INTEGER currTime;
+			QueryPerformanceCounter(&currTime);
+			if (currTime.QuadPart > budgetEnd)
+			{
+				bTileNoise = false;
+				m_tilesOverBudget++;
+			}
+		}
+
+		ProcessTile(pBuffer, tile, frameCount, bTileNoise);
+	});
+
+	LARGE_INTEGER endTime;
+	QueryPerformanceCounter(&endTime);
+	double elapsedMs = (endTime.QuadPart - startTime.QuadPart) * 1000.0 / frequency.QuadPart;
+
+	std::lock_guard<std::mutex> lock(m_statsMutex);
+	m_stats.frames++;
+	m_stats.tilesOverBudget += m_tilesOverBudget;
+	m_stats.lastMs = elapsedMs;
+	m_stats.maxMs = (std::max)(m_stats.maxMs, elapsedMs);
+}
+
+SensorIspStats SensorIsp::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_statsMutex);
+	return m_stats;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "camera_rig.h"
+#include "thread_pool.h"
+
+
+// Exposure time that leaves the rendered brightness unchanged.
+#define ISP_REFERENCE_EXPOSURE_MS 8.0f
+
+// Highest combined exposure, gain and white balance multiplier, limited by the fixed point kernels.
+#define ISP_MAX_CHANNEL_GAIN 15.0f
+
+#define ISP_DEFAULT_BUDGET_MS 2.0f
+
+// Texture rows per parallel tile.
+#define ISP_TILE_ROWS 32
+
+
+struct SensorIspSettings
+{
+	bool bEnabled = false;
+
+	// Scales the brightness relative to ISP_REFERENCE_EXPOSURE_MS.
+	float exposureMs = ISP_REFERENCE_EXPOSURE_MS;
+
+	// Analog gain. Scales the noise along with the signal.
+	float gain = 1.0f;
+
+	// Red, green and blue multipliers.
+	float whiteBalance[3] = { 1.0f, 1.0f, 1.0f };
+
+	// Fraction of the cos^4 lens falloff applied, from 0 to 1.
+	float vignetting = 0.0f;
+
+	// Shot noise variance per unit of signal, and read noise standard deviation, both in 8-bit levels at unit gain.
+	float shotNoise = 0.0f;
+	float readNoise = 0.0f;
+
+	// Tiles that start after this much time into the frame skip the noise.
+	float budgetMs = ISP_DEFAULT_BUDGET_MS;
+
+	// Reads the isp_* driver settings, and the runtime's forced exposure, gain and white balance if set.
+	static SensorIspSettings Load();
+
+	bool HasNoise() const { return shotNoise > 0.0f || readNoise > 0.0f; }
+};
+
+struct SensorIspStats
+{
+	uint64_t frames;
+	uint64_t tilesOverBudget;
+	double lastMs;
+	double maxMs;
+};
+
+
+// Simulates the camera sensor and image signal processor on rendered RGBX32 frames:
+// exposure and gain, white balance, lens shading from a precomputed map, and shot and read noise.
+// Runs in row tiles on the render pool, with AVX2 kernels when available.
+// Noise is generated with a per-lane xorshift generator, and made roughly Gaussian by summing four random bytes.
+class SensorIsp
+{
+public:
+	SensorIsp();
+
+	void SetSettings(const SensorIspSettings& settings);
+	const SensorIspSettings& GetSettings() const { return m_settings; }
+
+	// Builds the lens shading map for the camera regions of the rig. Does nothing if the rig hasn't changed.
+	void Configure(const CameraRig& rig);
+
+	// Processes the frame in place.
+	void Process(uint8_t* pBuffer, uint64_t frameCount, ThreadPool& pool);
+
+	SensorIspStats GetStats();
+	bool IsUsingAVX2() const { return m_bUseAVX2; }
+
+protected:
+	void UpdateGains();
+	void ProcessTile(uint8_t* pBuffer, uint32_t tile, uint64_t frameCount, bool bNoise);
+
+	SensorIspSettings m_settings;
+	bool m_bUseAVX2 = false;
+
+	CameraRig m_rig = {};
+	uint32_t m_textureWidth = 0;
+	uint32_t m_textureHeight = 0;
+
+	// Per texture pixel lens shading, 1.0 = 32767.
+	std::vector<uint16_t> m_shadingMap;
+
+	// Per channel multipliers in 8 bit fixed point, X left at 1.0.
+	int16_t m_channelGains[4] = {};
+
+	// Noise variance as a function of the signal level: readVariance + shotScale * level.
+	float m_readVariance = 0.0f;
+	float m_shotScale = 0.0f;
+
+	std::mutex m_statsMutex;
+	SensorIspStats m_stats = {};
+	std::atomic<uint32_t> m_tilesOverBudget = 0;
+};
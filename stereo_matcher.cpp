@@ -0,0 +1,548 @@
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include "stereo_matcher.h"
+
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include "cpu_features.h"
+
+
+#define STEREO_CENSUS_RADIUS 2
+#define STEREO_CENSUS_BITS 24
+
+
+static inline uint32_t PopCount32(uint32_t value)
+{
+	value = value - ((value >> 1) & 0x55555555);
+	value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+	return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+
+// Hamming distances between the left census row and the right row shifted by the disparity, for x in [disparity, width).
+static void HammingRowScalar(const uint32_t* pLeft, const uint32_t* pRight, uint16_t* pCosts, uint32_t width, uint32_t disparity)
+{
+	for (uint32_t x = disparity; x < width; x++)
+	{
+		pCosts[x] = (uint16_t)PopCount32(pLeft[x] ^ pRight[x - disparity]);
+	}
+}
+
+// Index of the lowest cost disparity for each pixel, costs laid out as [disparity][x].
+static void WinnerTakesAllScalar(const uint16_t* pCosts, uint16_t* pBestDisparity, uint32_t width, uint32_t numDisparities)
+{
+	for (uint32_t x = 0; x < width; x++)
+	{
+		uint16_t bestCost = 0xFFFF;
+		uint16_t bestDisparity = 0;
+		for (uint32_t d = 0; d < numDisparities; d++)
+		{
+			uint16_t cost = pCosts[d * width + x];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestDisparity = (uint16_t)d;
+			}
+		}
+		pBestDisparity[x] = bestDisparity;
+	}
+}
+
+// Box sum of 2 * STEREO_AGGREGATION_RADIUS + 1 costs. The input row is padded by the radius on both sides.
+static void HorizontalBoxScalar(const uint16_t* pPaddedCosts, uint16_t* pOut, uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++)
+	{
+		uint32_t sum = 0;
+		for (uint32_t k = 0; k < 2 * STEREO_AGGREGATION_RADIUS + 1; k++)
+		{
+			sum += pPaddedCosts[x + k];
+		}
+		pOut[x] = (uint16_t)sum;
+	}
+}
+
+// Slides the vertical aggregation window: adds the entering cost row and subtracts the leaving one, if any.
+static void SlideWindowScalar(uint16_t* pAggregated, const uint16_t* pEntering, const uint16_t* pLeaving, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		pAggregated[i] = (uint16_t)(pAggregated[i] + (pEntering ? pEntering[i] : 0) - (pLeaving ? pLeaving[i] : 0));
+	}
+}
+
+#ifdef CPU_X86
+
+// Per 32-bit lane population count using the nibble lookup method, since AVX2 has no vector popcount.
+CPU_TARGET_AVX2 static inline __m256i PopCount32AVX2(__m256i value)
+{
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i lowMask = _mm256_set1_epi8(0x0F);
+
+	__m256i low = _mm256_and_si256(value, lowMask);
+	__m256i high = _mm256_and_si256(_mm256_srli_epi16(value, 4), lowMask);
+	__m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+
+	__m256i words = _mm256_maddubs_epi16(bytes, _mm256_set1_epi8(1));
+	return _mm256_madd_epi16(words, _mm256_set1_epi16(1));
+}
+
+CPU_TARGET_AVX2 static void HammingRowAVX2(const uint32_t* pLeft, const uint32_t* pRight, uint16_t* pCosts, uint32_t width, uint32_t disparity)
+{
+	uint32_t x = disparity;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i left0 = _mm256_loadu_si256((const __m256i*)(pLeft + x));
+		__m256i left1 = _mm256_loadu_si256((const __m256i*)(pLeft + x + 8));
+		__m256i right0 = _mm256_loadu_si256((const __m256i*)(pRight + x - disparity));
+		__m256i right1 = _mm256_loadu_si256((const __m256i*)(pRight + x - disparity + 8));
+
+		__m256i count0 = PopCount32AVX2(_mm256_xor_si256(left0, right0));
+		__m256i count1 = PopCount32AVX2(_mm256_xor_si256(left1, right1));
+
+		// The pack works per 128-bit lane, the permute restores the pixel order.
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(count0, count1), 0xD8);
+		_mm256_storeu_si256((__m256i*)(pCosts + x), packed);
+	}
+
+	for (; x < width; x++)
+	{
+		pCosts[x] = (uint16_t)_mm_popcnt_u32(pLeft[x] ^ pRight[x - disparity]);
+	}
+}
+
+CPU_TARGET_AVX2 static void HorizontalBoxAVX2(const uint16_t* pPaddedCosts, uint16_t* pOut, uint32_t width)
+{
+	uint32_t x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i sum = _mm256_loadu_si256((const __m256i*)(pPaddedCosts + x));
+		for (uint32_t k = 1; k < 2 * STEREO_AGGREGATION_RADIUS + 1; k++)
+		{
+			sum = _mm256_add_epi16(sum, _mm256_loadu_si256((const __m256i*)(pPaddedCosts + x + k)));
+		}
+		_mm256_storeu_si256((__m256i*)(pOut + x), sum);
+	}
+
+	HorizontalBoxScalar(pPaddedCosts + x, pOut + x, width - x);
+}
+
+CPU_TARGET_AVX2 static void SlideWindowAVX2(uint16_t* pAggregated, const uint16_t* pEntering, const uint16_t* pLeaving, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i sum = _mm256_loadu_si256((const __m256i*)(pAggregated + i));
+		if (pEntering) { sum = _mm256_add_epi16(sum, _mm256_loadu_si256((const __m256i*)(pEntering + i))); }
+		if (pLeaving) { sum = _mm256_sub_epi16(sum, _mm256_loadu_si256((const __m256i*)(pLeaving + i))); }
+		_mm256_storeu_si256((__m256i*)(pAggregated + i), sum);
+	}
+
+	SlideWindowScalar(pAggregated + i, pEntering ? pEntering + i : nullptr, pLeaving ? pLeaving + i : nullptr, count - i);
+}
+
+CPU_TARGET_AVX2 static void WinnerTakesAllAVX2(const uint16_t* pCosts, uint16_t* pBestDisparity, uint32_t width, uint32_t numDisparities)
+{
+	uint32_t x = 0;
+
+	// Aggregated costs stay well below 0x7FFF, so signed compares are safe.
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i bestCost = _mm256_set1_epi16(0x7FFF);
+		__m256i bestDisparity = _mm256_setzero_si256();
+
+		for (uint32_t d = 0; d < numDisparities; d++)
+		{
+			__m256i cost = _mm256_loadu_si256((const __m256i*)(pCosts + d * width + x));
+			__m256i better = _mm256_cmpgt_epi16(bestCost, cost);
+			bestCost = _mm256_min_epi16(bestCost, cost);
+			bestDisparity = _mm256_blendv_epi8(bestDisparity, _mm256_set1_epi16((short)d), better);
+		}
+
+		_mm256_storeu_si256((__m256i*)(pBestDisparity + x), bestDisparity);
+	}
+
+	for (; x < width; x++)
+	{
+		uint16_t bestCost = 0xFFFF;
+		uint16_t bestDisparity = 0;
+		for (uint32_t d = 0; d < numDisparities; d++)
+		{
+			uint16_t cost = pCosts[d * width + x];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestDisparity = (uint16_t)d;
+			}
+		}
+		pBestDisparity[x] = bestDisparity;
+	}
+}
+
+#endif
+
+
+StereoMatcher::StereoMatcher()
+{
+	m_bUseAVX2 = CpuSupportsAVX2();
+}
+
+void StereoMatcher::Configure(uint32_t viewWidth, uint32_t viewHeight, uint32_t numDisparities)
+{
+	m_width = viewWidth / 2;
+	m_height = viewHeight / 2;
+	m_numDisparities = (std::max)(16u, (numDisparities + 15) / 16 * 16);
+
+	m_leftGray.assign((size_t)m_width * m_height, 0);
+	m_rightGray.assign((size_t)m_width * m_height, 0);
+	m_leftCensus.assign((size_t)m_width * m_height, 0);
+	m_rightCensus.assign((size_t)m_width * m_height, 0);
+	m_disparity.assign((size_t)m_width * m_height, 0);
+
+	uint32_t numBands = (m_height + STEREO_BAND_ROWS - 1) / STEREO_BAND_ROWS;
+	size_t costPlaneSize = (size_t)m_numDisparities * m_width;
+
+	m_bandScratch.resize(numBands);
+	for (BandScratch& scratch : m_bandScratch)
+	{
+		scratch.rowCosts.assign(costPlaneSize * (2 * STEREO_AGGREGATION_RADIUS + 1), 0);
+		scratch.aggregatedCosts.assign(costPlaneSize, 0);
+		scratch.rawCosts.assign(m_width + 2 * STEREO_AGGREGATION_RADIUS, 0);
+		scratch.bestDisparity.assign(m_width, 0);
+	}
+}
+
+void StereoMatcher::SetCameraGeometry(float baseline, float focalX)
+{
+	m_baseline = baseline;
+	m_focalX = focalX;
+}
+
+float StereoMatcher::DisparityToDepth(uint16_t disparity) const
+{
+	if (disparity == 0 || m_baseline <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// The focal length is halved along with the resolution.
+	float halfResDisparity = disparity / (float)(1 << STEREO_DISPARITY_FRACTION_BITS);
+	return m_baseline * (m_focalX * 0.5f) / halfResDisparity;
+}
+
+// Box filtered 2x2 downsample to grayscale.
+void StereoMatcher::DownsampleRows(const uint8_t* pView, uint32_t rowStride, uint8_t* pGray, uint32_t firstRow, uint32_t endRow) const
+{
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		const uint8_t* pRow0 = pView + (size_t)(y * 2) * rowStride;
+		const uint8_t* pRow1 = pRow0 + rowStride;
+		uint8_t* pOut = pGray + (size_t)y * m_width;
+
+		for (uint32_t x = 0; x < m_width; x++)
+		{
+			const uint8_t* p00 = pRow0 + x * 8;
+			const uint8_t* p10 = pRow1 + x * 8;
+
+			uint32_t sum =
+				p00[0] + 2 * p00[1] + p00[2] +
+				p00[4] + 2 * p00[5] + p00[6] +
+				p10[0] + 2 * p10[1] + p10[2] +
+				p10[4] + 2 * p10[5] + p10[6];
+
+			pOut[x] = (uint8_t)(sum >> 4);
+		}
+	}
+}
+
+// 5x5 census transform, one bit per neighbour that is darker than the center. Borders are clamped.
+void StereoMatcher::CensusRows(const uint8_t* pGray, uint32_t* pCensus, uint32_t firstRow, uint32_t endRow) const
+{
+	const int32_t width = (int32_t)m_width;
+	const int32_t height = (int32_t)m_height;
+
+	for (int32_t y = (int32_t)firstRow; y < (int32_t)endRow; y++)
+	{
+		const uint8_t* pRows[2 * STEREO_CENSUS_RADIUS + 1];
+		for (int32_t dy = -STEREO_CENSUS_RADIUS; dy <= STEREO_CENSUS_RADIUS; dy++)
+		{
+			int32_t sampleY = (std::min)((std::max)(y + dy, 0), height - 1);
+			pRows[dy + STEREO_CENSUS_RADIUS] = pGray + (size_t)sampleY * width;
+		}
+
+		for (int32_t x = 0; x < width; x++)
+		{
+			uint8_t center = pRows[STEREO_CENSUS_RADIUS][x];
+			uint32_t census = 0;
+
+			// Clamping is only needed near the left and right edges.
+			if (x >= STEREO_CENSUS_RADIUS && x < width - STEREO_CENSUS_RADIUS)
+			{
+				for (int32_t dy = 0; dy < 2 * STEREO_CENSUS_RADIUS + 1; dy++)
+				{
+					const uint8_t* pSample = pRows[dy] + x - STEREO_CENSUS_RADIUS;
+					for (int32_t dx = 0; dx < 2 * STEREO_CENSUS_RADIUS + 1; dx++)
+					{
+						if (dy == STEREO_CENSUS_RADIUS && dx == STEREO_CENSUS_RADIUS)
+						{
+							continue;
+						}
+						census = (census << 1) | (pSample[dx] < center ? 1 : 0);
+					}
+				}
+			}
+			else
+			{
+				for (int32_t dy = 0; dy < 2 * STEREO_CENSUS_RADIUS + 1; dy++)
+				{
+					for (int32_t dx = -STEREO_CENSUS_RADIUS; dx <= STEREO_CENSUS_RADIUS; dx++)
+					{
+						if (dy == STEREO_CENSUS_RADIUS && dx == 0)
+						{
+							continue;
+						}
+						int32_t sampleX = (std::min)((std::max)(x + dx, 0), width - 1);
+						census = (census << 1) | (pRows[dy][sampleX] < center ? 1 : 0);
+					}
+				}
+			}
+
+			pCensus[(size_t)y * width + x] = census;
+		}
+	}
+}
+
+// Matches one band of output rows. The vertical aggregation window slides down the band, so
+// each cost row is computed once per band plus the window overlap with the neighbouring bands.
+void StereoMatcher::MatchBand(uint32_t band)
+{
+	BandScratch& scratch = m_bandScratch[band];
+
+	const int32_t radius = STEREO_AGGREGATION_RADIUS;
+	const int32_t ringSize = 2 * radius + 1;
+	const uint32_t width = m_width;
+	const uint32_t numDisparities = m_numDisparities;
+	const size_t planeSize = (size_t)numDisparities * width;
+
+	const int32_t firstRow = band * STEREO_BAND_ROWS;
+	const int32_t endRow = (std::min)(firstRow + STEREO_BAND_ROWS, (int32_t)m_height);
+	const int32_t firstInputRow = (std::max)(firstRow - radius, 0);
+
+	uint16_t* pAggregated = scratch.aggregatedCosts.data();
+	uint16_t* pBestDisparity = scratch.bestDisparity.data();
+	// The padding either side of the raw costs stays zero, so the box sum needs no border handling.
+	uint16_t* pRaw = scratch.rawCosts.data() + radius;
+	memset(pAggregated, 0, planeSize * sizeof(uint16_t));
+
+	for (int32_t y = firstRow - radius; y < endRow + radius; y++)
+	{
+		// Drop the row leaving the window before its ring slot is reused.
+		const uint16_t* pLeaving = nullptr;
+		int32_t leavingRow = y - ringSize;
+		if (leavingRow >= firstInputRow && leavingRow < (int32_t)m_height)
+		{
+			pLeaving = scratch.rowCosts.data() + (leavingRow % ringSize) * planeSize;
+		}
+
+		const uint16_t* pEntering = nullptr;
+		if (y >= 0 && y < (int32_t)m_height)
+		{
+			const uint32_t* pLeftCensus = m_leftCensus.data() + (size_t)y * width;
+			const uint32_t* pRightCensus = m_rightCensus.data() + (size_t)y * width;
+			uint16_t* pRowCosts = scratch.rowCosts.data() + (y % ringSize) * planeSize;
+
+			// The leaving row occupies the same ring slot, so subtract it before it is overwritten.
+			if (pLeaving != nullptr)
+			{
+#ifdef CPU_X86
+				if (m_bUseAVX2) { SlideWindowAVX2(pAggregated, nullptr, pLeaving, planeSize); }
+				else
+#endif
+				{
+					SlideWindowScalar(pAggregated, nullptr, pLeaving, planeSize);
+				}
+				pLeaving = nullptr;
+			}
+
+			for (uint32_t d = 0; d < numDisparities; d++)
+			{
+				uint16_t* pDisparityRaw = pRaw;
+				uint16_t* pDisparityCosts = pRowCosts + d * width;
+
+				// Pixels whose match would fall outside the right view.
+				for (uint32_t x = 0; x < d && x < width; x++)
+				{
+					pDisparityRaw[x] = STEREO_CENSUS_BITS;
+				}
+
+#ifdef CPU_X86
+				if (m_bUseAVX2)
+				{
+					HammingRowAVX2(pLeftCensus, pRightCensus, pDisparityRaw, width, d);
+					HorizontalBoxAVX2(pDisparityRaw - radius, pDisparityCosts, width);
+				}
+				else
+#endif
+				{
+					HammingRowScalar(pLeftCensus, pRightCensus, pDisparityRaw, width, d);
+					HorizontalBoxScalar(pDisparityRaw - radius, pDisparityCosts, width);
+				}
+			}
+
+			pEntering = pRowCosts;
+		}
+
+		if (pEntering || pLeaving)
+		{
+#ifdef CPU_X86
+			if (m_bUseAVX2) { SlideWindowAVX2(pAggregated, pEntering, pLeaving, planeSize); }
+			else
+#endif
+			{
+				SlideWindowScalar(pAggregated, pEntering, pLeaving, planeSize);
+			}
+		}
+
+		int32_t outputRow = y - radius;
+		if (outputRow < firstRow || outputRow >= endRow)
+		{
+			continue;
+		}
+
+#ifdef CPU_X86
+		if (m_bUseAVX2)
+		{
+			WinnerTakesAllAVX2(pAggregated, pBestDisparity, width, numDisparities);
+		}
+		else
+#endif
+		{
+			WinnerTakesAllScalar(pAggregated, pBestDisparity, width, numDisparities);
+		}
+
+		// Parabola fit through the neighbouring costs for subpixel precision.
+		uint16_t* pOut = m_disparity.data() + (size_t)outputRow * width;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			uint32_t d = pBestDisparity[x];
+			if (d == 0 || d >= numDisparities - 1 || x < d)
+			{
+				pOut[x] = 0;
+				continue;
+			}
+
+			float costPrev = pAggregated[(d - 1) * width + x];
+			float cost = pAggregated[d * width + x];
+			float costNext = pAggregated[(d + 1) * width + x];
+			float denominator = costPrev - 2.0f * cost + costNext;
+			float offset = (denominator > 0.0f) ? (costPrev - costNext) / (2.0f * denominator) : 0.0f;
+
+			pOut[x] = (uint16_t)((d + offset) * (1 << STEREO_DISPARITY_FRACTION_BITS) + 0.5f);
+		}
+	}
+}
+
+void StereoMatcher::Compute(const uint8_t* pLeftView, const uint8_t* pRightView, uint32_t rowStride, const StereoParallelFor& parallelFor)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	auto runTasks = [&](uint32_t numTasks, const std::function<void(uint32_t)>& task)
+	{
+		if (parallelFor)
+		{
+			parallelFor(numTasks, task);
+		}
+		else
+		{
+			for (uint32_t i = 0; i < numTasks; i++)
+			{
+				task(i);
+			}
+		}
+	};
+
+	const uint32_t numBands = (uint32_t)m_bandScratch.size();
+
+	// The census needs the rows around each band, so each stage completes before the next starts.
+	runTasks(numBands, [&](uint32_t band)
+	{
+		uint32_t firstRow = band * STEREO_BAND_ROWS;
+		uint32_t endRow = (std::min)(firstRow + STEREO_BAND_ROWS, m_height);
+		DownsampleRows(pLeftView, rowStride, m_leftGray.data(), firstRow, endRow);
+		DownsampleRows(pRightView, rowStride, m_rightGray.data(), firstRow, endRow);
+	});
+
+	runTasks(numBands, [&](uint32_t band)
+	{
+		uint32_t firstRow = band * STEREO_BAND_ROWS;
+		uint32_t endRow = (std::min)(firstRow + STEREO_BAND_ROWS, m_height);
+		CensusRows(m_leftGray.data(), m_leftCensus.data(), firstRow, endRow);
+		CensusRows(m_rightGray.data(), m_rightCensus.data(), firstRow, endRow);
+	});
+
+	runTasks(numBands, [&](uint32_t band)
+	{
+		MatchBand(band);
+	});
+
+	UpdateStats();
+
+	m_stats.computeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void StereoMatcher::UpdateStats()
+{
+	std::vector<uint32_t> histogram((size_t)m_numDisparities << STEREO_DISPARITY_FRACTION_BITS, 0);
+
+	uint64_t disparitySum = 0;
+	uint32_t validPixels = 0;
+
+	for (uint16_t disparity : m_disparity)
+	{
+		if (disparity == 0 || disparity >= histogram.size())
+		{
+			continue;
+		}
+		histogram[disparity]++;
+		disparitySum += disparity;
+		validPixels++;
+	}
+
+	m_stats.validPixels = validPixels;
+	m_stats.totalPixels = m_width * m_height;
+	m_stats.meanDisparity = validPixels ? (float)disparitySum / validPixels / (1 << STEREO_DISPARITY_FRACTION_BITS) : 0.0f;
+	m_stats.medianDepth = 0.0f;
+
+	uint32_t accumulated = 0;
+	for (size_t i = 0; i < histogram.size(); i++)
+	{
+		accumulated += histogram[i];
+		if (accumulated * 2 >= validPixels && validPixels > 0)
+		{
+			m_stats.medianDepth = DisparityToDepth((uint16_t)i);
+			break;
+		}
+	}
+}
+
+void StereoMatcher::RenderDisparity(uint8_t* pView, uint32_t rowStride) const
+{
+	const uint32_t maxDisparity = m_numDisparities << STEREO_DISPARITY_FRACTION_BITS;
+
+	for (uint32_t y = 0; y < m_height * 2; y++)
+	{
+		const uint16_t* pDisparityRow = m_disparity.data() + (size_t)(y / 2) * m_width;
+		uint32_t* pOut = (uint32_t*)(pView + (size_t)y * rowStride);
+
+		for (uint32_t x = 0; x < m_width * 2; x++)
+		{
+			uint32_t value = pDisparityRow[x / 2] * 255 / maxDisparity;
+			pOut[x] = 0xFF000000 | (value << 16) | (value << 8) | value;
+		}
+	}
+}
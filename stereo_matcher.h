@@ -0,0 +1,102 @@
+#pragma once
+
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+
+// Maximum disparity searched, in half resolution pixels. Must be a multiple of 16.
+#define STEREO_DEFAULT_DISPARITIES 64
+
+// Radius of the box filter the matching costs are aggregated over.
+#define STEREO_AGGREGATION_RADIUS 2
+
+// Output rows per parallel task.
+#define STEREO_BAND_ROWS 16
+
+// Disparities are stored in fixed point with this many fractional bits. Zero marks an invalid match.
+#define STEREO_DISPARITY_FRACTION_BITS 4
+
+
+// Runs task(0) to task(numTasks - 1) and returns when all have finished.
+typedef std::function<void(uint32_t numTasks, const std::function<void(uint32_t)>& task)> StereoParallelFor;
+
+struct StereoStats
+{
+	uint32_t validPixels;
+	uint32_t totalPixels;
+	float meanDisparity;
+	float medianDepth;
+	double computeMs;
+};
+
+
+// Census transform block matcher for rectified stereo pairs in RGBX32 frames.
+// Works at half resolution: the views are downsampled to grayscale, census transformed with a 5x5 window,
+// matched with Hamming distance costs aggregated over a box window, and the best disparity refined to subpixel.
+// Uses AVX2 kernels when the CPU supports them.
+class StereoMatcher
+{
+public:
+	StereoMatcher();
+
+	// Full resolution size of a single camera view.
+	void Configure(uint32_t viewWidth, uint32_t viewHeight, uint32_t numDisparities = STEREO_DEFAULT_DISPARITIES);
+
+	// Baseline between the cameras in meters, and the horizontal focal length in full resolution pixels.
+	void SetCameraGeometry(float baseline, float focalX);
+
+	// Matches the views at the given pointers, with stride in bytes between rows.
+	// Without a parallel for function the work runs on the calling thread.
+	void Compute(const uint8_t* pLeftView, const uint8_t* pRightView, uint32_t rowStride, const StereoParallelFor& parallelFor = nullptr);
+
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	uint32_t GetNumDisparities() const { return m_numDisparities; }
+	bool IsUsingAVX2() const { return m_bUseAVX2; }
+
+	// Half resolution disparity map of the left view, fixed point with STEREO_DISPARITY_FRACTION_BITS.
+	const std::vector<uint16_t>& GetDisparity() const { return m_disparity; }
+
+	// Depth in meters along the camera axis for a fixed point disparity, or 0 for invalid ones.
+	float DisparityToDepth(uint16_t disparity) const;
+
+	const StereoStats& GetStats() const { return m_stats; }
+
+	// Writes the disparity as grayscale RGBX32 upscaled to the full resolution view size, nearer being brighter.
+	void RenderDisparity(uint8_t* pView, uint32_t rowStride) const;
+
+protected:
+	void DownsampleRows(const uint8_t* pView, uint32_t rowStride, uint8_t* pGray, uint32_t firstRow, uint32_t endRow) const;
+	void CensusRows(const uint8_t* pGray, uint32_t* pCensus, uint32_t firstRow, uint32_t endRow) const;
+	void MatchBand(uint32_t band);
+	void UpdateStats();
+
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	uint32_t m_numDisparities = 0;
+	bool m_bUseAVX2 = false;
+
+	float m_baseline = 0.0f;
+	float m_focalX = 0.0f;
+
+	std::vector<uint8_t> m_leftGray;
+	std::vector<uint8_t> m_rightGray;
+	std::vector<uint32_t> m_leftCensus;
+	std::vector<uint32_t> m_rightCensus;
+	std::vector<uint16_t> m_disparity;
+
+	// Per band scratch: a ring of horizontally aggregated cost rows and their vertical sum, both [disparity][x],
+	// and the winning disparity of each pixel in the current row.
+	struct BandScratch
+	{
+		std::vector<uint16_t> rowCosts;
+		std::vector<uint16_t> aggregatedCosts;
+		std::vector<uint16_t> rawCosts;
+		std::vector<uint16_t> bestDisparity;
+	};
+	std::vector<BandScratch> m_bandScratch;
+
+	StereoStats m_stats = {};
+};
@@ -0,0 +1,384 @@
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include "stereo_rectify.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "cpu_features.h"
+
+
+#define RECTIFY_WEIGHT_ONE (1 << RECTIFY_WEIGHT_BITS)
+#define RECTIFY_INVALID_WEIGHTS 0xFFFF
+
+
+static void Normalize(float vector[3])
+{
+	float length = sqrtf(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+	if (length > 0.0f)
+	{
+		vector[0] /= length;
+		vector[1] /= length;
+		vector[2] /= length;
+	}
+}
+
+static float Dot(const float a[3], const float b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void Cross(const float a[3], const float b[3], float outVector[3])
+{
+	outVector[0] = a[1] * b[2] - a[2] * b[1];
+	outVector[1] = a[2] * b[0] - a[0] * b[2];
+	outVector[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline int32_t Lerp(int32_t a, int32_t b, int32_t weight)
+{
+	return a + (((b - a) * weight) >> RECTIFY_WEIGHT_BITS);
+}
+
+
+// Bilinear lookups for output pixels [firstX, endX) of a row.
+static void RemapRowScalar(const uint8_t* pSource, uint32_t sourceRowStride, const uint32_t* pCoords, const uint16_t* pWeights, uint8_t* pOutput, uint32_t firstX, uint32_t endX)
+{
+	for (uint32_t x = firstX; x < endX; x++)
+	{
+		uint8_t* pPixel = pOutput + (size_t)x * 4;
+
+		if (pWeights[x] == RECTIFY_INVALID_WEIGHTS)
+		{
+			memset(pPixel, 0, 4);
+			continue;
+		}
+
+		int32_t weightX = pWeights[x] & 0xFF;
+		int32_t weightY = pWeights[x] >> 8;
+
+		const uint8_t* pTop = pSource + (size_t)(pCoords[x] >> 16) * sourceRowStride + (size_t)(pCoords[x] & 0xFFFF) * 4;
+		const uint8_t* pBottom = pTop + sourceRowStride;
+
+		for (uint32_t channel = 0; channel < 4; channel++)
+		{
+			int32_t top = Lerp(pTop[channel], pTop[channel + 4], weightX);
+			int32_t bottom = Lerp(pBottom[channel], pBottom[channel + 4], weightX);
+			pPixel[channel] = (uint8_t)Lerp(top, bottom, weightY);
+		}
+	}
+}
+
+
+#ifdef CPU_X86
+
+// 8 pixels at a time from firstX, gathering the four neighbours of each. Returns where the scalar kernel has to continue.
+// The source row stride must be a multiple of 4 bytes, which RGBX32 rows always are.
+CPU_TARGET_AVX2 static uint32_t RemapRowAVX2(const uint8_t* pSource, uint32_t sourceRowStride, const uint32_t* pCoords, const uint16_t* pWeights, uint8_t* pOutput, uint32_t firstX, uint32_t endX)
+{
+	const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+	const __m256i byteMask = _mm256_set1_epi32(0xFF);
+	const __m256i invalid = _mm256_set1_epi32(RECTIFY_INVALID_WEIGHTS);
+	const __m256i stride = _mm256_set1_epi32((int)(sourceRowStride / 4));
+	const __m256i zero = _mm256_setzero_si256();
+
+	const int* pTop = (const int*)pSource;
+	const int* pBottom = (const int*)(pSource + sourceRowStride);
+
+	uint32_t x = firstX;
+	for (; x + 8 <= endX; x += 8)
+	{
+		__m256i coords = _mm256_loadu_si256((const __m256i*)(pCoords + x));
+		__m256i weights = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(pWeights + x)));
+		__m256i invalidMask = _mm256_cmpeq_epi32(weights, invalid);
+
+		// Pixels without a source have zero coordinates, so the gathers stay inside the view.
+		__m256i index = _mm256_add_epi32(_mm256_and_si256(coords, lowMask), _mm256_mullo_epi32(_mm256_srli_epi32(coords, 16), stride));
+
+		__m256i topLeft = _mm256_i32gather_epi32(pTop, index, 4);
+		__m256i topRight = _mm256_i32gather_epi32(pTop + 1, index, 4);
+		__m256i bottomLeft = _mm256_i32gather_epi32(pBottom, index, 4);
+		__m256i bottomRight = _mm256_i32gather_epi32(pBottom + 1, index, 4);
+
+		// Each weight repeated in the four 16 bit channels of its pixel, in the order the pixels unpack in.
+		__m256i weightX = _mm256_and_si256(weights, byteMask);
+		__m256i weightY = _mm256_srli_epi32(weights, 8);
+		weightX = _mm256_or_si256(weightX, _mm256_slli_epi32(weightX, 16));
+		weightY = _mm256_or_si256(weightY, _mm256_slli_epi32(weightY, 16));
+
+		__m256i halves[2];
+		for (int half = 0; half < 2; half++)
+		{
+			__m256i a, b, c, d, wx, wy;
+			if (half == 0)
+			{
+				a = _mm256_unpacklo_epi8(topLeft, zero);
+				b = _mm256_unpacklo_epi8(topRight, zero);
+				c = _mm256_unpacklo_epi8(bottomLeft, zero);
+				d = _mm256_unpacklo_epi8(bottomRight, zero);
+				wx = _mm256_unpacklo_epi32(weightX, weightX);
+				wy = _mm256_unpacklo_epi32(weightY, weightY);
+			}
+			else
+			{
+				a = _mm256_unpackhi_epi8(topLeft, zero);
+				b = _mm256_unpackhi_epi8(topRight, zero);
+				c = _mm256_unpackhi_epi8(bottomLeft, zero);
+				d = _mm256_unpackhi_epi8(bottomRight, zero);
+				wx = _mm256_unpackhi_epi32(weightX, weightX);
+				wy = _mm256_unpackhi_epi32(weightY, weightY);
+			}
+
+			__m256i top = _mm256_add_epi16(a, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(b, a), wx), RECTIFY_WEIGHT_BITS));
+			__m256i bottom = _mm256_add_epi16(c, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(d, c), wx), RECTIFY_WEIGHT_BITS));
+			halves[half] = _mm256_add_epi16(top, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(bottom, top), wy), RECTIFY_WEIGHT_BITS));
+		}
+
+		// Packing within lanes puts the pixels back in order.
+		__m256i result = _mm256_andnot_si256(invalidMask, _mm256_packus_epi16(halves[0], halves[1]));
+		_mm256_storeu_si256((__m256i*)(pOutput + (size_t)x * 4), result);
+	}
+
+	return x;
+}
+
+#endif
+
+
+StereoRectifier::StereoRectifier()
+{
+	m_bUseAVX2 = CpuSupportsAVX2();
+}
+
+bool StereoRectifier::Configure(const StereoRectifyCamera& first, const StereoRectifyCamera& second, uint32_t viewWidth, uint32_t viewHeight, const StereoParallelFor& parallelFor)
+{
+	m_width = 0;
+	m_height = 0;
+
+	if (viewWidth < 2 || viewHeight < 2 || viewWidth > 0xFFFF || viewHeight > 0xFFFF)
+	{
+		return false;
+	}
+
+	const StereoRectifyCamera* cameras[2] = { &first, &second };
+
+	float baseline[3];
+	float meanX[3];
+	float meanZ[3];
+	for (int i = 0; i < 3; i++)
+	{
+		baseline[i] = second.cameraToHead[i][3] - first.cameraToHead[i][3];
+		meanX[i] = first.cameraToHead[i][0] + second.cameraToHead[i][0];
+		meanZ[i] = first.cameraToHead[i][2] + second.cameraToHead[i][2];
+	}
+
+	m_baseline = sqrtf(Dot(baseline, baseline));
+	if (m_baseline < 1e-6f)
+	{
+		return false;
+	}
+
+	// The rectified X axis runs along the baseline in the direction the cameras mostly face right,
+	// so neither view gets mirrored. Z is the mean of the camera Z axes made perpendicular to it.
+	float axisX[3] = { baseline[0], baseline[1], baseline[2] };
+	Normalize(axisX);
+
+	m_bFirstViewLeft = Dot(axisX, meanX) >= 0.0f;
+	if (!m_bFirstViewLeft)
+	{
+		axisX[0] = -axisX[0];
+		axisX[1] = -axisX[1];
+		axisX[2] = -axisX[2];
+	}
+
+	float alongX = Dot(meanZ, axisX);
+	float axisZ[3] = { meanZ[0] - alongX * axisX[0], meanZ[1] - alongX * axisX[1], meanZ[2] - alongX * axisX[2] };
+	Normalize(axisZ);
+
+	float axisY[3];
+	Cross(axisZ, axisX, axisY);
+
+	const float* headToRectified[3] = { axisX, axisY, axisZ };
+
+	for (uint32_t view = 0; view < 2; view++)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			for (int col = 0; col < 3; col++)
+			{
+				const float* pHeadRow = headToRectified[row];
+				m_rotation[view][row][col] = pHeadRow[0] * cameras[view]->cameraToHead[0][col] + pHeadRow[1] * cameras[view]->cameraToHead[1][col] + pHeadRow[2] * cameras[view]->cameraToHead[2][col];
+			}
+		}
+	}
+
+	m_focal = (first.focalX + first.focalY + second.focalX + second.focalY) / 4.0f;
+	m_centerX = (viewWidth - 1) / 2.0f;
+	m_centerY = (viewHeight - 1) / 2.0f;
+
+	for (uint32_t view = 0; view < 2; view++)
+	{
+		m_mapCoords[view].resize((size_t)viewWidth * viewHeight);
+		m_mapWeights[view].resize((size_t)viewWidth * viewHeight);
+	}
+
+	m_width = viewWidth;
+	m_height = viewHeight;
+
+	uint32_t numBands = (viewHeight + RECTIFY_BAND_ROWS - 1) / RECTIFY_BAND_ROWS;
+	auto buildBand = [&](uint32_t task)
+	{
+		uint32_t view = task / numBands;
+		uint32_t firstRow = (task % numBands) * RECTIFY_BAND_ROWS;
+		BuildMapRows(view, *cameras[view], firstRow, (std::min)(firstRow + RECTIFY_BAND_ROWS, viewHeight));
+	};
+
+	if (parallelFor)
+	{
+		parallelFor(numBands * 2, buildBand);
+	}
+	else
+	{
+		for (uint32_t task = 0; task < numBands * 2; task++)
+		{
+			buildBand(task);
+		}
+	}
+
+	return true;
+}
+
+// Traces each output pixel back through the rectifying rotation and the lens model of the camera to its source pixel.
+void StereoRectifier::BuildMapRows(uint32_t view, const StereoRectifyCamera& camera, uint32_t firstRow, uint32_t endRow)
+{
+	const float (&rotation)[3][3] = m_rotation[view];
+	const float maxX = (float)(m_width - 1);
+	const float maxY = (float)(m_height - 1);
+
+	for (uint32_t y = firstRow; y < endRow; y++)
+	{
+		uint32_t* pCoords = m_mapCoords[view].data() + (size_t)y * m_width;
+		uint16_t* pWeights = m_mapWeights[view].data() + (size_t)y * m_width;
+
+		float rectifiedY = -(y - m_centerY) / m_focal;
+
+		for (uint32_t x = 0; x < m_width; x++)
+		{
+			float rectified[3] = { (x - m_centerX) / m_focal, rectifiedY, -1.0f };
+
+			// The transpose takes the rectified ray back to the camera.
+			float ray[3];
+			for (int i = 0; i < 3; i++)
+			{
+				ray[i] = rotation[0][i] * rectified[0] + rotation[1][i] * rectified[1] + rotation[2][i] * rectified[2];
+			}
+
+			pCoords[x] = 0;
+			pWeights[x] = RECTIFY_INVALID_WEIGHTS;
+
+			if (ray[2] >= -1e-6f)
+			{
+				continue;
+			}
+
+			// Image plane coordinates with Y down.
+			float planeX = ray[0] / -ray[2];
+			float planeY = ray[1] / ray[2];
+
+			if (camera.bFisheye)
+			{
+				float radius = sqrtf(planeX * planeX + planeY * planeY);
+				if (radius > 1e-8f)
+				{
+					float theta = atanf(radius);
+					float theta2 = theta * theta;
+					float thetaD = theta * (1.0f + theta2 * ((float)camera.coefficients[0] + theta2 * ((float)camera.coefficients[1] + theta2 * ((float)camera.coefficients[2] + theta2 * (float)camera.coefficients[3]))));
+					planeX *= thetaD / radius;
+					planeY *= thetaD / radius;
+				}
+			}
+
+			float sourceX = camera.focalX * planeX + camera.centerX;
+			float sourceY = camera.focalY * planeY + camera.centerY;
+
+			if (!(sourceX >= 0.0f && sourceX <= maxX && sourceY >= 0.0f && sourceY <= maxY))
+			{
+				continue;
+			}
+
+			// The right and lower neighbours have to be inside the view, so the last column and row are sampled at full weight.
+			uint32_t left = (std::min)((uint32_t)sourceX, m_width - 2);
+			uint32_t top = (std::min)((uint32_t)sourceY, m_height - 2);
+			uint32_t weightX = (uint32_t)lroundf((sourceX - left) * RECTIFY_WEIGHT_ONE);
+			uint32_t weightY = (uint32_t)lroundf((sourceY - top) * RECTIFY_WEIGHT_ONE);
+
+			pCoords[x] = left | (top << 16);
+			pWeights[x] = (uint16_t)(weightX | (weightY << 8));
+		}
+	}
+}
+
+void StereoRectifier::Rectify(const uint8_t* pFirstView, const uint8_t* pSecondView, uint32_t sourceRowStride, uint8_t* pFirstOutput, uint8_t* pSecondOutput, uint32_t outputRowStride, const StereoParallelFor& parallelFor) const
+{
+	if (!IsConfigured())
+	{
+		return;
+	}
+
+	const uint8_t* sources[2] = { pFirstView, pSecondView };
+	uint8_t* outputs[2] = { pFirstOutput, pSecondOutput };
+
+	uint32_t numBands = (m_height + RECTIFY_BAND_ROWS - 1) / RECTIFY_BAND_ROWS;
+	auto rectifyBand = [&](uint32_t task)
+	{
+		uint32_t view = task / numBands;
+		uint32_t firstRow = (task % numBands) * RECTIFY_BAND_ROWS;
+		RectifyRows(view, sources[view], sourceRowStride, outputs[view], outputRowStride, firstRow, (std::min)(firstRow + RECTIFY_BAND_ROWS, m_height));
+	};
+
+	if (parallelFor)
+	{
+		parallelFor(numBands * 2, rectifyBand);
+	}
+	else
+	{
+		for (uint32_t task = 0; task < numBands * 2; task++)
+		{
+			rectifyBand(task);
+		}
+	}
+}
+
+void StereoRectifier::RectifyRows(uint32_t view, const uint8_t* pSourceView, uint32_t sourceRowStride, uint8_t* pOutputView, uint32_t outputRowStride, uint32_t firstRow, uint32_t endRow) const
+{
+	if (!IsConfigured() || view > 1)
+	{
+		return;
+	}
+
+	for (uint32_t tileX = 0; tileX < m_width; tileX += RECTIFY_TILE_WIDTH)
+	{
+		uint32_t endX = (std::min)(tileX + RECTIFY_TILE_WIDTH, m_width);
+
+		for (uint32_t y = firstRow; y < endRow; y++)
+		{
+			const uint32_t* pCoords = m_mapCoords[view].data() + (size_t)y * m_width;
+			const uint16_t* pWeights = m_mapWeights[view].data() + (size_t)y * m_width;
+			uint8_t* pOutputRow = pOutputView + (size_t)y * outputRowStride;
+
+			uint32_t x = tileX;
+#ifdef CPU_X86
+			if (m_bUseAVX2)
+			{
+				x = RemapRowAVX2(pSourceView, sourceRowStride, pCoords, pWeights, pOutputRow, tileX, endX);
+			}
+#endif
+			RemapRowScalar(pSourceView, sourceRowStride, pCoords, pWeights, pOutputRow, x, endX);
+		}
+	}
+}
+
+void StereoRectifier::GetRotation(uint32_t view, float outRotation[3][3]) const
+{
+	memcpy(outRotation, m_rotation[view > 1 ? 1 : view], sizeof(m_rotation[0]));
+}
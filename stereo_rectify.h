@@ -0,0 +1,94 @@
+#pragma once
+
+// Shared between the driver and camera_buffer_snooper, so this does not use the driver precompiled header.
+#include <cstdint>
+#include <vector>
+
+#include "stereo_matcher.h"
+
+
+// Output rows per parallel task. Each task walks its rows in tiles of RECTIFY_TILE_WIDTH columns,
+// so the source rows a tile samples from stay in cache between its rows.
+#define RECTIFY_BAND_ROWS 32
+#define RECTIFY_TILE_WIDTH 128
+
+// Bilinear weights are stored in fixed point with this many fractional bits.
+#define RECTIFY_WEIGHT_BITS 7
+
+
+// Geometry of one camera as published to the runtime. Pixel coordinates are relative to the camera view, with the centers of
+// pixels at integer coordinates.
+struct StereoRectifyCamera
+{
+	float focalX;
+	float focalY;
+	float centerX;
+	float centerY;
+
+	// Set for the FTheta distortion functions, which use the 4 coefficients as in the OpenCV fisheye model.
+	// Left unset when the frames are already undistorted.
+	bool bFisheye;
+	double coefficients[4];
+
+	// Matches Prop_CameraToHeadTransforms_Matrix34_Array, with the camera looking down -Z and Y up.
+	float cameraToHead[3][4];
+};
+
+
+// Builds undistort and rectify remap tables for a pair of cameras, and remaps RGBX32 views with them.
+// The views are rotated to share an image plane with rows parallel to the baseline, and projected with common intrinsics:
+// the mean focal length of both cameras and the principal point at the view center. The tables only change with the camera
+// parameters, so they are built once per change and the per-frame work is a bilinear lookup. Uses AVX2 gathers when the CPU
+// supports them, which give the same results as the scalar kernel.
+class StereoRectifier
+{
+public:
+	StereoRectifier();
+
+	// Builds the tables for views of the given size. Returns false if the cameras share their position.
+	bool Configure(const StereoRectifyCamera& first, const StereoRectifyCamera& second, uint32_t viewWidth, uint32_t viewHeight, const StereoParallelFor& parallelFor = nullptr);
+
+	// Remaps both views at the given pointers to the output views. Output pixels with no source pixel are black.
+	void Rectify(const uint8_t* pFirstView, const uint8_t* pSecondView, uint32_t sourceRowStride, uint8_t* pFirstOutput, uint8_t* pSecondOutput, uint32_t outputRowStride, const StereoParallelFor& parallelFor = nullptr) const;
+
+	// Remaps rows [firstRow, endRow) of one view.
+	void RectifyRows(uint32_t view, const uint8_t* pSourceView, uint32_t sourceRowStride, uint8_t* pOutputView, uint32_t outputRowStride, uint32_t firstRow, uint32_t endRow) const;
+
+	bool IsConfigured() const { return m_width > 0; }
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	bool IsUsingAVX2() const { return m_bUseAVX2; }
+
+	// Rectified intrinsics shared by both views, in pixels.
+	float GetFocalLength() const { return m_focal; }
+	float GetCenterX() const { return m_centerX; }
+	float GetCenterY() const { return m_centerY; }
+
+	float GetBaseline() const { return m_baseline; }
+
+	// Whether the first view is on the left after rectification, the order StereoMatcher expects.
+	bool IsFirstViewLeft() const { return m_bFirstViewLeft; }
+
+	// Rotation from the camera to the rectified frame of a view, in the camera convention of StereoRectifyCamera.
+	void GetRotation(uint32_t view, float outRotation[3][3]) const;
+
+protected:
+	void BuildMapRows(uint32_t view, const StereoRectifyCamera& camera, uint32_t firstRow, uint32_t endRow);
+
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	bool m_bUseAVX2 = false;
+
+	float m_focal = 0.0f;
+	float m_centerX = 0.0f;
+	float m_centerY = 0.0f;
+	float m_baseline = 0.0f;
+	bool m_bFirstViewLeft = true;
+
+	float m_rotation[2][3][3] = {};
+
+	// Per output pixel of each view: the top left source pixel as x | y << 16, and the horizontal and vertical
+	// weights of the pixels right and below as wx | wy << 8. Pixels without a source have weights 0xFFFF.
+	std::vector<uint32_t> m_mapCoords[2];
+	std::vector<uint16_t> m_mapWeights[2];
+};
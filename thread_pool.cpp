@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "thread_pool.h"
+
+
+ThreadPool::~ThreadPool()
+{
+	Stop();
+}
+
+void ThreadPool::Start(uint32_t numThreads, const std::function<void()>& threadInit)
+{
+	Stop();
+
+	m_bStop = false;
+	m_threadInit = threadInit;
+	for (uint32_t i = 0; i < numThreads; i++)
+	{
+		m_threads.emplace_back(&ThreadPool::WorkerLoop, this, m_generation);
+	}
+}
+
+void ThreadPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bStop = true;
+	}
+	m_workCondition.notify_all();
+
+	for (std::thread& thread : m_threads)
+	{
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
+	m_threads.clear();
+}
+
+void ThreadPool::ParallelFor(uint32_t numTasks, const std::function<void(uint32_t)>& task)
+{
+	std::lock_guard<std::mutex> callLock(m_parallelForMutex);
+
+	if (numTasks == 0)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pTask = &task;
+		m_numTasks = numTasks;
+		m_nextTask = 0;
+		m_activeWorkers = (uint32_t)m_threads.size();
+		m_generation++;
+	}
+	m_workCondition.notify_all();
+
+	// The caller works too instead of idling.
+	RunTasks();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this] { return m_activeWorkers == 0; });
+	m_pTask = nullptr;
+}
+
+// Workers start from the generation current at creation, so they never pick up an already finished batch.
+void ThreadPool::WorkerLoop(uint64_t lastGeneration)
+{
+	if (m_threadInit)
+	{
+		m_threadInit();
+	}
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_workCondition.wait(lock, [&] { return m_bStop || m_generation != lastGeneration; });
+
+			if (m_bStop)
+			{
+				return;
+			}
+			lastGeneration = m_generation;
+		}
+
+		RunTasks();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_activeWorkers == 0)
+			{
+				m_doneCondition.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::RunTasks()
+{
+	uint32_t taskIndex;
+	while ((taskIndex = m_nextTask.fetch_add(1, std::memory_order_relaxed)) < m_numTasks)
+	{
+		(*m_pTask)(taskIndex);
+	}
+}
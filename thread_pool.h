@@ -0,0 +1,39 @@
+#pragma once
+
+
+// Fixed set of worker threads for splitting per-frame work into parallel tasks.
+class ThreadPool
+{
+public:
+	~ThreadPool();
+
+	// The workers call threadInit first, if given, such as to register themselves with the thread registry.
+	void Start(uint32_t numThreads, const std::function<void()>& threadInit = nullptr);
+	void Stop();
+
+	uint32_t GetNumThreads() const { return (uint32_t)m_threads.size(); }
+
+	// Runs task(0) to task(numTasks - 1) on the workers and the calling thread, and returns once all have finished.
+	// Calls from multiple threads are serialized.
+	void ParallelFor(uint32_t numTasks, const std::function<void(uint32_t)>& task);
+
+protected:
+	void WorkerLoop(uint64_t lastGeneration);
+	void RunTasks();
+
+	std::vector<std::thread> m_threads;
+	std::function<void()> m_threadInit;
+
+	std::mutex m_parallelForMutex;
+
+	std::mutex m_mutex;
+	std::condition_variable m_workCondition;
+	std::condition_variable m_doneCondition;
+	uint64_t m_generation = 0;
+	uint32_t m_activeWorkers = 0;
+	bool m_bStop = false;
+
+	const std::function<void(uint32_t)>* m_pTask = nullptr;
+	uint32_t m_numTasks = 0;
+	std::atomic<uint32_t> m_nextTask = 0;
+};
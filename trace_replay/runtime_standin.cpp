@@ -0,0 +1,584 @@
+#include "runtime_standin.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+
+// Reads the next string, number or literal. Strings keep their text without the quotes.
+static bool ReadJsonToken(const std::string& text, size_t& position, std::string& outToken, bool& bOutString)
+{
+	while (position < text.size() && isspace((unsigned char)text[position]))
+	{
+		position++;
+	}
+
+	if (position >= text.size())
+	{
+		return false;
+	}
+
+	outToken.clear();
+	bOutString = text[position] == '"';
+
+	if (bOutString)
+	{
+		position++;
+		while (position < text.size() && text[position] != '"')
+		{
+			if (text[position] == '\\' && position + 1 < text.size())
+			{
+				position++;
+			}
+			outToken += text[position++];
+		}
+		position++;
+		return true;
+	}
+
+	if (strchr("{}:,[]", text[position]) != nullptr)
+	{
+		outToken = text[position++];
+		return true;
+	}
+
+	while (position < text.size() && strchr("{}:,[] \t\r\n", text[position]) == nullptr)
+	{
+		outToken += text[position++];
+	}
+	return true;
+}
+
+bool StandInSettings::LoadFile(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::stringstream stream;
+	stream << file.rdbuf();
+	std::string text = stream.str();
+
+	// Sections of flat values, as in the driver's default.vrsettings. Arrays are skipped.
+	std::string token, section, key;
+	bool bString = false;
+	size_t position = 0;
+	int depth = 0;
+	int arrayDepth = 0;
+	bool bExpectValue = false;
+
+	while (ReadJsonToken(text, position, token, bString))
+	{
+		if (!bString && token == "[") { arrayDepth++; continue; }
+		if (!bString && token == "]") { arrayDepth--; bExpectValue = false; continue; }
+		if (arrayDepth > 0) { continue; }
+
+		if (!bString && token == "{") { depth++; bExpectValue = false; continue; }
+		if (!bString && token == "}") { depth--; continue; }
+		if (!bString && token == ":") { bExpectValue = true; continue; }
+		if (!bString && token == ",") { continue; }
+
+		if (bExpectValue)
+		{
+			if (depth == 2)
+			{
+				SetValue(section, key, token);
+			}
+			bExpectValue = false;
+		}
+		else if (depth == 1)
+		{
+			section = token;
+		}
+		else if (depth == 2)
+		{
+			key = token;
+		}
+	}
+
+	return true;
+}
+
+bool StandInSettings::SetFromString(const std::string& assignment)
+{
+	size_t dot = assignment.find('.');
+	size_t equals = assignment.find('=');
+
+	if (dot == std::string::npos || equals == std::string::npos || dot > equals)
+	{
+		return false;
+	}
+
+	SetValue(assignment.substr(0, dot), assignment.substr(dot + 1, equals - dot - 1), assignment.substr(equals + 1));
+	return true;
+}
+
+void StandInSettings::SetValue(const std::string& section, const std::string& key, const std::string& value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_values[section + "." + key] = value;
+}
+
+bool StandInSettings::Find(const char* pchSection, const char* pchSettingsKey, std::string& outValue, vr::EVRSettingsError* peError)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto iter = m_values.find(std::string(pchSection) + "." + pchSettingsKey);
+	if (iter == m_values.end())
+	{
+		if (peError) { *peError = vr::VRSettingsError_UnsetSettingHasNoDefault; }
+		return false;
+	}
+
+	outValue = iter->second;
+	if (peError) { *peError = vr::VRSettingsError_None; }
+	return true;
+}
+
+const char* StandInSettings::GetSettingsErrorNameFromEnum(vr::EVRSettingsError eError)
+{
+	return (eError == vr::VRSettingsError_None) ? "None" : "Error";
+}
+
+void StandInSettings::SetBool(const char* pchSection, const char* pchSettingsKey, bool bValue, vr::EVRSettingsError* peError)
+{
+	SetValue(pchSection, pchSettingsKey, bValue ? "true" : "false");
+	if (peError) { *peError = vr::VRSettingsError_None; }
+}
+
+void StandInSettings::SetInt32(const char* pchSection, const char* pchSettingsKey, int32_t nValue, vr::EVRSettingsError* peError)
+{
+	SetValue(pchSection, pchSettingsKey, std::to_string(nValue));
+	if (peError) { *peError = vr::VRSettingsError_None; }
+}
+
+void StandInSettings::SetFloat(const char* pchSection, const char* pchSettingsKey, float flValue, vr::EVRSettingsError* peError)
+{
+	SetValue(pchSection, pchSettingsKey, std::to_string(flValue));
+	if (peError) { *peError = vr::VRSettingsError_None; }
+}
+
+void StandInSettings::SetString(const char* pchSection, const char* pchSettingsKey, const char* pchValue, vr::EVRSettingsError* peError)
+{
+	SetValue(pchSection, pchSettingsKey, pchValue);
+	if (peError) { *peError = vr::VRSettingsError_None; }
+}
+
+bool StandInSettings::GetBool(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError)
+{
+	std::string value;
+	if (!Find(pchSection, pchSettingsKey, value, peError))
+	{
+		return false;
+	}
+	return value == "true" || value == "1";
+}
+
+int32_t StandInSettings::GetInt32(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError)
+{
+	std::string value;
+	if (!Find(pchSection, pchSettingsKey, value, peError))
+	{
+		return 0;
+	}
+	return (int32_t)atof(value.c_str());
+}
+
+float StandInSettings::GetFloat(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError)
+{
+	std::string value;
+	if (!Find(pchSection, pchSettingsKey, value, peError))
+	{
+		return 0.0f;
+	}
+	return (float)atof(value.c_str());
+}
+
+void StandInSettings::GetString(const char* pchSection, const char* pchSettingsKey, char* pchValue, uint32_t unValueLen, vr::EVRSettingsError* peError)
+{
+	std::string value;
+	Find(pchSection, pchSettingsKey, value, peError);
+
+	if (pchValue != nullptr && unValueLen > 0)
+	{
+		size_t length = (std::min)(value.size(), (size_t)unValueLen - 1);
+		memcpy(pchValue, value.c_str(), length);
+		pchValue[length] = 0;
+	}
+}
+
+void StandInSettings::RemoveSection(const char* pchSection, vr::EVRSettingsError* peError)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::string prefix = std::string(pchSection) + ".";
+	for (auto iter = m_values.begin(); iter != m_values.end();)
+	{
+		iter = (iter->first.compare(0, prefix.size(), prefix) == 0) ? m_values.erase(iter) : std::next(iter);
+	}
+	if (peError) { *peError = vr::VRSettingsError_None; }
+}
+
+void StandInSettings::RemoveKeyInSection(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_values.erase(std::string(pchSection) + "." + pchSettingsKey);
+	if (peError) { *peError = vr::VRSettingsError_None; }
+}
+
+
+vr::ETrackedPropertyError StandInProperties::ReadPropertyBatch(vr::PropertyContainerHandle_t ulContainerHandle, vr::PropertyRead_t* pBatch, uint32_t unBatchEntryCount)
+{
+	for (uint32_t i = 0; i < unBatchEntryCount; i++)
+	{
+		pBatch[i].eError = vr::TrackedProp_UnknownProperty;
+	}
+	return vr::TrackedProp_Success;
+}
+
+vr::ETrackedPropertyError StandInProperties::WritePropertyBatch(vr::PropertyContainerHandle_t ulContainerHandle, vr::PropertyWrite_t* pBatch, uint32_t unBatchEntryCount)
+{
+	for (uint32_t i = 0; i < unBatchEntryCount; i++)
+	{
+		pBatch[i].eError = vr::TrackedProp_Success;
+	}
+	return vr::TrackedProp_Success;
+}
+
+const char* StandInProperties::GetPropErrorNameFromEnum(vr::ETrackedPropertyError error)
+{
+	return (error == vr::TrackedProp_Success) ? "Success" : "Error";
+}
+
+vr::PropertyContainerHandle_t StandInProperties::TrackedDeviceToPropertyContainer(vr::TrackedDeviceIndex_t nDevice)
+{
+	return (vr::PropertyContainerHandle_t)nDevice + 1;
+}
+
+
+void StandInDriverLog::Log(const char* pchLogMessage)
+{
+	m_lines++;
+
+	if (m_bVerbose)
+	{
+		std::cout << "[driver] " << pchLogMessage << "\n";
+	}
+}
+
+
+bool StandInServerDriverHost::TrackedDeviceAdded(const char* pchDeviceSerialNumber, vr::ETrackedDeviceClass eDeviceClass, vr::ITrackedDeviceServerDriver* pDriver)
+{
+	if (m_pDevice != nullptr)
+	{
+		return false;
+	}
+
+	std::cout << "Device added: " << pchDeviceSerialNumber << "\n";
+	m_pDevice = pDriver;
+	return true;
+}
+
+void StandInServerDriverHost::TrackedDevicePoseUpdated(uint32_t unWhichDevice, const vr::DriverPose_t& newPose, uint32_t unPoseStructSize)
+{
+	m_posesUpdated++;
+}
+
+void StandInServerDriverHost::VsyncEvent(double vsyncTimeOffsetSeconds)
+{
+}
+
+void StandInServerDriverHost::VendorSpecificEvent(uint32_t unWhichDevice, vr::EVREventType eventType, const vr::VREvent_Data_t& eventData, double eventTimeOffset)
+{
+}
+
+bool StandInServerDriverHost::IsExiting()
+{
+	return false;
+}
+
+bool StandInServerDriverHost::PollNextEvent(vr::VREvent_t* pEvent, uint32_t uncbVREvent)
+{
+	return false;
+}
+
+void StandInServerDriverHost::GetRawTrackedDevicePoses(float fPredictedSecondsFromNow, vr::TrackedDevicePose_t* pTrackedDevicePoseArray, uint32_t unTrackedDevicePoseArrayCount)
+{
+	memset(pTrackedDevicePoseArray, 0, sizeof(vr::TrackedDevicePose_t) * unTrackedDevicePoseArrayCount);
+}
+
+void StandInServerDriverHost::RequestRestart(const char* pchLocalizedReason, const char* pchExecutableToStart, const char* pchArguments, const char* pchWorkingDirectory)
+{
+	std::cout << "Driver requested a restart: " << pchLocalizedReason << "\n";
+}
+
+uint32_t StandInServerDriverHost::GetFrameTimings(vr::Compositor_FrameTiming* pTiming, uint32_t nFrames)
+{
+	return 0;
+}
+
+void StandInServerDriverHost::SetDisplayEyeToHead(uint32_t unWhichDevice, const vr::HmdMatrix34_t& eyeToHeadLeft, const vr::HmdMatrix34_t& eyeToHeadRight)
+{
+}
+
+void StandInServerDriverHost::SetDisplayProjectionRaw(uint32_t unWhichDevice, const vr::HmdRect2_t& eyeLeft, const vr::HmdRect2_t& eyeRight)
+{
+}
+
+void StandInServerDriverHost::SetRecommendedRenderTargetSize(uint32_t unWhichDevice, uint32_t nWidth, uint32_t nHeight)
+{
+}
+
+
+vr::EVRInputError StandInDriverInput::CreateBooleanComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle)
+{
+	*pHandle = m_nextHandle++;
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::UpdateBooleanComponent(vr::VRInputComponentHandle_t ulComponent, bool bNewValue, double fTimeOffset)
+{
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::CreateScalarComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle, vr::EVRScalarType eType, vr::EVRScalarUnits eUnits)
+{
+	*pHandle = m_nextHandle++;
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::UpdateScalarComponent(vr::VRInputComponentHandle_t ulComponent, float fNewValue, double fTimeOffset)
+{
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::CreateHapticComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle)
+{
+	*pHandle = m_nextHandle++;
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::CreateSkeletonComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, const char* pchSkeletonPath, const char* pchBasePosePath,
+	vr::EVRSkeletalTrackingLevel eSkeletalTrackingLevel, const vr::VRBoneTransform_t* pGripLimitTransforms, uint32_t unGripLimitTransformCount, vr::VRInputComponentHandle_t* pHandle)
+{
+	*pHandle = m_nextHandle++;
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::UpdateSkeletonComponent(vr::VRInputComponentHandle_t ulComponent, vr::EVRSkeletalMotionRange eMotionRange, const vr::VRBoneTransform_t* pTransforms, uint32_t unTransformCount)
+{
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::CreatePoseComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle)
+{
+	*pHandle = m_nextHandle++;
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::UpdatePoseComponent(vr::VRInputComponentHandle_t ulComponent, const vr::HmdMatrix34_t* pMatPoseOffset, double fTimeOffset)
+{
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::CreateEyeTrackingComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle)
+{
+	*pHandle = m_nextHandle++;
+	return vr::VRInputError_None;
+}
+
+vr::EVRInputError StandInDriverInput::UpdateEyeTrackingComponent(vr::VRInputComponentHandle_t ulComponent, const vr::VREyeTrackingData_t* pEyeTrackingData, double fTimeOffset)
+{
+	return vr::VRInputError_None;
+}
+
+
+vr::EIOBufferError StandInIOBuffer::Open(const char* pchPath, vr::EIOBufferMode mode, uint32_t unElementSize, uint32_t unElements, vr::IOBufferHandle_t* pulBuffer)
+{
+	*pulBuffer = m_nextHandle++;
+	return vr::IOBuffer_Success;
+}
+
+vr::EIOBufferError StandInIOBuffer::Close(vr::IOBufferHandle_t ulBuffer)
+{
+	return vr::IOBuffer_Success;
+}
+
+vr::EIOBufferError StandInIOBuffer::Read(vr::IOBufferHandle_t ulBuffer, void* pDst, uint32_t unBytes, uint32_t* punRead)
+{
+	*punRead = 0;
+	return vr::IOBuffer_Success;
+}
+
+vr::EIOBufferError StandInIOBuffer::Write(vr::IOBufferHandle_t ulBuffer, void* pSrc, uint32_t unBytes)
+{
+	return vr::IOBuffer_Success;
+}
+
+vr::PropertyContainerHandle_t StandInIOBuffer::PropertyContainer(vr::IOBufferHandle_t ulBuffer)
+{
+	return vr::k_ulInvalidPropertyContainer;
+}
+
+bool StandInIOBuffer::HasReaders(vr::IOBufferHandle_t ulBuffer)
+{
+	return false;
+}
+
+
+vr::ETrackedPropertyError StandInPaths::ReadPathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathRead_t* pBatch, uint32_t unBatchEntryCount)
+{
+	for (uint32_t i = 0; i < unBatchEntryCount; i++)
+	{
+		pBatch[i].eError = vr::TrackedProp_UnknownProperty;
+	}
+	return vr::TrackedProp_Success;
+}
+
+vr::ETrackedPropertyError StandInPaths::WritePathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathWrite_t* pBatch, uint32_t unBatchEntryCount)
+{
+	for (uint32_t i = 0; i < unBatchEntryCount; i++)
+	{
+		pBatch[i].eError = vr::TrackedProp_Success;
+	}
+	return vr::TrackedProp_Success;
+}
+
+vr::ETrackedPropertyError StandInPaths::StringToHandle(vr::PathHandle_t* pHandle, const char* pchPath)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto iter = m_handles.find(pchPath);
+	if (iter == m_handles.end())
+	{
+		m_paths.push_back(pchPath);
+		iter = m_handles.emplace(pchPath, (vr::PathHandle_t)m_paths.size()).first;
+	}
+
+	*pHandle = iter->second;
+	return vr::TrackedProp_Success;
+}
+
+vr::ETrackedPropertyError StandInPaths::HandleToString(vr::PathHandle_t pHandle, const char* pchBuffer, uint32_t unBufferSize, uint32_t* punBufferSizeUsed)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (pHandle == 0 || pHandle > m_paths.size())
+	{
+		return vr::TrackedProp_InvalidOperation;
+	}
+
+	const std::string& path = m_paths[pHandle - 1];
+	*punBufferSizeUsed = (uint32_t)path.size() + 1;
+
+	if (pchBuffer == nullptr || unBufferSize < path.size() + 1)
+	{
+		return vr::TrackedProp_BufferTooSmall;
+	}
+
+	memcpy((void*)pchBuffer, path.c_str(), path.size() + 1);
+	return vr::TrackedProp_Success;
+}
+
+
+vr::EBlockQueueError StandInBlockQueue::Create(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath, uint32_t unBlockDataSize, uint32_t unBlockHeaderSize, uint32_t unBlockCount, uint32_t unFlags)
+{
+	if (unBlockCount == 0)
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidParam;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Queue& queue = m_queues[m_nextHandle];
+	queue.blocks.resize(unBlockCount, std::vector<uint8_t>(unBlockDataSize));
+
+	*pulQueueHandle = m_nextHandle++;
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+vr::EBlockQueueError StandInBlockQueue::Connect(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath)
+{
+	return vr::EBlockQueueError_BlockQueueError_QueueNotFound;
+}
+
+vr::EBlockQueueError StandInBlockQueue::Destroy(vr::PropertyContainerHandle_t ulQueueHandle)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return (m_queues.erase(ulQueueHandle) > 0) ? vr::EBlockQueueError_BlockQueueError_None : vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+}
+
+vr::EBlockQueueError StandInBlockQueue::AcquireWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto iter = m_queues.find(ulQueueHandle);
+	if (iter == m_queues.end())
+	{
+		return vr::EBlockQueueError_BlockQueueError_InvalidHandle;
+	}
+
+	Queue& queue = iter->second;
+	uint32_t block = queue.nextBlock;
+	queue.nextBlock = (queue.nextBlock + 1) % (uint32_t)queue.blocks.size();
+
+	*pulBlockHandle = block + 1;
+	*ppvBuffer = queue.blocks[block].data();
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+vr::EBlockQueueError StandInBlockQueue::ReleaseWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle)
+{
+	m_blocksWritten++;
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+vr::EBlockQueueError StandInBlockQueue::WaitAndAcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType, uint32_t unTimeoutMs)
+{
+	return vr::EBlockQueueError_BlockQueueError_OperationIsServerOnly;
+}
+
+vr::EBlockQueueError StandInBlockQueue::AcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType)
+{
+	return vr::EBlockQueueError_BlockQueueError_OperationIsServerOnly;
+}
+
+vr::EBlockQueueError StandInBlockQueue::ReleaseReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle)
+{
+	return vr::EBlockQueueError_BlockQueueError_OperationIsServerOnly;
+}
+
+vr::EBlockQueueError StandInBlockQueue::QueueHasReader(vr::PropertyContainerHandle_t ulQueueHandle, bool* pbHasReaders)
+{
+	*pbHasReaders = false;
+	return vr::EBlockQueueError_BlockQueueError_None;
+}
+
+
+void* RuntimeStandIn::GetGenericInterface(const char* pchInterfaceVersion, vr::EVRInitError* peError)
+{
+	if (peError) { *peError = vr::VRInitError_None; }
+
+	if (strcmp(pchInterfaceVersion, vr::IVRSettings_Version) == 0) { return static_cast<vr::IVRSettings*>(&m_settings); }
+	if (strcmp(pchInterfaceVersion, vr::IVRProperties_Version) == 0) { return static_cast<vr::IVRProperties*>(&m_properties); }
+	if (strcmp(pchInterfaceVersion, vr::IVRDriverLog_Version) == 0) { return static_cast<vr::IVRDriverLog*>(&m_driverLog); }
+	if (strcmp(pchInterfaceVersion, vr::IVRServerDriverHost_Version) == 0) { return static_cast<vr::IVRServerDriverHost*>(&m_serverDriverHost); }
+	if (strcmp(pchInterfaceVersion, vr::IVRDriverInput_Version) == 0) { return static_cast<vr::IVRDriverInput*>(&m_driverInput); }
+	if (strcmp(pchInterfaceVersion, vr::IVRIOBuffer_Version) == 0) { return static_cast<vr::IVRIOBuffer*>(&m_ioBuffer); }
+	if (strcmp(pchInterfaceVersion, vr::IVRPaths_Version) == 0) { return static_cast<vr::IVRPaths*>(&m_paths); }
+	if (strcmp(pchInterfaceVersion, vr::IVRBlockQueue_Version) == 0) { return static_cast<vr::IVRBlockQueue*>(&m_blockQueue); }
+
+	std::cout << "The driver requested an interface without a stand-in: " << pchInterfaceVersion << "\n";
+
+	if (peError) { *peError = vr::VRInitError_Init_InterfaceNotFound; }
+	return nullptr;
+}
+
+vr::DriverHandle_t RuntimeStandIn::GetDriverHandle()
+{
+	return 1;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+#include "openvr_driver.h"
+#include "../vr_blockqueue.h"
+
+
+// Local stand-in for the SteamVR server interfaces the driver uses, so the driver DLL can be loaded and driven without the runtime.
+// Settings come from the driver's default.vrsettings and command line overrides. Properties, input and paths are accepted and discarded,
+// and block queues are plain memory without readers.
+
+class StandInSettings : public vr::IVRSettings
+{
+public:
+	// Reads a settings file of sections with string, number and boolean values. Returns false if the file can't be read.
+	bool LoadFile(const std::string& path);
+
+	// Sets a value from a "section.key=value" string.
+	bool SetFromString(const std::string& assignment);
+
+	void SetValue(const std::string& section, const std::string& key, const std::string& value);
+
+	const char* GetSettingsErrorNameFromEnum(vr::EVRSettingsError eError) override;
+
+	void SetBool(const char* pchSection, const char* pchSettingsKey, bool bValue, vr::EVRSettingsError* peError) override;
+	void SetInt32(const char* pchSection, const char* pchSettingsKey, int32_t nValue, vr::EVRSettingsError* peError) override;
+	void SetFloat(const char* pchSection, const char* pchSettingsKey, float flValue, vr::EVRSettingsError* peError) override;
+	void SetString(const char* pchSection, const char* pchSettingsKey, const char* pchValue, vr::EVRSettingsError* peError) override;
+
+	bool GetBool(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError) override;
+	int32_t GetInt32(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError) override;
+	float GetFloat(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError) override;
+	void GetString(const char* pchSection, const char* pchSettingsKey, char* pchValue, uint32_t unValueLen, vr::EVRSettingsError* peError) override;
+
+	void RemoveSection(const char* pchSection, vr::EVRSettingsError* peError) override;
+	void RemoveKeyInSection(const char* pchSection, const char* pchSettingsKey, vr::EVRSettingsError* peError) override;
+
+protected:
+	bool Find(const char* pchSection, const char* pchSettingsKey, std::string& outValue, vr::EVRSettingsError* peError);
+
+	std::mutex m_mutex;
+
+	// Values by "section.key", stored as their text.
+	std::map<std::string, std::string> m_values;
+};
+
+
+class StandInProperties : public vr::IVRProperties
+{
+public:
+	vr::ETrackedPropertyError ReadPropertyBatch(vr::PropertyContainerHandle_t ulContainerHandle, vr::PropertyRead_t* pBatch, uint32_t unBatchEntryCount) override;
+	vr::ETrackedPropertyError WritePropertyBatch(vr::PropertyContainerHandle_t ulContainerHandle, vr::PropertyWrite_t* pBatch, uint32_t unBatchEntryCount) override;
+	const char* GetPropErrorNameFromEnum(vr::ETrackedPropertyError error) override;
+	vr::PropertyContainerHandle_t TrackedDeviceToPropertyContainer(vr::TrackedDeviceIndex_t nDevice) override;
+};
+
+
+class StandInDriverLog : public vr::IVRDriverLog
+{
+public:
+	void Log(const char* pchLogMessage) override;
+
+	// Prints the driver log to the console rather than only counting it.
+	bool m_bVerbose = false;
+	std::atomic<uint64_t> m_lines = 0;
+};
+
+
+class StandInServerDriverHost : public vr::IVRServerDriverHost
+{
+public:
+	bool TrackedDeviceAdded(const char* pchDeviceSerialNumber, vr::ETrackedDeviceClass eDeviceClass, vr::ITrackedDeviceServerDriver* pDriver) override;
+	void TrackedDevicePoseUpdated(uint32_t unWhichDevice, const vr::DriverPose_t& newPose, uint32_t unPoseStructSize) override;
+	void VsyncEvent(double vsyncTimeOffsetSeconds) override;
+	void VendorSpecificEvent(uint32_t unWhichDevice, vr::EVREventType eventType, const vr::VREvent_Data_t& eventData, double eventTimeOffset) override;
+	bool IsExiting() override;
+	bool PollNextEvent(vr::VREvent_t* pEvent, uint32_t uncbVREvent) override;
+	void GetRawTrackedDevicePoses(float fPredictedSecondsFromNow, vr::TrackedDevicePose_t* pTrackedDevicePoseArray, uint32_t unTrackedDevicePoseArrayCount) override;
+	void RequestRestart(const char* pchLocalizedReason, const char* pchExecutableToStart, const char* pchArguments, const char* pchWorkingDirectory) override;
+	uint32_t GetFrameTimings(vr::Compositor_FrameTiming* pTiming, uint32_t nFrames) override;
+	void SetDisplayEyeToHead(uint32_t unWhichDevice, const vr::HmdMatrix34_t& eyeToHeadLeft, const vr::HmdMatrix34_t& eyeToHeadRight) override;
+	void SetDisplayProjectionRaw(uint32_t unWhichDevice, const vr::HmdRect2_t& eyeLeft, const vr::HmdRect2_t& eyeRight) override;
+	void SetRecommendedRenderTargetSize(uint32_t unWhichDevice, uint32_t nWidth, uint32_t nHeight) override;
+
+	// The device added by the provider, activated by the replay tool.
+	vr::ITrackedDeviceServerDriver* m_pDevice = nullptr;
+
+	std::atomic<uint64_t> m_posesUpdated = 0;
+};
+
+
+class StandInDriverInput : public vr::IVRDriverInput
+{
+public:
+	vr::EVRInputError CreateBooleanComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle) override;
+	vr::EVRInputError UpdateBooleanComponent(vr::VRInputComponentHandle_t ulComponent, bool bNewValue, double fTimeOffset) override;
+	vr::EVRInputError CreateScalarComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle, vr::EVRScalarType eType, vr::EVRScalarUnits eUnits) override;
+	vr::EVRInputError UpdateScalarComponent(vr::VRInputComponentHandle_t ulComponent, float fNewValue, double fTimeOffset) override;
+	vr::EVRInputError CreateHapticComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle) override;
+	vr::EVRInputError CreateSkeletonComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, const char* pchSkeletonPath, const char* pchBasePosePath,
+		vr::EVRSkeletalTrackingLevel eSkeletalTrackingLevel, const vr::VRBoneTransform_t* pGripLimitTransforms, uint32_t unGripLimitTransformCount, vr::VRInputComponentHandle_t* pHandle) override;
+	vr::EVRInputError UpdateSkeletonComponent(vr::VRInputComponentHandle_t ulComponent, vr::EVRSkeletalMotionRange eMotionRange, const vr::VRBoneTransform_t* pTransforms, uint32_t unTransformCount) override;
+	vr::EVRInputError CreatePoseComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle) override;
+	vr::EVRInputError UpdatePoseComponent(vr::VRInputComponentHandle_t ulComponent, const vr::HmdMatrix34_t* pMatPoseOffset, double fTimeOffset) override;
+	vr::EVRInputError CreateEyeTrackingComponent(vr::PropertyContainerHandle_t ulContainer, const char* pchName, vr::VRInputComponentHandle_t* pHandle) override;
+	vr::EVRInputError UpdateEyeTrackingComponent(vr::VRInputComponentHandle_t ulComponent, const vr::VREyeTrackingData_t* pEyeTrackingData, double fTimeOffset) override;
+
+protected:
+	std::atomic<vr::VRInputComponentHandle_t> m_nextHandle = 1;
+};
+
+
+// Buffers without readers, so the driver's IOBuffer output stays idle.
+class StandInIOBuffer : public vr::IVRIOBuffer
+{
+public:
+	vr::EIOBufferError Open(const char* pchPath, vr::EIOBufferMode mode, uint32_t unElementSize, uint32_t unElements, vr::IOBufferHandle_t* pulBuffer) override;
+	vr::EIOBufferError Close(vr::IOBufferHandle_t ulBuffer) override;
+	vr::EIOBufferError Read(vr::IOBufferHandle_t ulBuffer, void* pDst, uint32_t unBytes, uint32_t* punRead) override;
+	vr::EIOBufferError Write(vr::IOBufferHandle_t ulBuffer, void* pSrc, uint32_t unBytes) override;
+	vr::PropertyContainerHandle_t PropertyContainer(vr::IOBufferHandle_t ulBuffer) override;
+	bool HasReaders(vr::IOBufferHandle_t ulBuffer) override;
+
+protected:
+	std::atomic<vr::IOBufferHandle_t> m_nextHandle = 1;
+};
+
+
+class StandInPaths : public vr::IVRPaths
+{
+public:
+	vr::ETrackedPropertyError ReadPathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathRead_t* pBatch, uint32_t unBatchEntryCount) override;
+	vr::ETrackedPropertyError WritePathBatch(vr::PropertyContainerHandle_t ulRootHandle, vr::PathWrite_t* pBatch, uint32_t unBatchEntryCount) override;
+	vr::ETrackedPropertyError StringToHandle(vr::PathHandle_t* pHandle, const char* pchPath) override;
+	vr::ETrackedPropertyError HandleToString(vr::PathHandle_t pHandle, const char* pchBuffer, uint32_t unBufferSize, uint32_t* punBufferSizeUsed) override;
+
+protected:
+	std::mutex m_mutex;
+	std::map<std::string, vr::PathHandle_t> m_handles;
+	std::vector<std::string> m_paths;
+};
+
+
+// Block queues the driver writes frames into. Blocks are handed out round robin, nothing reads them.
+class StandInBlockQueue : public vr::IVRBlockQueue
+{
+public:
+	vr::EBlockQueueError Create(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath, uint32_t unBlockDataSize, uint32_t unBlockHeaderSize, uint32_t unBlockCount, uint32_t unFlags) override;
+	vr::EBlockQueueError Connect(vr::PropertyContainerHandle_t* pulQueueHandle, const char* pchPath) override;
+	vr::EBlockQueueError Destroy(vr::PropertyContainerHandle_t ulQueueHandle) override;
+	vr::EBlockQueueError AcquireWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer) override;
+	vr::EBlockQueueError ReleaseWriteOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle) override;
+	vr::EBlockQueueError WaitAndAcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType, uint32_t unTimeoutMs) override;
+	vr::EBlockQueueError AcquireReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t* pulBlockHandle, void** ppvBuffer, vr::EBlockQueueReadType eReadType) override;
+	vr::EBlockQueueError ReleaseReadOnlyBlock(vr::PropertyContainerHandle_t ulQueueHandle, vr::PropertyContainerHandle_t ulBlockHandle) override;
+	vr::EBlockQueueError QueueHasReader(vr::PropertyContainerHandle_t ulQueueHandle, bool* pbHasReaders) override;
+
+	std::atomic<uint64_t> m_blocksWritten = 0;
+
+protected:
+	struct Queue
+	{
+		std::vector<std::vector<uint8_t>> blocks;
+		uint32_t nextBlock = 0;
+	};
+
+	std::mutex m_mutex;
+	std::map<vr::PropertyContainerHandle_t, Queue> m_queues;
+	vr::PropertyContainerHandle_t m_nextHandle = 1;
+};
+
+
+class RuntimeStandIn : public vr::IVRDriverContext
+{
+public:
+	void* GetGenericInterface(const char* pchInterfaceVersion, vr::EVRInitError* peError) override;
+	vr::DriverHandle_t GetDriverHandle() override;
+
+	StandInSettings m_settings;
+	StandInProperties m_properties;
+	StandInDriverLog m_driverLog;
+	StandInServerDriverHost m_serverDriverHost;
+	StandInDriverInput m_driverInput;
+	StandInIOBuffer m_ioBuffer;
+	StandInPaths m_paths;
+	StandInBlockQueue m_blockQueue;
+};
@@ -0,0 +1,739 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+#include <cmath>
+
+#include "openvr_driver.h"
+#include "../driver_trace_format.h"
+#include "runtime_standin.h"
+
+
+// Replays a session recorded by the driver's trace_enable setting or the trace_start debug request against a local runtime stand-in.
+// The driver DLL is loaded and initialized as SteamVR would, then each recorded runtime call is made again with its recorded arguments,
+// either back to back in recorded order, or on one thread per recorded thread at the recorded times.
+
+
+// A recorded call with its string argument joined from the continuation records.
+struct TraceEvent
+{
+	DriverTraceRecord record;
+	std::string text;
+};
+
+struct TraceFile
+{
+	DriverTraceFileHeader header = {};
+	std::vector<TraceEvent> events;
+	uint64_t dropped = 0;
+};
+
+struct EventStats
+{
+	uint64_t count = 0;
+	double totalMs = 0.0;
+	double maxMs = 0.0;
+
+	void Add(double ms)
+	{
+		count++;
+		totalMs += ms;
+		maxMs = (std::max)(maxMs, ms);
+	}
+
+	void Merge(const EventStats& other)
+	{
+		count += other.count;
+		totalMs += other.totalMs;
+		maxMs = (std::max)(maxMs, other.maxMs);
+	}
+};
+
+struct ReplayTarget
+{
+	vr::IServerTrackedDeviceProvider* pProvider = nullptr;
+	vr::ITrackedDeviceServerDriver* pDevice = nullptr;
+	vr::IVRCameraComponent* pCamera = nullptr;
+	vr::IVRDisplayComponent* pDisplay = nullptr;
+	vr::IVRVirtualDisplay* pVirtualDisplay = nullptr;
+};
+
+
+class ReplaySinkCallback : public vr::ICameraVideoSinkCallback
+{
+public:
+	void OnCameraVideoSinkCallback() override { m_callbacks++; }
+
+	std::atomic<uint64_t> m_callbacks = 0;
+};
+
+
+typedef void* (*HmdDriverFactoryFn)(const char* pInterfaceName, int* pReturnCode);
+
+static RuntimeStandIn g_runtime;
+static ReplaySinkCallback g_sinkCallback;
+
+
+static bool LoadTrace(const std::string& path, TraceFile& outTrace)
+{
+	std::ifstream file(std::filesystem::path(path), std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to open " << path << "\n";
+		return false;
+	}
+
+	file.read((char*)&outTrace.header, sizeof(outTrace.header));
+
+	if (!file || outTrace.header.magic != DRIVER_TRACE_MAGIC || outTrace.header.version > DRIVER_TRACE_VERSION || outTrace.header.recordSize != sizeof(DriverTraceRecord))
+	{
+		std::cout << path << " is not a driver trace, or was written by a newer driver\n";
+		return false;
+	}
+
+	std::vector<DriverTraceRecord> records;
+	DriverTraceRecord record;
+	while (file.read((char*)&record, sizeof(record)))
+	{
+		records.push_back(record);
+	}
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		if (records[i].event == TraceEvent_Dropped)
+		{
+			outTrace.dropped += records[i].args.i[1];
+			continue;
+		}
+
+		// Continuation records are consumed with the record they belong to.
+		if (records[i].event == TraceEvent_Text)
+		{
+			continue;
+		}
+
+		TraceEvent event;
+		event.record = records[i];
+
+		for (uint32_t j = 0; j < records[i].textRecords && i + 1 < records.size() && records[i + 1].event == TraceEvent_Text; j++)
+		{
+			i++;
+			event.text.append(records[i].args.text, strnlen(records[i].args.text, DRIVER_TRACE_RECORD_TEXT));
+		}
+
+		outTrace.events.push_back(std::move(event));
+	}
+
+	// Records are written per thread, the file order only breaks ties.
+	std::stable_sort(outTrace.events.begin(), outTrace.events.end(), [](const TraceEvent& a, const TraceEvent& b)
+	{
+		if (a.record.startTicks != b.record.startTicks) { return a.record.startTicks < b.record.startTicks; }
+		return a.record.threadId < b.record.threadId;
+	});
+
+	return true;
+}
+
+
+// Makes the call recorded in the event. Returns false for events the tool performs itself, and ones without a target.
+static bool ReplayEvent(const ReplayTarget& target, const TraceEvent& event)
+{
+	const int64_t* i = event.record.args.i;
+	const double* d = event.record.args.d;
+
+	uint16_t type = event.record.event;
+
+	if (type >= TraceEvent_GetCameraFrameDimensions && type <= TraceEvent_GetCameraIntrinsics && target.pCamera == nullptr) { return false; }
+	if (type >= TraceEvent_IsDisplayOnDesktop && type <= TraceEvent_ComputeInverseDistortion && target.pDisplay == nullptr) { return false; }
+	if (type >= TraceEvent_Present && type <= TraceEvent_GetTimeSinceLastVsync && target.pVirtualDisplay == nullptr) { return false; }
+
+	uint32_t width, height, left, top;
+	int32_t x, y;
+	float u, v, l, r, t, b;
+	bool bPaused;
+
+	switch (type)
+	{
+	case TraceEvent_ProviderRunFrame:
+		target.pProvider->RunFrame();
+		return true;
+
+	case TraceEvent_ProviderEnterStandby:
+		target.pProvider->EnterStandby();
+		return true;
+
+	case TraceEvent_ProviderLeaveStandby:
+		target.pProvider->LeaveStandby();
+		return true;
+
+	case TraceEvent_DeviceEnterStandby:
+		target.pDevice->EnterStandby();
+		return true;
+
+	case TraceEvent_DeviceGetComponent:
+		target.pDevice->GetComponent(event.text.c_str());
+		return true;
+
+	case TraceEvent_DeviceDebugRequest:
+	{
+		// Trace requests would interfere with the replay's own recording.
+		if (event.text.compare(0, 6, "trace_") == 0)
+		{
+			return false;
+		}
+
+		std::vector<char> response((size_t)(std::max)(i[0], (int64_t)1));
+		target.pDevice->DebugRequest(event.text.c_str(), response.data(), (uint32_t)response.size());
+		return true;
+	}
+
+	case TraceEvent_DeviceGetPose:
+		target.pDevice->GetPose();
+		return true;
+
+	case TraceEvent_GetCameraFrameDimensions:
+		target.pCamera->GetCameraFrameDimensions((vr::ECameraVideoStreamFormat)i[0], &width, &height);
+		return true;
+
+	case TraceEvent_GetCameraFrameBufferingRequirements:
+	{
+		int queueSize;
+		target.pCamera->GetCameraFrameBufferingRequirements(&queueSize, &width);
+		return true;
+	}
+
+	case TraceEvent_SetCameraFrameBuffering:
+	{
+		// The driver doesn't read the runtime's buffers.
+		std::vector<void*> buffers((size_t)(std::max)(i[0], (int64_t)1), nullptr);
+		target.pCamera->SetCameraFrameBuffering((int)i[0], buffers.data(), (uint32_t)i[1]);
+		return true;
+	}
+
+	case TraceEvent_SetCameraVideoStreamFormat:
+		target.pCamera->SetCameraVideoStreamFormat((vr::ECameraVideoStreamFormat)i[0]);
+		return true;
+
+	case TraceEvent_GetCameraVideoStreamFormat:
+		target.pCamera->GetCameraVideoStreamFormat();
+		return true;
+
+	case TraceEvent_StartVideoStream:
+		target.pCamera->StartVideoStream();
+		return true;
+
+	case TraceEvent_StopVideoStream:
+		target.pCamera->StopVideoStream();
+		return true;
+
+	case TraceEvent_IsVideoStreamActive:
+		target.pCamera->IsVideoStreamActive(&bPaused, &u);
+		return true;
+
+	case TraceEvent_GetVideoStreamFrame:
+		target.pCamera->GetVideoStreamFrame();
+		return true;
+
+	case TraceEvent_ReleaseVideoStreamFrame:
+		target.pCamera->ReleaseVideoStreamFrame(nullptr);
+		return true;
+
+	case TraceEvent_SetAutoExposure:
+		target.pCamera->SetAutoExposure(i[0] != 0);
+		return true;
+
+	case TraceEvent_PauseVideoStream:
+		target.pCamera->PauseVideoStream();
+		return true;
+
+	case TraceEvent_ResumeVideoStream:
+		target.pCamera->ResumeVideoStream();
+		return true;
+
+	case TraceEvent_GetCameraDistortion:
+		target.pCamera->GetCameraDistortion((uint32_t)i[0], (float)d[1], (float)d[2], &u, &v);
+		return true;
+
+	case TraceEvent_GetCameraProjection:
+	{
+		vr::HmdMatrix44_t projection;
+		target.pCamera->GetCameraProjection((uint32_t)i[0], (vr::EVRTrackedCameraFrameType)i[1], (float)d[2], (float)d[3], &projection);
+		return true;
+	}
+
+	case TraceEvent_SetFrameRate:
+		target.pCamera->SetFrameRate((int)i[0], (int)i[1]);
+		return true;
+
+	case TraceEvent_SetCameraVideoSinkCallback:
+		target.pCamera->SetCameraVideoSinkCallback((i[0] != 0) ? &g_sinkCallback : nullptr);
+		return true;
+
+	case TraceEvent_GetCameraCompatibilityMode:
+	{
+		vr::ECameraCompatibilityMode mode;
+		target.pCamera->GetCameraCompatibilityMode(&mode);
+		return true;
+	}
+
+	case TraceEvent_SetCameraCompatibilityMode:
+		target.pCamera->SetCameraCompatibilityMode((vr::ECameraCompatibilityMode)i[0]);
+		return true;
+
+	case TraceEvent_GetCameraFrameBounds:
+		target.pCamera->GetCameraFrameBounds((vr::EVRTrackedCameraFrameType)i[0], &left, &top, &width, &height);
+		return true;
+
+	case TraceEvent_GetCameraIntrinsics:
+	{
+		vr::HmdVector2_t focalLength, center;
+		vr::EVRDistortionFunctionType distortionType;
+		double coefficients[vr::k_unMaxDistortionFunctionParameters];
+		target.pCamera->GetCameraIntrinsics((uint32_t)i[0], (vr::EVRTrackedCameraFrameType)i[1], &focalLength, &center, &distortionType, coefficients);
+		return true;
+	}
+
+	case TraceEvent_IsDisplayOnDesktop:
+		target.pDisplay->IsDisplayOnDesktop();
+		return true;
+
+	case TraceEvent_IsDisplayRealDisplay:
+		target.pDisplay->IsDisplayRealDisplay();
+		return true;
+
+	case TraceEvent_GetRecommendedRenderTargetSize:
+		target.pDisplay->GetRecommendedRenderTargetSize(&width, &height);
+		return true;
+
+	case TraceEvent_GetEyeOutputViewport:
+		target.pDisplay->GetEyeOutputViewport((vr::EVREye)i[0], &left, &top, &width, &height);
+		return true;
+
+	case TraceEvent_GetProjectionRaw:
+		target.pDisplay->GetProjectionRaw((vr::EVREye)i[0], &l, &r, &t, &b);
+		return true;
+
+	case TraceEvent_ComputeDistortion:
+		target.pDisplay->ComputeDistortion((vr::EVREye)i[0], (float)d[1], (float)d[2]);
+		return true;
+
+	case TraceEvent_GetWindowBounds:
+		target.pDisplay->GetWindowBounds(&x, &y, &width, &height);
+		return true;
+
+	case TraceEvent_ComputeInverseDistortion:
+	{
+		vr::HmdVector2_t result;
+		target.pDisplay->ComputeInverseDistortion(&result, (vr::EVREye)i[0], (uint32_t)i[1], (float)d[2], (float)d[3]);
+		return true;
+	}
+
+	case TraceEvent_Present:
+	{
+		// There is no compositor texture to share, so the renderer fails to open the backbuffer and skips the frame.
+		vr::PresentInfo_t presentInfo = {};
+		presentInfo.backbufferTextureHandle = 0;
+		presentInfo.vsync = (vr::EVSync)i[0];
+		presentInfo.nFrameId = (uint64_t)i[1];
+		presentInfo.flVSyncTimeInSeconds = d[2];
+		target.pVirtualDisplay->Present(&presentInfo, sizeof(presentInfo));
+		return true;
+	}
+
+	case TraceEvent_WaitForPresent:
+		target.pVirtualDisplay->WaitForPresent();
+		return true;
+
+	case TraceEvent_GetTimeSinceLastVsync:
+	{
+		uint64_t frameCounter;
+		target.pVirtualDisplay->GetTimeSinceLastVsync(&u, &frameCounter);
+		return true;
+	}
+
+	default:
+		// Init, Activate, Deactivate and Cleanup are done by the tool around the replay.
+		return false;
+	}
+}
+
+
+static void ReplayTimed(const ReplayTarget& target, const TraceEvent& event, std::vector<EventStats>& stats, int64_t frequency)
+{
+	LARGE_INTEGER startTime, endTime;
+	QueryPerformanceCounter(&startTime);
+
+	if (!ReplayEvent(target, event))
+	{
+		return;
+	}
+
+	QueryPerformanceCounter(&endTime);
+	stats[event.record.event].Add((endTime.QuadPart - startTime.QuadPart) * 1000.0 / frequency);
+}
+
+// Makes the calls back to back on the calling thread, in recorded order.
+static void ReplayFast(const ReplayTarget& target, const TraceFile& trace, std::vector<EventStats>& outStats)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	for (const TraceEvent& event : trace.events)
+	{
+		ReplayTimed(target, event, outStats, frequency.QuadPart);
+	}
+}
+
+// Makes the calls of each recorded thread on a thread of its own, at the recorded times divided by the speed.
+static void ReplayRealtime(const ReplayTarget& target, const TraceFile& trace, double speed, std::vector<EventStats>& outStats)
+{
+	std::map<uint32_t, std::vector<const TraceEvent*>> threadEvents;
+	for (const TraceEvent& event : trace.events)
+	{
+		if (IsTraceEventReplayed(event.record.event))
+		{
+			threadEvents[event.record.threadId].push_back(&event);
+		}
+	}
+
+	if (threadEvents.empty())
+	{
+		return;
+	}
+
+	int64_t firstTicks = INT64_MAX;
+	for (auto& [threadId, events] : threadEvents)
+	{
+		firstTicks = (std::min)(firstTicks, events.front()->record.startTicks);
+	}
+
+	LARGE_INTEGER frequency, replayStart;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&replayStart);
+
+	double ticksScale = (double)frequency.QuadPart / (double)trace.header.ticksPerSecond / speed;
+
+	std::vector<std::vector<EventStats>> threadStats(threadEvents.size(), std::vector<EventStats>(TraceEvent_Count));
+	std::vector<std::thread> threads;
+
+	size_t threadIndex = 0;
+	for (auto& [threadId, events] : threadEvents)
+	{
+		threads.emplace_back([&, pEvents = &events, pStats = &threadStats[threadIndex]]()
+		{
+			for (const TraceEvent* pEvent : *pEvents)
+			{
+				int64_t dueTicks = replayStart.QuadPart + (int64_t)((pEvent->record.startTicks - firstTicks) * ticksScale);
+
+				LARGE_INTEGER currTime;
+				QueryPerformanceCounter(&currTime);
+
+				// Sleep most of the way, and yield for the last couple of milliseconds.
+				int64_t remainingUs = (dueTicks - currTime.QuadPart) * 1000000 / frequency.QuadPart;
+				if (remainingUs > 2000)
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(remainingUs - 2000));
+				}
+
+				do
+				{
+					QueryPerformanceCounter(&currTime);
+					if (currTime.QuadPart < dueTicks)
+					{
+						std::this_thread::yield();
+					}
+				}
+				while (currTime.QuadPart < dueTicks);
+
+				ReplayTimed(target, *pEvent, *pStats, frequency.QuadPart);
+			}
+		});
+
+		threadIndex++;
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	for (std::vector<EventStats>& stats : threadStats)
+	{
+		for (uint32_t event = 0; event < TraceEvent_Count; event++)
+		{
+			outStats[event].Merge(stats[event]);
+		}
+	}
+}
+
+
+static void GetRecordedStats(const TraceFile& trace, std::vector<EventStats>& outStats)
+{
+	for (const TraceEvent& event : trace.events)
+	{
+		outStats[event.record.event].Add(event.record.durationTicks * 1000.0 / trace.header.ticksPerSecond);
+	}
+}
+
+// Intervals between the starts of consecutive events of a type, for the work the driver starts on its own.
+static void PrintIntervals(const char* label, const TraceFile& trace, uint16_t type)
+{
+	std::vector<double> intervals;
+	int64_t lastTicks = -1;
+
+	for (const TraceEvent& event : trace.events)
+	{
+		if (event.record.event != type)
+		{
+			continue;
+		}
+
+		if (lastTicks >= 0)
+		{
+			intervals.push_back((event.record.startTicks - lastTicks) * 1000.0 / trace.header.ticksPerSecond);
+		}
+		lastTicks = event.record.startTicks;
+	}
+
+	std::cout << "  " << std::left << std::setw(28) << GetTraceEventName(type) << std::setw(12) << label;
+
+	if (intervals.empty())
+	{
+		std::cout << "no events\n";
+		return;
+	}
+
+	double sum = 0.0, maxInterval = 0.0;
+	for (double interval : intervals)
+	{
+		sum += interval;
+		maxInterval = (std::max)(maxInterval, interval);
+	}
+	double mean = sum / intervals.size();
+
+	double variance = 0.0;
+	for (double interval : intervals)
+	{
+		variance += (interval - mean) * (interval - mean);
+	}
+
+	std::cout << std::fixed << std::setprecision(3) << std::right
+		<< std::setw(8) << intervals.size() + 1 << " events, interval mean " << std::setw(8) << mean
+		<< " ms, stddev " << std::setw(8) << sqrt(variance / intervals.size()) << " ms, max " << std::setw(8) << maxInterval << " ms\n";
+}
+
+static void PrintUsage()
+{
+	std::cout << "Usage: trace_replay <trace file> --driver <driver_openvr_camera_sim.dll> [options]\n\n"
+		<< "  --settings <file>        Settings file, defaults to the default.vrsettings of the driver\n"
+		<< "  --set <section.key=value> Overrides a setting, can be repeated\n"
+		<< "  --mode fast|realtime     Back to back on one thread, or at the recorded times on the recorded threads (default fast)\n"
+		<< "  --speed <factor>         Time scale for realtime mode (default 1)\n"
+		<< "  --record <trace file>    Records the replay, to compare the driver's own frame and pose timing\n"
+		<< "  --verbose                Prints the driver log\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::cout << "OpenVR camera sim trace replay\n\n";
+
+	std::string tracePath, driverPath, settingsPath, recordPath;
+	std::vector<std::string> settingOverrides;
+	bool bRealtime = false;
+	double speed = 1.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool bHasValue = i + 1 < argc;
+
+		if (strcmp(argv[i], "--driver") == 0 && bHasValue) { driverPath = argv[++i]; }
+		else if (strcmp(argv[i], "--settings") == 0 && bHasValue) { settingsPath = argv[++i]; }
+		else if (strcmp(argv[i], "--set") == 0 && bHasValue) { settingOverrides.push_back(argv[++i]); }
+		else if (strcmp(argv[i], "--mode") == 0 && bHasValue) { bRealtime = strcmp(argv[++i], "realtime") == 0; }
+		else if (strcmp(argv[i], "--speed") == 0 && bHasValue) { speed = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--record") == 0 && bHasValue) { recordPath = argv[++i]; }
+		else if (strcmp(argv[i], "--verbose") == 0) { g_runtime.m_driverLog.m_bVerbose = true; }
+		else if (argv[i][0] != '-' && tracePath.empty()) { tracePath = argv[i]; }
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (tracePath.empty() || driverPath.empty() || speed <= 0.0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	TraceFile trace;
+	if (!LoadTrace(tracePath, trace))
+	{
+		return 1;
+	}
+
+	double traceSeconds = trace.events.empty() ? 0.0 :
+		(trace.events.back().record.startTicks - trace.events.front().record.startTicks) / (double)trace.header.ticksPerSecond;
+
+	std::cout << "Loaded " << trace.events.size() << " events spanning " << std::fixed << std::setprecision(2) << traceSeconds << " s\n";
+
+	if (trace.dropped > 0)
+	{
+		std::cout << "Warning: " << trace.dropped << " records were dropped while recording, the replay is incomplete\n";
+	}
+
+
+	// The driver is installed as drivers/openvr_camera_sim/bin/win64/driver_openvr_camera_sim.dll.
+	if (settingsPath.empty())
+	{
+		settingsPath = (std::filesystem::path(driverPath).parent_path() / "../../resources/settings/default.vrsettings").string();
+	}
+
+	if (!g_runtime.m_settings.LoadFile(settingsPath))
+	{
+		std::cout << "Failed to read settings from " << settingsPath << "\n";
+		return 1;
+	}
+
+	// The replay only records when asked to, whatever the settings file says.
+	g_runtime.m_settings.SetValue("openvr_camera_sim", "trace_enable", recordPath.empty() ? "false" : "true");
+	g_runtime.m_settings.SetValue("openvr_camera_sim", "trace_path", recordPath);
+
+	for (const std::string& assignment : settingOverrides)
+	{
+		if (!g_runtime.m_settings.SetFromString(assignment))
+		{
+			std::cout << "Invalid setting override: " << assignment << "\n";
+			return 1;
+		}
+	}
+
+
+	HMODULE hDriver = LoadLibraryA(driverPath.c_str());
+	if (hDriver == nullptr)
+	{
+		std::cout << "Failed to load " << driverPath << ": " << GetLastError() << "\n";
+		return 1;
+	}
+
+	HmdDriverFactoryFn pFactory = (HmdDriverFactoryFn)GetProcAddress(hDriver, "HmdDriverFactory");
+	if (pFactory == nullptr)
+	{
+		std::cout << driverPath << " does not export HmdDriverFactory\n";
+		return 1;
+	}
+
+	int returnCode = 0;
+	ReplayTarget target;
+	target.pProvider = (vr::IServerTrackedDeviceProvider*)pFactory(vr::IServerTrackedDeviceProvider_Version, &returnCode);
+
+	if (target.pProvider == nullptr)
+	{
+		std::cout << "The driver has no device provider: " << returnCode << "\n";
+		return 1;
+	}
+
+	vr::EVRInitError initError = target.pProvider->Init(&g_runtime);
+	if (initError != vr::VRInitError_None)
+	{
+		std::cout << "Provider Init failed: " << (int)initError << "\n";
+		return 1;
+	}
+
+	target.pDevice = g_runtime.m_serverDriverHost.m_pDevice;
+	if (target.pDevice == nullptr)
+	{
+		std::cout << "The provider did not add a device\n";
+		return 1;
+	}
+
+	initError = target.pDevice->Activate(0);
+	if (initError != vr::VRInitError_None)
+	{
+		std::cout << "Device Activate failed: " << (int)initError << "\n";
+		return 1;
+	}
+
+	target.pCamera = (vr::IVRCameraComponent*)target.pDevice->GetComponent(vr::IVRCameraComponent_Version);
+	target.pDisplay = (vr::IVRDisplayComponent*)target.pDevice->GetComponent(vr::IVRDisplayComponent_Version);
+	target.pVirtualDisplay = (vr::IVRVirtualDisplay*)target.pDevice->GetComponent(vr::IVRVirtualDisplay_Version);
+
+
+	std::cout << "Replaying in " << (bRealtime ? "realtime" : "fast") << " mode\n";
+
+	std::vector<EventStats> replayStats(TraceEvent_Count);
+
+	LARGE_INTEGER frequency, replayStart, replayEnd;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&replayStart);
+
+	if (bRealtime)
+	{
+		ReplayRealtime(target, trace, speed, replayStats);
+	}
+	else
+	{
+		ReplayFast(target, trace, replayStats);
+	}
+
+	QueryPerformanceCounter(&replayEnd);
+
+	target.pDevice->Deactivate();
+	target.pProvider->Cleanup();
+
+	std::cout << "Replay took " << std::fixed << std::setprecision(2) << (replayEnd.QuadPart - replayStart.QuadPart) / (double)frequency.QuadPart << " s\n\n";
+
+
+	std::vector<EventStats> recordedStats(TraceEvent_Count);
+	GetRecordedStats(trace, recordedStats);
+
+	std::cout << std::left << std::setw(38) << "Call" << std::right
+		<< std::setw(10) << "recorded" << std::setw(11) << "mean ms" << std::setw(11) << "max ms"
+		<< std::setw(10) << "replayed" << std::setw(11) << "mean ms" << std::setw(11) << "max ms" << "\n";
+
+	for (uint16_t event = 0; event < TraceEvent_Count; event++)
+	{
+		const EventStats& recorded = recordedStats[event];
+		const EventStats& replayed = replayStats[event];
+
+		if (!IsTraceEventReplayed(event) || (recorded.count == 0 && replayed.count == 0))
+		{
+			continue;
+		}
+
+		std::cout << std::left << std::setw(38) << GetTraceEventName(event) << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(10) << recorded.count << std::setw(11) << (recorded.count ? recorded.totalMs / recorded.count : 0.0) << std::setw(11) << recorded.maxMs
+			<< std::setw(10) << replayed.count << std::setw(11) << (replayed.count ? replayed.totalMs / replayed.count : 0.0) << std::setw(11) << replayed.maxMs << "\n";
+	}
+
+
+	std::cout << "\nDriver timing\n";
+	PrintIntervals("recorded", trace, TraceEvent_PoseUpdated);
+	PrintIntervals("recorded", trace, TraceEvent_ServeFrame);
+
+	TraceFile replayTrace;
+	if (!recordPath.empty() && LoadTrace(recordPath, replayTrace))
+	{
+		PrintIntervals("replayed", replayTrace, TraceEvent_PoseUpdated);
+		PrintIntervals("replayed", replayTrace, TraceEvent_ServeFrame);
+	}
+
+	std::cout << "\nPoses updated: " << g_runtime.m_serverDriverHost.m_posesUpdated
+		<< ", frames written: " << g_runtime.m_blockQueue.m_blocksWritten
+		<< ", sink callbacks: " << g_sinkCallback.m_callbacks
+		<< ", driver log lines: " << g_runtime.m_driverLog.m_lines << "\n";
+
+	return 0;
+}